@@ -119,29 +119,15 @@ static void compile_stdin(struct out *insns) {
             case ']': {
                 struct loop_info loop_info;
                 pop_loop(loop_info);
-                // We're going to write it right after, so no need to emit
-                // dummy and then patch.
-                u32 jal_offset = out_resv_index(insns, 4);
-                u32 loop_end = insns->len;
-                // HACK: Assuming that there are no overflows...
-                i16 dist_from_chk = (i32)loop_end - (i32)loop_info.check_offset;
-
-                // Skipping the loop body is skipping right here.
-                patch_beq(insns->bytes + loop_info.beq_offset, dist_from_chk);
-
                 // Make sure the loop body ends with a jump to the check.
-                {
-                    struct jal {
-                        u8 tag : 7;
-                        u8 rd : 5;
-                        i32 offset : 20;
-                    } __attribute__((packed)) *jal = insns->bytes + jal_offset;
-                    jal->tag = 0b1101111;
-                    jal->rd = rv_zero;
-                    // XXX: I don't know if this will interpret it correctly.
-                    jal->offset = -dist_from_chk;
-                }
+                asm_jal(insns, rv_zero,
+                        (i32)loop_info.check_offset - (i32)insns->len);
 
+                // Skipping the loop body is skipping right past that jump.
+                // HACK: Assuming that there are no overflows...
+                i16 dist_from_beq =
+                    (i32)insns->len - (i32)loop_info.beq_offset;
+                patch_beq(insns->bytes + loop_info.beq_offset, dist_from_beq);
                 break;
             }
             case '+':
@@ -158,7 +144,7 @@ static void compile_stdin(struct out *insns) {
                 // write(1, rv_s1, 1);
                 asm_addi(insns, rv_a7, rv_zero, 64);
                 asm_addi(insns, rv_a0, rv_zero, 1);
-                asm_or(insns, rv_a0, rv_zero, rv_s1);
+                asm_or(insns, rv_a1, rv_zero, rv_s1);
                 asm_addi(insns, rv_a2, rv_zero, 1);
                 asm_ecall(insns);
                 // we don't care about the return value.
@@ -166,8 +152,8 @@ static void compile_stdin(struct out *insns) {
             case ',':
                 // read(0, rv_s1, 1);
                 asm_addi(insns, rv_a7, rv_zero, 63);
-                asm_addi(insns, rv_a0, rv_zero, 1);
-                asm_or(insns, rv_a0, rv_zero, rv_s1);
+                asm_addi(insns, rv_a0, rv_zero, 0);
+                asm_or(insns, rv_a1, rv_zero, rv_s1);
                 asm_addi(insns, rv_a2, rv_zero, 1);
                 asm_ecall(insns);
                 // we don't care about the return value.
@@ -576,6 +562,16 @@ static void asm_lui(struct out *out, u8 dest, i32 imm_20) {
     lui->u.imm_31_12 = imm_20;
 }
 
+static void asm_jal(struct out *out, u8 link_register, i32 pc_rel_off) {
+    union insn *jal = out_resv(out, 4);
+    jal->j.opcode = op_jal;
+    jal->j.rd = link_register;
+    jal->j.imm_10_1 = pc_rel_off >> 1;
+    jal->j.imm_11 = pc_rel_off >> 11;
+    jal->j.imm_19_12 = pc_rel_off >> 12;
+    jal->j.imm_20 = pc_rel_off >> 20;
+}
+
 static void asm_ecall(struct out *out) {
     // ecall is all rv_zeroes except for the tag.
     *(union insn *)out_resv(out, 4) =
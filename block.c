@@ -0,0 +1,489 @@
+#include "block.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "idiom.h"
+#include "interpret.h"
+#include "jit_x86.h"
+#include "optimize.h"
+#include "rv/bits.h"
+#include "rv/dasm.h"
+#include "rv/decode.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static u32 hash_pc(u32 pc) { return (pc >> 2) * 2654435761u; }
+
+int block_cache_init(struct block_cache *cache, u32 text_begin, u32 text_end,
+                     bool compressed) {
+    cache->text_begin = text_begin;
+    cache->text_end = text_end;
+    cache->compressed = compressed;
+    cache->mask = 1024 - 1;
+    cache->len = 0;
+    memset(cache->returns, 0, sizeof(cache->returns));
+    cache->return_top = 0;
+    cache->trace = false;
+    cache->optimize = true;
+    cache->idioms = true;
+    cache->jit = NULL;
+    cache->jit_threshold = JIT_HOT_THRESHOLD;
+    cost_model_init(&cache->costs);
+    cache->memory = NULL;
+    cache->pages = NULL;
+    cache->page_size = sysconf(_SC_PAGESIZE);
+    cache->dirty = 0;
+    cache->table = calloc(cache->mask + 1, sizeof(*cache->table));
+    if (cache->table == NULL)
+        return ENOMEM;
+    return 0;
+}
+
+void block_cache_destroy(struct block_cache *cache) {
+    for (u32 i = 0; i <= cache->mask; ++i) {
+        free(cache->table[i]);
+    }
+    free(cache->table);
+    free(cache->pages);
+}
+
+static void insert_block(struct block_cache *cache, struct block *block);
+
+static void grow_table(struct block_cache *cache) {
+    struct block **old = cache->table;
+    u32 old_capacity = cache->mask + 1;
+
+    cache->mask = old_capacity * 2 - 1;
+    cache->len = 0;
+    cache->table = calloc(cache->mask + 1, sizeof(*cache->table));
+    if (cache->table == NULL) {
+        error("Could not grow block cache to %u entries\n", cache->mask + 1);
+        abort();
+    }
+
+    for (u32 i = 0; i < old_capacity; ++i) {
+        if (old[i] != NULL)
+            insert_block(cache, old[i]);
+    }
+    free(old);
+}
+
+static void insert_block(struct block_cache *cache, struct block *block) {
+    // Keep the load factor under 1/2 so that probe sequences stay short.
+    if ((cache->len + 1) * 2 > cache->mask + 1)
+        grow_table(cache);
+
+    u32 slot = hash_pc(block->pc) & cache->mask;
+    while (cache->table[slot] != NULL)
+        slot = (slot + 1) & cache->mask;
+    cache->table[slot] = block;
+    ++cache->len;
+}
+
+struct block *block_cache_lookup(struct block_cache const *cache, u32 pc) {
+    u32 slot = hash_pc(pc) & cache->mask;
+    for (struct block *block; (block = cache->table[slot]) != NULL;
+         slot = (slot + 1) & cache->mask) {
+        if (block->pc == pc)
+            return block;
+    }
+    return NULL;
+}
+
+// Decodes the loop idiom starting at `pc` into `insns`, if there's one.
+// Returns how many instructions it covers, or 0, and stores the address right
+// after them in `*end`.
+static u32 translate_idiom(struct block_cache const *cache, void const *memory,
+                           u32 pc, struct decoded_insn *insns, u32 *end) {
+    u32 count = 0;
+    // Address right after `insns[i]`.
+    u32 ends[IDIOM_MAX_INSNS];
+    // Idioms span branches, so this doesn't stop at the end of a block.
+    for (u32 at = pc; count < IDIOM_MAX_INSNS && at < cache->text_end;) {
+        u32 size;
+        insns[count] = decode_insn_at(memory, at, cache->compressed, &size);
+        at += size;
+        ends[count++] = at;
+    }
+    count = idiom_match(insns, count, pc);
+    if (count != 0)
+        *end = ends[count - 1];
+    return count;
+}
+
+static struct block *translate_block(struct block_cache const *cache,
+                                     void const *memory, u32 pc) {
+    struct decoded_insn insns[BLOCK_MAX_INSNS];
+    u32 end = pc;
+    u32 count =
+        cache->idioms ? translate_idiom(cache, memory, pc, insns, &end) : 0;
+    bool const idiom = count != 0;
+    u32 exit_pc = pc;
+
+    if (idiom && cache->trace) {
+        log("Loop idiom %s @ 0x%08x (%u insns)\n",
+            decoded_op_names[insns[0].op], pc, count);
+    }
+    while (!idiom && count < BLOCK_MAX_INSNS && end < cache->text_end) {
+        u32 size;
+        exit_pc = end;
+        insns[count++] = decode_insn_at(memory, end, cache->compressed, &size);
+        end += size;
+        if (decoded_op_ends_block(insns[count - 1].op))
+            break;
+    }
+
+    u32 const guest_count = count;
+    u32 cycles = 0;
+    for (u32 i = 0; i < count; ++i)
+        cycles += cache->costs.cycles[insns[i].op];
+    u32 const exit_cycles = cache->costs.cycles[insns[count - 1].op];
+    // The pass leaving a loop idiom's loop ends with its first branch.
+    u32 leave_count = count, leave_cycles = cycles;
+    for (u32 i = 0, sum = 0; idiom && i < count; ++i) {
+        sum += cache->costs.cycles[insns[i].op];
+        if (insns[i].op == dop_beq || insns[i].op == dop_bne) {
+            leave_count = i + 1;
+            leave_cycles = sum;
+            break;
+        }
+    }
+    // The instructions an idiom covers are its operands.
+    if (cache->optimize && !idiom)
+        count = optimize_block(insns, count, end);
+
+    struct block *block =
+        malloc(sizeof(*block) + (count + 1) * sizeof(*block->insns));
+    if (block == NULL) {
+        error("Could not allocate block @ 0x%08x\n", pc);
+        abort();
+    }
+    block->pc = pc;
+    block->count = count;
+    block->guest_count = guest_count;
+    block->cycles = cycles;
+    block->exit_cycles = exit_cycles;
+    block->leave_count = leave_count;
+    block->leave_cycles = leave_cycles;
+    block->exit_pc = exit_pc;
+    block->end = end;
+    block->succ[0] = block->succ[1] = NULL;
+    block->indirect = NULL;
+    block->return_to = NULL;
+    block->hits = 0;
+    block->native = NULL;
+    memcpy(block->insns, insns, count * sizeof(*insns));
+    // Falling off the end of the block is a jump to the next instruction.
+    // Running off the text is caught when looking that one up.
+    block->insns[count] = (struct decoded_insn){
+        .op = dop_jal, .rd = DECODED_SINK_REG, .imm = end};
+
+    return block;
+}
+
+// Returns the index into `cache->pages` of the page holding `addr`.
+static u32 page_index(struct block_cache const *cache, u32 addr) {
+    return addr / cache->page_size - cache->text_begin / cache->page_size;
+}
+
+int block_cache_watch_writes(struct block_cache *cache, void *memory,
+                             u32 begin, u32 end) {
+    if (begin < cache->text_begin)
+        begin = cache->text_begin;
+    if (end > cache->text_end)
+        end = cache->text_end;
+    if (begin >= end)
+        return 0;
+
+    if (cache->pages == NULL) {
+        u32 count = page_index(cache, cache->text_end - 1) + 1;
+        if ((cache->pages = calloc(count, sizeof(*cache->pages))) == NULL)
+            return ENOMEM;
+    }
+    cache->memory = memory;
+    for (u32 i = page_index(cache, begin); i <= page_index(cache, end - 1);
+         ++i) {
+        cache->pages[i] |= block_page_writable;
+    }
+    return 0;
+}
+
+// Write-protects the watched pages `block` was translated from.
+static void protect_pages(struct block_cache *cache,
+                          struct block const *block) {
+    if (cache->pages == NULL)
+        return;
+
+    u32 last = page_index(cache, block->end - 1);
+    for (u32 i = page_index(cache, block->pc); i <= last; ++i) {
+        u8 *page = &cache->pages[i];
+        if ((*page & (block_page_writable | block_page_protected)) !=
+            block_page_writable)
+            continue;
+        u32 addr =
+            (cache->text_begin / cache->page_size + i) * cache->page_size;
+        if (mprotect(cache->memory + addr, cache->page_size, PROT_READ) != 0) {
+            error("Could not write-protect text @ 0x%08x: %s\n", addr,
+                  strerror(errno));
+            abort();
+        }
+        *page |= block_page_protected;
+    }
+}
+
+bool block_cache_write_fault(struct block_cache *cache, u32 addr) {
+    if (cache->pages == NULL ||
+        addr / cache->page_size < cache->text_begin / cache->page_size ||
+        addr / cache->page_size > (cache->text_end - 1) / cache->page_size)
+        return false;
+
+    u8 *page = &cache->pages[page_index(cache, addr)];
+    if (!(*page & block_page_protected))
+        return false;
+    u32 begin = addr - addr % cache->page_size;
+    if (mprotect(cache->memory + begin, cache->page_size,
+                 PROT_READ | PROT_WRITE) != 0)
+        return false;
+    *page = (*page & ~block_page_protected) | block_page_dirty;
+    cache->dirty = 1;
+    return true;
+}
+
+// Returns whether `block` was translated from a dirty page.
+static bool on_dirty_page(struct block_cache const *cache,
+                          struct block const *block) {
+    u32 last = page_index(cache, block->end - 1);
+    for (u32 i = page_index(cache, block->pc); i <= last; ++i) {
+        if (cache->pages[i] & block_page_dirty)
+            return true;
+    }
+    return false;
+}
+
+void block_cache_flush_dirty(struct block_cache *cache) {
+    struct block **old = cache->table;
+    u32 capacity = cache->mask + 1;
+    u32 dropped = 0;
+
+    cache->len = 0;
+    cache->table = calloc(capacity, sizeof(*cache->table));
+    if (cache->table == NULL) {
+        error("Could not rebuild block cache\n");
+        abort();
+    }
+    for (u32 i = 0; i < capacity; ++i) {
+        struct block *block = old[i];
+        if (block == NULL)
+            continue;
+        // Compiled code stays behind in the JIT's buffer, unused.
+        if (on_dirty_page(cache, block)) {
+            free(block);
+            ++dropped;
+            continue;
+        }
+        block->succ[0] = block->succ[1] = NULL;
+        block->indirect = NULL;
+        block->return_to = NULL;
+        insert_block(cache, block);
+    }
+    free(old);
+    memset(cache->returns, 0, sizeof(cache->returns));
+
+    u32 count = page_index(cache, cache->text_end - 1) + 1;
+    for (u32 i = 0; i < count; ++i) {
+        cache->pages[i] &= ~block_page_dirty;
+    }
+    cache->dirty = 0;
+
+    if (cache->trace)
+        log("Dropped %u blocks after writes to text\n", dropped);
+}
+
+bool block_cache_check_pc(struct block_cache const *cache, u32 pc) {
+    u32 const align = cache->compressed ? 2 : 4;
+    if (__builtin_expect(pc & (align - 1), 0)) {
+        error("Refusing to execute: pc 0x%08x is not aligned to %u bytes\n",
+              pc, align);
+        return false;
+    }
+    if (__builtin_expect(pc < cache->text_begin || pc >= cache->text_end, 0)) {
+        error("Refusing to execute: pc 0x%08x is outside of text\n", pc);
+        return false;
+    }
+    return true;
+}
+
+struct block *block_cache_get(struct block_cache *cache, void const *memory,
+                              u32 pc) {
+    struct block *block = block_cache_lookup(cache, pc);
+    if (block != NULL)
+        return block;
+
+    // Alignment and bounds are only checked when a block is first seen:
+    // chained and cached blocks are known to be good.
+    if (!block_cache_check_pc(cache, pc))
+        return NULL;
+
+    block = translate_block(cache, memory, pc);
+    protect_pages(cache, block);
+    insert_block(cache, block);
+    return block;
+}
+
+// Charges `state` for `passes` full passes through the loop idiom `block`, and
+// for the one leaving the loop if `left`, fuel and counters alike.
+static void retire_loop(struct block const *block, struct run_state *state,
+                        u64 passes, bool left) {
+    u64 const count =
+        passes * block->guest_count + (left ? block->leave_count : 0);
+    state->fuel -= count;
+    state->cpu.instret += count;
+    state->cpu.cycle +=
+        passes * block->cycles + (left ? block->leave_cycles : 0);
+}
+
+struct decoded_insn const *block_run(struct block const *block,
+                                     struct run_state *state, void *memory,
+                                     u32 *next_pc) {
+    struct rv32i *const cpu = &state->cpu;
+    u32 *const x = cpu->registers;
+    struct rvv_state *const vector = &cpu->vector;
+    struct fpu_state *const fpu = &cpu->fpu;
+    struct amo_reservation *const reservation = &cpu->reservation;
+    if (block->native != NULL) {
+        *next_pc = block->native(x, memory);
+        // A jalr can only be the last instruction, and the only way out.
+        return &block->insns[block->count - (block->count != 0)];
+    }
+
+    struct decoded_insn const *insn = block->insns;
+    for (;;) {
+        switch ((enum decoded_op)insn->op) {
+#define OP(name) case dop_##name:
+#define NEXT                                                                   \
+    {                                                                          \
+        ++insn;                                                                \
+        continue;                                                              \
+    }
+#define JUMP(target)                                                           \
+    {                                                                          \
+        *next_pc = (target);                                                   \
+        return insn;                                                           \
+    }
+#define PC block_insn_pc(block, insn - block->insns)
+// Instructions that use this always end the block.
+#define PC_AFTER(n) block->end
+#define LOAD(type, addr) (*(type *)(memory + (u32)(addr)))
+#define STORE(type, addr, value) (*(type *)(memory + (u32)(addr)) = (value))
+#define ATOMIC(type, addr) ((_Atomic type *)(memory + (u32)(addr)))
+#define FAULT() return NULL
+#define EXIT(all)                                                              \
+    {                                                                          \
+        *next_pc = PC;                                                         \
+        return insn;                                                           \
+    }
+// Writes to code are tracked by page, and handled between blocks.
+#define FENCE_I()
+// Blocks are never fused.
+#define NO_FUSED_OPS
+// The engine stops once the loop is back at its start without the fuel for
+// another pass.
+#define LOOP_PASSES (state->fuel / block->guest_count)
+#define LOOP_RETIRE(passes, left) retire_loop(block, state, passes, left)
+// The block was charged as a whole, and a counter read ends it.
+#define INSTRET (cpu->instret - 1)
+#define CYCLE (cpu->cycle - block->exit_cycles)
+#include "interpret_ops.h"
+#undef CYCLE
+#undef INSTRET
+#undef LOOP_RETIRE
+#undef LOOP_PASSES
+#undef NO_FUSED_OPS
+#undef FENCE_I
+#undef EXIT
+#undef FAULT
+#undef ATOMIC
+#undef STORE
+#undef LOAD
+#undef PC_AFTER
+#undef PC
+#undef JUMP
+#undef NEXT
+#undef OP
+        case dop_count:
+            __builtin_unreachable();
+        }
+    }
+}
+
+// Body of interpret_blocks(), between handing the FPU over to the hart and
+// taking it back.
+static enum run_exit run_blocks(void *memory, struct block_cache *cache,
+                                struct run_state *state) {
+    struct block *block = block_cache_get(cache, memory, state->pc);
+    if (block == NULL)
+        return run_fault;
+
+    for (;;) {
+        if (__builtin_expect(cache->dirty, 0)) {
+            block_cache_flush_dirty(cache);
+            if ((block = block_cache_get(cache, memory, state->pc)) == NULL)
+                return run_fault;
+        }
+        // Per-block work goes here, before running the body.
+        if (__builtin_expect(block->guest_count > state->fuel, 0))
+            return run_out_of_fuel;
+        if (__builtin_expect(
+                atomic_load_explicit(&state->stop, memory_order_relaxed), 0))
+            return run_stopped;
+        // Loop idioms charge the passes they make as they make them.
+        if (!block_is_idiom(block)) {
+            state->fuel -= block->guest_count;
+            state->cpu.instret += block->guest_count;
+            state->cpu.cycle += block->cycles;
+        }
+        if (__builtin_expect(cache->trace, 0)) {
+            log("block @ 0x%08x (%u insns, %u after optimizing)\n",
+                block->pc, block->guest_count, block->count);
+        }
+        if (cache->jit != NULL && block->native == NULL &&
+            ++block->hits == cache->jit_threshold) {
+            jit_compile(cache->jit, block);
+        }
+
+        u32 next_pc;
+        struct decoded_insn const *exit =
+            block_run(block, state, memory, &next_pc);
+        if (exit == NULL)
+            return run_fault;
+        state->pc = next_pc;
+        if (block_exit_is_guest_exit(exit))
+            return run_exited;
+
+        // Exits remember where they went, so that later runs skip the cache
+        // lookup.
+        struct block *next = block_next(cache, block, exit, next_pc);
+        if (next == NULL) {
+            if ((next = block_cache_get(cache, memory, next_pc)) == NULL)
+                return run_fault;
+            block_remember(block, exit, next);
+        }
+        block = next;
+    }
+}
+
+enum run_exit interpret_blocks(void *memory, struct block_cache *cache,
+                               struct run_state *state) {
+    log("Begin block execution. Memory @ %p, Entrypoint @ 0x%x\n", memory,
+        state->pc);
+    fpu_attach(&state->cpu.fpu);
+    enum run_exit const exit = run_blocks(memory, cache, state);
+    fpu_detach(&state->cpu.fpu);
+    return exit;
+}
+
+// vim:sw=4
@@ -0,0 +1,309 @@
+#pragma once
+
+#include "common/types.h"
+#include "counters.h"
+#include "interpret.h"
+#include "rv/decode.h"
+#include <signal.h>
+#include <stdbool.h>
+
+// Basic-block translation cache.
+// Guest code is discovered at run time one basic block at a time: a block
+// starts at any jump target and runs until (and including) the first branch,
+// jal or jalr. Each block is decoded once and then kept in the cache.
+// Blocks whose exits go to a static address (everything but jalr) get chained
+// to their successors, so that running them doesn't go back to the cache
+// lookup.
+// Text the guest can write to is write-protected while blocks were translated
+// from it. A write there faults, which marks the page as dirty, and the blocks
+// on dirty pages get dropped before the next block runs. `fence.i` always
+// ends a block, so that it's a point where the guest sees its own writes.
+// Blocks are charged to the counters (see counters.h) as a whole before they
+// run, and CSR instructions end them, so that a counter read there only has
+// to leave out itself. So do ecalls, which read and write registers and memory
+// the optimizer (see optimize.h) can't see.
+// A block starting with a loop idiom (see idiom.h) is just that loop, run at
+// once by a host kernel. It's charged for fuel and to the counters as it runs,
+// for every pass through the loop it makes, and goes back to the start of the
+// loop when the fuel runs out before the loop does.
+
+// Upper bound on the number of guest instructions in a single block.
+#define BLOCK_MAX_INSNS 64
+
+// Depth of the shadow return-address stack. Deeper call chains just wrap
+// around, and mispredict once they return past it.
+#define RETURN_STACK_SIZE 64
+
+struct jit;
+
+// Host code for a block: runs it against the register file and memory, and
+// returns the guest address of the next instruction.
+typedef u32 native_block_fn(u32 *registers, void *memory);
+
+struct block {
+    // Guest address of the first instruction.
+    u32 pc;
+    // Number of instructions in `insns`, which can be less than the number of
+    // guest instructions the block covers once it's been optimized.
+    u32 count;
+    // Number of guest instructions the block was translated from. For a loop
+    // idiom, that's a pass through the loop.
+    u32 guest_count;
+    // Cycles the cost model charges for those, and for the last one alone.
+    u32 cycles;
+    u32 exit_cycles;
+    // For a loop idiom, number of guest instructions in the pass leaving the
+    // loop, which ends with its first branch, and the cycles those cost.
+    u32 leave_count;
+    u32 leave_cycles;
+    // Guest address of the instruction leaving the block (its last one, or the
+    // loop idiom it's made of), and the address right after the instructions
+    // it covers. Compressed instructions keep these from being worked out of
+    // `pc` and `guest_count`.
+    u32 exit_pc;
+    u32 end;
+    // Successors already resolved for this block's static exits. NULL until
+    // the exit is taken for the first time.
+    struct block *succ[2];
+    // For blocks ending in jalr, the block it jumped to last time.
+    struct block *indirect;
+    // For blocks ending in a call, the block the call returns to, once that
+    // one exists.
+    struct block *return_to;
+    // How many times the block has been entered while interpreted.
+    u32 hits;
+    // Compiled version of the block, or NULL while it's interpreted.
+    native_block_fn *native;
+    // Decoded instructions. There's always one more than `count`: a trailing
+    // `jal` to the next address, so that every block ends by jumping out.
+    struct decoded_insn insns[];
+};
+
+// State of a page of text, for caches watching writes to it.
+enum block_page_flags {
+    // The guest is allowed to write to the page.
+    block_page_writable = 1 << 0,
+    // Blocks were translated from the page, which is write-protected.
+    block_page_protected = 1 << 1,
+    // The guest wrote to the page since blocks were translated from it.
+    block_page_dirty = 1 << 2,
+};
+
+struct block_cache {
+    // Span of guest memory that holds code.
+    u32 text_begin;
+    u32 text_end;
+    // Whether the text holds compressed instructions.
+    bool compressed;
+    // Open-addressed table of blocks, keyed by `pc`. `mask + 1` is its
+    // capacity, which is a power of two.
+    struct block **table;
+    u32 mask;
+    u32 len;
+    // Shadow return-address stack: blocks that calls will return to, most
+    // recent at `returns[(return_top - 1) % RETURN_STACK_SIZE]`. These are only
+    // predictions, checked against the actual return address.
+    struct block *returns[RETURN_STACK_SIZE];
+    u32 return_top;
+    // Writable text, see block_cache_watch_writes(). `pages` holds the
+    // `enum block_page_flags` of every page of text, or is NULL when none of
+    // it is watched.
+    u8 *memory;
+    u8 *pages;
+    u32 page_size;
+    // Set when a page went dirty, until its blocks have been dropped.
+    volatile sig_atomic_t dirty;
+    // Log every block as it gets entered.
+    bool trace;
+    // Run optimize_block() on blocks as they get translated.
+    bool optimize;
+    // Translate loop idioms to a single block running them at once, see
+    // idiom.h.
+    bool idioms;
+    // When not NULL, blocks that have been entered `jit_threshold` times get
+    // compiled to host code.
+    struct jit *jit;
+    u32 jit_threshold;
+    // What blocks cost in cycles, the defaults unless set otherwise before
+    // running any.
+    struct cost_model costs;
+};
+
+// Initializes `cache` for code found in `[text_begin, text_end)`, which may
+// include compressed instructions when `compressed`.
+// Returns 0 on success or an errno value.
+int block_cache_init(struct block_cache *cache, u32 text_begin, u32 text_end,
+                     bool compressed);
+
+void block_cache_destroy(struct block_cache *cache);
+
+// Watches guest writes to `[begin, end)` of `memory`, which is text the guest
+// is allowed to write to. Returns 0 on success or an errno value.
+int block_cache_watch_writes(struct block_cache *cache, void *memory,
+                             u32 begin, u32 end);
+
+// Handles a host fault for a write to guest address `addr`, from a signal
+// handler. When it's a watched page holding blocks, it lets the guest write
+// to it again, marks it dirty and returns true, so that the write can be
+// retried. Returns false for faults that are the guest's own.
+bool block_cache_write_fault(struct block_cache *cache, u32 addr);
+
+// Drops every block translated from a dirty page, and forgets every link and
+// prediction, which could point at those. Blocks are never dropped anywhere
+// else, so that the one running when the write happens can still finish.
+void block_cache_flush_dirty(struct block_cache *cache);
+
+// Returns whether code at `pc` can be run, logging why not otherwise.
+bool block_cache_check_pc(struct block_cache const *cache, u32 pc);
+
+// Returns the cached block starting at `pc`, or NULL if there's none.
+struct block *block_cache_lookup(struct block_cache const *cache, u32 pc);
+
+// Returns the block starting at `pc`, translating it from `memory` if it's not
+// cached yet. Returns NULL if `pc` can't hold code.
+struct block *block_cache_get(struct block_cache *cache, void const *memory,
+                              u32 pc);
+
+// Returns whether `op` is the last instruction of a block.
+static inline bool decoded_op_ends_block(enum decoded_op op) {
+    switch (op) {
+    case dop_jal:
+    case dop_jalr:
+    case dop_beq:
+    case dop_bne:
+    case dop_blt:
+    case dop_bge:
+    case dop_bltu:
+    case dop_bgeu:
+    case dop_fence_i:
+    case dop_ecall:
+#define X(name) case dop_##name:
+    IDIOM_OPS(X)
+    CSR_OPS(X)
+#undef X
+    case dop_illegal:
+    case dop_unimplemented:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Returns whether `block` is a loop idiom, which gets charged for the passes
+// through the loop as it makes them rather than up front, counters included.
+static inline bool block_is_idiom(struct block const *block) {
+    switch (block->insns[0].op) {
+#define X(name) case dop_##name:
+    IDIOM_OPS(X)
+#undef X
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Returns whether the block exit taken through `insn` always goes to the same
+// address, i.e. whether it can be chained.
+static inline bool block_exit_is_static(struct decoded_insn const *insn) {
+    return insn->op != dop_jalr;
+}
+
+// Returns whether leaving through `insn` is the guest exiting. An ecall that
+// returns goes on to the block's trailing jal instead.
+static inline bool block_exit_is_guest_exit(struct decoded_insn const *insn) {
+    return insn->op == dop_ecall;
+}
+
+// Returns whether leaving through `insn` is a call, i.e. links to ra.
+static inline bool block_exit_is_call(struct decoded_insn const *insn) {
+    return (insn->op == dop_jal || insn->op == dop_jalr) && insn->rd == 1;
+}
+
+// Returns whether leaving through `insn` is a return, i.e. `jalr x0, ra`.
+static inline bool block_exit_is_return(struct decoded_insn const *insn) {
+    return insn->op == dop_jalr && insn->rd == DECODED_SINK_REG &&
+           insn->rs1 == 1;
+}
+
+// Returns the guest address of `block->insns[i]`.
+// Optimized blocks may be missing instructions, but never their last one. This
+// is only exact for the instructions that end a block, which are the only ones
+// needing it, and for the trailing `jal`.
+static inline u32 block_insn_pc(struct block const *block, u32 i) {
+    return i == block->count ? block->end : block->exit_pc;
+}
+
+// Returns the already linked successor of `block` starting at `pc`, if any.
+static inline struct block *block_successor(struct block const *block,
+                                            u32 pc) {
+    if (block->succ[0] != NULL && block->succ[0]->pc == pc)
+        return block->succ[0];
+    if (block->succ[1] != NULL && block->succ[1]->pc == pc)
+        return block->succ[1];
+    return NULL;
+}
+
+// Links `next` as a successor of `block`, if there's room left.
+static inline void block_link(struct block *block, struct block *next) {
+    if (block->succ[0] == NULL)
+        block->succ[0] = next;
+    else if (block->succ[1] == NULL)
+        block->succ[1] = next;
+}
+
+// Returns the block `block` continues to after leaving through `exit` for
+// `pc`, without going through the cache: a linked successor for static exits,
+// the return stack's prediction for returns and the jalr's last target for the
+// other indirect jumps. Returns NULL when `pc` needs a lookup, after which
+// block_remember() keeps the result around for next time.
+static inline struct block *block_next(struct block_cache *cache,
+                                       struct block *block,
+                                       struct decoded_insn const *exit,
+                                       u32 pc) {
+    if (block_exit_is_call(exit)) {
+        if (block->return_to == NULL) {
+            // Calls are always last, so they return to the end of the block.
+            block->return_to = block_cache_lookup(cache, block->end);
+        }
+        cache->returns[cache->return_top++ % RETURN_STACK_SIZE] =
+            block->return_to;
+    }
+    if (block_exit_is_static(exit))
+        return block_successor(block, pc);
+
+    if (block_exit_is_return(exit)) {
+        struct block *predicted =
+            cache->returns[--cache->return_top % RETURN_STACK_SIZE];
+        if (predicted != NULL && predicted->pc == pc)
+            return predicted;
+    }
+    if (block->indirect != NULL && block->indirect->pc == pc)
+        return block->indirect;
+    return NULL;
+}
+
+// Remembers `next` as where `block` went after leaving through `exit`.
+static inline void block_remember(struct block *block,
+                                  struct decoded_insn const *exit,
+                                  struct block *next) {
+    if (block_exit_is_static(exit))
+        block_link(block, next);
+    else
+        block->indirect = next;
+}
+
+// Runs the body of `block` (through `native` if it's compiled) against the
+// hart of `state`, whose fuel a loop idiom uses. Stores where to continue in
+// `next_pc` and returns the instruction that left the block, or NULL if the
+// guest faulted. When the guest exited, that's the ecall, and `next_pc` is its
+// address.
+struct decoded_insn const *block_run(struct block const *block,
+                                     struct run_state *state, void *memory,
+                                     u32 *next_pc);
+
+// Runs the guest block by block from `state`, until it faults, exits or
+// `state` says to stop.
+enum run_exit interpret_blocks(void *memory, struct block_cache *cache,
+                               struct run_state *state);
+
+// vim:ft=c
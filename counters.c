@@ -0,0 +1,191 @@
+#include "counters.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "rv/decode.h"
+#include "rv/insn.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+char const *cost_class_names[cost_class_count] = {
+#define X(name, cycles) [cost_##name] = #name,
+    COST_CLASSES(X)
+#undef X
+};
+
+// Superinstructions and loop idioms are of the class of the first instruction
+// they cover.
+static enum cost_class class_of(enum decoded_op op) {
+    switch (op) {
+    case dop_beq:
+    case dop_bne:
+    case dop_blt:
+    case dop_bge:
+    case dop_bltu:
+    case dop_bgeu:
+        return cost_branch;
+    case dop_jal:
+    case dop_jalr:
+        return cost_jump;
+    case dop_lb:
+    case dop_lh:
+    case dop_lw:
+    case dop_lbu:
+    case dop_lhu:
+#if RV_XLEN == 64
+    case dop_ld:
+    case dop_lwu:
+#endif
+    case dop_flw:
+    case dop_fld:
+    case dop_fused_byte_update:
+    case dop_idiom_scan:
+    case dop_idiom_clear:
+    case dop_idiom_strlen:
+    case dop_idiom_memcpy:
+        return cost_load;
+    case dop_sb:
+    case dop_sh:
+    case dop_sw:
+#if RV_XLEN == 64
+    case dop_sd:
+#endif
+    case dop_fsw:
+    case dop_fsd:
+    case dop_idiom_memset:
+        return cost_store;
+    case dop_mul:
+    case dop_mulh:
+    case dop_mulhsu:
+    case dop_mulhu:
+#if RV_XLEN == 64
+    case dop_mulw:
+#endif
+        return cost_mul;
+    case dop_div:
+    case dop_divu:
+    case dop_rem:
+    case dop_remu:
+#if RV_XLEN == 64
+    case dop_divw:
+    case dop_divuw:
+    case dop_remw:
+    case dop_remuw:
+#endif
+        return cost_div;
+    case dop_fdiv_s:
+    case dop_fsqrt_s:
+    case dop_fdiv_d:
+    case dop_fsqrt_d:
+        return cost_fdiv;
+    default:
+        break;
+    }
+
+    // The rest go by extension.
+    switch (op) {
+#define X(name) case dop_##name:
+        FLOAT_OPS(X)
+        return cost_fp;
+        VECTOR_OPS(X)
+        return cost_vector;
+        ATOMIC_OPS(X)
+        return cost_atomic;
+        CSR_OPS(X)
+#undef X
+    case dop_fence:
+    case dop_fence_i:
+    case dop_ecall:
+        return cost_system;
+    default:
+        return cost_alu;
+    }
+}
+
+void cost_model_init(struct cost_model *model) {
+    static u8 const defaults[cost_class_count] = {
+#define X(name, cycles) [cost_##name] = cycles,
+        COST_CLASSES(X)
+#undef X
+    };
+    for (u32 op = 0; op < dop_count; ++op)
+        model->cycles[op] = defaults[class_of(op)];
+}
+
+bool cost_model_parse(struct cost_model *model, char const *spec) {
+    while (*spec != '\0') {
+        size_t const len = strcspn(spec, "=");
+        enum cost_class class = 0;
+        while (class < cost_class_count &&
+               (strlen(cost_class_names[class]) != len ||
+                strncmp(cost_class_names[class], spec, len) != 0))
+            ++class;
+        if (class == cost_class_count || spec[len] != '=') {
+            error("Unknown instruction class in '%s'\n", spec);
+            return false;
+        }
+
+        char *end;
+        unsigned long cycles = strtoul(spec + len + 1, &end, 0);
+        if (end == spec + len + 1 || (*end != ',' && *end != '\0') ||
+            cycles > UINT8_MAX) {
+            error("Cycles for '%s' must be from 0 to %u\n",
+                  cost_class_names[class], UINT8_MAX);
+            return false;
+        }
+        for (u32 op = 0; op < dop_count; ++op) {
+            if (class_of(op) == class)
+                model->cycles[op] = cycles;
+        }
+        spec = *end == ',' ? end + 1 : end;
+    }
+    return true;
+}
+
+void cost_model_sum(struct cost_model const *model,
+                    struct decoded_text const *text, u32 *sums) {
+    u32 sum = 0;
+    for (u32 i = 0; i < text->count; ++i) {
+        sums[i] = sum;
+        sum += model->cycles[text->insns[i].op];
+    }
+    sums[text->count] = sum;
+}
+
+bool counter_csr(u32 csr) {
+    switch (csr) {
+    case csr_cycle:
+    case csr_time:
+    case csr_instret:
+#if RV_XLEN == 32
+    case csr_cycleh:
+    case csr_timeh:
+    case csr_instreth:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+uxlen counter_csr_read(u32 csr, u64 instret, u64 cycle) {
+    u64 value;
+    switch (csr & ~0x80) {
+    case csr_cycle:
+        value = cycle;
+        break;
+    case csr_time: {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        value = (u64)now.tv_sec * 1000000000 + now.tv_nsec;
+    } break;
+    default:
+        value = instret;
+        break;
+    }
+    // The upper halves are 0x80 further, and only in RV32.
+    return csr & 0x80 ? value >> 32 : value;
+}
+
+// vim:sw=4
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common/types.h"
+#include "rv/decode.h"
+#include "rv/xlen.h"
+#include <stdbool.h>
+
+// Zicsr's counters.
+// A hart counts the instructions it retired (instret) and the cycles they'd
+// have taken (cycle), but engines only bring these up to date a block at a
+// time: the block engines charge a whole block before running it, like they
+// do fuel, and the decoded ones charge a run of instructions once it ends in a
+// taken jump. Reading a counter adds up what the engine hasn't charged yet, so
+// that it's exact, and instructions that don't read one never pay for it.
+// Cycles come from a cost model, which charges every instruction by its class.
+// time is the host's monotonic clock, in nanoseconds.
+
+// Classes of instructions, and what each costs by default, in cycles: roughly
+// a simple in-order core whose loads hit in the cache.
+#define COST_CLASSES(X)                                                        \
+    X(alu, 1)                                                                  \
+    X(branch, 1)                                                               \
+    X(jump, 2)                                                                 \
+    X(load, 2)                                                                 \
+    X(store, 1)                                                                \
+    X(mul, 3)                                                                  \
+    X(div, 20)                                                                 \
+    X(fp, 4)                                                                   \
+    X(fdiv, 20)                                                                \
+    X(vector, 4)                                                               \
+    X(atomic, 10)                                                              \
+    X(system, 4)
+
+enum cost_class {
+#define X(name, cycles) cost_##name,
+    COST_CLASSES(X)
+#undef X
+        cost_class_count,
+};
+
+extern char const *cost_class_names[cost_class_count];
+
+struct cost_model {
+    // Cycles charged for each `enum decoded_op`.
+    u8 cycles[dop_count];
+};
+
+// Sets up `model` with the default cost of every class.
+void cost_model_init(struct cost_model *model);
+
+// Sets the cost of the classes listed in `spec`, as comma-separated
+// `class=cycles` pairs, up to 255 cycles. Returns false if it can't be parsed,
+// after logging why, with `model` possibly changed already.
+bool cost_model_parse(struct cost_model *model, char const *spec);
+
+// Stores in `sums[i]` what the instructions of `text` before `insns[i]` cost,
+// for every `i` up to `text->count`, wrapping around. What a run of
+// instructions costs is then the difference between the sums at its ends.
+// A superinstruction costs what the first instruction it covers does, so that
+// sums are the same with and without them.
+void cost_model_sum(struct cost_model const *model,
+                    struct decoded_text const *text, u32 *sums);
+
+// Returns whether `csr` is one of the counters, which are read-only: cycle,
+// time and instret, and in RV32 their upper halves.
+bool counter_csr(u32 csr);
+
+// Returns the counter `csr`, for a hart that has retired `instret` instructions
+// over `cycle` cycles.
+uxlen counter_csr_read(u32 csr, u64 instret, u64 cycle);
+
+// vim:ft=c
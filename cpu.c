@@ -1,7 +1,17 @@
+#include "block.h"
+#include "counters.h"
+#include "fuse.h"
+#include "guard.h"
+#include "hart.h"
 #include "common/log.h"
 #include "interpret.h"
+#include "jit_x86.h"
 #include "loader.h"
+#include "mmu.h"
 #include "rv/insn.h"
+#include "simt.h"
+#include "syscalls.h"
+#include "tier.h"
 #include <assert.h>
 #include <elf.h>
 #include <elfutils/elf-knowledge.h>
@@ -9,6 +19,7 @@
 #include <fcntl.h>
 #include <libelf.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -24,10 +35,44 @@ struct cli_options {
     char *input_file;
     enum input_mode { mode_raw, mode_elf } mode;
     size_t empend_segment_size;
+    enum engine {
+        engine_switch,
+        engine_decoded,
+        engine_threaded,
+        engine_blocks,
+        engine_jit,
+        engine_tiered,
+        engine_simt,
+    } engine;
+    struct tiers tiers;
+    bool trace;
+    bool trace_blocks;
+    bool optimize_blocks;
+    bool idioms;
+    bool fuse;
+    bool mmu;
+    bool reserve;
+    u64 fuel;
+    unsigned time_limit;
+    u32 tlb_entries;
+    u32 lanes;
+    u32 harts;
+    struct cost_model costs;
+    bool fusion_report;
     bool wants_help;
 };
 
 static bool parse_options(size_t argc, char **argv, struct cli_options *opts);
+static int exit_code(enum run_exit exit);
+#if RV_XLEN == 32
+static void on_alarm(int sig);
+static int watch_text_writes(struct block_cache *cache,
+                             struct loaded_exe const *exe, struct guard *guard,
+                             bool installed);
+
+// Stop flag of the run --time-limit applies to.
+static atomic_bool *stop_on_alarm;
+#endif
 
 static char const USAGE[] =
     "usage: %s <file> [OPTIONS]\n"
@@ -39,7 +84,59 @@ static char const USAGE[] =
     "\t\t\t\tWhen using raw, use --empend-segment to allocate memory for\n"
     "\t\t\t\twanted data.\n\n"
     "\t--empend-segment SIZE\tEmpend a read/write (not executable) segment at\n"
-    "\t\t\t\tthe start of the image.\n";
+    "\t\t\t\tthe start of the image.\n\n"
+    "\t--engine ENGINE\t\tExecute the guest with ENGINE.\n"
+    "\t\t\t\tENGINE can be either 'switch' (decode every\n"
+    "\t\t\t\tinstruction as it runs), 'decoded'\n"
+    "\t\t\t\t(pre-decode the text segment once, default) or\n"
+    "\t\t\t\t'threaded' (pre-decode, then dispatch each handler\n"
+    "\t\t\t\tthrough its own indirect jump) or 'blocks' (translate\n"
+    "\t\t\t\tbasic blocks as they're found and chain them),\n"
+    "\t\t\t\t'jit' (like 'blocks', compiling hot blocks to host\n"
+    "\t\t\t\tcode), 'tiered' (start interpreting, promote\n"
+    "\t\t\t\tblocks to 'blocks' and then 'jit' as they get hot)\n"
+    "\t\t\t\tor 'simt' (run several instances of the guest at\n"
+    "\t\t\t\tonce, one per SIMD lane). The RV64 build, cpu64,\n"
+    "\t\t\t\tonly has 'decoded' and 'threaded'.\n\n"
+    "\t--lanes N\t\tWith the 'simt' engine, run N instances (1 to 8,\n"
+    "\t\t\t\t8 by default). Instance i starts with a0 = i and\n"
+    "\t\t\t\ta1 = N, and gets its own copy of memory.\n\n"
+    "\t--harts N\t\tWith the 'decoded' and 'threaded' engines, run N\n"
+    "\t\t\t\tharts (1 to 256, 1 by default) on as many host\n"
+    "\t\t\t\tthreads, sharing memory. Hart i starts with a0 = i\n"
+    "\t\t\t\tand a1 = N. Doesn't work with --mmu or --reserve.\n\n"
+    "\t--cycles CLASS=N,...\tHave the cycle counter charge N cycles for every\n"
+    "\t\t\t\tinstruction of CLASS, which is one of alu (1 by\n"
+    "\t\t\t\tdefault), branch (1), jump (2), load (2), store\n"
+    "\t\t\t\t(1), mul (3), div (20), fp (4), fdiv (20), vector\n"
+    "\t\t\t\t(4), atomic (10) or system (4).\n\n"
+    "\t--tier-thresholds D,N\tWith the 'tiered' engine, promote blocks after\n"
+    "\t\t\t\trunning D times interpreted and N times decoded.\n\n"
+    "\t--mmu\t\t\tWith the 'decoded' engine, run the guest at its\n"
+    "\t\t\t\tvirtual addresses through a software MMU, checking\n"
+    "\t\t\t\tpage permissions, and report TLB statistics.\n\n"
+    "\t--tlb-entries N\t\tWith --mmu, use a TLB of N entries (a power of\n"
+    "\t\t\t\ttwo, 256 by default).\n\n"
+    "\t--reserve\t\tLoad the guest at its virtual addresses inside a\n"
+    "\t\t\t\treserved 4 GiB region, and catch its bad accesses\n"
+    "\t\t\t\tas host page faults instead of checking them.\n\n"
+    "\t--fuel N\t\tWith block engines, stop the guest once it has run\n"
+    "\t\t\t\tN instructions.\n\n"
+    "\t--time-limit SECONDS\tWith block engines, stop the guest after it has\n"
+    "\t\t\t\trun for SECONDS.\n\n"
+    "\t--trace\t\t\tWith the 'switch' engine, log and disassemble every\n"
+    "\t\t\t\tinstruction, and check alignment.\n\n"
+    "\t--trace-blocks\t\tWith block engines, log every interpreted block\n"
+    "\t\t\t\tentered.\n\n"
+    "\t--no-optimize\t\tWith block engines, run blocks as they were\n"
+    "\t\t\t\tdecoded instead of optimizing them first.\n\n"
+    "\t--no-idioms\t\tWith block engines, run byte loops (e.g. strlen,\n"
+    "\t\t\t\tmemset) one instruction at a time instead of\n"
+    "\t\t\t\twith host kernels.\n\n"
+    "\t--no-fuse\t\tWith the 'decoded' and 'threaded' engines, don't\n"
+    "\t\t\t\tfuse common sequences into superinstructions.\n\n"
+    "\t--fusion-report\t\tWith the 'decoded' and 'threaded' engines, print\n"
+    "\t\t\t\tthe most frequent instruction pairs and triples.\n";
 
 int main(int argc, char **argv) {
 
@@ -63,6 +160,41 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    bool const block_engine = opts.engine == engine_blocks ||
+                              opts.engine == engine_jit ||
+                              opts.engine == engine_tiered;
+    if ((opts.fuel != UINT64_MAX || opts.time_limit != 0) && !block_engine) {
+        fprintf(stderr, "--fuel and --time-limit only work with block "
+                        "engines\n");
+        return 1;
+    }
+    if (opts.reserve && opts.engine == engine_simt) {
+        fprintf(stderr, "--reserve doesn't work with the 'simt' engine\n");
+        return 1;
+    }
+    if (opts.mmu && opts.engine != engine_decoded) {
+        fprintf(stderr, "--mmu only works with the 'decoded' engine\n");
+        return 1;
+    }
+    // The MMU's TLB and the fault handler of --reserve belong to one thread.
+    if (opts.harts > 1 &&
+        ((opts.engine != engine_decoded && opts.engine != engine_threaded) ||
+         opts.mmu || opts.reserve)) {
+        fprintf(stderr, "--harts only works with the 'decoded' and "
+                        "'threaded' engines, without --mmu or --reserve\n");
+        return 1;
+    }
+#if RV_XLEN == 64
+    // The other engines, the MMU and the reserved address space all assume
+    // 32-bit registers and addresses.
+    if ((opts.engine != engine_decoded && opts.engine != engine_threaded) ||
+        opts.mmu || opts.reserve) {
+        fprintf(stderr, "RV64 guests only run on the 'decoded' and "
+                        "'threaded' engines, without --mmu or --reserve\n");
+        return 1;
+    }
+#endif
+
     printf("Chosen file is '%s'\n", opts.input_file);
 
     struct loaded_exe exe;
@@ -88,14 +220,278 @@ int main(int argc, char **argv) {
         return code;
     }
 
-    interpret(exe.mem, exe.entrypoint);
+#if RV_XLEN == 32
+    struct guard guard;
+    if (opts.reserve) {
+        if ((code = loader_reserve_address_space(&exe)) != 0 ||
+            (code = guard_install(&guard, exe.mem, exe.mem_count)) != 0) {
+            fprintf(stderr, "Could not reserve guest address space: %s\n",
+                    strerror(code));
+            loader_destroy_exe(&exe);
+            return 1;
+        }
+        guard.catch_faults = true;
+        // Whatever the engine had allocated is left behind, since we're
+        // about to exit anyway.
+        if (sigsetjmp(guard.fault, 1) != 0) {
+            error("Refusing to execute: %s of 0x%08x is not allowed\n",
+                  guard.fault_write ? "write" : "access", guard.fault_addr);
+            code = exit_code(run_fault);
+            goto guest_faulted;
+        }
+    }
+#endif
+
+    // The guest writes to fd 1 itself (see syscalls.h), after what's been
+    // printed so far.
+    fflush(stdout);
+
+    switch (opts.engine) {
+#if RV_XLEN == 32
+    case engine_switch:
+        code = exit_code(
+            interpret(exe.mem, exe.entrypoint, exe.compressed, opts.trace));
+        break;
+#endif
+    case engine_decoded:
+    case engine_threaded: {
+        struct decoded_text text;
+        // Through the MMU, code is addressed by its virtual address instead
+        // of its offset into the image.
+        u32 text_base = opts.mmu ? exe.text_vaddr : exe.text_offset;
+        if ((code = decode_text(&text,
+                                (u8 *)exe.mem + exe.text_offset - text_base,
+                                text_base, exe.text_size, exe.compressed)) !=
+            0) {
+            fprintf(stderr, "Could not decode text segment: %s\n",
+                    strerror(code));
+            break;
+        }
+        if (opts.fusion_report)
+            fusion_report(&text, 10, stderr);
+        if (opts.fuse) {
+            u32 fused = fuse_text(&text, NULL);
+            log("Fused %u superinstructions\n", fused);
+        }
+        enum run_exit exit;
+#if RV_XLEN == 32
+        if (opts.mmu) {
+            struct mmu mmu;
+            if ((code = mmu_init(&mmu, opts.tlb_entries)) != 0 ||
+                (code = mmu_map_exe(&mmu, &exe)) != 0) {
+                fprintf(stderr, "Could not set up the MMU: %s\n",
+                        strerror(code));
+                decoded_text_destroy(&text);
+                break;
+            }
+            exit = interpret_decoded_mmu(&mmu, &text, &opts.costs,
+                                         exe.entry_vaddr);
+            mmu_report(&mmu, stderr);
+            mmu_destroy(&mmu);
+        } else
+#endif
+        {
+            exit = harts_run(exe.mem, &text, &opts.costs, opts.harts,
+                             opts.engine == engine_threaded, exe.entrypoint);
+        }
+        code = exit_code(exit);
+        decoded_text_destroy(&text);
+    } break;
+#if RV_XLEN == 32
+    case engine_blocks:
+    case engine_jit:
+    case engine_tiered: {
+        struct block_cache cache;
+        struct jit jit;
+        if ((code = block_cache_init(&cache, exe.text_offset,
+                                     exe.text_offset + exe.text_size,
+                                     exe.compressed)) != 0) {
+            fprintf(stderr, "Could not create block cache: %s\n",
+                    strerror(code));
+            break;
+        }
+        cache.trace = opts.trace_blocks;
+        cache.optimize = opts.optimize_blocks;
+        cache.idioms = opts.idioms;
+        cache.costs = opts.costs;
+        if ((code = watch_text_writes(&cache, &exe, &guard, opts.reserve)) !=
+            0) {
+            fprintf(stderr, "Could not watch writes to text: %s\n",
+                    strerror(code));
+            block_cache_destroy(&cache);
+            break;
+        }
+        if (opts.engine != engine_blocks) {
+            int jit_code = jit_init(&jit, 64ul << 20);
+            if (jit_code == 0) {
+                cache.jit = &jit;
+            } else {
+                fprintf(stderr,
+                        "Could not create JIT code buffer, running without "
+                        "it: %s\n",
+                        strerror(jit_code));
+            }
+        }
+
+        struct run_state state;
+        run_state_init(&state, exe.entrypoint);
+        state.fuel = opts.fuel;
+        if (opts.time_limit != 0) {
+            stop_on_alarm = &state.stop;
+            signal(SIGALRM, on_alarm);
+            alarm(opts.time_limit);
+        }
 
+        enum run_exit exit;
+        if (opts.engine == engine_tiered) {
+            exit = interpret_tiered(exe.mem, &cache, &opts.tiers, &state);
+            tiers_report(&opts.tiers, stderr);
+        } else {
+            exit = interpret_blocks(exe.mem, &cache, &state);
+        }
+        alarm(0);
+        stop_on_alarm = NULL;
+        code = exit_code(exit);
+        if (exit == run_out_of_fuel || exit == run_stopped) {
+            fprintf(stderr, "Stopped @ 0x%08x after %lu instructions\n",
+                    state.pc, (unsigned long)(opts.fuel - state.fuel));
+        }
+
+        guard.retry = NULL;
+        if (cache.jit != NULL) {
+            jit_report(cache.jit, stderr);
+            jit_destroy(cache.jit);
+        }
+        block_cache_destroy(&cache);
+    } break;
+    case engine_simt: {
+        struct decoded_text text;
+        if ((code = decode_text(&text, exe.mem, exe.text_offset,
+                                exe.text_size, exe.compressed)) != 0) {
+            fprintf(stderr, "Could not decode text segment: %s\n",
+                    strerror(code));
+            break;
+        }
+        // Lane 0 runs off the image itself, the others off copies of it.
+        struct simt_lane lanes[SIMT_LANES];
+        u32 count = 0;
+        for (; count < opts.lanes; ++count) {
+            if (count == 0) {
+                lanes[count].memory = exe.mem;
+                continue;
+            }
+            if ((lanes[count].memory = malloc(exe.mem_count)) == NULL) {
+                fprintf(stderr, "Could not allocate memory for lane %u\n",
+                        count);
+                break;
+            }
+            memcpy(lanes[count].memory, exe.mem, exe.mem_count);
+        }
+        if (count == opts.lanes) {
+            interpret_simt(&text, lanes, count, exe.entrypoint);
+            // Like a batch of processes: a fault in any lane fails the run,
+            // and otherwise the first lane exiting with a failure decides.
+            bool faulted = false;
+            code = 0;
+            for (u32 l = 0; l < count; ++l) {
+                if (lanes[l].exited) {
+                    fprintf(stderr, "Lane %u exited with %d\n", l,
+                            lanes[l].exit_status);
+                    if (code == 0)
+                        code = lanes[l].exit_status;
+                    continue;
+                }
+                fprintf(stderr, "Lane %u stopped @ 0x%08x with a0 = 0x%08x\n",
+                        l, lanes[l].pc, lanes[l].cpu.registers[rv_a0]);
+                faulted = true;
+            }
+            if (faulted)
+                code = exit_code(run_fault);
+        } else {
+            code = 1;
+        }
+        for (u32 l = 1; l < count; ++l)
+            free(lanes[l].memory);
+        decoded_text_destroy(&text);
+    } break;
+#else
+    default:
+        // The other engines were turned down above.
+        break;
+#endif
+    }
+
+#if RV_XLEN == 32
+guest_faulted:
+    guard_remove(&guard);
+#endif
     loader_destroy_exe(&exe);
 
     close(fd);
 
+    return code;
+}
+
+#if RV_XLEN == 32
+static void on_alarm(int sig) {
+    (void)sig;
+    if (stop_on_alarm != NULL)
+        atomic_store_explicit(stop_on_alarm, true, memory_order_relaxed);
+}
+
+static bool retry_text_write(void *cache, u32 addr) {
+    return block_cache_write_fault(cache, addr);
+}
+
+// Has `cache` watch the segments of `exe` that hold code and can be written to,
+// installing `guard` to see the writes unless it's already `installed`.
+static int watch_text_writes(struct block_cache *cache,
+                             struct loaded_exe const *exe, struct guard *guard,
+                             bool installed) {
+    bool watching = false;
+    for (u32 i = 0; i < exe->segment_count; ++i) {
+        struct loaded_segment const *segm = &exe->segments[i];
+        if ((segm->flags & (PF_W | PF_X)) != (PF_W | PF_X))
+            continue;
+        int code = block_cache_watch_writes(cache, exe->mem, segm->offset,
+                                            segm->offset + segm->size);
+        if (code != 0)
+            return code;
+        watching = true;
+    }
+    if (!watching)
+        return 0;
+
+    if (!installed) {
+        int code = guard_install(guard, exe->mem, exe->mem_count);
+        if (code != 0)
+            return code;
+    }
+    guard->retry = retry_text_write;
+    guard->retry_arg = cache;
     return 0;
 }
+#endif
+
+static int exit_code(enum run_exit exit) {
+    // What the guest wrote comes before how it stopped.
+    syscall_flush();
+    switch (exit) {
+    case run_fault:
+        fputs("Guest faulted\n", stderr);
+        return 1;
+    case run_out_of_fuel:
+        fputs("Guest ran out of fuel\n", stderr);
+        return 1;
+    case run_stopped:
+        fputs("Guest was stopped\n", stderr);
+        return 1;
+    case run_exited:
+        log("Guest exited with %d\n", syscall_exit_status());
+        return syscall_exit_status();
+    }
+    return 1;
+}
 
 // FIXME: maybe this shouldn't handle the errors itself...
 
@@ -103,6 +499,25 @@ static bool parse_options(size_t argc, char **argv, struct cli_options *opts) {
     // defaults.
     opts->empend_segment_size = 0;
     opts->mode = mode_elf;
+    opts->engine = engine_decoded;
+    opts->trace = false;
+    opts->trace_blocks = false;
+    opts->optimize_blocks = true;
+    opts->idioms = true;
+    opts->fuse = true;
+    opts->mmu = false;
+    opts->reserve = false;
+    opts->fuel = UINT64_MAX;
+    opts->time_limit = 0;
+    opts->tlb_entries = MMU_TLB_ENTRIES;
+    opts->lanes = SIMT_LANES;
+    opts->harts = 1;
+    cost_model_init(&opts->costs);
+    opts->fusion_report = false;
+#if RV_XLEN == 32
+    tiers_init(&opts->tiers);
+#endif
+    opts->wants_help = false;
 
     // ensure we can detect that we didn't find it.
     opts->input_file = NULL;
@@ -162,6 +577,153 @@ static bool parse_options(size_t argc, char **argv, struct cli_options *opts) {
             }
 
             opts->empend_segment_size += addend;
+        } else if (strncmp(arg, "--engine", sizeof("--engine")) == 0) {
+            ++i;
+            if (i == argc) {
+                fprintf(stderr, "--engine flag requires an ENGINE after it.");
+                res = false;
+                continue;
+            }
+            char const *engine = argv[i];
+            if (strncmp(engine, "switch", sizeof("switch")) == 0) {
+                opts->engine = engine_switch;
+            } else if (strncmp(engine, "decoded", sizeof("decoded")) == 0) {
+                opts->engine = engine_decoded;
+            } else if (strncmp(engine, "threaded", sizeof("threaded")) == 0) {
+                opts->engine = engine_threaded;
+            } else if (strncmp(engine, "blocks", sizeof("blocks")) == 0) {
+                opts->engine = engine_blocks;
+            } else if (strncmp(engine, "jit", sizeof("jit")) == 0) {
+                opts->engine = engine_jit;
+            } else if (strncmp(engine, "tiered", sizeof("tiered")) == 0) {
+                opts->engine = engine_tiered;
+            } else if (strncmp(engine, "simt", sizeof("simt")) == 0) {
+                opts->engine = engine_simt;
+            } else {
+                fprintf(stderr, "unknown engine: '%s'\n", engine);
+                res = false;
+            }
+        } else if (strncmp(arg, "--tier-thresholds",
+                           sizeof("--tier-thresholds")) == 0) {
+            ++i;
+            if (i == argc) {
+                fprintf(stderr,
+                        "--tier-thresholds flag requires D,N after it.");
+                res = false;
+                continue;
+            }
+            char *endptr;
+            unsigned long decoded = strtoul(argv[i], &endptr, 0);
+            unsigned long native = 0;
+            if (*endptr == ',')
+                native = strtoul(endptr + 1, &endptr, 0);
+            if (*endptr != '\0' || decoded > UINT32_MAX ||
+                native > UINT32_MAX) {
+                fprintf(stderr, "Could not parse thresholds: '%s'\n",
+                        argv[i]);
+                res = false;
+                continue;
+            }
+            opts->tiers.thresholds[tier_decoded] = decoded;
+            opts->tiers.thresholds[tier_native] = native;
+        } else if (strncmp(arg, "--mmu", sizeof("--mmu")) == 0) {
+            opts->mmu = true;
+        } else if (strncmp(arg, "--tlb-entries", sizeof("--tlb-entries")) ==
+                   0) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--tlb-entries flag requires N after it.");
+                return false;
+            }
+            char *end;
+            unsigned long entries = strtoul(argv[i], &end, 0);
+            if (*end != '\0' || entries == 0 || entries > UINT32_MAX ||
+                (entries & (entries - 1)) != 0) {
+                fprintf(stderr,
+                        "--tlb-entries must be a power of two, not '%s'\n",
+                        argv[i]);
+                return false;
+            }
+            opts->tlb_entries = entries;
+        } else if (strncmp(arg, "--lanes", sizeof("--lanes")) == 0) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--lanes flag requires N after it.");
+                return false;
+            }
+            char *end;
+            unsigned long lanes = strtoul(argv[i], &end, 0);
+            if (*end != '\0' || lanes == 0 || lanes > SIMT_LANES) {
+                fprintf(stderr, "--lanes must be from 1 to %u, not '%s'\n",
+                        SIMT_LANES, argv[i]);
+                return false;
+            }
+            opts->lanes = lanes;
+        } else if (strncmp(arg, "--harts", sizeof("--harts")) == 0) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--harts flag requires N after it.");
+                return false;
+            }
+            char *end;
+            unsigned long harts = strtoul(argv[i], &end, 0);
+            if (*end != '\0' || harts == 0 || harts > HART_MAX) {
+                fprintf(stderr, "--harts must be from 1 to %u, not '%s'\n",
+                        HART_MAX, argv[i]);
+                return false;
+            }
+            opts->harts = harts;
+        } else if (strncmp(arg, "--cycles", sizeof("--cycles")) == 0) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--cycles flag requires CLASS=N after it.");
+                return false;
+            }
+            if (!cost_model_parse(&opts->costs, argv[i]))
+                return false;
+        } else if (strncmp(arg, "--reserve", sizeof("--reserve")) == 0) {
+            opts->reserve = true;
+        } else if (strncmp(arg, "--fuel", sizeof("--fuel")) == 0) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--fuel flag requires N after it.");
+                return false;
+            }
+            char *end;
+            opts->fuel = strtoull(argv[i], &end, 0);
+            if (*end != '\0') {
+                fprintf(stderr, "Could not parse fuel: '%s'\n", argv[i]);
+                return false;
+            }
+        } else if (strncmp(arg, "--time-limit", sizeof("--time-limit")) == 0) {
+            ++i;
+            if (i >= argc) {
+                fprintf(stderr, "--time-limit flag requires SECONDS after it.");
+                return false;
+            }
+            char *end;
+            unsigned long seconds = strtoul(argv[i], &end, 0);
+            if (*end != '\0' || seconds == 0 || seconds > UINT_MAX) {
+                fprintf(stderr, "Could not parse time limit: '%s'\n",
+                        argv[i]);
+                return false;
+            }
+            opts->time_limit = seconds;
+        } else if (strncmp(arg, "--trace", sizeof("--trace")) == 0) {
+            opts->trace = true;
+        } else if (strncmp(arg, "--trace-blocks", sizeof("--trace-blocks")) ==
+                   0) {
+            opts->trace_blocks = true;
+        } else if (strncmp(arg, "--no-optimize", sizeof("--no-optimize")) ==
+                   0) {
+            opts->optimize_blocks = false;
+        } else if (strncmp(arg, "--no-idioms", sizeof("--no-idioms")) == 0) {
+            opts->idioms = false;
+        } else if (strncmp(arg, "--no-fuse", sizeof("--no-fuse")) == 0) {
+            opts->fuse = false;
+        } else if (strncmp(arg, "--fusion-report", sizeof("--fusion-report")) ==
+                   0) {
+            opts->fusion_report = true;
         } else if (strncmp(arg, "--help", sizeof("--help")) == 0) {
             opts->wants_help = true;
             return true;
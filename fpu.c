@@ -0,0 +1,329 @@
+// <math.h> comes first: common/log.h has a `log` macro.
+#include <fenv.h>
+#include <math.h>
+
+#include "fpu.h"
+#include "common/types.h"
+#include "rv/insn.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Host rounding mode for each guest one. Ties away from zero is rounded to
+// nearest even, then fixed up.
+static int const host_modes[] = {
+    [fp_rm_rne] = FE_TONEAREST, [fp_rm_rtz] = FE_TOWARDZERO,
+    [fp_rm_rdn] = FE_DOWNWARD,  [fp_rm_rup] = FE_UPWARD,
+    [fp_rm_rmm] = FE_TONEAREST,
+};
+
+// Host rounding mode while the hart runs: reserved values of frm make the
+// instructions that use it illegal, so any will do.
+static int host_mode(u32 frm) {
+    return frm <= fp_rm_rmm ? host_modes[frm] : FE_TONEAREST;
+}
+
+// Resolves the dynamic rounding mode. Returns false for reserved ones.
+static bool resolve_rm(struct fpu_state const *fpu, u32 *rm) {
+    if (*rm == fp_rm_dyn)
+        *rm = fpu->frm;
+    return *rm <= fp_rm_rmm;
+}
+
+// Keeps the compiler from moving computations on `value` across rounding mode
+// changes, which it assumes don't happen.
+#define BARRIER(value) __asm__ volatile("" : "+m"(value))
+
+void fpu_attach(struct fpu_state *fpu) {
+    fesetround(host_mode(fpu->frm));
+    feclearexcept(FE_ALL_EXCEPT);
+}
+
+static u32 host_flags(void) {
+    int const raised = fetestexcept(FE_ALL_EXCEPT);
+    return (raised & FE_INEXACT ? fpu_nx : 0) |
+           (raised & FE_UNDERFLOW ? fpu_uf : 0) |
+           (raised & FE_OVERFLOW ? fpu_of : 0) |
+           (raised & FE_DIVBYZERO ? fpu_dz : 0) |
+           (raised & FE_INVALID ? fpu_nv : 0);
+}
+
+void fpu_detach(struct fpu_state *fpu) {
+    fpu->flags |= host_flags();
+    feclearexcept(FE_ALL_EXCEPT);
+}
+
+bool fpu_csr_read(struct fpu_state const *fpu, u32 csr, u32 *value) {
+    switch (csr) {
+    case csr_fflags:
+        *value = fpu->flags | host_flags();
+        return true;
+    case csr_frm:
+        *value = fpu->frm;
+        return true;
+    case csr_fcsr:
+        *value = fpu->frm << 5 | fpu->flags | host_flags();
+        return true;
+    default:
+        return false;
+    }
+}
+
+void fpu_csr_write(struct fpu_state *fpu, u32 csr, u32 value) {
+    if (csr != csr_frm) {
+        fpu->flags = value & 0x1f;
+        feclearexcept(FE_ALL_EXCEPT);
+    }
+    if (csr != csr_fflags) {
+        fpu->frm = (csr == csr_fcsr ? value >> 5 : value) & 0b111;
+        fesetround(host_mode(fpu->frm));
+    }
+}
+
+// Rounding to nearest with ties away from zero.
+// The result rounded to nearest even is only wrong when the exact result is
+// right between it and a neighbour, which is found out exactly by summing
+// long doubles: they hold the products of two doubles in two parts, and have
+// the exponent range not to underflow halfway between two doubles.
+
+// A sum of long doubles that don't overlap, by increasing magnitude, with no
+// zeros: the exact value of a sum of long doubles (J. R. Shewchuk, Adaptive
+// Precision Floating-Point Arithmetic and Fast Robust Geometric Predicates).
+struct expansion {
+    long double terms[8];
+    u32 count;
+};
+
+// Adds `value` to `e`, exactly.
+static void grow(struct expansion *e, long double value) {
+    u32 count = 0;
+    for (u32 i = 0; i < e->count; ++i) {
+        long double const term = e->terms[i];
+        long double const sum = value + term;
+        long double const virtual = sum - value;
+        long double const error = (value - (sum - virtual)) + (term - virtual);
+        if (error != 0)
+            e->terms[count++] = error;
+        value = sum;
+    }
+    if (value != 0)
+        e->terms[count++] = value;
+    e->count = count;
+}
+
+// Adds `a` * `b` to `e`, exactly.
+static void grow_product(struct expansion *e, long double a, long double b) {
+    long double const product = a * b;
+    grow(e, product);
+    grow(e, fmal(a, b, -product));
+}
+
+static int sign_of(struct expansion const *e) {
+    if (e->count == 0)
+        return 0;
+    return signbit(e->terms[e->count - 1]) ? -1 : 1;
+}
+
+// Returns `s`, the result of `op` rounded to nearest even, rounded to nearest
+// with ties away from zero instead. `up` and `down` are the values next to
+// `s` in its format.
+static long double ties_away(enum fpu_arith op, long double a, long double b,
+                             long double c, long double s, long double up,
+                             long double down) {
+    // Neither division nor square roots of normal numbers ever land exactly
+    // between two values, but divisions can in the subnormal range.
+    if (!isfinite(s) || op == fpu_sqrt)
+        return s;
+
+    // The exact result minus `s`, or times `b` for divisions.
+    struct expansion e = {.count = 0};
+    switch (op) {
+    case fpu_add:
+        grow(&e, a);
+        grow(&e, b);
+        break;
+    case fpu_sub:
+        grow(&e, a);
+        grow(&e, -b);
+        break;
+    case fpu_mul:
+        grow_product(&e, a, b);
+        break;
+    case fpu_div:
+        grow(&e, a);
+        break;
+    case fpu_madd:
+    case fpu_msub:
+    case fpu_nmsub:
+    case fpu_nmadd:
+        grow_product(&e, op == fpu_madd || op == fpu_msub ? a : -a, b);
+        grow(&e, op == fpu_madd || op == fpu_nmsub ? c : -c);
+        break;
+    case fpu_sqrt:
+        break;
+    }
+    long double const scale = op == fpu_div ? b : 1;
+    grow_product(&e, -s, scale);
+
+    int const sign = sign_of(&e) * (scale < 0 ? -1 : 1);
+    long double const next = sign > 0 ? up : down;
+    if (sign == 0 || !isfinite(next))
+        return s;
+    // Halfway to the neighbour on the side of the exact result.
+    long double const half = (next - s) / 2;
+    grow(&e, -half * scale);
+    if (e.count != 0)
+        return s;
+    return fabsl(next) > fabsl(s) ? next : s;
+}
+
+static float arith_s(enum fpu_arith op, float a, float b, float c) {
+    switch (op) {
+    case fpu_add:
+        return a + b;
+    case fpu_sub:
+        return a - b;
+    case fpu_mul:
+        return a * b;
+    case fpu_div:
+        return a / b;
+    case fpu_sqrt:
+        return sqrtf(a);
+    case fpu_madd:
+        return fmaf(a, b, c);
+    case fpu_msub:
+        return fmaf(a, b, -c);
+    case fpu_nmsub:
+        return fmaf(-a, b, c);
+    case fpu_nmadd:
+        return fmaf(-a, b, -c);
+    }
+    __builtin_unreachable();
+}
+
+static double arith_d(enum fpu_arith op, double a, double b, double c) {
+    switch (op) {
+    case fpu_add:
+        return a + b;
+    case fpu_sub:
+        return a - b;
+    case fpu_mul:
+        return a * b;
+    case fpu_div:
+        return a / b;
+    case fpu_sqrt:
+        return sqrt(a);
+    case fpu_madd:
+        return fma(a, b, c);
+    case fpu_msub:
+        return fma(a, b, -c);
+    case fpu_nmsub:
+        return fma(-a, b, c);
+    case fpu_nmadd:
+        return fma(-a, b, -c);
+    }
+    __builtin_unreachable();
+}
+
+bool fpu_round_s(struct fpu_state *fpu, enum fpu_arith op, u32 rm, float a,
+                 float b, float c, float *result) {
+    if (!resolve_rm(fpu, &rm))
+        return false;
+    fesetround(host_modes[rm]);
+    BARRIER(a);
+    BARRIER(b);
+    BARRIER(c);
+    float s = arith_s(op, a, b, c);
+    BARRIER(s);
+    if (rm == fp_rm_rmm) {
+        // The exceptions are the same either way, and the check mustn't
+        // raise any of its own.
+        fexcept_t raised;
+        fegetexceptflag(&raised, FE_ALL_EXCEPT);
+        s = ties_away(op, a, b, c, s, nextafterf(s, INFINITY),
+                      nextafterf(s, -INFINITY));
+        fesetexceptflag(&raised, FE_ALL_EXCEPT);
+    }
+    fesetround(host_mode(fpu->frm));
+    *result = s;
+    return true;
+}
+
+bool fpu_round_d(struct fpu_state *fpu, enum fpu_arith op, u32 rm, double a,
+                 double b, double c, double *result) {
+    if (!resolve_rm(fpu, &rm))
+        return false;
+    fesetround(host_modes[rm]);
+    BARRIER(a);
+    BARRIER(b);
+    BARRIER(c);
+    double s = arith_d(op, a, b, c);
+    BARRIER(s);
+    if (rm == fp_rm_rmm) {
+        fexcept_t raised;
+        fegetexceptflag(&raised, FE_ALL_EXCEPT);
+        s = ties_away(op, a, b, c, s, nextafter(s, INFINITY),
+                      nextafter(s, -INFINITY));
+        fesetexceptflag(&raised, FE_ALL_EXCEPT);
+    }
+    fesetround(host_mode(fpu->frm));
+    *result = s;
+    return true;
+}
+
+bool fpu_narrow(struct fpu_state *fpu, u32 rm, double value, float *result) {
+    if (!resolve_rm(fpu, &rm))
+        return false;
+    fesetround(host_modes[rm]);
+    BARRIER(value);
+    float s = (float)value;
+    BARRIER(s);
+    if (rm == fp_rm_rmm) {
+        fexcept_t raised;
+        fegetexceptflag(&raised, FE_ALL_EXCEPT);
+        s = ties_away(fpu_add, value, 0, 0, s, nextafterf(s, INFINITY),
+                      nextafterf(s, -INFINITY));
+        fesetexceptflag(&raised, FE_ALL_EXCEPT);
+    }
+    fesetround(host_mode(fpu->frm));
+    *result = s;
+    return true;
+}
+
+bool fpu_round_to_int(struct fpu_state *fpu, u32 rm, double value,
+                      bool is_signed, u32 *result) {
+    if (!resolve_rm(fpu, &rm))
+        return false;
+    if (isnan(value)) {
+        fpu->flags |= fpu_nv;
+        *result = is_signed ? INT32_MAX : UINT32_MAX;
+        return true;
+    }
+    // These may raise inexact when the compiler inlines them, and the flags
+    // here are the ones of fcvt rather than of the host's rounding.
+    fexcept_t raised;
+    fegetexceptflag(&raised, FE_ALL_EXCEPT);
+    double rounded = rm == fp_rm_rne   ? __builtin_roundeven(value)
+                     : rm == fp_rm_rtz ? trunc(value)
+                     : rm == fp_rm_rdn ? floor(value)
+                     : rm == fp_rm_rup ? ceil(value)
+                                       : round(value);
+    BARRIER(rounded);
+    fesetexceptflag(&raised, FE_ALL_EXCEPT);
+    double const min = is_signed ? -2147483648.0 : 0.0;
+    double const max = is_signed ? 2147483647.0 : 4294967295.0;
+    // Out of range is invalid rather than inexact.
+    if (rounded < min) {
+        fpu->flags |= fpu_nv;
+        *result = is_signed ? (u32)INT32_MIN : 0;
+    } else if (rounded > max) {
+        fpu->flags |= fpu_nv;
+        *result = is_signed ? INT32_MAX : UINT32_MAX;
+    } else {
+        if (rounded != value)
+            fpu->flags |= fpu_nx;
+        *result = is_signed ? (u32)(i32)rounded : (u32)rounded;
+    }
+    return true;
+}
+
+// vim:sw=4
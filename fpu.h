@@ -0,0 +1,248 @@
+#pragma once
+
+#include "common/types.h"
+#include "rv/insn.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// F and D extensions.
+// Arithmetic runs on the host FPU, whose rounding mode is kept the same as the
+// guest's frm, so that an instruction asking for the dynamic rounding mode is
+// a single host instruction, plus turning NaN results into the canonical NaN.
+// Other rounding modes, and round to nearest with ties away from zero which
+// the host doesn't have, go through a slower path that switches the host's
+// rounding mode around the operation.
+// The guest's accrued exceptions are the host's own sticky exception flags:
+// nothing is spent on them until the guest reads fflags, which looks at the
+// host flags then. The few exceptions the host can't raise by itself (the
+// ones of comparisons and conversions to integers) are kept in software.
+// The host FPU is the hart's while it runs, so host code mustn't compute with
+// floating point in the middle of a guest run.
+
+// Accrued exception bits, as in fflags.
+enum fpu_flag {
+    // Inexact.
+    fpu_nx = 1 << 0,
+    // Underflow.
+    fpu_uf = 1 << 1,
+    // Overflow.
+    fpu_of = 1 << 2,
+    // Divide by zero.
+    fpu_dz = 1 << 3,
+    // Invalid operation.
+    fpu_nv = 1 << 4,
+};
+
+// The canonical NaNs, which every operation that produces a NaN returns.
+#define FPU_NAN_S 0x7fc00000u
+#define FPU_NAN_D 0x7ff8000000000000ull
+
+struct fpu_state {
+    // f0 to f31. Single-precision values are NaN-boxed: their upper 32 bits
+    // are all ones.
+    u64 f[32];
+    // Dynamic rounding mode, an `enum fp_rm` but for the reserved values the
+    // guest can still write.
+    u32 frm;
+    // Accrued exceptions raised in software. The guest's fflags is these along
+    // with the host's.
+    u32 flags;
+};
+
+// Operations that round, for the slow path.
+enum fpu_arith {
+    fpu_add,
+    fpu_sub,
+    fpu_mul,
+    fpu_div,
+    fpu_sqrt,
+    // a * b + c, a * b - c, -(a * b) + c and -(a * b) - c.
+    fpu_madd,
+    fpu_msub,
+    fpu_nmsub,
+    fpu_nmadd,
+};
+
+// Hands the host FPU over to the hart: sets its rounding mode from frm, and
+// clears its exception flags. Engines call this before running guest code.
+void fpu_attach(struct fpu_state *fpu);
+
+// Takes the host FPU back from the hart, keeping the exception flags it raised
+// in `fpu`, so that a run picked up again later still has them. Engines call
+// this once they stop running guest code.
+void fpu_detach(struct fpu_state *fpu);
+
+// Returns whether an instruction asking for `rm` rounds like the host
+// currently does, i.e. can run as a host instruction.
+static inline bool fpu_native(struct fpu_state const *fpu, u32 rm) {
+    return (rm == fp_rm_dyn || rm == fpu->frm) && fpu->frm < fp_rm_rmm;
+}
+
+// Runs `op` on `a`, `b` and `c` (those of them it takes), rounding as `rm`
+// says, and stores the result in `*result`. Returns false if `rm` isn't a
+// valid rounding mode.
+bool fpu_round_s(struct fpu_state *fpu, enum fpu_arith op, u32 rm, float a,
+                 float b, float c, float *result);
+bool fpu_round_d(struct fpu_state *fpu, enum fpu_arith op, u32 rm, double a,
+                 double b, double c, double *result);
+
+// Rounds `value` to single precision as `rm` says. Returns false if `rm` isn't
+// a valid rounding mode.
+bool fpu_narrow(struct fpu_state *fpu, u32 rm, double value, float *result);
+
+// Converts `value` to a 32-bit integer, signed or not, rounding as `rm` says,
+// and saturating out of range values and NaNs. Returns false if `rm` isn't a
+// valid rounding mode.
+bool fpu_round_to_int(struct fpu_state *fpu, u32 rm, double value,
+                      bool is_signed, u32 *result);
+
+// Returns whether `csr` is one of fflags, frm and fcsr, and if so stores its
+// value in `*value`.
+bool fpu_csr_read(struct fpu_state const *fpu, u32 csr, u32 *value);
+
+// Writes `value` to `csr`, which fpu_csr_read() knows about.
+void fpu_csr_write(struct fpu_state *fpu, u32 csr, u32 value);
+
+static inline float fpu_f32(u32 bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+static inline double fpu_f64(u64 bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// The bits of `value`, or of the canonical NaN if it's a NaN.
+static inline u32 fpu_canonical_s(float value) {
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return value == value ? bits : FPU_NAN_S;
+}
+static inline u64 fpu_canonical_d(double value) {
+    u64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return value == value ? bits : FPU_NAN_D;
+}
+
+static inline u64 fpu_box(u32 bits) { return (u64)UINT32_MAX << 32 | bits; }
+
+// The single-precision value of a register, which is the canonical NaN if it
+// isn't NaN-boxed.
+static inline u32 fpu_unbox(u64 reg) {
+    return reg >> 32 == UINT32_MAX ? (u32)reg : FPU_NAN_S;
+}
+
+// The rest works on the bits of either format, the single-precision ones
+// unboxed into the low bits.
+
+static inline u64 fpu_sign(bool dbl) { return dbl ? 1ull << 63 : 1u << 31; }
+
+static inline bool fpu_is_nan(u64 bits, bool dbl) {
+    u64 const inf = dbl ? 0x7ff0000000000000ull : 0x7f800000u;
+    return (bits & ~fpu_sign(dbl)) > inf;
+}
+
+static inline bool fpu_is_snan(u64 bits, bool dbl) {
+    u64 const quiet = dbl ? 1ull << 51 : 1u << 22;
+    return fpu_is_nan(bits, dbl) && !(bits & quiet);
+}
+
+static inline bool fpu_is_zero(u64 bits, bool dbl) {
+    return (bits & ~fpu_sign(dbl)) == 0;
+}
+
+// Maps the bits of non-NaN values to integers in the same order as the
+// values, -0 coming right before +0.
+static inline u64 fpu_order(u64 bits, bool dbl) {
+    u64 const sign = fpu_sign(dbl);
+    return bits & sign ? ~bits & (sign | (sign - 1)) : bits | sign;
+}
+
+// fsgnj, fsgnjn and fsgnjx: `a` with a sign made from the one of `b`.
+static inline u64 fpu_sign_inject(u64 a, u64 b, bool dbl, u32 funct3) {
+    u64 const sign = fpu_sign(dbl);
+    switch (funct3) {
+    case 0b000:
+        return (a & ~sign) | (b & sign);
+    case 0b001:
+        return (a & ~sign) | (~b & sign);
+    default:
+        return a ^ (b & sign);
+    }
+}
+
+// fmin and fmax. A NaN operand is ignored, unless both are.
+static inline u64 fpu_min_max(struct fpu_state *fpu, u64 a, u64 b, bool dbl,
+                              bool max) {
+    bool const nan_a = fpu_is_nan(a, dbl), nan_b = fpu_is_nan(b, dbl);
+    if (fpu_is_snan(a, dbl) || fpu_is_snan(b, dbl))
+        fpu->flags |= fpu_nv;
+    if (nan_a || nan_b) {
+        return nan_a && nan_b ? (dbl ? FPU_NAN_D : FPU_NAN_S)
+               : nan_a        ? b
+                              : a;
+    }
+    bool const a_first = fpu_order(a, dbl) < fpu_order(b, dbl);
+    return a_first != max ? a : b;
+}
+
+// feq, flt and fle, with funct3 0b010, 0b001 and 0b000. feq only signals
+// NaNs that are signaling, the others any NaN.
+static inline u32 fpu_compare(struct fpu_state *fpu, u64 a, u64 b, bool dbl,
+                              u32 funct3) {
+    if (fpu_is_nan(a, dbl) || fpu_is_nan(b, dbl)) {
+        if (funct3 != 0b010 || fpu_is_snan(a, dbl) || fpu_is_snan(b, dbl))
+            fpu->flags |= fpu_nv;
+        return 0;
+    }
+    // +0 and -0 are equal.
+    bool const equal = a == b || (fpu_is_zero(a, dbl) && fpu_is_zero(b, dbl));
+    switch (funct3) {
+    case 0b010:
+        return equal;
+    case 0b001:
+        return !equal && fpu_order(a, dbl) < fpu_order(b, dbl);
+    default:
+        return equal || fpu_order(a, dbl) < fpu_order(b, dbl);
+    }
+}
+
+// fclass: a single bit set, for (in order) -inf, negative normal, negative
+// subnormal, -0, +0, positive subnormal, positive normal, +inf, signaling NaN
+// and quiet NaN.
+static inline u32 fpu_classify(u64 bits, bool dbl) {
+    u32 const mantissa_bits = dbl ? 52 : 23;
+    u64 const exponent_max = dbl ? 0x7ff : 0xff;
+    u64 const exponent = bits >> mantissa_bits & exponent_max;
+    u64 const mantissa = bits & ((1ull << mantissa_bits) - 1);
+    bool const negative = bits & fpu_sign(dbl);
+    if (exponent == exponent_max) {
+        if (mantissa == 0)
+            return negative ? 1 << 0 : 1 << 7;
+        return fpu_is_snan(bits, dbl) ? 1 << 8 : 1 << 9;
+    }
+    u32 const positive_class = exponent != 0 ? 6 : mantissa != 0 ? 5 : 4;
+    return negative ? 1u << (7 - positive_class) : 1u << positive_class;
+}
+
+// fcvt.w and fcvt.wu. Truncation, which is what C casts do, runs on the host
+// as long as the result fits.
+static inline bool fpu_to_int(struct fpu_state *fpu, u32 rm, double value,
+                              bool is_signed, u32 *result) {
+    if (rm == fp_rm_rtz) {
+        if (is_signed && value > -2147483649.0 && value < 2147483648.0) {
+            *result = (u32)(i32)value;
+            return true;
+        }
+        if (!is_signed && value > -1.0 && value < 4294967296.0) {
+            *result = (u32)(i64)value;
+            return true;
+        }
+    }
+    return fpu_round_to_int(fpu, rm, value, is_signed, result);
+}
+
+// vim:ft=c
@@ -0,0 +1,138 @@
+#include "fuse.h"
+#include "block.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "rv/decode.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static bool is_li(struct decoded_insn const *insn) {
+    return insn->op == dop_addi && insn->rs1 == 0;
+}
+
+// Returns the superinstruction starting at `insns[0]`, or dop_undecoded if
+// there's none. `left` is how many instructions there are from `insns[0]`
+// onwards.
+static enum decoded_op match(struct decoded_insn const *insns, u32 left) {
+    struct decoded_insn const *a = &insns[0];
+    struct decoded_insn const *b = &insns[1];
+    struct decoded_insn const *c = &insns[2];
+
+    if (left >= 2 && a->op == dop_lui && b->op == dop_addi &&
+        b->rd == a->rd && b->rs1 == a->rd) {
+        return dop_fused_li;
+    }
+    if (left >= 2 && a->op == dop_auipc && b->op == dop_jalr &&
+        b->rs1 == a->rd) {
+        return dop_fused_far_call;
+    }
+    if (left >= 3 && a->op == dop_lbu && b->op == dop_addi &&
+        b->rd == a->rd && b->rs1 == a->rd && c->op == dop_sb &&
+        c->rs2 == a->rd && c->rs1 == a->rs1 && c->imm == a->imm &&
+        a->rs1 != a->rd) {
+        return dop_fused_byte_update;
+    }
+    if (left >= 4 && is_li(a) && is_li(b) && c->op == dop_or && c->rs1 == 0 &&
+        is_li(&insns[3])) {
+        return dop_fused_ecall_args;
+    }
+    return dop_undecoded;
+}
+
+u32 fuse_text(struct decoded_text *text, u32 fused[dop_count]) {
+    u32 total = 0;
+    for (u32 i = 0; i < text->count; ++i) {
+        struct decoded_insn *insn = &text->insns[i];
+        enum decoded_op op = match(insn, text->count - i);
+        if (op == dop_undecoded)
+            continue;
+
+        // Only the op changes: handlers read the rest from the instructions
+        // they cover, which may start superinstructions of their own.
+        insn->op = op;
+        ++total;
+        if (fused != NULL)
+            ++fused[op];
+    }
+    return total;
+}
+
+struct ngram {
+    // Operations packed one per byte, first one lowest.
+    u32 key;
+    u32 count;
+};
+
+static int compare_keys(void const *a, void const *b) {
+    u32 ka = *(u32 const *)a, kb = *(u32 const *)b;
+    return (ka > kb) - (ka < kb);
+}
+
+static int compare_counts(void const *a, void const *b) {
+    u32 ca = ((struct ngram const *)a)->count;
+    u32 cb = ((struct ngram const *)b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+static void report_ngrams(struct decoded_text const *text, u32 n, u32 top,
+                          FILE *out) {
+    if (text->count < n)
+        return;
+
+    u32 *keys = malloc(text->count * sizeof(*keys));
+    struct ngram *ngrams = malloc(text->count * sizeof(*ngrams));
+    if (keys == NULL || ngrams == NULL) {
+        error("Could not allocate fusion report\n");
+        goto clean;
+    }
+
+    // Only sequences that run straight through are candidates, so nothing
+    // but the last instruction may leave the block.
+    u32 key_count = 0;
+    for (u32 i = 0; i + n <= text->count; ++i) {
+        u32 key = 0;
+        bool straight = true;
+        for (u32 j = 0; j < n; ++j) {
+            enum decoded_op op = text->insns[i + j].op;
+            if (j + 1 < n && decoded_op_ends_block(op))
+                straight = false;
+            key |= (u32)op << (8 * j);
+        }
+        if (straight)
+            keys[key_count++] = key;
+    }
+
+    qsort(keys, key_count, sizeof(*keys), compare_keys);
+    u32 ngram_count = 0;
+    for (u32 i = 0; i < key_count; ++i) {
+        if (ngram_count != 0 && ngrams[ngram_count - 1].key == keys[i])
+            ++ngrams[ngram_count - 1].count;
+        else
+            ngrams[ngram_count++] = (struct ngram){.key = keys[i], .count = 1};
+    }
+    qsort(ngrams, ngram_count, sizeof(*ngrams), compare_counts);
+
+    fprintf(out, "most frequent %s (of %u):\n", n == 2 ? "pairs" : "triples",
+            key_count);
+    for (u32 i = 0; i < ngram_count && i < top; ++i) {
+        fprintf(out, "%8u  %5.1f%% ", ngrams[i].count,
+                100.0 * ngrams[i].count / key_count);
+        for (u32 j = 0; j < n; ++j) {
+            u8 op = ngrams[i].key >> 8 * j;
+            fprintf(out, " %s", decoded_op_names[op]);
+        }
+        fputc('\n', out);
+    }
+
+clean:
+    free(ngrams);
+    free(keys);
+}
+
+void fusion_report(struct decoded_text const *text, u32 top, FILE *out) {
+    report_ngrams(text, 2, top, out);
+    report_ngrams(text, 3, top, out);
+}
+
+// vim:sw=4
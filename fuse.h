@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common/types.h"
+#include "rv/decode.h"
+#include <stdio.h>
+
+// Superinstruction fusion for pre-decoded text.
+// Common instruction sequences get their first slot rewritten to a single
+// `FUSED_OPS` handler that runs the whole sequence, saving a dispatch per
+// instruction covered. The covered slots are left as they were, so jumping
+// into the middle of a fused sequence still works.
+
+// Fuses every recognized sequence in `text`. Returns how many were fused, and
+// adds the count for each superinstruction to `fused` when it's not NULL.
+u32 fuse_text(struct decoded_text *text, u32 fused[dop_count]);
+
+// Prints the `top` most frequent pairs and triples of operations found in
+// straight-line code in `text`, as candidates for new superinstructions. Must
+// run before fuse_text().
+void fusion_report(struct decoded_text const *text, u32 top, FILE *out);
+
+// vim:ft=c
@@ -0,0 +1,74 @@
+#define _GNU_SOURCE
+#include "guard.h"
+#include "common/types.h"
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <ucontext.h>
+
+static struct guard *installed;
+
+// Returns whether the faulting access was a write, as far as the host can tell.
+static bool fault_was_write(void *context) {
+#if defined(__x86_64__)
+    // Bit 1 of the page fault error code is set for writes.
+    ucontext_t const *uc = context;
+    return (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+#else
+    (void)context;
+    return false;
+#endif
+}
+
+static void on_fault(int sig, siginfo_t *info, void *context) {
+    struct guard *guard = installed;
+    u8 *addr = info->si_addr;
+    if (guard == NULL || addr < guard->base ||
+        addr >= guard->base + guard->size) {
+        // Not the guest's fault: let it crash once we return.
+        signal(sig, SIG_DFL);
+        return;
+    }
+    u32 guest_addr = (u32)(addr - guard->base);
+    if (guard->retry != NULL && guard->retry(guard->retry_arg, guest_addr))
+        return;
+    if (!guard->catch_faults) {
+        signal(sig, SIG_DFL);
+        return;
+    }
+    guard->fault_addr = guest_addr;
+    guard->fault_write = fault_was_write(context);
+    siglongjmp(guard->fault, 1);
+}
+
+int guard_install(struct guard *guard, void *base, size_t size) {
+    guard->base = base;
+    guard->size = size;
+    guard->retry = NULL;
+    guard->retry_arg = NULL;
+    guard->catch_faults = false;
+    guard->fault_addr = 0;
+    guard->fault_write = false;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, NULL) != 0 ||
+        sigaction(SIGBUS, &action, NULL) != 0)
+        return errno;
+    installed = guard;
+    return 0;
+}
+
+void guard_remove(struct guard *guard) {
+    if (installed != guard)
+        return;
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGBUS, SIG_DFL);
+    installed = NULL;
+}
+
+// vim:sw=4
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common/types.h"
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Guest faults through host page faults.
+// When the guest lives in a reserved address space (see
+// loader_reserve_address_space()), engines access its memory without any
+// checks. Accesses outside of its segments, or that its permissions don't
+// allow, make the host raise SIGSEGV. The handler installed here turns those
+// into a jump back to where the guest was started from, with the guest
+// address that faulted.
+// Engines that write-protect guest memory for their own purposes get to look
+// at faults first, and have the access retried.
+
+struct guard {
+    // Host region holding the guest address space.
+    u8 *base;
+    size_t size;
+    // When not NULL, called first with the guest address of every fault in the
+    // region. Returning true means it dealt with it, and the access is retried.
+    bool (*retry)(void *arg, u32 addr);
+    void *retry_arg;
+    // Whether the other faults in the region jump to `fault`. When not, they
+    // crash the host like any other.
+    bool catch_faults;
+    // Where the handler jumps to on a guest fault.
+    sigjmp_buf fault;
+    // Guest address of the access that faulted, and whether it was a write.
+    u32 fault_addr;
+    bool fault_write;
+};
+
+// Handles host faults in `[base, base + size)`, with no `retry` hook and not
+// catching faults yet. When setting `catch_faults`, the caller must also set
+// `guard->fault` with sigsetjmp() before running the guest. Faults anywhere
+// else still crash the host. Only one guard can be installed at a time.
+// Returns 0 on success or an errno value.
+int guard_install(struct guard *guard, void *base, size_t size);
+
+// Restores the default handlers.
+void guard_remove(struct guard *guard);
+
+// vim:ft=c
@@ -0,0 +1,120 @@
+#include "hart.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "interpret.h"
+#include "rv/decode.h"
+#include "rv/insn.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What every hart shares.
+struct hart_group {
+    void *memory;
+    struct cost_model const *costs;
+    bool threaded;
+    u32 entrypoint;
+    // Held while the threads are being started, so that no hart runs before
+    // all of them can. `abort` is set under it if one couldn't be.
+    pthread_mutex_t start;
+    bool abort;
+    // Set once the guest is done with, to stop every hart still running: by a
+    // hart exiting the whole group, or faulting.
+    atomic_bool stop;
+};
+
+struct hart {
+    // First, so that it starts on a cache line of its own.
+    struct rv32i cpu;
+    struct decoded_text const *text;
+    // The copy of the text the hart runs off, for all but hart 0.
+    struct decoded_text copy;
+    struct hart_group *group;
+    pthread_t thread;
+    enum run_exit exit;
+} __attribute__((aligned(HART_CACHE_LINE)));
+
+static enum run_exit run_hart(struct hart_group *group, struct hart *hart) {
+    enum run_exit const exit =
+        group->threaded
+            ? interpret_threaded(group->memory, hart->text, group->costs,
+                                 &hart->cpu, group->entrypoint, &group->stop)
+            : interpret_decoded(group->memory, hart->text, group->costs,
+                                &hart->cpu, group->entrypoint, &group->stop);
+    // A fault takes every hart down, like exit_group does: the others could
+    // be waiting for this one forever.
+    if (exit == run_fault)
+        atomic_store_explicit(&group->stop, true, memory_order_relaxed);
+    return exit;
+}
+
+static void *hart_thread(void *arg) {
+    struct hart *hart = arg;
+    struct hart_group *group = hart->group;
+    pthread_mutex_lock(&group->start);
+    bool const abort = group->abort;
+    pthread_mutex_unlock(&group->start);
+    hart->exit = abort ? run_fault : run_hart(group, hart);
+    return NULL;
+}
+
+enum run_exit harts_run(void *memory, struct decoded_text const *text,
+                        struct cost_model const *costs, u32 count,
+                        bool threaded, u32 entrypoint) {
+    struct hart *harts = aligned_alloc(HART_CACHE_LINE, count * sizeof(*harts));
+    if (harts == NULL) {
+        error("Could not allocate %u harts\n", count);
+        return run_fault;
+    }
+    memset(harts, 0, count * sizeof(*harts));
+    for (u32 i = 0; i < count; ++i) {
+        harts[i].cpu.registers[rv_a0] = i;
+        harts[i].cpu.registers[rv_a1] = count;
+    }
+
+    struct hart_group group = {.memory = memory,
+                               .costs = costs,
+                               .threaded = threaded,
+                               .entrypoint = entrypoint};
+    atomic_init(&group.stop, false);
+    pthread_mutex_init(&group.start, NULL);
+    pthread_mutex_lock(&group.start);
+    u32 started = 1;
+    for (; started < count; ++started) {
+        struct hart *hart = &harts[started];
+        hart->text = &hart->copy;
+        hart->group = &group;
+        int code = decoded_text_copy(&hart->copy, text);
+        if (code == 0) {
+            code = pthread_create(&hart->thread, NULL, hart_thread, hart);
+            if (code != 0)
+                decoded_text_destroy(&hart->copy);
+        }
+        if (code != 0) {
+            error("Could not start hart %u: %s\n", started, strerror(code));
+            group.abort = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&group.start);
+
+    harts[0].text = text;
+    harts[0].exit = group.abort ? run_fault : run_hart(&group, &harts[0]);
+    for (u32 i = 1; i < started; ++i) {
+        pthread_join(harts[i].thread, NULL);
+        decoded_text_destroy(&harts[i].copy);
+    }
+    pthread_mutex_destroy(&group.start);
+
+    enum run_exit exit = harts[0].exit;
+    for (u32 i = 0; i < started && exit != run_fault; ++i) {
+        if (harts[i].exit == run_fault || harts[i].exit == run_exited)
+            exit = harts[i].exit;
+    }
+    free(harts);
+    return exit;
+}
+
+// vim:sw=4
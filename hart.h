@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common/types.h"
+#include "interpret.h"
+#include "rv/decode.h"
+#include <stdbool.h>
+
+// Multi-hart execution.
+// Runs several harts of the same guest at once, each on a host thread of its
+// own, all of them sharing guest memory: the A extension's atomics and fences
+// are host atomics and fences (see interpret_ops.h), so that harts can work
+// together through memory like they would on hardware. Each hart has its own
+// copy of the decoded text, since fence.i only makes a hart's writes to code
+// visible to itself.
+// Hart `i` starts with a0 = i and a1 = the number of harts, which it can use
+// to pick its share of the work.
+// A hart calling exit stops on its own, like a Linux thread would. exit_group,
+// or a fault in any hart, stops all of them, the others at their next jump.
+
+// Upper bound on the number of harts.
+#define HART_MAX 256
+
+// Harts are kept this far apart, so that one writing its registers doesn't
+// take the cache line away from another.
+#define HART_CACHE_LINE 64
+
+// Runs `count` harts (1 to HART_MAX) from `entrypoint` off `text`, with the
+// 'threaded' engine if `threaded`, or the 'decoded' one otherwise, counting
+// cycles as `costs` says, until every one of them has stopped. Hart 0 runs on
+// the calling thread, so that a single hart is just a call to the engine.
+// Returns run_fault if any hart faulted or the harts couldn't be started,
+// run_exited if any exited, and how hart 0 stopped otherwise.
+enum run_exit harts_run(void *memory, struct decoded_text const *text,
+                        struct cost_model const *costs, u32 count,
+                        bool threaded, u32 entrypoint);
+
+// vim:ft=c
@@ -0,0 +1,182 @@
+#include "idiom.h"
+#include "common/types.h"
+#include "rv/decode.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Returns whether `insn` is `addi reg, reg, imm`.
+static bool is_increment(struct decoded_insn const *insn, u8 reg, i32 imm) {
+    return insn->op == dop_addi && insn->rd == reg && insn->rs1 == reg &&
+           (i32)insn->imm == imm;
+}
+
+// Returns whether `insn` is `bne` comparing `a` and `b`, in either order.
+static bool is_bne(struct decoded_insn const *insn, u8 a, u8 b) {
+    return insn->op == dop_bne && ((insn->rs1 == a && insn->rs2 == b) ||
+                                   (insn->rs1 == b && insn->rs2 == a));
+}
+
+// Returns whether `insns[0..1]` are the header of a bfc loop on the byte at
+// `off(p)`, loaded into `t`: `lbu t, off(p); beq t, x0, end`.
+static bool is_bfc_header(struct decoded_insn const *insns) {
+    struct decoded_insn const *load = &insns[0], *exit = &insns[1];
+    return load->op == dop_lbu && load->rd != load->rs1 &&
+           exit->op == dop_beq && exit->rs1 == load->rd && exit->rs2 == 0;
+}
+
+// Returns the idiom at the start of `insns`, setting `*covered` to its length,
+// or dop_undecoded if there's none.
+static enum decoded_op match(struct decoded_insn const *insns, u32 count,
+                             u32 pc, u32 *covered) {
+    struct decoded_insn const *a = &insns[0];
+    u8 const t = a->rd, p = a->rs1;
+
+    // lbu t, off(p); beq t, x0, end; addi p, p, ±1; jal x0, <start>
+    if (count >= 4 && is_bfc_header(insns) && p != 0 &&
+        (is_increment(&insns[2], p, 1) || is_increment(&insns[2], p, -1)) &&
+        insns[3].op == dop_jal && insns[3].rd == DECODED_SINK_REG &&
+        insns[3].imm == pc) {
+        *covered = 4;
+        return dop_idiom_scan;
+    }
+
+    // lbu t, off(p); beq t, x0, end; lbu t, off(p); addi t, t, <odd>;
+    // sb t, off(p); jal x0, <start>
+    // Adding an odd number always gets a byte to zero, so the loop always ends.
+    if (count >= 6 && is_bfc_header(insns) && insns[2].op == dop_lbu &&
+        insns[2].rd == t && insns[2].rs1 == p && insns[2].imm == a->imm &&
+        insns[3].op == dop_addi && insns[3].rd == t && insns[3].rs1 == t &&
+        (insns[3].imm & 1) && insns[4].op == dop_sb && insns[4].rs2 == t &&
+        insns[4].rs1 == p && insns[4].imm == a->imm && insns[5].op == dop_jal &&
+        insns[5].rd == DECODED_SINK_REG && insns[5].imm == pc) {
+        *covered = 6;
+        return dop_idiom_clear;
+    }
+
+    // lbu t, off(p); addi p, p, ±1; bne t, x0, <start>
+    if (count >= 3 && a->op == dop_lbu && t != p && p != 0 &&
+        (is_increment(&insns[1], p, 1) || is_increment(&insns[1], p, -1)) &&
+        insns[2].op == dop_bne && insns[2].rs1 == t && insns[2].rs2 == 0 &&
+        insns[2].imm == pc) {
+        *covered = 3;
+        return dop_idiom_strlen;
+    }
+
+    // sb v, off(p); addi p, p, 1; bne p, e, <start>
+    if (count >= 3 && a->op == dop_sb && p != 0 && a->rs2 != p &&
+        is_increment(&insns[1], p, 1) && insns[2].op == dop_bne &&
+        insns[2].imm == pc &&
+        (insns[2].rs1 == p) != (insns[2].rs2 == p)) {
+        *covered = 3;
+        return dop_idiom_memset;
+    }
+
+    // lbu t, so(s); sb t, do(d); addi s, s, 1; addi d, d, 1; bne s, e, <start>
+    if (count >= 5 && a->op == dop_lbu && insns[1].op == dop_sb) {
+        u8 const s = p, d = insns[1].rs1;
+        u8 const e = insns[4].rs1 == s ? insns[4].rs2 : insns[4].rs1;
+        if (insns[1].rs2 == t && s != 0 && d != 0 && s != d && t != s &&
+            t != d && is_increment(&insns[2], s, 1) &&
+            is_increment(&insns[3], d, 1) && is_bne(&insns[4], s, e) &&
+            e != s && e != d && e != t && insns[4].imm == pc) {
+            *covered = 5;
+            return dop_idiom_memcpy;
+        }
+    }
+
+    return dop_undecoded;
+}
+
+u32 idiom_match(struct decoded_insn *insns, u32 count, u32 pc) {
+    u32 covered = 0;
+    enum decoded_op op = match(insns, count, pc, &covered);
+    if (op == dop_undecoded)
+        return 0;
+    insns[0].op = op;
+    return covered;
+}
+
+#if defined(__x86_64__)
+
+// The vector versions only ever load aligned chunks, so they never cross into
+// a page the scalar loop wouldn't have touched.
+
+static u8 *find_zero_sse2(u8 *at, i32 step) {
+    __m128i const zero = _mm_setzero_si128();
+    u32 const skew = (uintptr_t)at & 15;
+    u8 *chunk = at - skew;
+#define ZEROS(chunk)                                                           \
+    (u32) _mm_movemask_epi8(                                                   \
+        _mm_cmpeq_epi8(_mm_load_si128((__m128i const *)(chunk)), zero))
+
+    if (step > 0) {
+        // Ignore the bytes before `at`.
+        u32 mask = ZEROS(chunk) >> skew << skew;
+        while (mask == 0) {
+            chunk += 16;
+            mask = ZEROS(chunk);
+        }
+        return chunk + __builtin_ctz(mask);
+    }
+
+    // Ignore the bytes after `at`.
+    u32 mask = ZEROS(chunk) & ((2u << skew) - 1);
+    while (mask == 0) {
+        chunk -= 16;
+        mask = ZEROS(chunk);
+    }
+    return chunk + 31 - __builtin_clz(mask);
+#undef ZEROS
+}
+
+__attribute__((target("avx2"))) static u8 *find_zero_avx2(u8 *at, i32 step) {
+    __m256i const zero = _mm256_setzero_si256();
+    u32 const skew = (uintptr_t)at & 31;
+    u8 *chunk = at - skew;
+#define ZEROS(chunk)                                                           \
+    (u32) _mm256_movemask_epi8(                                                \
+        _mm256_cmpeq_epi8(_mm256_load_si256((__m256i const *)(chunk)), zero))
+
+    if (step > 0) {
+        u32 mask = ZEROS(chunk) >> skew << skew;
+        while (mask == 0) {
+            chunk += 32;
+            mask = ZEROS(chunk);
+        }
+        return chunk + __builtin_ctz(mask);
+    }
+
+    u32 mask = ZEROS(chunk) & (u32)(((u64)2 << skew) - 1);
+    while (mask == 0) {
+        chunk -= 32;
+        mask = ZEROS(chunk);
+    }
+    return chunk + 31 - __builtin_clz(mask);
+#undef ZEROS
+}
+
+u8 *idiom_find_zero(u8 *at, i32 step) {
+    static u8 *(*kernel)(u8 *, i32);
+    if (__builtin_expect(kernel == NULL, 0)) {
+        __builtin_cpu_init();
+        kernel = __builtin_cpu_supports("avx2") ? find_zero_avx2
+                                                : find_zero_sse2;
+    }
+    return kernel(at, step);
+}
+
+#else
+
+u8 *idiom_find_zero(u8 *at, i32 step) {
+    while (*at != 0)
+        at += step;
+    return at;
+}
+
+#endif
+
+// vim:sw=4
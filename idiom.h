@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common/types.h"
+#include "rv/decode.h"
+
+// Loop idiom recognition.
+// Some byte-at-a-time guest loops are common enough to be worth recognizing
+// as a whole: bfc's `[>]`/`[<]` (scan for a zero cell) and `[-]`/`[+]` (clear
+// a cell), and the loops C compilers emit for strlen, memset and memcpy. The
+// first instruction of a recognized loop gets rewritten to an `IDIOM_OPS`
+// handler, which runs the whole loop at once with a host kernel and leaves
+// registers and memory just like the loop would have. Like superinstructions,
+// idiom handlers read their operands from the instructions they cover.
+//
+// Kernels work on host memory directly, so idioms are only ever produced by
+// the block translator, whose guest memory is flat.
+
+// Upper bound on the number of instructions an idiom covers.
+#define IDIOM_MAX_INSNS 6
+
+// Looks for a loop idiom at the start of the `count` instructions in `insns`,
+// decoded from guest address `pc` onwards. If there's one, rewrites the op of
+// `insns[0]` to it and returns how many instructions it covers. Returns 0
+// otherwise.
+u32 idiom_match(struct decoded_insn *insns, u32 count, u32 pc);
+
+// Returns the first zero byte found going from `at` in steps of `step`, which
+// is 1 or -1.
+u8 *idiom_find_zero(u8 *at, i32 step);
+
+// vim:ft=c
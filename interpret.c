@@ -6,285 +6,285 @@
 // https://riscv.org/wp-content/uploads/2017/05/riscv-spec-v2.2.pdf
 
 #include "interpret.h"
+#include "mmu.h"
 #include "common/log.h"
 #include "common/types.h"
 #include "rv/bits.h"
 #include "rv/dasm.h"
 #include "rv/insn.h"
+#include "rv/rvc.h"
 #include <assert.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-struct rv32i {
-    uint32_t registers[32];
-};
-
+#if RV_XLEN == 32
 static void write_register(struct rv32i *cpu, u8 reg_index, u32 value);
 static u32 read_register(struct rv32i const *cpu, u8 reg_index);
 
-void interpret(void *memory, u32 entrypoint) {
-    struct rv32i cpu = {0};
-
-    log("Begin execution. Memory @ %p, Entrypoint @ 0x%x\n", memory,
-        entrypoint);
-
-    u32 pc = entrypoint;
-    for (;; pc += 4) {
-        union insn as;
-        u32 const *insn_ptr = memory + pc;
-        if (__builtin_expect((uintptr_t)insn_ptr & 0b11, 0)) {
-            fputs("fatal: instructions MUST be aligned to 4 bytes\n", stderr);
-            abort();
-        }
-        as.raw = *(u32 *)(__builtin_assume_aligned(insn_ptr, 4));
-        log("insn @ 0x%08x: (0x%08x) ", pc, as.raw);
-        dasm(stderr, as.raw, pc);
-        fputc('\n', stderr);
-        if (as.raw == 0) {
-            error("Refusing to execute: illegal all 0s instruction\n");
-            __builtin_trap();
-            return;
-        }
-        switch (as.unknown.opcode) {
-        case op_jalr: {
-            // Quoting Spec:
-            // > The target address is obtained by adding the 12-bit signed
-            // I-immediate to the register rs1, then setting the
-            // least-significant bit of the result to zero.
-            u32 jump_pc =
-                (read_i_immediate(as.raw) + read_register(&cpu, as.i.rs1)) &
-                ~0b1;
-
-            write_register(&cpu, as.i.rd, pc + 4);
-            // ensure we don't mess the address by adding 4 in the loop footer.
-            pc = jump_pc - 4;
+// The tracing variant logs every instruction it runs, and checks what the
+// fast one assumes.
+#define INTERPRET_NAME interpret_traced
+#define INTERPRET_TRACED 1
+#define INTERPRET_CHECKED 1
+#include "interpret_switch.h"
+#undef INTERPRET_CHECKED
+#undef INTERPRET_TRACED
+#undef INTERPRET_NAME
 
-        } break;
-        case op_jal: {
-            u32 offt = read_j_immediate(as.raw);
-            u32 jump_pc = pc + offt;
+#define INTERPRET_NAME interpret_fast
+#define INTERPRET_TRACED 0
+#define INTERPRET_CHECKED 0
+#include "interpret_switch.h"
+#undef INTERPRET_CHECKED
+#undef INTERPRET_TRACED
+#undef INTERPRET_NAME
 
-            write_register(&cpu, as.j.rd, pc + 4);
+enum run_exit interpret(void *memory, u32 entrypoint, bool compressed,
+                        bool traced) {
+    if (traced)
+        return interpret_traced(memory, entrypoint, compressed);
+    return interpret_fast(memory, entrypoint, compressed);
+}
+#endif
 
-            // ensure we don't mess the address by adding 4 in the loop footer.
-            pc = jump_pc - 4;
+void run_state_init(struct run_state *state, u32 entrypoint) {
+    memset(&state->cpu, 0, sizeof(state->cpu));
+    state->pc = entrypoint;
+    state->fuel = UINT64_MAX;
+    atomic_init(&state->stop, false);
+}
 
-        } break;
-        case op_lui:
-            // x[rd] = sext(immediate[31:12] << 12)
-            // sext will be identity; since we're 32-bit.
-            write_register(&cpu, as.u.rd, read_upper_immediate(as.raw));
-            break;
-        case op_auipc:
-            // x[rd] = pc + sext(immediate[31:12] << 12)
-            write_register(&cpu, as.u.rd, pc + read_upper_immediate(as.raw));
-            break;
-        case op_imm:
-            switch ((enum insn_imm_func)as.i.funct3) {
-            case imm_func_addi:
-                // x[rd] = x[rs1] + sext(immediate)
-                write_register(&cpu, as.i.rd,
-                               bit_cast_i32(read_register(&cpu, as.i.rs1)) +
-                                   bit_cast_i32(read_i_immediate(as.raw)));
-                break;
-            case imm_func_slti:
-                // x[rd] = x[rs1] <s sext(immediate)
-                {
-                    int32_t signed_xrs1 =
-                        bit_cast_i32(read_register(&cpu, as.i.rs1));
-                    int32_t signed_imm = bit_cast_i32(read_i_immediate(as.raw));
-                    // "cheat" by using an already implemented signed comparison
-                    write_register(&cpu, as.i.rd, signed_xrs1 < signed_imm);
-                }
-                break;
-            case imm_func_sltiu:
-                // x[rd] = x[rs1] <u sext(immediate)
-                // "cheat" by using an already implemented unsigned comparison
-                write_register(&cpu, as.i.rd,
-                               read_register(&cpu, as.i.rs1) <
-                                   read_i_immediate(as.raw));
-                break;
-            case imm_func_xori: // sorry :(
-                // x[rd] = x[rs1] ^ sext(immediate)
-                write_register(&cpu, as.i.rd,
-                               read_register(&cpu, as.i.rs1) ^
-                                   read_i_immediate(as.raw));
-                break;
-            case imm_func_ori:
-                // x[rd] = x[rs1] | sext(immediate)
-                write_register(&cpu, as.i.rd,
-                               read_register(&cpu, as.i.rs1) |
-                                   read_i_immediate(as.raw));
-                break;
-            case imm_func_andi:
-                // x[rd] = x[rs1] & sext(immediate)
-                write_register(&cpu, as.i.rd,
-                               read_register(&cpu, as.i.rs1) &
-                                   read_i_immediate(as.raw));
-                break;
-            case imm_func_slli:
-                // x[rd] = x[rs1] << shamt
-                // shamt is lower five bits, since anything else would wrap
-                // around.
-                write_register(&cpu, as.i.rd,
-                               read_register(&cpu, as.i.rs1)
-                                   << read_shift_immediate(as.raw));
-                break;
-            case imm_func_srli: {
+enum run_exit interpret_decoded(void *memory, struct decoded_text const *text,
+                                struct cost_model const *costs,
+                                struct rv32i *cpu, u32 entrypoint,
+                                atomic_bool *stop) {
+    // sums[i] is what the instructions before text->insns[i] cost, see
+    // cost_model_sum().
+    u32 *sums = malloc((text->count + 1) * sizeof(*sums));
+    if (sums == NULL) {
+        error("Could not allocate cycle counts\n");
+        return run_fault;
+    }
+    cost_model_sum(costs, text, sums);
 
-                u32 imm = read_i_immediate(as.raw);
-                u8 shift_count = read_shift_immediate(as.raw);
+    uxlen *const x = cpu->registers;
+    struct rvv_state *const vector = &cpu->vector;
+    struct fpu_state *const fpu = &cpu->fpu;
+    struct amo_reservation *const reservation = &cpu->reservation;
+    fpu_attach(fpu);
 
-                bool is_SRAI = (imm >> 12) & 1;
-                u32 src = read_register(&cpu, as.i.rs1);
-                // if it's SRAI, then we want to put the top bit in, in the
-                // shifted bits.
-                // otherwise, we "extend" with zero.
-                bool top_bit = (src >> 31) & is_SRAI;
-                // we shift left whatever it's left so that we end up
-                // with `shift_count` zeroes at the top.
-                u32 bit_addend = (~(u32)top_bit + 1) << (31 - shift_count);
+    log("Begin decoded execution. Memory @ %p, Entrypoint @ 0x%x\n", memory,
+        entrypoint);
 
-                u32 result = (src >> shift_count) | bit_addend;
-                write_register(&cpu, as.i.rd, result);
-            }
-            }
-            break;
-        case op_load: {
-            i32 offset = bit_cast_i32(read_register(&cpu, as.i.rs1));
-            void const *mem_loc = memory + offset;
-            mem_loc += sext32_imm12(as.i.imm_11_0);
-            switch ((enum insn_load_func)as.i.funct3) {
-            case load_func_lbu: {
-                write_register(&cpu, as.i.rd, *(uint8_t *)mem_loc);
-                break;
-            }
-            case load_func_lb:
-            case load_func_lh:
-            case load_func_lw:
-            case load_func_lhu:
-                assert(!"not implemented load");
-            }
-        } break;
+    struct decoded_insn const *insn =
+        decoded_jump_target(text, entrypoint, entrypoint);
+    // First instruction of the straight-line run being executed, which the
+    // counters get charged for when it ends.
+    struct decoded_insn const *run = insn;
+    if (insn == NULL)
+        goto fault;
 
-        case op_store: {
-            i32 offset =
-                sext32_imm12((u32)as.s.imm_4_0 | (u32)as.s.imm_11_5 << 5);
+    for (;;) {
+        switch ((enum decoded_op)insn->op) {
+#define OP(name) case dop_##name:
+#define NEXT                                                                   \
+    {                                                                          \
+        ++insn;                                                                \
+        continue;                                                              \
+    }
+#define JUMP(target)                                                           \
+    {                                                                          \
+        decoded_charge(cpu, text, sums, run, insn);                            \
+        if (atomic_load_explicit(stop, memory_order_relaxed))                  \
+            goto stopped;                                                      \
+        if ((insn = run = decoded_jump_target(text, PC, (target))) == NULL)    \
+            goto fault;                                                        \
+        continue;                                                              \
+    }
+#define PC decoded_text_pc(text, (u32)(insn - text->insns))
+#define PC_AFTER(n) decoded_text_pc(text, (u32)(insn - text->insns) + (n))
+#define LOAD(type, addr) (*(type *)(memory + (uxlen)(addr)))
+#define STORE(type, addr, value) (*(type *)(memory + (uxlen)(addr)) = (value))
+#define ATOMIC(type, addr) ((_Atomic type *)(memory + (uxlen)(addr)))
+#define FAULT() goto fault
+#define EXIT(all)                                                              \
+    {                                                                          \
+        if (all)                                                               \
+            atomic_store_explicit(stop, true, memory_order_relaxed);           \
+        goto exited;                                                           \
+    }
+// Loop idioms are only ever found in blocks.
+#define NO_IDIOM_OPS
+#define FENCE_I()                                                              \
+    {                                                                          \
+        decoded_text_refresh(text, memory);                                    \
+        cost_model_sum(costs, text, sums);                                     \
+    }
+#define INSTRET (cpu->instret + (u64)(insn - run))
+#define CYCLE                                                                  \
+    (cpu->cycle + (u32)(sums[insn - text->insns] - sums[run - text->insns]))
+#include "interpret_ops.h"
+#undef CYCLE
+#undef INSTRET
+#undef FENCE_I
+#undef NO_IDIOM_OPS
+#undef EXIT
+#undef FAULT
+#undef ATOMIC
+#undef STORE
+#undef LOAD
+#undef PC_AFTER
+#undef PC
+#undef JUMP
+#undef NEXT
+#undef OP
+        case dop_count:
+            __builtin_unreachable();
+        }
+    }
 
-            void *mem_loc =
-                memory + offset + bit_cast_i32(read_register(&cpu, as.s.rs1));
+exited:
+    fpu_detach(fpu);
+    free(sums);
+    return run_exited;
 
-            switch ((enum insn_store_func)as.s.funct3) {
-            case store_func_sb:
-                *(uint8_t *)mem_loc = read_register(&cpu, as.s.rs2);
-                break;
-            case store_func_sw:
-                if ((uintptr_t)mem_loc % 4 != 0) {
-                    error("Refusing to execute: unaligned store");
-                    __builtin_trap();
-                }
-                *(u32 *)mem_loc = read_register(&cpu, as.s.rs2);
-                break;
-            case store_func_sh:
-                assert(!"not implemented store");
-            }
+stopped:
+    fpu_detach(fpu);
+    free(sums);
+    return run_stopped;
 
-        } break;
-        case op_branch: {
+fault:
+    fpu_detach(fpu);
+    free(sums);
+    return run_fault;
+}
 
-            i32 offset = bit_cast_i32(read_b_immediate(as.raw));
+#if RV_XLEN == 32
+enum run_exit interpret_decoded_mmu(struct mmu *mmu,
+                                    struct decoded_text const *text,
+                                    struct cost_model const *costs,
+                                    u32 entrypoint) {
+    u32 *sums = malloc((text->count + 1) * sizeof(*sums));
+    if (sums == NULL) {
+        error("Could not allocate cycle counts\n");
+        return run_fault;
+    }
+    cost_model_sum(costs, text, sums);
 
-            u32 a = read_register(&cpu, as.b.rs1);
-            u32 b = read_register(&cpu, as.b.rs2);
+    struct rv32i cpu = {0};
+    u32 *const x = cpu.registers;
+    struct rvv_state *const vector = &cpu.vector;
+    struct fpu_state *const fpu = &cpu.fpu;
+    struct amo_reservation *const reservation = &cpu.reservation;
+    fpu_attach(fpu);
 
-            switch ((enum insn_branch_func)as.b.funct3) {
-            case branch_func_bne:
-                if (a != b) {
-                    pc += offset - 4;
-                }
-                break;
-            case branch_func_beq:
-                if (a == b) {
-                    pc += offset - 4;
-                }
-                break;
-            case branch_func_bgeu:
-                if (a >= b) {
-                    pc += offset - 4;
-                }
-                break;
-            case branch_func_bltu:
-                if (a < b) {
-                    pc += offset - 4;
-                }
-                break;
-            case branch_func_blt:
-            case branch_func_bge:
-                assert(!"not implemented branch");
-            }
-        } break;
+    log("Begin decoded execution through the MMU. Entrypoint @ 0x%x\n",
+        entrypoint);
 
-        case op_op: {
-            switch ((enum insn_op_funct3)as.r.funct3) {
-            case op_funct3_or:
-                write_register(&cpu, as.r.rd,
-                               read_register(&cpu, as.r.rs1) |
-                                   read_register(&cpu, as.r.rs2));
-                break;
-            case op_funct3_add: {
-                u32 s1 = read_register(&cpu, as.r.rs1);
-                u32 s2 = read_register(&cpu, as.r.rs2);
-                printf("add");
-                if (as.r.funct7 == op_funct7_sub) {
-                    s2 = -s2;
-                }
-                write_register(&cpu, as.r.rd, s1 + s2);
-                break;
-            }
-            case op_funct3_sll:
-            case op_funct3_slt:
-            case op_funct3_sltu:
-            case op_funct3_xor:
-            case op_funct3_srl:
-            case op_funct3_and:
-                assert(!"not implemented r-type op.");
-            }
-        }; break;
+    struct decoded_insn const *insn =
+        decoded_jump_target(text, entrypoint, entrypoint);
+    struct decoded_insn const *run = insn;
+    if (insn == NULL)
+        goto fault;
 
-        case op_system:
-        case op_load_fp:
-        case op_custom_0:
-        case op_misc_mem:
-        case op_imm_32:
-        case op_store_fp:
-        case op_custom_1:
-        case op_amo:
-        case op_op_32:
-        case op_madd:
-        case op_msub:
-        case op_nmsub:
-        case op_nmadd:
-        case op_fp:
-        case op_custom2_rv128:
-        case op_custom3_rv128:
-            assert(!"not implemented");
+    for (;;) {
+        switch ((enum decoded_op)insn->op) {
+#define OP(name) case dop_##name:
+#define NEXT                                                                   \
+    {                                                                          \
+        ++insn;                                                                \
+        continue;                                                              \
+    }
+#define JUMP(target)                                                           \
+    {                                                                          \
+        decoded_charge(&cpu, text, sums, run, insn);                           \
+        if ((insn = run = decoded_jump_target(text, PC, (target))) == NULL)    \
+            goto fault;                                                        \
+        continue;                                                              \
+    }
+#define PC decoded_text_pc(text, (u32)(insn - text->insns))
+#define PC_AFTER(n) decoded_text_pc(text, (u32)(insn - text->insns) + (n))
+// Host address of a guest access, bailing out if it's not allowed.
+#define TRANSLATE(type, addr, access)                                          \
+    ({                                                                         \
+        u32 const vaddr_ = (addr);                                             \
+        type *host_ = mmu_translate(mmu, vaddr_, sizeof(type), (access));      \
+        if (__builtin_expect(host_ == NULL, 0)) {                              \
+            error("Refusing to execute: %s of 0x%08x @ 0x%08x is not "         \
+                  "allowed\n",                                                 \
+                  (access) == mmu_write ? "write" : "read", vaddr_, PC);       \
+            goto fault;                                                        \
+        }                                                                      \
+        host_;                                                                 \
+    })
+#define LOAD(type, addr) (*TRANSLATE(type, addr, mmu_read))
+#define STORE(type, addr, value) (*TRANSLATE(type, addr, mmu_write) = (value))
+// Checked as a write, which atomics need the page to allow.
+#define ATOMIC(type, addr) ((_Atomic type *)TRANSLATE(type, addr, mmu_write))
+#define FAULT() goto fault
+#define EXIT(all) goto exited
+// Loop idioms are only ever found in blocks.
+#define NO_IDIOM_OPS
+// Text is a single span of the image, so it's contiguous on the host too.
+#define FENCE_I()                                                              \
+    {                                                                          \
+        decoded_text_refresh(text,                                             \
+                             (u8 *)mmu_translate(mmu, text->base, 4,           \
+                                                 mmu_read) -                   \
+                                 text->base);                                  \
+        cost_model_sum(costs, text, sums);                                     \
+    }
+#define INSTRET (cpu.instret + (u64)(insn - run))
+#define CYCLE                                                                  \
+    (cpu.cycle + (u32)(sums[insn - text->insns] - sums[run - text->insns]))
+#include "interpret_ops.h"
+#undef CYCLE
+#undef INSTRET
+#undef FENCE_I
+#undef NO_IDIOM_OPS
+#undef EXIT
+#undef FAULT
+#undef ATOMIC
+#undef STORE
+#undef LOAD
+#undef TRANSLATE
+#undef PC_AFTER
+#undef PC
+#undef JUMP
+#undef NEXT
+#undef OP
+        case dop_count:
+            __builtin_unreachable();
         }
     }
+
+exited:
+    fpu_detach(fpu);
+    free(sums);
+    return run_exited;
+
+fault:
+    fpu_detach(fpu);
+    free(sums);
+    return run_fault;
 }
 
+#endif
+
+#if RV_XLEN == 32
 static void write_register(struct rv32i *cpu, u8 reg_index, u32 value) {
     // register 0 is a sink.
     if (reg_index != 0) {
-        cpu->registers[reg_index - 1] = value;
+        cpu->registers[reg_index] = value;
     }
 }
 static u32 read_register(struct rv32i const *cpu, u8 reg_index) {
-    if (reg_index == 0)
-        return 0;
-    return cpu->registers[reg_index - 1];
+    return cpu->registers[reg_index];
 }
+#endif
 
 // vim:sw=4
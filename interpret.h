@@ -3,8 +3,134 @@
 //
 
 #pragma once
+#include "common/log.h"
+#include "common/types.h"
+#include "counters.h"
+#include "fpu.h"
+#include "rv/decode.h"
+#include "rv/xlen.h"
+#include "syscalls.h"
+#include "vector.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 
-void interpret(void *memory, uint32_t entrypoint);
+// What the hart's last lr.w or lr.d read. The sc after it stores only if
+// memory still holds that value, which is as close as host atomics get to
+// the hart holding on to the location: a store of the same value in between
+// goes unnoticed.
+struct amo_reservation {
+    uxlen addr;
+    u64 value;
+    // Width of the access in bytes, or 0 when there's no reservation.
+    u32 size;
+};
+
+// The hart's state. Its registers are 64 bits wide in RV64 builds, despite the
+// name (see rv/xlen.h).
+struct rv32i {
+    // x0 lives at index 0 and is never written. Index 32 is the sink that
+    // pre-decoded instructions write to when their destination is x0.
+    uxlen registers[33];
+    struct rvv_state vector;
+    struct fpu_state fpu;
+    struct amo_reservation reservation;
+    // Zicsr's counters, as far as the engine has charged them (see
+    // counters.h).
+    u64 instret;
+    u64 cycle;
+};
+
+// Why an engine stopped running the guest.
+enum run_exit {
+    // The guest ran an illegal or unimplemented instruction, or jumped
+    // somewhere it can't run code from. The reason has already been logged.
+    run_fault,
+    // The guest used up its fuel (see `struct run_state`).
+    run_out_of_fuel,
+    // Someone asked the guest to stop (see `struct run_state`).
+    run_stopped,
+    // The guest asked to exit, with syscall_exit_status() (see syscalls.h).
+    run_exited,
+};
+
+// Where a metered guest run is, so that it can be inspected once it stops and
+// picked up again from there.
+// Fuel is charged a whole block at a time before running it, and the stop flag
+// is looked at between blocks, so that metering costs next to nothing. A run
+// out of fuel stops at the last block boundary the fuel lasted to, which for a
+// loop idiom (see block.h) is the start of its loop, after as many passes as
+// the fuel lasted for.
+struct run_state {
+    struct rv32i cpu;
+    // Guest address of the next instruction to run. After a fault, the start
+    // of the block that faulted.
+    u32 pc;
+    // How many more instructions the guest may retire.
+    u64 fuel;
+    // Set from any thread (or signal handler) to stop at the next block.
+    atomic_bool stop;
+};
+
+// Initializes `state` to start at `entrypoint`, with unlimited fuel.
+void run_state_init(struct run_state *state, u32 entrypoint);
+
+// Returns the decoded instruction for guest address `target`, or NULL if it's
+// outside of the decoded text. `from` is only used to report the error.
+static inline struct decoded_insn const *
+decoded_jump_target(struct decoded_text const *text, u32 from, uxlen target) {
+    if (__builtin_expect(!decoded_text_contains(text, target), 0)) {
+        error("Jump to 0x%08lx from 0x%08x is outside of decoded text\n",
+              (u64)target, from);
+        return NULL;
+    }
+    return text->insns + decoded_text_index(text, target);
+}
+
+// Charges `cpu` for the decoded instructions of `text` from `first` to `last`,
+// both included, with `sums` from cost_model_sum().
+static inline void decoded_charge(struct rv32i *cpu,
+                                  struct decoded_text const *text,
+                                  u32 const *sums,
+                                  struct decoded_insn const *first,
+                                  struct decoded_insn const *last) {
+    u32 const begin = first - text->insns, end = last - text->insns + 1;
+    cpu->instret += end - begin;
+    cpu->cycle += sums[end] - sums[begin];
+}
+
+// Runs the guest, decoding every instruction as it goes, compressed ones
+// included when `compressed`. When `traced`, every instruction is logged with
+// its disassembly, and alignment gets checked. Only in RV32 builds.
+enum run_exit interpret(void *memory, uint32_t entrypoint, bool compressed,
+                        bool traced);
+
+// Runs the guest off the pre-decoded `text` as the hart `cpu`, whose registers
+// and counters are taken as they are, until it stops. Cycles are counted as
+// `costs` says. Jumping outside of the text is a fault.
+// `stop` is shared with the other harts of the guest: the hart stops at its
+// next jump once it's set, and sets it when the guest exits all of them.
+enum run_exit interpret_decoded(void *memory, struct decoded_text const *text,
+                                struct cost_model const *costs,
+                                struct rv32i *cpu, uint32_t entrypoint,
+                                atomic_bool *stop);
+
+struct mmu;
+
+// Same as interpret_decoded(), with a hart of its own that starts out zeroed,
+// but guest memory is reached through `mmu` instead of being the packed image:
+// `text` and `entrypoint` are in guest virtual addresses, and accesses the page
+// table doesn't allow fault. Only in RV32 builds.
+enum run_exit interpret_decoded_mmu(struct mmu *mmu,
+                                    struct decoded_text const *text,
+                                    struct cost_model const *costs,
+                                    uint32_t entrypoint);
+
+// Same as interpret_decoded(), but every handler dispatches the next one
+// through its own indirect jump instead of going back to a central switch.
+enum run_exit interpret_threaded(void *memory, struct decoded_text const *text,
+                                 struct cost_model const *costs,
+                                 struct rv32i *cpu, uint32_t entrypoint,
+                                 atomic_bool *stop);
 
 // vim:ft=c
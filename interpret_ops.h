@@ -0,0 +1,1197 @@
+// Handler bodies for every `enum decoded_op`.
+// This file is meant to be included inside the body of an executor, once per
+// engine, after defining:
+//
+// - OP(name): starts the handler for `dop_<name>`.
+// - NEXT: continues with the following instruction.
+// - JUMP(target): continues at guest address `target`.
+// - PC: guest address of the instruction being executed.
+// - PC_AFTER(n): guest address right after the `n` instructions starting with
+//   the one being executed, which compressed instructions make depend on more
+//   than `n`.
+// - LOAD(type, addr) / STORE(type, addr, value): guest memory accesses.
+// - ATOMIC(type, addr): host address of a guest access that both reads and
+//   writes, as an `_Atomic type *`, for the A extension.
+// - FAULT(): stops running the guest, which did something it can't do.
+// - EXIT(all): stops running the guest, which asked to exit: the hart running
+//   it, and every other one as well when `all`, for engines running several.
+// - FENCE_I(): makes the guest's own writes to its code visible to the engine,
+//   for engines that keep it decoded.
+// - INSTRET / CYCLE: the hart's counters (see counters.h) as of the
+//   instruction being executed, i.e. with what the engine hasn't charged yet.
+// - LOOP_PASSES: for loop idioms, how many passes through their loop the guest
+//   has the fuel for, at least one.
+// - LOOP_RETIRE(passes, left): charges the guest's fuel and counters for
+//   `passes` full passes through the loop of the idiom being executed, and for
+//   the one leaving it when `left`. An idiom that runs out of fuel makes the
+//   passes it can, and jumps back to the start of the loop, where the engine
+//   stops.
+//
+// Along with `x` (the register file, as a `uxlen *`, see rv/xlen.h), `vector`
+// (the V extension state, as a `struct rvv_state *`), `fpu` (the F and D
+// extensions' state, as a `struct fpu_state *`), `reservation` (the hart's
+// `struct amo_reservation *`) and `insn` (the current
+// `struct decoded_insn const *`) being in scope.
+// Superinstructions read the instructions they cover from `insn[1]` onwards,
+// and step `insn` over them before continuing. They're only ever found in
+// decoded text that went through fuse_text(). Engines that never see them can
+// define NO_FUSED_OPS to leave their handlers out, and NO_IDIOM_OPS for loop
+// idioms, which then don't need LOOP_PASSES and LOOP_RETIRE: those ops are
+// handled like dop_undecoded instead.
+// No include guard on purpose.
+
+// The immediate, sign-extended to the width of the registers.
+#define IMM xlen_sext(insn->imm)
+
+// What the auipc `d` writes. Its imm is the sum it's after, but cut to 32 bits,
+// so that RV64 gets it back from the offset, with guest code in the low 4 GiB.
+#if RV_XLEN == 64
+#define AUIPC(d) ((uxlen)PC + xlen_sext((d)->imm - PC))
+#else
+#define AUIPC(d) ((d)->imm)
+#endif
+
+OP(lui) {
+    x[insn->rd] = IMM;
+    NEXT;
+}
+OP(auipc) {
+    x[insn->rd] = AUIPC(insn);
+    NEXT;
+}
+OP(jal) {
+    x[insn->rd] = PC_AFTER(1);
+    JUMP(insn->imm);
+}
+OP(jalr) {
+    // Quoting Spec:
+    // > The target address is obtained by adding the 12-bit signed
+    // I-immediate to the register rs1, then setting the
+    // least-significant bit of the result to zero.
+    uxlen target = (x[insn->rs1] + IMM) & ~0b1;
+    x[insn->rd] = PC_AFTER(1);
+    JUMP(target);
+}
+
+#define BRANCH(cond)                                                           \
+    if (cond)                                                                  \
+        JUMP(insn->imm);                                                       \
+    NEXT;
+
+OP(beq) { BRANCH(x[insn->rs1] == x[insn->rs2]); }
+OP(bne) { BRANCH(x[insn->rs1] != x[insn->rs2]); }
+OP(blt) { BRANCH((ixlen)x[insn->rs1] < (ixlen)x[insn->rs2]); }
+OP(bge) { BRANCH((ixlen)x[insn->rs1] >= (ixlen)x[insn->rs2]); }
+OP(bltu) { BRANCH(x[insn->rs1] < x[insn->rs2]); }
+OP(bgeu) { BRANCH(x[insn->rs1] >= x[insn->rs2]); }
+
+#undef BRANCH
+
+OP(lb) {
+    x[insn->rd] = (ixlen)LOAD(int8_t, x[insn->rs1] + IMM);
+    NEXT;
+}
+OP(lh) {
+    x[insn->rd] = (ixlen)LOAD(i16, x[insn->rs1] + IMM);
+    NEXT;
+}
+OP(lw) {
+    x[insn->rd] = (ixlen)LOAD(i32, x[insn->rs1] + IMM);
+    NEXT;
+}
+OP(lbu) {
+    x[insn->rd] = LOAD(u8, x[insn->rs1] + IMM);
+    NEXT;
+}
+OP(lhu) {
+    x[insn->rd] = LOAD(u16, x[insn->rs1] + IMM);
+    NEXT;
+}
+OP(sb) {
+    STORE(u8, x[insn->rs1] + IMM, x[insn->rs2]);
+    NEXT;
+}
+OP(sh) {
+    STORE(u16, x[insn->rs1] + IMM, x[insn->rs2]);
+    NEXT;
+}
+OP(sw) {
+    STORE(u32, x[insn->rs1] + IMM, x[insn->rs2]);
+    NEXT;
+}
+
+OP(addi) {
+    x[insn->rd] = x[insn->rs1] + IMM;
+    NEXT;
+}
+OP(slti) {
+    x[insn->rd] = (ixlen)x[insn->rs1] < (ixlen)IMM;
+    NEXT;
+}
+OP(sltiu) {
+    x[insn->rd] = x[insn->rs1] < IMM;
+    NEXT;
+}
+OP(xori) {
+    x[insn->rd] = x[insn->rs1] ^ IMM;
+    NEXT;
+}
+OP(ori) {
+    x[insn->rd] = x[insn->rs1] | IMM;
+    NEXT;
+}
+OP(andi) {
+    x[insn->rd] = x[insn->rs1] & IMM;
+    NEXT;
+}
+OP(slli) {
+    x[insn->rd] = x[insn->rs1] << insn->imm;
+    NEXT;
+}
+OP(srli) {
+    x[insn->rd] = x[insn->rs1] >> insn->imm;
+    NEXT;
+}
+OP(srai) {
+    x[insn->rd] = (ixlen)x[insn->rs1] >> insn->imm;
+    NEXT;
+}
+
+OP(add) {
+    x[insn->rd] = x[insn->rs1] + x[insn->rs2];
+    NEXT;
+}
+OP(sub) {
+    x[insn->rd] = x[insn->rs1] - x[insn->rs2];
+    NEXT;
+}
+OP(sll) {
+    x[insn->rd] = x[insn->rs1] << (x[insn->rs2] & (RV_XLEN - 1));
+    NEXT;
+}
+OP(slt) {
+    x[insn->rd] = (ixlen)x[insn->rs1] < (ixlen)x[insn->rs2];
+    NEXT;
+}
+OP(sltu) {
+    x[insn->rd] = x[insn->rs1] < x[insn->rs2];
+    NEXT;
+}
+OP(xor) {
+    x[insn->rd] = x[insn->rs1] ^ x[insn->rs2];
+    NEXT;
+}
+OP(srl) {
+    x[insn->rd] = x[insn->rs1] >> (x[insn->rs2] & (RV_XLEN - 1));
+    NEXT;
+}
+OP(sra) {
+    x[insn->rd] = (ixlen)x[insn->rs1] >> (x[insn->rs2] & (RV_XLEN - 1));
+    NEXT;
+}
+OP(or) {
+    x[insn->rd] = x[insn->rs1] | x[insn->rs2];
+    NEXT;
+}
+OP(and) {
+    x[insn->rd] = x[insn->rs1] & x[insn->rs2];
+    NEXT;
+}
+
+// The helpers for the width of the registers.
+#if RV_XLEN == 64
+#define MULDIV(name) rv_##name##64
+#else
+#define MULDIV(name) rv_##name
+#endif
+
+OP(mul) {
+    x[insn->rd] = x[insn->rs1] * x[insn->rs2];
+    NEXT;
+}
+OP(mulh) {
+    x[insn->rd] = MULDIV(mulh)(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+OP(mulhsu) {
+    x[insn->rd] = MULDIV(mulhsu)(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+OP(mulhu) {
+    x[insn->rd] = MULDIV(mulhu)(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+OP(div) {
+    x[insn->rd] = MULDIV(div)(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+OP(divu) {
+    x[insn->rd] = MULDIV(divu)(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+OP(rem) {
+    x[insn->rd] = MULDIV(rem)(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+OP(remu) {
+    x[insn->rd] = MULDIV(remu)(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+
+#undef MULDIV
+
+#if RV_XLEN == 64
+// RV64I and RV64M. The word forms work on the low 32 bits of their operands.
+
+OP(ld) {
+    x[insn->rd] = LOAD(u64, x[insn->rs1] + IMM);
+    NEXT;
+}
+OP(lwu) {
+    x[insn->rd] = LOAD(u32, x[insn->rs1] + IMM);
+    NEXT;
+}
+OP(sd) {
+    STORE(u64, x[insn->rs1] + IMM, x[insn->rs2]);
+    NEXT;
+}
+
+OP(addiw) {
+    x[insn->rd] = xlen_sext(x[insn->rs1] + insn->imm);
+    NEXT;
+}
+OP(slliw) {
+    x[insn->rd] = xlen_sext((u32)x[insn->rs1] << insn->imm);
+    NEXT;
+}
+OP(srliw) {
+    x[insn->rd] = xlen_sext((u32)x[insn->rs1] >> insn->imm);
+    NEXT;
+}
+OP(sraiw) {
+    x[insn->rd] = xlen_sext((i32)x[insn->rs1] >> insn->imm);
+    NEXT;
+}
+OP(addw) {
+    x[insn->rd] = xlen_sext(x[insn->rs1] + x[insn->rs2]);
+    NEXT;
+}
+OP(subw) {
+    x[insn->rd] = xlen_sext(x[insn->rs1] - x[insn->rs2]);
+    NEXT;
+}
+OP(sllw) {
+    x[insn->rd] = xlen_sext((u32)x[insn->rs1] << (x[insn->rs2] & 0x1f));
+    NEXT;
+}
+OP(srlw) {
+    x[insn->rd] = xlen_sext((u32)x[insn->rs1] >> (x[insn->rs2] & 0x1f));
+    NEXT;
+}
+OP(sraw) {
+    x[insn->rd] = xlen_sext((i32)x[insn->rs1] >> (x[insn->rs2] & 0x1f));
+    NEXT;
+}
+
+OP(mulw) {
+    x[insn->rd] = xlen_sext(x[insn->rs1] * x[insn->rs2]);
+    NEXT;
+}
+OP(divw) {
+    x[insn->rd] = xlen_sext(rv_div(x[insn->rs1], x[insn->rs2]));
+    NEXT;
+}
+OP(divuw) {
+    x[insn->rd] = xlen_sext(rv_divu(x[insn->rs1], x[insn->rs2]));
+    NEXT;
+}
+OP(remw) {
+    x[insn->rd] = xlen_sext(rv_rem(x[insn->rs1], x[insn->rs2]));
+    NEXT;
+}
+OP(remuw) {
+    x[insn->rd] = xlen_sext(rv_remu(x[insn->rs1], x[insn->rs2]));
+    NEXT;
+}
+#endif
+
+OP(sh1add) {
+    x[insn->rd] = (x[insn->rs1] << 1) + x[insn->rs2];
+    NEXT;
+}
+OP(sh2add) {
+    x[insn->rd] = (x[insn->rs1] << 2) + x[insn->rs2];
+    NEXT;
+}
+OP(sh3add) {
+    x[insn->rd] = (x[insn->rs1] << 3) + x[insn->rs2];
+    NEXT;
+}
+OP(andn) {
+    x[insn->rd] = x[insn->rs1] & ~x[insn->rs2];
+    NEXT;
+}
+OP(orn) {
+    x[insn->rd] = x[insn->rs1] | ~x[insn->rs2];
+    NEXT;
+}
+OP(xnor) {
+    x[insn->rd] = ~(x[insn->rs1] ^ x[insn->rs2]);
+    NEXT;
+}
+OP(clz) {
+    x[insn->rd] = rv_clz(x[insn->rs1]);
+    NEXT;
+}
+OP(ctz) {
+    x[insn->rd] = rv_ctz(x[insn->rs1]);
+    NEXT;
+}
+OP(cpop) {
+    x[insn->rd] = rv_cpop(x[insn->rs1]);
+    NEXT;
+}
+OP(min) {
+    i32 a = bit_cast_i32(x[insn->rs1]), b = bit_cast_i32(x[insn->rs2]);
+    x[insn->rd] = a < b ? a : b;
+    NEXT;
+}
+OP(minu) {
+    u32 a = x[insn->rs1], b = x[insn->rs2];
+    x[insn->rd] = a < b ? a : b;
+    NEXT;
+}
+OP(max) {
+    i32 a = bit_cast_i32(x[insn->rs1]), b = bit_cast_i32(x[insn->rs2]);
+    x[insn->rd] = a > b ? a : b;
+    NEXT;
+}
+OP(maxu) {
+    u32 a = x[insn->rs1], b = x[insn->rs2];
+    x[insn->rd] = a > b ? a : b;
+    NEXT;
+}
+OP(sext_b) {
+    x[insn->rd] = (i32)(int8_t)x[insn->rs1];
+    NEXT;
+}
+OP(sext_h) {
+    x[insn->rd] = (i32)(i16)x[insn->rs1];
+    NEXT;
+}
+OP(zext_h) {
+    x[insn->rd] = (u16)x[insn->rs1];
+    NEXT;
+}
+OP(rol) {
+    x[insn->rd] = rv_rol(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+OP(ror) {
+    x[insn->rd] = rv_ror(x[insn->rs1], x[insn->rs2]);
+    NEXT;
+}
+OP(rori) {
+    x[insn->rd] = rv_ror(x[insn->rs1], insn->imm);
+    NEXT;
+}
+OP(orc_b) {
+    x[insn->rd] = rv_orc_b(x[insn->rs1]);
+    NEXT;
+}
+OP(rev8) {
+    x[insn->rd] = rv_rev8(x[insn->rs1]);
+    NEXT;
+}
+OP(bclr) {
+    x[insn->rd] = x[insn->rs1] & ~(1u << (x[insn->rs2] & 0x1f));
+    NEXT;
+}
+OP(bclri) {
+    x[insn->rd] = x[insn->rs1] & ~(1u << insn->imm);
+    NEXT;
+}
+OP(bext) {
+    x[insn->rd] = (x[insn->rs1] >> (x[insn->rs2] & 0x1f)) & 1;
+    NEXT;
+}
+OP(bexti) {
+    x[insn->rd] = (x[insn->rs1] >> insn->imm) & 1;
+    NEXT;
+}
+OP(binv) {
+    x[insn->rd] = x[insn->rs1] ^ (1u << (x[insn->rs2] & 0x1f));
+    NEXT;
+}
+OP(binvi) {
+    x[insn->rd] = x[insn->rs1] ^ (1u << insn->imm);
+    NEXT;
+}
+OP(bset) {
+    x[insn->rd] = x[insn->rs1] | (1u << (x[insn->rs2] & 0x1f));
+    NEXT;
+}
+OP(bseti) {
+    x[insn->rd] = x[insn->rs1] | (1u << insn->imm);
+    NEXT;
+}
+
+// V extension, see vector.h.
+
+#define VECTOR_ILLEGAL()                                                       \
+    {                                                                          \
+        error("Refusing to execute: vector instruction @ 0x%08x is illegal "   \
+              "with vtype 0x%08x\n",                                           \
+              PC, vector->vtype);                                              \
+        FAULT();                                                               \
+    }
+
+// rs1 = x0 asks for as many elements as fit, unless rd is x0 too, which
+// keeps vl as it is.
+#define VECTOR_AVL()                                                           \
+    (insn->rs1 != rv_zero             ? x[insn->rs1]                           \
+     : insn->rd != DECODED_SINK_REG ? UINT32_MAX                               \
+                                      : vector->vl)
+
+OP(vsetvli) {
+    x[insn->rd] = rvv_set_vtype(vector, insn->imm, VECTOR_AVL());
+    NEXT;
+}
+OP(vsetivli) {
+    x[insn->rd] = rvv_set_vtype(vector, insn->imm, insn->rs1);
+    NEXT;
+}
+OP(vsetvl) {
+    x[insn->rd] = rvv_set_vtype(vector, x[insn->rs2], VECTOR_AVL());
+    NEXT;
+}
+
+// Loads and stores go element by element through LOAD and STORE, `stride`
+// bytes apart.
+#define VECTOR_ACCESS(stride, ACCESS)                                          \
+    {                                                                          \
+        struct rvv_access a_;                                                  \
+        if (!rvv_access_init(vector, insn->imm, &a_))                          \
+            VECTOR_ILLEGAL();                                                  \
+        u32 const stride_ = (stride);                                          \
+        u32 addr_ = x[insn->rs1];                                              \
+        for (u32 i_ = 0; i_ < a_.vl; ++i_, addr_ += stride_) {                 \
+            if (!rvv_active(vector, a_.masked, i_))                            \
+                continue;                                                      \
+            u8 *const element_ = a_.group + i_ * a_.size;                      \
+            switch (a_.size) {                                                 \
+            case 1:                                                            \
+                ACCESS(u8);                                                    \
+                break;                                                         \
+            case 2:                                                            \
+                ACCESS(u16);                                                   \
+                break;                                                         \
+            default:                                                           \
+                ACCESS(u32);                                                   \
+                break;                                                         \
+            }                                                                  \
+        }                                                                      \
+        NEXT;                                                                  \
+    }
+#define VECTOR_LOAD(type)                                                      \
+    {                                                                          \
+        type const value_ = LOAD(type, addr_);                                 \
+        memcpy(element_, &value_, sizeof(type));                               \
+    }
+#define VECTOR_STORE(type)                                                     \
+    {                                                                          \
+        type value_;                                                           \
+        memcpy(&value_, element_, sizeof(type));                               \
+        STORE(type, addr_, value_);                                            \
+    }
+
+OP(vle) { VECTOR_ACCESS(a_.size, VECTOR_LOAD); }
+OP(vlse) { VECTOR_ACCESS(x[insn->rs2], VECTOR_LOAD); }
+OP(vse) { VECTOR_ACCESS(a_.size, VECTOR_STORE); }
+OP(vsse) { VECTOR_ACCESS(x[insn->rs2], VECTOR_STORE); }
+
+OP(varith_vv) {
+    if (!rvv_arith(vector, insn->imm, 0))
+        VECTOR_ILLEGAL();
+    NEXT;
+}
+OP(varith_vx) {
+    if (!rvv_arith(vector, insn->imm, x[insn->rs1]))
+        VECTOR_ILLEGAL();
+    NEXT;
+}
+OP(varith_vi) {
+    // The 5-bit immediate is in the vs1 field.
+    if (!rvv_arith(vector, insn->imm, (u32)((i32)((u32)insn->rs1 << 27) >> 27)))
+        VECTOR_ILLEGAL();
+    NEXT;
+}
+OP(vred) {
+    if (!rvv_reduce(vector, insn->imm))
+        VECTOR_ILLEGAL();
+    NEXT;
+}
+OP(vmv_x_s) {
+    u32 value;
+    if (!rvv_move_to_scalar(vector, insn->rs2, &value))
+        VECTOR_ILLEGAL();
+    x[insn->rd] = value;
+    NEXT;
+}
+OP(vmv_s_x) {
+    if (!rvv_move_from_scalar(vector, insn->rd, x[insn->rs1]))
+        VECTOR_ILLEGAL();
+    NEXT;
+}
+
+#undef VECTOR_STORE
+#undef VECTOR_LOAD
+#undef VECTOR_ACCESS
+#undef VECTOR_AVL
+#undef VECTOR_ILLEGAL
+
+// F and D extensions, see fpu.h.
+
+#define FLOAT_ILLEGAL()                                                        \
+    {                                                                          \
+        error("Refusing to execute: floating-point instruction @ 0x%08x is "   \
+              "illegal with frm %u\n",                                         \
+              PC, fpu->frm);                                                   \
+        FAULT();                                                               \
+    }
+
+// Operands, unboxed for single precision.
+#define F32(reg) fpu_unbox(fpu->f[reg])
+#define F64(reg) fpu->f[reg]
+#define FLOAT_RM (insn->imm & 0b111)
+
+// f[rd] = `expr`, computed from `a`, `b` and `c` on the host when it rounds
+// like the instruction asks, and by `op` on the slow path otherwise. `c` is
+// the third source of the `fused` multiply-adds, which is in imm.
+// Infinity times zero is invalid for them even when adding a quiet NaN, which
+// the host may not flag.
+#define FLOAT_ROUND(type, to_float, op, fused, expr, round, result)            \
+    {                                                                          \
+        type const a = to_float(insn->rs1), b = to_float(insn->rs2);           \
+        type const c = (fused) ? to_float(insn->imm >> 3) : 0;                 \
+        if ((fused) && ((__builtin_isinf(a) && b == 0) ||                      \
+                        (a == 0 && __builtin_isinf(b))))                       \
+            fpu->flags |= fpu_nv;                                              \
+        type r;                                                                \
+        if (fpu_native(fpu, FLOAT_RM))                                         \
+            r = (expr);                                                        \
+        else if (!round(fpu, (op), FLOAT_RM, a, b, c, &r))                     \
+            FLOAT_ILLEGAL();                                                   \
+        fpu->f[insn->rd] = (result);                                           \
+        NEXT;                                                                  \
+    }
+#define FLOAT_S(reg) fpu_f32(F32(reg))
+#define FLOAT_D(reg) fpu_f64(F64(reg))
+#define FLOAT_ROUND_S(op, fused, expr)                                         \
+    FLOAT_ROUND(float, FLOAT_S, op, fused, expr, fpu_round_s,                  \
+                fpu_box(fpu_canonical_s(r)))
+#define FLOAT_ROUND_D(op, fused, expr)                                         \
+    FLOAT_ROUND(double, FLOAT_D, op, fused, expr, fpu_round_d,                 \
+                fpu_canonical_d(r))
+
+// f[rd] = `value` rounded to single precision, by `expr` on the host when it
+// rounds like the instruction asks.
+#define FLOAT_NARROW(value, expr)                                              \
+    {                                                                          \
+        float r;                                                               \
+        if (fpu_native(fpu, FLOAT_RM))                                         \
+            r = (expr);                                                        \
+        else if (!fpu_narrow(fpu, FLOAT_RM, (value), &r))                      \
+            FLOAT_ILLEGAL();                                                   \
+        fpu->f[insn->rd] = fpu_box(fpu_canonical_s(r));                        \
+        NEXT;                                                                  \
+    }
+
+// x[rd] = `value` converted to a 32-bit integer, which RV64 sign-extends
+// even when it's unsigned.
+#define FLOAT_TO_INT(value, is_signed)                                         \
+    {                                                                          \
+        u32 r;                                                                 \
+        if (!fpu_to_int(fpu, FLOAT_RM, (value), (is_signed), &r))              \
+            FLOAT_ILLEGAL();                                                   \
+        x[insn->rd] = xlen_sext(r);                                            \
+        NEXT;                                                                  \
+    }
+
+OP(flw) {
+    fpu->f[insn->rd] = fpu_box(LOAD(u32, x[insn->rs1] + IMM));
+    NEXT;
+}
+OP(fld) {
+    fpu->f[insn->rd] = LOAD(u64, x[insn->rs1] + IMM);
+    NEXT;
+}
+OP(fsw) {
+    // Stores and moves take the bits as they are, boxed or not.
+    STORE(u32, x[insn->rs1] + IMM, (u32)fpu->f[insn->rs2]);
+    NEXT;
+}
+OP(fsd) {
+    STORE(u64, x[insn->rs1] + IMM, fpu->f[insn->rs2]);
+    NEXT;
+}
+
+OP(fmadd_s) { FLOAT_ROUND_S(fpu_madd, true, __builtin_fmaf(a, b, c)); }
+OP(fmsub_s) { FLOAT_ROUND_S(fpu_msub, true, __builtin_fmaf(a, b, -c)); }
+OP(fnmsub_s) { FLOAT_ROUND_S(fpu_nmsub, true, __builtin_fmaf(-a, b, c)); }
+OP(fnmadd_s) { FLOAT_ROUND_S(fpu_nmadd, true, __builtin_fmaf(-a, b, -c)); }
+OP(fmadd_d) { FLOAT_ROUND_D(fpu_madd, true, __builtin_fma(a, b, c)); }
+OP(fmsub_d) { FLOAT_ROUND_D(fpu_msub, true, __builtin_fma(a, b, -c)); }
+OP(fnmsub_d) { FLOAT_ROUND_D(fpu_nmsub, true, __builtin_fma(-a, b, c)); }
+OP(fnmadd_d) { FLOAT_ROUND_D(fpu_nmadd, true, __builtin_fma(-a, b, -c)); }
+
+OP(fadd_s) { FLOAT_ROUND_S(fpu_add, false, a + b); }
+OP(fsub_s) { FLOAT_ROUND_S(fpu_sub, false, a - b); }
+OP(fmul_s) { FLOAT_ROUND_S(fpu_mul, false, a * b); }
+OP(fdiv_s) { FLOAT_ROUND_S(fpu_div, false, a / b); }
+OP(fsqrt_s) { FLOAT_ROUND_S(fpu_sqrt, false, __builtin_sqrtf(a)); }
+OP(fsgnj_s) {
+    fpu->f[insn->rd] = fpu_box(
+        fpu_sign_inject(F32(insn->rs1), F32(insn->rs2), false, 0b000));
+    NEXT;
+}
+OP(fsgnjn_s) {
+    fpu->f[insn->rd] = fpu_box(
+        fpu_sign_inject(F32(insn->rs1), F32(insn->rs2), false, 0b001));
+    NEXT;
+}
+OP(fsgnjx_s) {
+    fpu->f[insn->rd] = fpu_box(
+        fpu_sign_inject(F32(insn->rs1), F32(insn->rs2), false, 0b010));
+    NEXT;
+}
+OP(fmin_s) {
+    fpu->f[insn->rd] = fpu_box(
+        fpu_min_max(fpu, F32(insn->rs1), F32(insn->rs2), false, false));
+    NEXT;
+}
+OP(fmax_s) {
+    fpu->f[insn->rd] = fpu_box(
+        fpu_min_max(fpu, F32(insn->rs1), F32(insn->rs2), false, true));
+    NEXT;
+}
+OP(fcvt_s_w) {
+    FLOAT_NARROW((i32)x[insn->rs1], (float)(i32)x[insn->rs1]);
+}
+OP(fcvt_s_wu) { FLOAT_NARROW((u32)x[insn->rs1], (float)(u32)x[insn->rs1]); }
+
+OP(fadd_d) { FLOAT_ROUND_D(fpu_add, false, a + b); }
+OP(fsub_d) { FLOAT_ROUND_D(fpu_sub, false, a - b); }
+OP(fmul_d) { FLOAT_ROUND_D(fpu_mul, false, a * b); }
+OP(fdiv_d) { FLOAT_ROUND_D(fpu_div, false, a / b); }
+OP(fsqrt_d) { FLOAT_ROUND_D(fpu_sqrt, false, __builtin_sqrt(a)); }
+OP(fsgnj_d) {
+    fpu->f[insn->rd] =
+        fpu_sign_inject(F64(insn->rs1), F64(insn->rs2), true, 0b000);
+    NEXT;
+}
+OP(fsgnjn_d) {
+    fpu->f[insn->rd] =
+        fpu_sign_inject(F64(insn->rs1), F64(insn->rs2), true, 0b001);
+    NEXT;
+}
+OP(fsgnjx_d) {
+    fpu->f[insn->rd] =
+        fpu_sign_inject(F64(insn->rs1), F64(insn->rs2), true, 0b010);
+    NEXT;
+}
+OP(fmin_d) {
+    fpu->f[insn->rd] =
+        fpu_min_max(fpu, F64(insn->rs1), F64(insn->rs2), true, false);
+    NEXT;
+}
+OP(fmax_d) {
+    fpu->f[insn->rd] =
+        fpu_min_max(fpu, F64(insn->rs1), F64(insn->rs2), true, true);
+    NEXT;
+}
+// Every 32-bit integer is a double, so these never round.
+OP(fcvt_d_w) {
+    fpu->f[insn->rd] = fpu_canonical_d((i32)x[insn->rs1]);
+    NEXT;
+}
+OP(fcvt_d_wu) {
+    fpu->f[insn->rd] = fpu_canonical_d((u32)x[insn->rs1]);
+    NEXT;
+}
+
+OP(fmv_w_x) {
+    fpu->f[insn->rd] = fpu_box(x[insn->rs1]);
+    NEXT;
+}
+OP(fcvt_s_d) { FLOAT_NARROW(FLOAT_D(insn->rs1), (float)FLOAT_D(insn->rs1)); }
+OP(fcvt_d_s) {
+    fpu->f[insn->rd] = fpu_canonical_d(FLOAT_S(insn->rs1));
+    NEXT;
+}
+
+OP(fcvt_w_s) { FLOAT_TO_INT(FLOAT_S(insn->rs1), true); }
+OP(fcvt_wu_s) { FLOAT_TO_INT(FLOAT_S(insn->rs1), false); }
+OP(feq_s) {
+    x[insn->rd] =
+        fpu_compare(fpu, F32(insn->rs1), F32(insn->rs2), false, 0b010);
+    NEXT;
+}
+OP(flt_s) {
+    x[insn->rd] =
+        fpu_compare(fpu, F32(insn->rs1), F32(insn->rs2), false, 0b001);
+    NEXT;
+}
+OP(fle_s) {
+    x[insn->rd] =
+        fpu_compare(fpu, F32(insn->rs1), F32(insn->rs2), false, 0b000);
+    NEXT;
+}
+OP(fclass_s) {
+    x[insn->rd] = fpu_classify(F32(insn->rs1), false);
+    NEXT;
+}
+OP(fmv_x_w) {
+    x[insn->rd] = xlen_sext((u32)fpu->f[insn->rs1]);
+    NEXT;
+}
+OP(fcvt_w_d) { FLOAT_TO_INT(FLOAT_D(insn->rs1), true); }
+OP(fcvt_wu_d) { FLOAT_TO_INT(FLOAT_D(insn->rs1), false); }
+OP(feq_d) {
+    x[insn->rd] = fpu_compare(fpu, F64(insn->rs1), F64(insn->rs2), true, 0b010);
+    NEXT;
+}
+OP(flt_d) {
+    x[insn->rd] = fpu_compare(fpu, F64(insn->rs1), F64(insn->rs2), true, 0b001);
+    NEXT;
+}
+OP(fle_d) {
+    x[insn->rd] = fpu_compare(fpu, F64(insn->rs1), F64(insn->rs2), true, 0b000);
+    NEXT;
+}
+OP(fclass_d) {
+    x[insn->rd] = fpu_classify(F64(insn->rs1), true);
+    NEXT;
+}
+
+#undef FLOAT_TO_INT
+#undef FLOAT_NARROW
+#undef FLOAT_ROUND_D
+#undef FLOAT_ROUND_S
+#undef FLOAT_D
+#undef FLOAT_S
+#undef FLOAT_ROUND
+#undef FLOAT_RM
+#undef F64
+#undef F32
+#undef FLOAT_ILLEGAL
+
+// Zicsr, for the floating-point CSRs (see fpu_csr_read()) and the counters.
+// x[rd] = the CSR, which is then set to `update` (made from it as `old` and
+// from `value`) if `writes`.
+#define CSR(value_expr, writes, update)                                        \
+    {                                                                          \
+        uxlen old;                                                             \
+        u32 fpu_old;                                                           \
+        bool const counter = counter_csr(insn->imm);                           \
+        if (counter) {                                                         \
+            old = counter_csr_read(insn->imm, INSTRET, CYCLE);                 \
+        } else if (fpu_csr_read(fpu, insn->imm, &fpu_old)) {                   \
+            old = fpu_old;                                                     \
+        } else {                                                               \
+            error("Refusing to execute: CSR 0x%03x @ 0x%08x is not "           \
+                  "supported\n",                                               \
+                  insn->imm, PC);                                              \
+            FAULT();                                                           \
+        }                                                                      \
+        u32 const value = (value_expr);                                        \
+        if (writes) {                                                          \
+            if (counter) {                                                     \
+                error("Refusing to execute: write to read-only CSR 0x%03x "    \
+                      "@ 0x%08x\n",                                            \
+                      insn->imm, PC);                                          \
+                FAULT();                                                       \
+            }                                                                  \
+            fpu_csr_write(fpu, insn->imm, (update));                           \
+        }                                                                      \
+        x[insn->rd] = old;                                                     \
+        NEXT;                                                                  \
+    }
+
+// Setting or clearing no bits doesn't write, which matters for read-only
+// CSRs.
+OP(csrrw) { CSR(x[insn->rs1], true, value); }
+OP(csrrs) { CSR(x[insn->rs1], insn->rs1 != rv_zero, old | value); }
+OP(csrrc) { CSR(x[insn->rs1], insn->rs1 != rv_zero, old & ~value); }
+OP(csrrwi) { CSR(insn->rs1, true, value); }
+OP(csrrsi) { CSR(insn->rs1, value != 0, old | value); }
+OP(csrrci) { CSR(insn->rs1, value != 0, old & ~value); }
+
+#undef CSR
+
+// A extension. Guest memory may be shared with other harts (see hart.h), so
+// every access is a host atomic, as ordered as its aq and rl bits ask.
+
+// Host address of the `type` at x[rs1], which atomics want aligned.
+#define AMO_ADDR(type)                                                         \
+    ({                                                                         \
+        uxlen const addr_ = x[insn->rs1];                                      \
+        if (__builtin_expect(addr_ % sizeof(type) != 0, 0)) {                  \
+            error("Refusing to execute: misaligned atomic access of 0x%08lx "  \
+                  "@ 0x%08x\n",                                                \
+                  (u64)addr_, PC);                                             \
+            FAULT();                                                           \
+        }                                                                      \
+        ATOMIC(type, addr_);                                                   \
+    })
+#define AMO_ORDER                                                              \
+    (insn->imm == (amo_aq | amo_rl) ? memory_order_seq_cst                     \
+     : insn->imm == amo_aq          ? memory_order_acquire                     \
+     : insn->imm == amo_rl          ? memory_order_release                     \
+                                    : memory_order_relaxed)
+// x[rd] = the old value, sign-extended from 32 bits for the `*_w` forms.
+#define AMO_RESULT(type, value)                                                \
+    (sizeof(type) == 4 ? xlen_sext((u32)(value)) : (uxlen)(value))
+
+// A load can't release, so rl without aq takes the strongest order.
+#define LR(type)                                                               \
+    {                                                                          \
+        _Atomic type *const slot = AMO_ADDR(type);                             \
+        type const value = atomic_load_explicit(                               \
+            slot, insn->imm == amo_aq ? memory_order_acquire                   \
+                : insn->imm != 0    ? memory_order_seq_cst                     \
+                                    : memory_order_relaxed);                   \
+        *reservation = (struct amo_reservation){                               \
+            .addr = x[insn->rs1], .value = value, .size = sizeof(type)};       \
+        x[insn->rd] = AMO_RESULT(type, value);                                 \
+        NEXT;                                                                  \
+    }
+// x[rd] = 0 if it stored, 1 otherwise. Either way, the reservation is gone.
+#define SC(type)                                                               \
+    {                                                                          \
+        _Atomic type *const slot = AMO_ADDR(type);                             \
+        type expected = reservation->value;                                    \
+        bool const stored =                                                    \
+            reservation->size == sizeof(type) &&                               \
+            reservation->addr == x[insn->rs1] &&                               \
+            atomic_compare_exchange_strong_explicit(                           \
+                slot, &expected, (type)x[insn->rs2], AMO_ORDER,                \
+                memory_order_relaxed);                                         \
+        reservation->size = 0;                                                 \
+        x[insn->rd] = !stored;                                                 \
+        NEXT;                                                                  \
+    }
+// Operations the host has an atomic for.
+#define AMO_FETCH(type, fetch)                                                 \
+    {                                                                          \
+        _Atomic type *const slot = AMO_ADDR(type);                             \
+        type const old = fetch(slot, (type)x[insn->rs2], AMO_ORDER);           \
+        x[insn->rd] = AMO_RESULT(type, old);                                   \
+        NEXT;                                                                  \
+    }
+// The others: memory keeps `old` if `keep` (made from it and from x[rs2] as
+// `value`), and becomes `value` otherwise.
+#define AMO_PICK(type, keep)                                                   \
+    {                                                                          \
+        _Atomic type *const slot = AMO_ADDR(type);                             \
+        type const value = x[insn->rs2];                                       \
+        type old = atomic_load_explicit(slot, memory_order_relaxed);           \
+        while (!atomic_compare_exchange_weak_explicit(                         \
+            slot, &old, (keep) ? old : value, AMO_ORDER,                       \
+            memory_order_relaxed))                                             \
+            ;                                                                  \
+        x[insn->rd] = AMO_RESULT(type, old);                                   \
+        NEXT;                                                                  \
+    }
+
+OP(lr_w) { LR(u32); }
+OP(sc_w) { SC(u32); }
+OP(amoswap_w) { AMO_FETCH(u32, atomic_exchange_explicit); }
+OP(amoadd_w) { AMO_FETCH(u32, atomic_fetch_add_explicit); }
+OP(amoxor_w) { AMO_FETCH(u32, atomic_fetch_xor_explicit); }
+OP(amoand_w) { AMO_FETCH(u32, atomic_fetch_and_explicit); }
+OP(amoor_w) { AMO_FETCH(u32, atomic_fetch_or_explicit); }
+OP(amomin_w) { AMO_PICK(u32, (i32)old < (i32)value); }
+OP(amomax_w) { AMO_PICK(u32, (i32)old > (i32)value); }
+OP(amominu_w) { AMO_PICK(u32, old < value); }
+OP(amomaxu_w) { AMO_PICK(u32, old > value); }
+
+#if RV_XLEN == 64
+OP(lr_d) { LR(u64); }
+OP(sc_d) { SC(u64); }
+OP(amoswap_d) { AMO_FETCH(u64, atomic_exchange_explicit); }
+OP(amoadd_d) { AMO_FETCH(u64, atomic_fetch_add_explicit); }
+OP(amoxor_d) { AMO_FETCH(u64, atomic_fetch_xor_explicit); }
+OP(amoand_d) { AMO_FETCH(u64, atomic_fetch_and_explicit); }
+OP(amoor_d) { AMO_FETCH(u64, atomic_fetch_or_explicit); }
+OP(amomin_d) { AMO_PICK(u64, (i64)old < (i64)value); }
+OP(amomax_d) { AMO_PICK(u64, (i64)old > (i64)value); }
+OP(amominu_d) { AMO_PICK(u64, old < value); }
+OP(amomaxu_d) { AMO_PICK(u64, old > value); }
+#endif
+
+#undef AMO_PICK
+#undef AMO_FETCH
+#undef SC
+#undef LR
+#undef AMO_RESULT
+#undef AMO_ORDER
+#undef AMO_ADDR
+
+OP(fence) {
+    // The host keeps loads and stores in order against the ones of the same
+    // kind, so only ordering earlier stores before later loads takes a full
+    // fence. The others just keep the compiler from moving accesses across.
+    if ((insn->imm >> 4 & fence_w) && (insn->imm & fence_r))
+        atomic_thread_fence(memory_order_seq_cst);
+    else
+        atomic_thread_fence(memory_order_acq_rel);
+    NEXT;
+}
+OP(fence_i) {
+    // Continuing with a jump, rather than NEXT, lets the block engines leave
+    // the block and pick up code written since they translated it.
+    // Compressed text may decode differently once refreshed, so the address
+    // to go on from is taken beforehand.
+    u32 next = PC_AFTER(1);
+    FENCE_I();
+    JUMP(next);
+}
+OP(ecall) {
+    // Linux system calls (see syscalls.h). Guest memory is copied through a
+    // chunk on the host's stack, with LOAD and STORE, so that it's reached the
+    // same way as by any other instruction.
+    uxlen const arg = x[rv_a0], addr = x[rv_a1], length = x[rv_a2];
+    u8 chunk[SYSCALL_CHUNK_SIZE];
+    i64 result = 0;
+    switch (x[rv_a7]) {
+    case sys_write:
+        result = length;
+        for (uxlen done = 0; done < length; done += SYSCALL_CHUNK_SIZE) {
+            u32 const n = length - done < SYSCALL_CHUNK_SIZE
+                              ? length - done
+                              : SYSCALL_CHUNK_SIZE;
+            for (u32 i = 0; i < n; ++i)
+                chunk[i] = LOAD(u8, addr + done + i);
+            i64 const written = syscall_write(arg, chunk, n);
+            if (written < 0) {
+                result = written;
+                break;
+            }
+        }
+        break;
+    case sys_read:
+        result = syscall_read(arg, chunk,
+                              length < SYSCALL_CHUNK_SIZE ? length
+                                                          : SYSCALL_CHUNK_SIZE);
+        for (i64 i = 0; i < result; ++i)
+            STORE(u8, addr + i, chunk[i]);
+        break;
+    case sys_exit:
+        syscall_exit(arg);
+        EXIT(false);
+    case sys_exit_group:
+        syscall_exit(arg);
+        EXIT(true);
+    default:
+        error("Refusing to execute: unsupported system call %lu @ 0x%08x\n",
+              (u64)x[rv_a7], PC);
+        FAULT();
+    }
+    x[rv_a0] = result;
+    NEXT;
+}
+
+#ifndef NO_FUSED_OPS
+// Continues past the `n` instructions covered by a superinstruction.
+#define FUSED_NEXT(n)                                                          \
+    {                                                                          \
+        insn += (n) - 1;                                                       \
+        NEXT;                                                                  \
+    }
+
+OP(fused_li) {
+    // lui rd, hi; addi rd, rd, lo.
+    x[insn->rd] = IMM + xlen_sext(insn[1].imm);
+    FUSED_NEXT(2);
+}
+OP(fused_far_call) {
+    // auipc rd, hi; jalr rd2, lo(rd).
+    uxlen const link = AUIPC(insn);
+    x[insn->rd] = link;
+    uxlen target = (link + xlen_sext(insn[1].imm)) & ~0b1;
+    x[insn[1].rd] = PC_AFTER(2);
+    // The jalr is what jumps, which keeps the engines' counts of retired
+    // instructions right.
+    ++insn;
+    JUMP(target);
+}
+OP(fused_byte_update) {
+    // lbu rd, off(rs1); addi rd, rd, c; sb rd, off(rs1).
+    uxlen addr = x[insn->rs1] + IMM;
+    uxlen value = LOAD(u8, addr) + xlen_sext(insn[1].imm);
+    STORE(u8, addr, value);
+    x[insn->rd] = value;
+    FUSED_NEXT(3);
+}
+OP(fused_ecall_args) {
+    // li; li; mv (or rd, x0, rs2); li, as bfc sets up `.` and `,`.
+    x[insn[0].rd] = xlen_sext(insn[0].imm);
+    x[insn[1].rd] = xlen_sext(insn[1].imm);
+    x[insn[2].rd] = x[insn[2].rs2];
+    x[insn[3].rd] = xlen_sext(insn[3].imm);
+    FUSED_NEXT(4);
+}
+
+#undef FUSED_NEXT
+#endif
+
+#ifndef NO_IDIOM_OPS
+// Loop idioms work on host memory directly, through `&LOAD()`, and continue
+// wherever the loop would have left off. They're only ever found in blocks (see
+// idiom.h), whose guest memory is flat.
+// Each works out how many full passes the loop makes before the one leaving
+// it, and cuts that down to what the fuel allows before running its kernel.
+
+// Cuts `passes` down to LOOP_PASSES, and sets `left` to whether the loop still
+// gets to leave.
+#define LOOP_CLAMP(passes, left)                                               \
+    bool const left = (passes) < LOOP_PASSES;                                  \
+    if (!left)                                                                 \
+        passes = LOOP_PASSES;
+
+OP(idiom_scan) {
+    // lbu t, off(p); beq t, x0, end; addi p, p, ±1; jal x0, <this>.
+    // Every byte before the zero one is a full pass.
+    i32 const step = (i32)insn[2].imm;
+    u8 *host = &LOAD(u8, x[insn->rs1] + insn->imm);
+    u64 passes = (u32)((idiom_find_zero(host, step) - host) * step);
+    LOOP_CLAMP(passes, left);
+    x[insn->rs1] += (u32)passes * step;
+    LOOP_RETIRE(passes, left);
+    if (left) {
+        x[insn->rd] = 0;
+        JUMP(insn[1].imm);
+    }
+    x[insn->rd] = host[((i64)passes - 1) * step];
+    JUMP(PC);
+}
+OP(idiom_clear) {
+    // lbu t, off(p); beq t, x0, end; lbu t, off(p); addi t, t, <odd>;
+    // sb t, off(p); jal x0, <this>.
+    // The byte gets to zero after -byte / c full passes, modulo 256, dividing
+    // by the odd c being multiplying by its inverse. Newton's iteration gets
+    // that from c itself, which is its own inverse for the low 3 bits,
+    // doubling the bits that are right every time.
+    u32 const addr = x[insn->rs1] + insn->imm;
+    u8 const byte = LOAD(u8, addr), c = insn[3].imm;
+    u8 inverse = c;
+    inverse *= 2 - c * inverse;
+    inverse *= 2 - c * inverse;
+    u64 passes = (u8)(-byte * inverse);
+    LOOP_CLAMP(passes, left);
+    u8 const value = byte + passes * c;
+    if (passes != 0)
+        STORE(u8, addr, value);
+    x[insn->rd] = value;
+    LOOP_RETIRE(passes, left);
+    if (left)
+        JUMP(insn[1].imm);
+    JUMP(PC);
+}
+OP(idiom_strlen) {
+    // lbu t, off(p); addi p, p, ±1; bne t, x0, <this>.
+    // Every byte before the zero one is a full pass, and that one leaves.
+    i32 const step = (i32)insn[1].imm;
+    u8 *host = &LOAD(u8, x[insn->rs1] + insn->imm);
+    u64 passes = (u32)((idiom_find_zero(host, step) - host) * step);
+    LOOP_CLAMP(passes, left);
+    x[insn->rs1] += ((u32)passes + left) * step;
+    LOOP_RETIRE(passes, left);
+    if (left) {
+        x[insn->rd] = 0;
+        JUMP(PC_AFTER(3));
+    }
+    x[insn->rd] = host[((i64)passes - 1) * step];
+    JUMP(PC);
+}
+OP(idiom_memset) {
+    // sb v, off(p); addi p, p, 1; bne p, e, <this>.
+    // Every byte but the last is a full pass, and that one leaves. p == e is
+    // the whole address space.
+    u8 const p = insn->rs1;
+    u8 const e = insn[2].rs1 == p ? insn[2].rs2 : insn[2].rs1;
+    u32 const addr = x[p] + insn->imm;
+    u64 passes = (u32)(x[e] - x[p] - 1);
+    LOOP_CLAMP(passes, left);
+    u64 const n = passes + left;
+    if (addr + n <= (u64)UINT32_MAX + 1) {
+        memset(&LOAD(u8, addr), (u8)x[insn->rs2], n);
+    } else {
+        // Wraps around the address space, one byte at a time like the guest.
+        for (u64 i = 0; i < n; ++i)
+            STORE(u8, addr + i, x[insn->rs2]);
+    }
+    x[p] += n;
+    LOOP_RETIRE(passes, left);
+    if (left)
+        JUMP(PC_AFTER(3));
+    JUMP(PC);
+}
+OP(idiom_memcpy) {
+    // lbu t, so(s); sb t, do(d); addi s, s, 1; addi d, d, 1; bne s, e, <this>.
+    // Every byte but the last is a full pass, and that one leaves.
+    u8 const s = insn->rs1, d = insn[1].rs1;
+    u8 const e = insn[4].rs1 == s ? insn[4].rs2 : insn[4].rs1;
+    u32 const src = x[s] + insn->imm, dst = x[d] + insn[1].imm;
+    u64 passes = (u32)(x[e] - x[s] - 1);
+    LOOP_CLAMP(passes, left);
+    u64 const n = passes + left;
+    // Copying forwards onto a later part of the source repeats its start,
+    // which memmove() doesn't do.
+    if (src + n <= (u64)UINT32_MAX + 1 && dst + n <= (u64)UINT32_MAX + 1 &&
+        (dst <= src || dst - src >= n)) {
+        memmove(&LOAD(u8, dst), &LOAD(u8, src), n);
+    } else {
+        for (u64 i = 0; i < n; ++i)
+            STORE(u8, dst + i, LOAD(u8, src + i));
+    }
+    x[insn->rd] = LOAD(u8, dst + n - 1);
+    x[s] += n;
+    x[d] += n;
+    LOOP_RETIRE(passes, left);
+    if (left)
+        JUMP(PC_AFTER(5));
+    JUMP(PC);
+}
+
+#undef LOOP_CLAMP
+#endif
+
+OP(illegal) {
+    error("Refusing to execute: illegal instruction @ 0x%08x\n", PC);
+    FAULT();
+}
+#define X(name) OP(name)
+#ifdef NO_FUSED_OPS
+FUSED_OPS(X)
+#endif
+#ifdef NO_IDIOM_OPS
+IDIOM_OPS(X)
+#endif
+#undef X
+OP(undecoded) {
+    // Pre-decoders fill every slot, so reaching one of these is a bug in the
+    // engine rather than in the guest.
+    error("Reached undecoded instruction @ 0x%08x\n", PC);
+    FAULT();
+}
+OP(unimplemented) {
+    error("Refusing to execute: unimplemented instruction @ 0x%08x: ", PC);
+    dasm(stderr, insn->imm, PC);
+    fputc('\n', stderr);
+    FAULT();
+}
+
+#undef AUIPC
+#undef IMM
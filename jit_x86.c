@@ -0,0 +1,747 @@
+#include "jit_x86.h"
+#include "block.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "rv/decode.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+int jit_init(struct jit *jit, size_t code_size) {
+    jit->len = 0;
+    jit->compiled = 0;
+    jit->rejected = 0;
+    jit->cap = code_size;
+    jit->code = mmap(NULL, code_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+        return errno;
+    return 0;
+}
+
+void jit_destroy(struct jit *jit) { munmap(jit->code, jit->cap); }
+
+void jit_report(struct jit const *jit, FILE *out) {
+    fprintf(out,
+            "jit: %u blocks compiled, %u rejected, %zu of %zu code bytes\n",
+            jit->compiled, jit->rejected, jit->len, jit->cap);
+}
+
+#if defined(__x86_64__)
+
+// Register usage inside compiled blocks (System V ABI):
+// - rdi: guest register file (u32[33]).
+// - rsi: guest memory base.
+// - eax, ecx, edx: scratch. Guest addresses are computed in eax, so that
+//   32-bit wraparound and zero extension into rax come for free.
+enum host_reg {
+    host_eax = 0,
+    host_ecx = 1,
+    host_edx = 2,
+    host_rsi = 6,
+    host_rdi = 7,
+};
+
+// Condition codes, as used by jcc/setcc.
+enum host_cc {
+    cc_b = 0x2,
+    cc_ae = 0x3,
+    cc_e = 0x4,
+    cc_ne = 0x5,
+    cc_a = 0x7,
+    cc_l = 0xc,
+    cc_ge = 0xd,
+    cc_g = 0xf,
+};
+
+// Upper bound of bytes emitted for a single guest instruction.
+#define MAX_INSN_BYTES 48
+
+struct emitter {
+    u8 *at;
+};
+
+static void emit8(struct emitter *e, u8 byte) { *e->at++ = byte; }
+static void emit32(struct emitter *e, u32 val) {
+    memcpy(e->at, &val, sizeof(val));
+    e->at += sizeof(val);
+}
+
+// Emits a ModRM byte (and displacement) addressing `[rdi + 4 * guest]`.
+static void emit_guest_reg_operand(struct emitter *e, u8 host, u8 guest) {
+    u32 disp = guest * 4;
+    if (disp < 0x80) {
+        emit8(e, 0x40 | host << 3 | host_rdi);
+        emit8(e, disp);
+    } else {
+        emit8(e, 0x80 | host << 3 | host_rdi);
+        emit32(e, disp);
+    }
+}
+
+// host = x[guest]
+static void emit_load_guest(struct emitter *e, enum host_reg host, u8 guest) {
+    if (guest == 0) {
+        // xor host, host
+        emit8(e, 0x31);
+        emit8(e, 0xc0 | host << 3 | host);
+        return;
+    }
+    // mov host, [rdi + 4 * guest]
+    emit8(e, 0x8b);
+    emit_guest_reg_operand(e, host, guest);
+}
+
+// x[guest] = host
+static void emit_store_guest(struct emitter *e, u8 guest, enum host_reg host) {
+    if (guest == 0 || guest == DECODED_SINK_REG)
+        return;
+    // mov [rdi + 4 * guest], host
+    emit8(e, 0x89);
+    emit_guest_reg_operand(e, host, guest);
+}
+
+// mov host, imm32
+static void emit_mov_imm(struct emitter *e, enum host_reg host, u32 imm) {
+    emit8(e, 0xb8 + host);
+    emit32(e, imm);
+}
+
+// <op> eax, ecx, where `opcode` is the `r/m32, r32` form.
+static void emit_alu_eax_ecx(struct emitter *e, u8 opcode) {
+    emit8(e, opcode);
+    emit8(e, 0xc0 | host_ecx << 3 | host_eax);
+}
+
+// <op> eax, imm32, where `ext` is the /digit of opcode 0x81.
+static void emit_alu_eax_imm(struct emitter *e, u8 ext, u32 imm) {
+    emit8(e, 0x81);
+    emit8(e, 0xc0 | ext << 3 | host_eax);
+    emit32(e, imm);
+}
+
+// Emits a short jump, where `opcode` is jmp rel8 (0xeb) or 0x70 + a condition
+// code. Returns where the displacement goes, for emit_label() to fill in.
+static u8 *emit_jump8(struct emitter *e, u8 opcode) {
+    emit8(e, opcode);
+    emit8(e, 0);
+    return e->at - 1;
+}
+
+// Makes the short jump whose displacement is at `rel8` land here.
+static void emit_label(struct emitter *e, u8 *rel8) {
+    *rel8 = (u8)(e->at - (rel8 + 1));
+}
+
+enum alu_ext {
+    alu_add = 0,
+    alu_or = 1,
+    alu_and = 4,
+    alu_sub = 5,
+    alu_xor = 6,
+    alu_cmp = 7,
+};
+
+enum shift_ext {
+    shift_rol = 0,
+    shift_ror = 1,
+    shift_shl = 4,
+    shift_shr = 5,
+    shift_sar = 7,
+};
+
+// eax = (eax <cc> [operand]) ? 1 : 0, after a cmp.
+static void emit_setcc_eax(struct emitter *e, enum host_cc cc) {
+    // setcc al
+    emit8(e, 0x0f);
+    emit8(e, 0x90 | cc);
+    emit8(e, 0xc0);
+    // movzx eax, al
+    emit8(e, 0x0f);
+    emit8(e, 0xb6);
+    emit8(e, 0xc0);
+}
+
+// eax = <op> eax, for the two-byte `0f xx` opcodes taking eax as both
+// operands (movsx, movzx, bsf, bsr).
+static void emit_0f_eax_eax(struct emitter *e, u8 opcode) {
+    emit8(e, 0x0f);
+    emit8(e, opcode);
+    emit8(e, 0xc0 | host_eax << 3 | host_eax);
+}
+
+// cmov<cc> eax, ecx
+static void emit_cmov_eax_ecx(struct emitter *e, enum host_cc cc) {
+    emit8(e, 0x0f);
+    emit8(e, 0x40 | cc);
+    emit8(e, 0xc0 | host_eax << 3 | host_ecx);
+}
+
+// eax = x[rs1] + imm
+static void emit_address(struct emitter *e, struct decoded_insn const *insn) {
+    emit_load_guest(e, host_eax, insn->rs1);
+    if (insn->imm != 0)
+        emit_alu_eax_imm(e, alu_add, insn->imm);
+}
+
+// Emits `mov eax, target; ret`.
+static void emit_exit(struct emitter *e, u32 target) {
+    emit_mov_imm(e, host_eax, target);
+    emit8(e, 0xc3);
+}
+
+// Emits the `[rsi + rax]` memory operand, with `reg` in the ModRM reg field.
+static void emit_mem_operand(struct emitter *e, u8 reg) {
+    emit8(e, 0x04 | reg << 3);
+    // SIB: scale 1, index rax, base rsi.
+    emit8(e, host_eax << 3 | host_rsi);
+}
+
+// `next` is the guest address the block ends at, which is right after `insn`
+// for the instructions that need it: those ending the block.
+static bool emit_insn(struct emitter *e, struct decoded_insn const *insn,
+                      u32 next) {
+    switch ((enum decoded_op)insn->op) {
+    case dop_lui:
+    case dop_auipc:
+        if (insn->rd != DECODED_SINK_REG) {
+            emit_mov_imm(e, host_eax, insn->imm);
+            emit_store_guest(e, insn->rd, host_eax);
+        }
+        return true;
+    case dop_jal:
+        if (insn->rd != DECODED_SINK_REG) {
+            emit_mov_imm(e, host_eax, next);
+            emit_store_guest(e, insn->rd, host_eax);
+        }
+        emit_exit(e, insn->imm);
+        return true;
+    case dop_jalr:
+        emit_address(e, insn);
+        emit_alu_eax_imm(e, alu_and, ~1u);
+        if (insn->rd != DECODED_SINK_REG) {
+            emit_mov_imm(e, host_ecx, next);
+            emit_store_guest(e, insn->rd, host_ecx);
+        }
+        emit8(e, 0xc3);
+        return true;
+
+    case dop_beq:
+    case dop_bne:
+    case dop_blt:
+    case dop_bge:
+    case dop_bltu:
+    case dop_bgeu: {
+        // Jump over the taken exit when the condition doesn't hold.
+        static u8 const inverse[] = {
+            [dop_beq] = cc_ne, [dop_bne] = cc_e,   [dop_blt] = cc_ge,
+            [dop_bge] = cc_l,  [dop_bltu] = cc_ae, [dop_bgeu] = cc_b,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        emit_alu_eax_ecx(e, 0x39);
+        emit8(e, 0x70 | inverse[insn->op]);
+        // mov eax, imm32 (5 bytes) + ret (1 byte)
+        emit8(e, 6);
+        emit_exit(e, insn->imm);
+        return true;
+    }
+
+    case dop_lb:
+    case dop_lh:
+    case dop_lw:
+    case dop_lbu:
+    case dop_lhu: {
+        emit_address(e, insn);
+        switch ((enum decoded_op)insn->op) {
+        case dop_lb:
+            // movsx eax, byte [rsi + rax]
+            emit8(e, 0x0f);
+            emit8(e, 0xbe);
+            break;
+        case dop_lh:
+            // movsx eax, word [rsi + rax]
+            emit8(e, 0x0f);
+            emit8(e, 0xbf);
+            break;
+        case dop_lbu:
+            // movzx eax, byte [rsi + rax]
+            emit8(e, 0x0f);
+            emit8(e, 0xb6);
+            break;
+        case dop_lhu:
+            // movzx eax, word [rsi + rax]
+            emit8(e, 0x0f);
+            emit8(e, 0xb7);
+            break;
+        default:
+            // mov eax, [rsi + rax]
+            emit8(e, 0x8b);
+            break;
+        }
+        emit_mem_operand(e, host_eax);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+
+    case dop_sb:
+    case dop_sh:
+    case dop_sw:
+        emit_address(e, insn);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        if (insn->op == dop_sh)
+            emit8(e, 0x66);
+        // mov [rsi + rax], cl/cx/ecx
+        emit8(e, insn->op == dop_sb ? 0x88 : 0x89);
+        emit_mem_operand(e, host_ecx);
+        return true;
+
+    case dop_addi:
+    case dop_xori:
+    case dop_ori:
+    case dop_andi: {
+        static u8 const ext[] = {
+            [dop_addi] = alu_add,
+            [dop_xori] = alu_xor,
+            [dop_ori] = alu_or,
+            [dop_andi] = alu_and,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_alu_eax_imm(e, ext[insn->op], insn->imm);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+    case dop_slti:
+    case dop_sltiu:
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_alu_eax_imm(e, alu_cmp, insn->imm);
+        emit_setcc_eax(e, insn->op == dop_slti ? cc_l : cc_b);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_slli:
+    case dop_srli:
+    case dop_srai: {
+        static u8 const ext[] = {
+            [dop_slli] = shift_shl,
+            [dop_srli] = shift_shr,
+            [dop_srai] = shift_sar,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        // <shift> eax, imm8
+        emit8(e, 0xc1);
+        emit8(e, 0xc0 | ext[insn->op] << 3 | host_eax);
+        emit8(e, insn->imm);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+
+    case dop_add:
+    case dop_sub:
+    case dop_xor:
+    case dop_or:
+    case dop_and: {
+        static u8 const opcode[] = {
+            [dop_add] = 0x01, [dop_sub] = 0x29, [dop_xor] = 0x31,
+            [dop_or] = 0x09,  [dop_and] = 0x21,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        emit_alu_eax_ecx(e, opcode[insn->op]);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+    case dop_sll:
+    case dop_srl:
+    case dop_sra: {
+        static u8 const ext[] = {
+            [dop_sll] = shift_shl,
+            [dop_srl] = shift_shr,
+            [dop_sra] = shift_sar,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        // <shift> eax, cl. The host masks the count to 5 bits, like RISC-V.
+        emit8(e, 0xd3);
+        emit8(e, 0xc0 | ext[insn->op] << 3 | host_eax);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+    case dop_slt:
+    case dop_sltu:
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        emit_alu_eax_ecx(e, 0x39);
+        emit_setcc_eax(e, insn->op == dop_slt ? cc_l : cc_b);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+
+    case dop_mul:
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        // imul eax, ecx
+        emit8(e, 0x0f);
+        emit8(e, 0xaf);
+        emit8(e, 0xc0 | host_eax << 3 | host_ecx);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_mulh:
+    case dop_mulhsu:
+    case dop_mulhu:
+        // Both operands fit in 33 bits once extended, so the low half of a
+        // 64-bit imul is the full product.
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        if (insn->op != dop_mulhu) {
+            // movsxd rax, eax
+            emit8(e, 0x48);
+            emit8(e, 0x63);
+            emit8(e, 0xc0 | host_eax << 3 | host_eax);
+        }
+        if (insn->op == dop_mulh) {
+            // movsxd rcx, ecx
+            emit8(e, 0x48);
+            emit8(e, 0x63);
+            emit8(e, 0xc0 | host_ecx << 3 | host_ecx);
+        }
+        // imul rax, rcx; shr rax, 32
+        emit8(e, 0x48);
+        emit8(e, 0x0f);
+        emit8(e, 0xaf);
+        emit8(e, 0xc0 | host_eax << 3 | host_ecx);
+        emit8(e, 0x48);
+        emit8(e, 0xc1);
+        emit8(e, 0xc0 | shift_shr << 3 | host_eax);
+        emit8(e, 32);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_div:
+    case dop_divu:
+    case dop_rem:
+    case dop_remu: {
+        // The host faults where RISC-V has defined results, so division by
+        // zero, and signed division by -1 (which only overflows for
+        // INT32_MIN), are handled on the side.
+        bool const is_signed = insn->op == dop_div || insn->op == dop_rem;
+        bool const is_rem = insn->op == dop_rem || insn->op == dop_remu;
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        // test ecx, ecx; jz by_zero
+        emit8(e, 0x85);
+        emit8(e, 0xc0 | host_ecx << 3 | host_ecx);
+        u8 *by_zero = emit_jump8(e, 0x70 + cc_e);
+        u8 *by_minus_one = NULL;
+        if (is_signed) {
+            // cmp ecx, -1; je by_minus_one
+            emit8(e, 0x83);
+            emit8(e, 0xc0 | alu_cmp << 3 | host_ecx);
+            emit8(e, 0xff);
+            by_minus_one = emit_jump8(e, 0x70 + cc_e);
+            // cdq; idiv ecx
+            emit8(e, 0x99);
+            emit8(e, 0xf7);
+            emit8(e, 0xc0 | 7 << 3 | host_ecx);
+        } else {
+            // xor edx, edx; div ecx
+            emit8(e, 0x31);
+            emit8(e, 0xc0 | host_edx << 3 | host_edx);
+            emit8(e, 0xf7);
+            emit8(e, 0xc0 | 6 << 3 | host_ecx);
+        }
+        if (is_rem) {
+            // mov eax, edx
+            emit8(e, 0x89);
+            emit8(e, 0xc0 | host_edx << 3 | host_eax);
+        }
+        u8 *done[2];
+        u32 exits = 0;
+        done[exits++] = emit_jump8(e, 0xeb);
+        if (is_signed) {
+            emit_label(e, by_minus_one);
+            if (is_rem) {
+                // x % -1 is always 0: xor eax, eax
+                emit8(e, 0x31);
+                emit8(e, 0xc0 | host_eax << 3 | host_eax);
+            } else {
+                // neg eax, which leaves INT32_MIN as it is.
+                emit8(e, 0xf7);
+                emit8(e, 0xc0 | 3 << 3 | host_eax);
+            }
+            done[exits++] = emit_jump8(e, 0xeb);
+        }
+        // By zero, the quotient is all ones and the remainder the dividend.
+        emit_label(e, by_zero);
+        if (!is_rem)
+            emit_mov_imm(e, host_eax, UINT32_MAX);
+        for (u32 i = 0; i < exits; ++i)
+            emit_label(e, done[i]);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+
+    case dop_sh1add:
+    case dop_sh2add:
+    case dop_sh3add:
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        // lea eax, [rcx + rax * scale]
+        emit8(e, 0x8d);
+        emit8(e, 0x04 | host_eax << 3);
+        emit8(e, (insn->op - dop_sh1add + 1) << 6 | host_eax << 3 | host_ecx);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_andn:
+    case dop_orn:
+    case dop_xnor: {
+        static u8 const opcode[] = {
+            [dop_andn] = 0x21,
+            [dop_orn] = 0x09,
+            [dop_xnor] = 0x31,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        // not ecx
+        emit8(e, 0xf7);
+        emit8(e, 0xc0 | 2 << 3 | host_ecx);
+        emit_alu_eax_ecx(e, opcode[insn->op]);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+    case dop_clz:
+    case dop_ctz:
+        // bsr and bsf set ZF and leave eax alone for a zero operand, where
+        // RISC-V wants 32. bsr gives the index of the top bit, 31 - clz,
+        // which the final xor turns around, so it starts from 63.
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_mov_imm(e, host_ecx, insn->op == dop_clz ? 63 : 32);
+        emit_0f_eax_eax(e, insn->op == dop_clz ? 0xbd : 0xbc);
+        emit_cmov_eax_ecx(e, cc_e);
+        if (insn->op == dop_clz)
+            emit_alu_eax_imm(e, alu_xor, 31);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_cpop:
+        if (!__builtin_cpu_supports("popcnt"))
+            break;
+        emit_load_guest(e, host_eax, insn->rs1);
+        // popcnt eax, eax
+        emit8(e, 0xf3);
+        emit_0f_eax_eax(e, 0xb8);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_min:
+    case dop_minu:
+    case dop_max:
+    case dop_maxu: {
+        // Replaces rs1 with rs2 where rs1 is the wrong side of it.
+        static u8 const cc[] = {
+            [dop_min] = cc_g,
+            [dop_minu] = cc_a,
+            [dop_max] = cc_l,
+            [dop_maxu] = cc_b,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        emit_alu_eax_ecx(e, 0x39);
+        emit_cmov_eax_ecx(e, cc[insn->op]);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+    case dop_sext_b:
+    case dop_sext_h:
+    case dop_zext_h: {
+        // movsx eax, al; movsx eax, ax; movzx eax, ax
+        static u8 const opcode[] = {
+            [dop_sext_b] = 0xbe,
+            [dop_sext_h] = 0xbf,
+            [dop_zext_h] = 0xb7,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_0f_eax_eax(e, opcode[insn->op]);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+    case dop_rol:
+    case dop_ror:
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        // rol/ror eax, cl
+        emit8(e, 0xd3);
+        emit8(e, 0xc0 | (insn->op == dop_rol ? shift_rol : shift_ror) << 3 |
+                     host_eax);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_rori:
+        emit_load_guest(e, host_eax, insn->rs1);
+        // ror eax, imm8
+        emit8(e, 0xc1);
+        emit8(e, 0xc0 | shift_ror << 3 | host_eax);
+        emit8(e, insn->imm);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_orc_b:
+        // ecx = (eax & 0x7f7f7f7f) + 0x7f7f7f7f has the top bit of each byte
+        // set if any of its low 7 bits are. Or-ing in eax adds the top bit
+        // itself, and the multiplication spreads each top bit over its byte.
+        emit_load_guest(e, host_eax, insn->rs1);
+        // mov ecx, eax; and ecx, 0x7f7f7f7f; add ecx, 0x7f7f7f7f
+        emit8(e, 0x89);
+        emit8(e, 0xc0 | host_eax << 3 | host_ecx);
+        emit8(e, 0x81);
+        emit8(e, 0xc0 | alu_and << 3 | host_ecx);
+        emit32(e, 0x7f7f7f7f);
+        emit8(e, 0x81);
+        emit8(e, 0xc0 | alu_add << 3 | host_ecx);
+        emit32(e, 0x7f7f7f7f);
+        emit_alu_eax_ecx(e, 0x09);
+        // shr eax, 7
+        emit8(e, 0xc1);
+        emit8(e, 0xc0 | shift_shr << 3 | host_eax);
+        emit8(e, 7);
+        emit_alu_eax_imm(e, alu_and, 0x01010101);
+        // imul eax, eax, 0xff
+        emit8(e, 0x69);
+        emit8(e, 0xc0 | host_eax << 3 | host_eax);
+        emit32(e, 0xff);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_rev8:
+        emit_load_guest(e, host_eax, insn->rs1);
+        // bswap eax
+        emit8(e, 0x0f);
+        emit8(e, 0xc8 + host_eax);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    case dop_bclr:
+    case dop_bext:
+    case dop_binv:
+    case dop_bset: {
+        // btr/bt/btc/bts eax, ecx, which take the bit index modulo 32 for a
+        // register operand.
+        static u8 const opcode[] = {
+            [dop_bclr] = 0xb3,
+            [dop_bext] = 0xa3,
+            [dop_binv] = 0xbb,
+            [dop_bset] = 0xab,
+        };
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_load_guest(e, host_ecx, insn->rs2);
+        emit8(e, 0x0f);
+        emit8(e, opcode[insn->op]);
+        emit8(e, 0xc0 | host_ecx << 3 | host_eax);
+        if (insn->op == dop_bext)
+            emit_setcc_eax(e, cc_b);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+    case dop_bclri:
+    case dop_binvi:
+    case dop_bseti: {
+        static u8 const ext[] = {
+            [dop_bclri] = alu_and,
+            [dop_binvi] = alu_xor,
+            [dop_bseti] = alu_or,
+        };
+        u32 const bit = 1u << insn->imm;
+        emit_load_guest(e, host_eax, insn->rs1);
+        emit_alu_eax_imm(e, ext[insn->op], insn->op == dop_bclri ? ~bit : bit);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+    }
+    case dop_bexti:
+        emit_load_guest(e, host_eax, insn->rs1);
+        // shr eax, imm8
+        emit8(e, 0xc1);
+        emit8(e, 0xc0 | shift_shr << 3 | host_eax);
+        emit8(e, insn->imm);
+        emit_alu_eax_imm(e, alu_and, 1);
+        emit_store_guest(e, insn->rd, host_eax);
+        return true;
+
+    case dop_fence:
+        return true;
+    case dop_fence_i:
+        // Leaving the block is all it takes, see block_cache_watch_writes().
+        emit_exit(e, next);
+        return true;
+
+    case dop_undecoded:
+    case dop_illegal:
+    case dop_unimplemented:
+    // System calls may stop the guest, which compiled code can't.
+    case dop_ecall:
+    // Blocks are never fused.
+    case dop_fused_li:
+    case dop_fused_far_call:
+    case dop_fused_byte_update:
+    case dop_fused_ecall_args:
+    // Idioms run host library code, which is left to the interpreter.
+    case dop_idiom_scan:
+    case dop_idiom_clear:
+    case dop_idiom_strlen:
+    case dop_idiom_memset:
+    case dop_idiom_memcpy:
+    // The vector registers live outside of the guest registers compiled code
+    // is given.
+    case dop_vsetvli:
+    case dop_vsetivli:
+    case dop_vsetvl:
+    case dop_vle:
+    case dop_vlse:
+    case dop_vse:
+    case dop_vsse:
+    case dop_varith_vv:
+    case dop_varith_vx:
+    case dop_varith_vi:
+    case dop_vred:
+    case dop_vmv_x_s:
+    case dop_vmv_s_x:
+    // So do the floating-point registers and the CSRs.
+#define X(name) case dop_##name:
+        FLOAT_OPS(X)
+        CSR_OPS(X)
+    // Atomics need the reservation, and are rare enough to interpret.
+        ATOMIC_OPS(X)
+#undef X
+    case dop_count:
+        break;
+    }
+    return false;
+}
+
+bool jit_compile(struct jit *jit, struct block *block) {
+    // The trailing jal is part of the block's code too.
+    u32 const insn_count = block->count + 1;
+
+    if (jit->len + insn_count * MAX_INSN_BYTES > jit->cap) {
+        ++jit->rejected;
+        return false;
+    }
+
+    u8 *const start = jit->code + jit->len;
+    struct emitter e = {.at = start};
+
+    for (u32 i = 0; i < insn_count; ++i) {
+        if (!emit_insn(&e, &block->insns[i], block->end)) {
+            ++jit->rejected;
+            return false;
+        }
+    }
+
+    jit->len += e.at - start;
+    ++jit->compiled;
+    block->native = (native_block_fn *)start;
+    return true;
+}
+
+#else
+
+bool jit_compile(struct jit *jit, struct block *block) {
+    (void)block;
+    ++jit->rejected;
+    return false;
+}
+
+#endif
+
+// vim:sw=4
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "block.h"
+#include "common/types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// x86-64 backend for hot guest blocks.
+// A compiled block is a `native_block_fn`: it keeps guest registers in the
+// register file it's given, accesses guest memory relative to `memory`, and
+// returns the guest address to continue at.
+// Blocks containing anything the backend doesn't know how to emit are left to
+// the interpreter.
+
+// Number of times a block runs in the interpreter before it gets compiled.
+#define JIT_HOT_THRESHOLD 16
+
+struct jit {
+    // Executable code buffer. Code is only ever appended.
+    u8 *code;
+    size_t cap;
+    size_t len;
+    // Statistics.
+    u32 compiled;
+    u32 rejected;
+};
+
+// Returns 0 on success or an errno value.
+int jit_init(struct jit *jit, size_t code_size);
+
+void jit_destroy(struct jit *jit);
+
+// Prints how many blocks got compiled or left to the interpreter, and how much
+// of the code buffer they use.
+void jit_report(struct jit const *jit, FILE *out);
+
+// Compiles `block`, setting `block->native` on success.
+// Returns false if the block can't be compiled, in which case it must keep
+// running in the interpreter.
+bool jit_compile(struct jit *jit, struct block *block);
+
+// vim:ft=c
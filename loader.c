@@ -14,6 +14,31 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+// The ELF class of this build's guests, see rv/xlen.h.
+#if RV_XLEN == 64
+#define ELF_CLASS ELFCLASS64
+#define ELF_R_SYM ELF64_R_SYM
+#define ELF_R_TYPE ELF64_R_TYPE
+typedef Elf64_Ehdr Elf_Ehdr;
+typedef Elf64_Phdr Elf_Phdr;
+typedef Elf64_Shdr Elf_Shdr;
+typedef Elf64_Sym Elf_Sym;
+typedef Elf64_Rela Elf_Rela;
+typedef Elf64_Half Elf_Half;
+typedef Elf64_Word Elf_Word;
+#else
+#define ELF_CLASS ELFCLASS32
+#define ELF_R_SYM ELF32_R_SYM
+#define ELF_R_TYPE ELF32_R_TYPE
+typedef Elf32_Ehdr Elf_Ehdr;
+typedef Elf32_Phdr Elf_Phdr;
+typedef Elf32_Shdr Elf_Shdr;
+typedef Elf32_Sym Elf_Sym;
+typedef Elf32_Rela Elf_Rela;
+typedef Elf32_Half Elf_Half;
+typedef Elf32_Word Elf_Word;
+#endif
+
 static int mmap_file(int fd, void **file, size_t *filesz);
 
 int loader_read_raw(int fd, u32 data_segment_count,
@@ -24,6 +49,10 @@ int loader_read_raw(int fd, u32 data_segment_count,
         return code;
 
     exe->entrypoint = 0;
+    exe->text_offset = 0;
+    exe->text_size = exe->mem_count;
+    exe->compressed = false;
+    exe->segment_count = 0;
     if (data_segment_count > 0) {
         u32 page_size = sysconf(_SC_PAGESIZE);
 
@@ -42,10 +71,115 @@ int loader_read_raw(int fd, u32 data_segment_count,
         }
         exe->mem = wanted_start_addr;
         exe->entrypoint = aligned_count;
+        exe->text_offset = aligned_count;
+        exe->segments[exe->segment_count++] = (struct loaded_segment){
+            .vaddr = 0,
+            .size = aligned_count,
+            .offset = 0,
+            .flags = PF_R | PF_W,
+        };
+    }
+
+    // Raw images are laid out just like the guest expects them.
+    exe->segments[exe->segment_count++] = (struct loaded_segment){
+        .vaddr = exe->text_offset,
+        .size = exe->text_size,
+        .offset = exe->text_offset,
+        .flags = PF_R | PF_X,
+    };
+    exe->entry_vaddr = exe->entrypoint;
+    exe->text_vaddr = exe->text_offset;
+
+    return 0;
+}
+
+#if RV_XLEN == 32
+// Host protection for guest pages with `flags`. Guest code is only ever read
+// by the host, never run.
+static int segment_prot(u32 flags) {
+    int prot = PROT_NONE;
+    if (flags & (PF_R | PF_X))
+        prot |= PROT_READ;
+    if (flags & PF_W)
+        prot |= PROT_WRITE;
+    return prot;
+}
+
+int loader_reserve_address_space(struct loaded_exe *_Nonnull exe) {
+    u8 *space = mmap(NULL, LOADER_ADDRESS_SPACE_SIZE, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (space == MAP_FAILED) {
+        error("Could not reserve the guest address space: %s\n",
+              strerror(errno));
+        return errno;
     }
 
+    u32 const page_size = sysconf(_SC_PAGESIZE);
+    int code = 0;
+
+    // Fill in every segment first, since their pages may overlap.
+    for (u32 i = 0; i < exe->segment_count; ++i) {
+        struct loaded_segment const *segm = &exe->segments[i];
+        if (segm->size == 0)
+            continue;
+        u64 begin = segm->vaddr & ~(u64)(page_size - 1);
+        u64 end = align_upwards64((u64)segm->vaddr + segm->size, page_size);
+        if (mprotect(space + begin, end - begin, PROT_READ | PROT_WRITE) !=
+            0) {
+            code = errno;
+            error("Could not map segment @ 0x%08x: %s\n", segm->vaddr,
+                  strerror(code));
+            goto clean_space;
+        }
+        memcpy(space + segm->vaddr, (u8 *)exe->mem + segm->offset, segm->size);
+    }
+
+    // Then protect each segment's pages. Pages shared by several segments get
+    // all of their permissions, which only the first and last page of a
+    // segment can be.
+    for (u32 i = 0; i < exe->segment_count; ++i) {
+        struct loaded_segment const *segm = &exe->segments[i];
+        if (segm->size == 0)
+            continue;
+        u64 begin = segm->vaddr & ~(u64)(page_size - 1);
+        u64 end = align_upwards64((u64)segm->vaddr + segm->size, page_size);
+        for (u64 page = begin; page < end; page += page_size) {
+            bool boundary = page == begin || page + page_size == end;
+            u32 flags = segm->flags;
+            for (u32 j = 0; boundary && j < exe->segment_count; ++j) {
+                struct loaded_segment const *other = &exe->segments[j];
+                if (other->size != 0 && other->vaddr < page + page_size &&
+                    (u64)other->vaddr + other->size > page)
+                    flags |= other->flags;
+            }
+            // Interior pages all share the segment's own permissions.
+            u64 len = boundary ? page_size
+                               : (end - page_size) - page;
+            if (mprotect(space + page, len, segment_prot(flags)) != 0) {
+                code = errno;
+                error("Could not protect segment @ 0x%08x: %s\n",
+                      segm->vaddr, strerror(code));
+                goto clean_space;
+            }
+            page += len - page_size;
+        }
+    }
+
+    munmap(exe->mem, exe->mem_count);
+    exe->mem = space;
+    exe->mem_count = LOADER_ADDRESS_SPACE_SIZE;
+    exe->entrypoint = exe->entry_vaddr;
+    exe->text_offset = exe->text_vaddr;
+    for (u32 i = 0; i < exe->segment_count; ++i) {
+        exe->segments[i].offset = exe->segments[i].vaddr;
+    }
     return 0;
+
+clean_space:
+    munmap(space, LOADER_ADDRESS_SPACE_SIZE);
+    return code;
 }
+#endif
 
 void loader_destroy_exe(struct loaded_exe *_Nonnull exe) {
     munmap(exe->mem, exe->mem_count);
@@ -66,7 +200,7 @@ struct page_descr_list {
 struct loadable_segment {
     struct loadable_segment *next;
     size_t mem_offset;
-    Elf32_Phdr const *phdr;
+    Elf_Phdr const *phdr;
 };
 
 // To mantain order, nodes are appended to the list's end, but we can start
@@ -90,7 +224,7 @@ static struct page_descr *add_page(struct page_descr_list *list, size_t offset,
 static void set_page_end(struct page_descr *descr, size_t end_offset);
 static void destroy_page_list(struct page_descr_list *list);
 
-static bool find_offset_for_section(Elf32_Shdr const *section,
+static bool find_offset_for_section(Elf_Shdr const *section,
                                     struct loadable_segments_list list,
                                     u32 *result);
 
@@ -98,7 +232,7 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
     log("Begin loading image fd = %u\n", fd);
     union {
         void *begin;
-        Elf32_Ehdr *elf;
+        Elf_Ehdr *elf;
         unsigned char (*elf_ident)[16];
     } as;
     size_t file_size;
@@ -112,8 +246,8 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
     static char const expected_ident[] = {
         // EI_MAG*
         0x7f, 'E', 'L', 'F',
-        // EI_CLASS == ELFCLASS32
-        ELFCLASS32,
+        // EI_CLASS == ELFCLASS32, or ELFCLASS64 for RV64
+        ELF_CLASS,
         // EI_DATA == ELFDATA2LSB
         ELFDATA2LSB,
         // EI_VERSION == EV_CURRENT
@@ -127,9 +261,10 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
     };
 
     if (memcmp(as.elf_ident, expected_ident, sizeof(expected_ident)) != 0) {
-        fputs("(error) Bad ELF magic: Should be 32-bit LSB ELF file for SysV "
-              "v0.\n",
-              stderr);
+        fprintf(stderr,
+                "(error) Bad ELF magic: Should be %d-bit LSB ELF file for "
+                "SysV v0.\n",
+                RV_XLEN);
         code = ENOEXEC;
         goto clean_mapped;
     }
@@ -148,14 +283,30 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
         code = ENOEXEC;
     }
 
-    // TODO: If the ELF file has RVC flag set, then alignment can be 16-bit.
+    // With the RVC flag set, text may hold compressed instructions, which only
+    // need to be aligned to 2 bytes.
+    exe->compressed = as.elf->e_flags & EF_RISCV_RVC;
+    if (as.elf->e_entry & (exe->compressed ? 0b1 : 0b11)) {
+        error("Entrypoint 0x%08lx is not aligned to %u bytes\n",
+              (u64)as.elf->e_entry, exe->compressed ? 2 : 4);
+        code = ENOEXEC;
+        goto clean_mapped;
+    }
+#if RV_XLEN == 64
+    // Guest code must be in the low 4 GiB, see rv/xlen.h.
+    if (as.elf->e_entry > UINT32_MAX) {
+        error("Entrypoint 0x%lx is past 4 GiB\n", (u64)as.elf->e_entry);
+        code = ENOEXEC;
+        goto clean_mapped;
+    }
+#endif
 
     struct loadable_segments_list memory_segms = {0};
 
     bool found_any_exec_segment = false;
-    Elf32_Phdr const *segments = as.begin + as.elf->e_phoff;
+    Elf_Phdr const *segments = as.begin + as.elf->e_phoff;
 
-    if (!__builtin_expect(as.elf->e_phentsize == sizeof(Elf32_Phdr), 1)) {
+    if (!__builtin_expect(as.elf->e_phentsize == sizeof(Elf_Phdr), 1)) {
         if (as.elf->e_phentsize == 0) {
             fputs("(error): This file doesn't have any executable code!\n",
                   stderr);
@@ -164,7 +315,7 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
         }
     }
 
-    for (Elf32_Half i = 0; i < as.elf->e_phnum; ++i) {
+    for (Elf_Half i = 0; i < as.elf->e_phnum; ++i) {
         if (segments[i].p_type == PT_LOAD) {
             add_segment(&memory_segms)->phdr = &segments[i];
             found_any_exec_segment |=
@@ -184,7 +335,7 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
 
     // Since the segments are stored in order, we know that the first loadable
     // segment has the lowest virtual address.
-    uint32_t starting_virtual_address = memory_segms.head->phdr->p_vaddr;
+    uxlen starting_virtual_address = memory_segms.head->phdr->p_vaddr;
 
     size_t const page_size = sysconf(_SC_PAGESIZE);
 
@@ -238,7 +389,7 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
                 add_page(&pages, next_segment_offset, segm->phdr->p_flags);
         }
 
-        uint32_t segm_virtual_end = segm->phdr->p_vaddr + segm->phdr->p_memsz;
+        uxlen segm_virtual_end = segm->phdr->p_vaddr + segm->phdr->p_memsz;
 
         // Ensure we patch the entrypoint so that it's correctly based on our
         // offset.
@@ -268,7 +419,7 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
     for (struct loadable_segment *segm = memory_segms.head; segm != NULL;
          segm = segm->next) {
 
-        log("segm filesz  = 0x%x\n", segm->phdr->p_filesz);
+        log("segm filesz  = 0x%lx\n", (u64)segm->phdr->p_filesz);
         log("segm offset = 0x%lx\n", segm->mem_offset);
 
         memcpy(memory + segm->mem_offset, as.begin + segm->phdr->p_offset,
@@ -281,27 +432,68 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
         }
     }
 
-    Elf32_Shdr const *sections = as.begin + as.elf->e_shoff;
+    // Record the span covering every executable segment, so that engines can
+    // translate the code ahead of running it.
+    size_t text_begin = full_memory_image_size, text_end = 0;
+    exe->segment_count = 0;
+    for (struct loadable_segment *segm = memory_segms.head; segm != NULL;
+         segm = segm->next) {
+        if (exe->segment_count == LOADER_MAX_SEGMENTS) {
+            error("More than %u loadable segments, refusing to execute\n",
+                  LOADER_MAX_SEGMENTS);
+            code = ENOEXEC;
+            goto clean_mapped_exe;
+        }
+        exe->segments[exe->segment_count++] = (struct loaded_segment){
+            .vaddr = segm->phdr->p_vaddr,
+            .size = segm->phdr->p_memsz,
+            .offset = segm->mem_offset,
+            .flags = segm->phdr->p_flags,
+        };
+
+        if (!(segm->phdr->p_flags & PF_X))
+            continue;
+#if RV_XLEN == 64
+        // Like the entrypoint, code must be in the low 4 GiB, both in the
+        // guest and in the image.
+        if (segm->phdr->p_vaddr + segm->phdr->p_memsz > 1ul << 32 ||
+            segm->mem_offset + segm->phdr->p_memsz > 1ul << 32) {
+            error("Executable segment @ 0x%lx is past 4 GiB, refusing to "
+                  "execute\n",
+                  (u64)segm->phdr->p_vaddr);
+            code = ENOEXEC;
+            goto clean_mapped_exe;
+        }
+#endif
+        if (segm->mem_offset < text_begin) {
+            text_begin = segm->mem_offset;
+            exe->text_vaddr = segm->phdr->p_vaddr;
+        }
+        if (segm->mem_offset + segm->phdr->p_memsz > text_end)
+            text_end = segm->mem_offset + segm->phdr->p_memsz;
+    }
+
+    Elf_Shdr const *sections = as.begin + as.elf->e_shoff;
     char const *shnames =
         as.elf->e_shoff == 0
             ? NULL
             : as.begin + sections[as.elf->e_shstrndx].sh_offset;
-    for (Elf32_Half i = 0; i < as.elf->e_shnum; ++i) {
-        Elf32_Shdr const *rela_shdr = &sections[i];
+    for (Elf_Half i = 0; i < as.elf->e_shnum; ++i) {
+        Elf_Shdr const *rela_shdr = &sections[i];
         char const *shname =
             shnames == 0 ? NULL : (shnames + rela_shdr->sh_name);
         if (rela_shdr->sh_type == SHT_RELA) {
             log("Found relocation table '%s'\n", shname);
-            Elf32_Shdr const *symtab = &sections[rela_shdr->sh_link];
-            Elf32_Sym const *syms = as.begin + symtab->sh_offset;
+            Elf_Shdr const *symtab = &sections[rela_shdr->sh_link];
+            Elf_Sym const *syms = as.begin + symtab->sh_offset;
             char const *sym_names =
                 as.begin + sections[symtab->sh_link].sh_offset;
-            assert(rela_shdr->sh_entsize == sizeof(Elf32_Rela));
+            assert(rela_shdr->sh_entsize == sizeof(Elf_Rela));
 
-            Elf32_Word rela_count = rela_shdr->sh_size / sizeof(Elf32_Rela);
+            Elf_Word rela_count = rela_shdr->sh_size / sizeof(Elf_Rela);
             log("Have %u relocations\n", rela_count);
 
-            Elf32_Rela const *relatbl = as.begin + rela_shdr->sh_offset;
+            Elf_Rela const *relatbl = as.begin + rela_shdr->sh_offset;
 
             u32 patch_base;
             if (!find_offset_for_section(&sections[rela_shdr->sh_info],
@@ -318,20 +510,20 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
                 shnames ? shnames + sections[rela_shdr->sh_info].sh_name : NULL,
                 patch_base);
 
-            for (Elf32_Word i = 0; i < rela_count; ++i) {
-                Elf32_Rela const *rela = &relatbl[i];
+            for (Elf_Word i = 0; i < rela_count; ++i) {
+                Elf_Rela const *rela = &relatbl[i];
 
-                u32 const sym_ndx = ELF32_R_SYM(rela->r_info);
+                u32 const sym_ndx = ELF_R_SYM(rela->r_info);
 
                 u32 const sym_shndx = syms[sym_ndx].st_shndx;
 
-                log("Relocation @  0x%x S =  '%s' (0x%x from '%s') using type "
-                    "= "
+                log("Relocation @  0x%lx S =  '%s' (0x%lx from '%s') using "
+                    "type = "
                     "%u\n",
-                    rela->r_offset, sym_names + syms[sym_ndx].st_name,
-                    syms[sym_ndx].st_value,
+                    (u64)rela->r_offset, sym_names + syms[sym_ndx].st_name,
+                    (u64)syms[sym_ndx].st_value,
                     sections[sym_shndx].sh_name + shnames,
-                    ELF32_R_TYPE(rela->r_info));
+                    (u32)ELF_R_TYPE(rela->r_info));
                 u32 sym_base;
                 if (!find_offset_for_section(&sections[sym_shndx], memory_segms,
                                              &sym_base)) {
@@ -344,7 +536,7 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
                 }
                 u32 s = sym_base + syms[sym_ndx].st_value;
                 log("S = 0x%x\n", s);
-                switch (ELF32_R_TYPE(rela->r_info)) {
+                switch (ELF_R_TYPE(rela->r_info)) {
                 case R_RISCV_HI20: {
                     u32 result = s + rela->r_addend;
 
@@ -359,7 +551,7 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
 
                 default:
                     error("Unknown relocation %u, refusing to execute\n",
-                          ELF32_R_TYPE(rela->r_info));
+                          (u32)ELF_R_TYPE(rela->r_info));
                     code = ENOEXEC;
                     goto clean_mapped_exe;
                 }
@@ -392,6 +584,9 @@ int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe) {
     exe->mem = memory;
     exe->mem_count = full_memory_image_size;
     exe->entrypoint = as.elf->e_entry - starting_virtual_address;
+    exe->entry_vaddr = as.elf->e_entry;
+    exe->text_offset = text_begin;
+    exe->text_size = text_end - text_begin;
 
     log("Finished loading image from fd = %u\n", fd);
 
@@ -414,13 +609,13 @@ clean_none:
 
 // TODO: this *will* be slow for multiple relocations. Cache this with a table
 // section index <-> lazy-loaded result (or error)
-static bool find_offset_for_section(Elf32_Shdr const *section,
+static bool find_offset_for_section(Elf_Shdr const *section,
                                     struct loadable_segments_list segms,
                                     u32 *result) {
     for (struct loadable_segment *segm = segms.head; segm != NULL;
          segm = segm->next) {
-        u32 virt_start = segm->phdr->p_vaddr;
-        u32 virt_end = segm->phdr->p_vaddr + segm->phdr->p_memsz;
+        uxlen virt_start = segm->phdr->p_vaddr;
+        uxlen virt_end = segm->phdr->p_vaddr + segm->phdr->p_memsz;
         // I'm not taking the section size into account; should I?
         // It doesn't really make sense to have a section outside the segment,
         // since sections have to be fully contained inside segments.
@@ -2,6 +2,7 @@
 #pragma once
 
 #include "common/types.h"
+#include "rv/xlen.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -10,17 +11,60 @@
 #define _Nonnull
 #endif
 
+// Size of the region loader_reserve_address_space() maps the guest into: every
+// 32-bit address, plus some room for accesses that start at the very end.
+#define LOADER_ADDRESS_SPACE_SIZE ((1ul << 32) + (1ul << 16))
+
+// Upper bound on the loadable segments described by `struct loaded_exe`.
+#define LOADER_MAX_SEGMENTS 16
+
+// Where a loadable segment ended up.
+struct loaded_segment {
+    // Guest virtual address and size the program expects it at.
+    uxlen vaddr;
+    uxlen size;
+    // Where it lives in the packed image, as an offset from `mem`.
+    uxlen offset;
+    // Permissions, as PF_R, PF_W and PF_X from <elf.h>.
+    u32 flags;
+};
+
 struct loaded_exe {
     void *_Nonnull mem;
     size_t mem_count;
     uint64_t entrypoint;
+    // Span of `mem` that holds executable code, as offsets from `mem`.
+    u32 text_offset;
+    u32 text_size;
+    // Whether the text may hold compressed instructions (the C extension).
+    bool compressed;
+    // Guest virtual addresses of the entrypoint and of `text_offset`, for
+    // engines that don't run off the packed image.
+    u32 entry_vaddr;
+    u32 text_vaddr;
+    u32 segment_count;
+    struct loaded_segment segments[LOADER_MAX_SEGMENTS];
 };
 
+// Loads an ELF executable for the guests of this build: ELFCLASS32 ones, or
+// ELFCLASS64 ones for RV64 (see rv/xlen.h), whose code must be in the low
+// 4 GiB.
 int loader_read_elf(int fd, struct loaded_exe *_Nonnull exe);
 
 int loader_read_raw(int fd, u32 data_segment_size,
                     struct loaded_exe *_Nonnull exe);
 
+// Moves the image of `exe` into a freshly reserved region of
+// LOADER_ADDRESS_SPACE_SIZE bytes, with every segment at its virtual address
+// and with its permissions, and everything else inaccessible. Afterwards, guest
+// addresses and offsets from `mem` are the same thing, so engines can run
+// without checking accesses: the bad ones end up in SIGSEGV. Returns 0 on
+// success or an errno value, leaving `exe` untouched on failure.
+// Only in RV32 builds.
+#if RV_XLEN == 32
+int loader_reserve_address_space(struct loaded_exe *_Nonnull exe);
+#endif
+
 void loader_destroy_exe(struct loaded_exe *_Nonnull exe);
 
 // vim:sw=4:ft=c
@@ -0,0 +1,133 @@
+#include "mmu.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "loader.h"
+#include <elf.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_BITS 10
+#define TABLE_SIZE (1u << TABLE_BITS)
+
+static void tlb_flush(struct mmu *mmu) {
+    for (u32 i = 0; i <= mmu->tlb_mask; ++i) {
+        mmu->tlb[i] = (struct mmu_tlb_entry){.read_tag = 1, .write_tag = 1};
+    }
+}
+
+int mmu_init(struct mmu *mmu, u32 tlb_entries) {
+    if (tlb_entries == 0 || (tlb_entries & (tlb_entries - 1)) != 0)
+        return EINVAL;
+
+    memset(mmu->directory, 0, sizeof(mmu->directory));
+    mmu->tlb = malloc(tlb_entries * sizeof(*mmu->tlb));
+    if (mmu->tlb == NULL)
+        return ENOMEM;
+    mmu->tlb_mask = tlb_entries - 1;
+    mmu->tlb_hits = 0;
+    mmu->tlb_misses = 0;
+    tlb_flush(mmu);
+    return 0;
+}
+
+void mmu_destroy(struct mmu *mmu) {
+    for (u32 i = 0; i < TABLE_SIZE; ++i) {
+        free(mmu->directory[i]);
+    }
+    free(mmu->tlb);
+}
+
+// Returns the page table entry for `vaddr`, creating its table if `create`.
+static struct mmu_pte *lookup_pte(struct mmu *mmu, u32 vaddr, bool create) {
+    struct mmu_pte **table = &mmu->directory[vaddr >> (MMU_PAGE_BITS + 10)];
+    if (*table == NULL) {
+        if (!create || (*table = calloc(TABLE_SIZE, sizeof(**table))) == NULL)
+            return NULL;
+    }
+    return &(*table)[(vaddr >> MMU_PAGE_BITS) & (TABLE_SIZE - 1)];
+}
+
+int mmu_map(struct mmu *mmu, u32 vaddr, void *host, u32 size, u8 perms) {
+    if (size == 0)
+        return 0;
+    if (((uintptr_t)host & MMU_PAGE_MASK) != (vaddr & MMU_PAGE_MASK)) {
+        error("Can't map 0x%08x to %p: they're not at the same page offset\n",
+              vaddr, host);
+        return EINVAL;
+    }
+
+    u8 *page_host = (u8 *)host - (vaddr & MMU_PAGE_MASK);
+    u32 page = vaddr & ~MMU_PAGE_MASK;
+    u32 last_page = (vaddr + (size - 1)) & ~MMU_PAGE_MASK;
+    for (;; page += MMU_PAGE_SIZE, page_host += MMU_PAGE_SIZE) {
+        struct mmu_pte *pte = lookup_pte(mmu, page, true);
+        if (pte == NULL)
+            return ENOMEM;
+        // Segments sharing a page share its permissions too.
+        if (pte->host != NULL && pte->host != page_host) {
+            error("Page 0x%08x is already mapped elsewhere\n", page);
+            return EEXIST;
+        }
+        pte->host = page_host;
+        pte->perms |= perms;
+        if (page == last_page)
+            break;
+    }
+
+    tlb_flush(mmu);
+    return 0;
+}
+
+int mmu_map_exe(struct mmu *mmu, struct loaded_exe const *exe) {
+    for (u32 i = 0; i < exe->segment_count; ++i) {
+        struct loaded_segment const *segm = &exe->segments[i];
+        u8 perms = (segm->flags & PF_R ? mmu_read : 0) |
+                   (segm->flags & PF_W ? mmu_write : 0) |
+                   (segm->flags & PF_X ? mmu_exec : 0);
+        int code = mmu_map(mmu, segm->vaddr, (u8 *)exe->mem + segm->offset,
+                           segm->size, perms);
+        if (code != 0)
+            return code;
+    }
+    return 0;
+}
+
+void *mmu_translate_slow(struct mmu *mmu, u32 vaddr, u32 size,
+                         enum mmu_access access) {
+    ++mmu->tlb_misses;
+
+    struct mmu_pte const *pte = lookup_pte(mmu, vaddr, false);
+    if (pte == NULL || pte->host == NULL || !(pte->perms & access))
+        return NULL;
+
+    u32 offset = vaddr & MMU_PAGE_MASK;
+    if (offset + size > MMU_PAGE_SIZE) {
+        // Accesses straddling two pages work when both allow them, and the
+        // host has them next to each other. They're never cached.
+        struct mmu_pte const *next =
+            lookup_pte(mmu, vaddr + MMU_PAGE_SIZE, false);
+        if (next == NULL || next->host != pte->host + MMU_PAGE_SIZE ||
+            !(next->perms & access))
+            return NULL;
+        return pte->host + offset;
+    }
+
+    struct mmu_tlb_entry *entry =
+        &mmu->tlb[(vaddr >> MMU_PAGE_BITS) & mmu->tlb_mask];
+    u32 page = vaddr & ~MMU_PAGE_MASK;
+    entry->read_tag = pte->perms & mmu_read ? page : 1;
+    entry->write_tag = pte->perms & mmu_write ? page : 1;
+    entry->addend = (uintptr_t)pte->host - page;
+    return pte->host + offset;
+}
+
+void mmu_report(struct mmu const *mmu, FILE *out) {
+    u64 total = mmu->tlb_hits + mmu->tlb_misses;
+    fprintf(out, "tlb: %u entries, %lu hits, %lu misses (%.2f%% hit rate)\n",
+            mmu->tlb_mask + 1, (unsigned long)mmu->tlb_hits,
+            (unsigned long)mmu->tlb_misses,
+            total == 0 ? 0.0 : 100.0 * mmu->tlb_hits / total);
+}
+
+// vim:sw=4
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common/types.h"
+#include "loader.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Software MMU.
+// Guest addresses are translated through a two-level page table (like Sv32:
+// 10 bits of directory, 10 bits of table, 12 bits of page offset) into host
+// pointers, with permissions per page. A direct-mapped software TLB in front
+// of it keeps the common case to a single compare: each entry caches one page
+// as a host addend, with separate tags for reads and writes so that the
+// permission check is part of the tag compare.
+
+#define MMU_PAGE_BITS 12
+#define MMU_PAGE_SIZE (1u << MMU_PAGE_BITS)
+#define MMU_PAGE_MASK (MMU_PAGE_SIZE - 1)
+
+// Default number of TLB entries.
+#define MMU_TLB_ENTRIES 256
+
+enum mmu_access {
+    mmu_read = 1 << 0,
+    mmu_write = 1 << 1,
+    mmu_exec = 1 << 2,
+};
+
+struct mmu_pte {
+    // Host address of the page, or NULL when it's not mapped.
+    u8 *host;
+    // `enum mmu_access` bits allowed on the page.
+    u8 perms;
+};
+
+struct mmu_tlb_entry {
+    // Page address the entry allows reading and writing, or an odd value when
+    // it doesn't (pages are aligned, so that never matches).
+    u32 read_tag;
+    u32 write_tag;
+    // Host address of a guest address `a` in the page is `addend + a`.
+    uintptr_t addend;
+};
+
+struct mmu {
+    // directory[vaddr >> 22] is the table for that 4 MiB, NULL if it has
+    // nothing mapped. Tables are indexed by `(vaddr >> 12) & 1023`.
+    struct mmu_pte *directory[1024];
+    struct mmu_tlb_entry *tlb;
+    u32 tlb_mask;
+    u64 tlb_hits;
+    u64 tlb_misses;
+};
+
+// Initializes an empty address space with a TLB of `tlb_entries` entries,
+// which must be a power of two. Returns 0 on success or an errno value.
+int mmu_init(struct mmu *mmu, u32 tlb_entries);
+
+void mmu_destroy(struct mmu *mmu);
+
+// Maps `size` bytes of guest memory at `vaddr` to `host`, allowing `perms`.
+// Whole pages get mapped, so `host` must have the same offset into a page as
+// `vaddr`. Returns 0 on success or an errno value.
+int mmu_map(struct mmu *mmu, u32 vaddr, void *host, u32 size, u8 perms);
+
+// Maps every segment of `exe` at its virtual address.
+int mmu_map_exe(struct mmu *mmu, struct loaded_exe const *exe);
+
+// Returns the host address of `vaddr` for an access of `size` bytes, or NULL
+// if the guest isn't allowed to make it. Refills the TLB.
+void *mmu_translate_slow(struct mmu *mmu, u32 vaddr, u32 size,
+                         enum mmu_access access);
+
+// Same, going through the TLB first. `access` must be mmu_read or mmu_write.
+static inline void *mmu_translate(struct mmu *mmu, u32 vaddr, u32 size,
+                                  enum mmu_access access) {
+    struct mmu_tlb_entry const *entry =
+        &mmu->tlb[(vaddr >> MMU_PAGE_BITS) & mmu->tlb_mask];
+    u32 tag = access == mmu_write ? entry->write_tag : entry->read_tag;
+    if (__builtin_expect(tag == (vaddr & ~MMU_PAGE_MASK) &&
+                             (vaddr & MMU_PAGE_MASK) + size <= MMU_PAGE_SIZE,
+                         1)) {
+        ++mmu->tlb_hits;
+        return (void *)(entry->addend + vaddr);
+    }
+    return mmu_translate_slow(mmu, vaddr, size, access);
+}
+
+// Prints TLB hit and miss counts.
+void mmu_report(struct mmu const *mmu, FILE *out);
+
+// vim:ft=c
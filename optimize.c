@@ -0,0 +1,541 @@
+#include "optimize.h"
+#include "block.h"
+#include "common/types.h"
+#include "rv/bits.h"
+#include "rv/decode.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+// How many memory facts and pending stores are tracked at once. Blocks are
+// short, and anything past this is simply not optimized.
+#define MAX_TRACKED 16
+
+// What a register is known to hold about some bytes of guest memory.
+struct mem_fact {
+    // The bytes at `x[base] + offset`, `width` bytes long...
+    u8 base;
+    u8 width;
+    i32 offset;
+    // ...are the low bytes of `x[value]`.
+    u8 value;
+    // How the rest of `x[value]` relates to them.
+    enum extension { ext_none, ext_zero, ext_sign } ext;
+};
+
+// A store that may still turn out to be dead, i.e. overwritten before
+// anything reads it.
+struct pending_store {
+    u32 index;
+    u8 base;
+    u8 width;
+    i32 offset;
+};
+
+struct optimizer {
+    struct decoded_insn *insns;
+    // Instructions that get dropped when compacting.
+    bool dead[BLOCK_MAX_INSNS];
+    // known[r] tells whether x[r] is a known constant, held in values[r].
+    bool known[DECODED_SINK_REG + 1];
+    u32 values[DECODED_SINK_REG + 1];
+    struct mem_fact facts[MAX_TRACKED];
+    u32 fact_count;
+    struct pending_store stores[MAX_TRACKED];
+    u32 store_count;
+};
+
+static bool is_alu_imm(enum decoded_op op) {
+    return op >= dop_addi && op <= dop_srai;
+}
+
+static bool is_alu_reg(enum decoded_op op) {
+    return op >= dop_add && op <= dop_and;
+}
+
+static bool is_branch(enum decoded_op op) {
+    return op >= dop_beq && op <= dop_bgeu;
+}
+
+static bool is_load(enum decoded_op op) {
+    return op >= dop_lb && op <= dop_lhu;
+}
+
+static bool is_store(enum decoded_op op) {
+    return op >= dop_sb && op <= dop_sw;
+}
+
+// Returns whether `op` is a vector instruction. Those name vector registers in
+// rd, except the ones that write a scalar result.
+static bool is_vector(enum decoded_op op) {
+    return op >= dop_vsetvli && op <= dop_vmv_s_x;
+}
+
+static bool writes_vector(enum decoded_op op) {
+    return is_vector(op) && op != dop_vsetvli && op != dop_vsetivli &&
+           op != dop_vsetvl && op != dop_vmv_x_s;
+}
+
+// Returns whether `op` is a floating-point instruction that writes a
+// floating-point register, which is what rd names then.
+static bool writes_float(enum decoded_op op) {
+    return op >= dop_flw && op <= dop_fcvt_d_s;
+}
+
+static bool is_atomic(enum decoded_op op) {
+    return op >= dop_lr_w && op <= dop_amomaxu_w;
+}
+
+static bool is_float_access(enum decoded_op op) {
+    return op == dop_flw || op == dop_fld || op == dop_fsw || op == dop_fsd;
+}
+
+// Returns whether `op` stops the guest instead of running.
+static bool is_fault(enum decoded_op op) {
+    return op == dop_illegal || op == dop_undecoded || op == dop_unimplemented;
+}
+
+// Returns whether `insn` writes `insn->rd`.
+static bool writes_rd(struct decoded_insn const *insn) {
+    enum decoded_op op = insn->op;
+    return !is_branch(op) && !is_store(op) && !is_fault(op) &&
+           !writes_vector(op) && !writes_float(op) && op != dop_fsw &&
+           op != dop_fsd;
+}
+
+// Returns whether `insn` may read `insn->rs1` and `insn->rs2`. Operations
+// this file doesn't know about are assumed to read both.
+static bool reads_rs1(struct decoded_insn const *insn) {
+    enum decoded_op op = insn->op;
+    return op != dop_lui && op != dop_auipc && op != dop_jal && !is_fault(op);
+}
+static bool reads_rs2(struct decoded_insn const *insn) {
+    enum decoded_op op = insn->op;
+    return reads_rs1(insn) && op != dop_jalr && !is_load(op) &&
+           !is_alu_imm(op);
+}
+
+// Returns the result of the ALU operation `op` on `a` and `b`, where `b` is
+// either rs2 or the immediate.
+static u32 alu(enum decoded_op op, u32 a, u32 b) {
+    switch (op) {
+    case dop_addi:
+    case dop_add:
+        return a + b;
+    case dop_sub:
+        return a - b;
+    case dop_slti:
+    case dop_slt:
+        return bit_cast_i32(a) < bit_cast_i32(b);
+    case dop_sltiu:
+    case dop_sltu:
+        return a < b;
+    case dop_xori:
+    case dop_xor:
+        return a ^ b;
+    case dop_ori:
+    case dop_or:
+        return a | b;
+    case dop_andi:
+    case dop_and:
+        return a & b;
+    case dop_slli:
+    case dop_sll:
+        return a << (b & 0x1f);
+    case dop_srli:
+    case dop_srl:
+        return a >> (b & 0x1f);
+    case dop_srai:
+    case dop_sra:
+        return bit_cast_i32(a) >> (b & 0x1f);
+    default:
+        assert(false && "not an ALU operation");
+        return 0;
+    }
+}
+
+// Returns whether the branch `op` is taken for `a` and `b`.
+static bool branch_taken(enum decoded_op op, u32 a, u32 b) {
+    switch (op) {
+    case dop_beq:
+        return a == b;
+    case dop_bne:
+        return a != b;
+    case dop_blt:
+        return bit_cast_i32(a) < bit_cast_i32(b);
+    case dop_bge:
+        return bit_cast_i32(a) >= bit_cast_i32(b);
+    case dop_bltu:
+        return a < b;
+    case dop_bgeu:
+        return a >= b;
+    default:
+        assert(false && "not a branch");
+        return false;
+    }
+}
+
+// Immediate form of each register-register operation, for when rs2 is known.
+static u8 const imm_form[dop_count] = {
+    [dop_add] = dop_addi,  [dop_sub] = dop_addi,   [dop_sll] = dop_slli,
+    [dop_slt] = dop_slti,  [dop_sltu] = dop_sltiu, [dop_xor] = dop_xori,
+    [dop_srl] = dop_srli,  [dop_sra] = dop_srai,   [dop_or] = dop_ori,
+    [dop_and] = dop_andi,
+};
+
+static struct decoded_insn load_constant(u8 rd, u32 value) {
+    return (struct decoded_insn){.op = dop_lui, .rd = rd, .imm = value};
+}
+
+// Rewrites `insn` in terms of the registers known to be constant. `end` is
+// where the block falls through to, which is where a branch does when it's not
+// taken: branches are always last.
+static void fold_constants(struct optimizer *opt, struct decoded_insn *insn,
+                           u32 end) {
+    enum decoded_op op = insn->op;
+    bool const known1 = opt->known[insn->rs1];
+    bool const known2 = opt->known[insn->rs2];
+    u32 const value1 = opt->values[insn->rs1];
+    u32 const value2 = opt->values[insn->rs2];
+
+    if (is_alu_imm(op) && known1) {
+        *insn = load_constant(insn->rd, alu(op, value1, insn->imm));
+    } else if (is_alu_reg(op)) {
+        if (known1 && known2) {
+            *insn = load_constant(insn->rd, alu(op, value1, value2));
+        } else if (known2) {
+            insn->op = imm_form[op];
+            insn->imm = op == dop_sub ? -value2
+                        : op == dop_sll || op == dop_srl || op == dop_sra
+                            ? value2 & 0x1f
+                            : value2;
+        } else if (known1 && (op == dop_add || op == dop_xor ||
+                              op == dop_or || op == dop_and)) {
+            insn->op = imm_form[op];
+            insn->rs1 = insn->rs2;
+            insn->imm = value1;
+        }
+    } else if (op == dop_jalr && known1) {
+        *insn = (struct decoded_insn){
+            .op = dop_jal, .rd = insn->rd, .imm = (value1 + insn->imm) & ~1u};
+    } else if (is_branch(op) && known1 && known2) {
+        u32 target = branch_taken(op, value1, value2) ? insn->imm : end;
+        *insn = (struct decoded_insn){
+            .op = dop_jal, .rd = DECODED_SINK_REG, .imm = target};
+    }
+}
+
+static u8 access_width(enum decoded_op op) {
+    switch (op) {
+    case dop_lb:
+    case dop_lbu:
+    case dop_sb:
+        return 1;
+    case dop_lh:
+    case dop_lhu:
+    case dop_sh:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// Returns whether two accesses off the same base register overlap.
+static bool overlaps(i32 offset_a, u8 width_a, i32 offset_b, u8 width_b) {
+    return offset_a < offset_b + width_b && offset_b < offset_a + width_a;
+}
+
+// Forgets everything that depended on the old value of `reg`, which is being
+// overwritten by `insn`.
+static void clobber(struct optimizer *opt, struct decoded_insn const *insn) {
+    u8 const reg = insn->rd;
+    // `addi r, r, c` moves the base rather than losing it: addresses off it
+    // just shift by `-c`.
+    bool const rebase = insn->op == dop_addi && insn->rs1 == reg;
+    i32 const shift = bit_cast_i32(insn->imm);
+
+    u32 kept = 0;
+    for (u32 i = 0; i < opt->fact_count; ++i) {
+        struct mem_fact fact = opt->facts[i];
+        if (fact.value == reg || (fact.base == reg && !rebase))
+            continue;
+        if (fact.base == reg)
+            fact.offset -= shift;
+        opt->facts[kept++] = fact;
+    }
+    opt->fact_count = kept;
+
+    kept = 0;
+    for (u32 i = 0; i < opt->store_count; ++i) {
+        struct pending_store store = opt->stores[i];
+        if (store.base == reg) {
+            if (!rebase)
+                continue;
+            store.offset -= shift;
+        }
+        opt->stores[kept++] = store;
+    }
+    opt->store_count = kept;
+}
+
+static void add_fact(struct optimizer *opt, struct mem_fact fact) {
+    if (opt->fact_count < MAX_TRACKED)
+        opt->facts[opt->fact_count++] = fact;
+}
+
+// Tries to replace the load `insn` with a register operation, using what's
+// known about the memory it reads.
+static void forward_load(struct optimizer *opt, struct decoded_insn *insn) {
+    enum decoded_op const op = insn->op;
+    u8 const width = access_width(op);
+    i32 const offset = bit_cast_i32(insn->imm);
+    enum extension const wanted =
+        op == dop_lb || op == dop_lh ? ext_sign : ext_zero;
+
+    for (u32 i = 0; i < opt->fact_count; ++i) {
+        struct mem_fact const *fact = &opt->facts[i];
+        if (fact->base != insn->rs1 || fact->offset != offset ||
+            fact->width != width)
+            continue;
+
+        if (width == 4 || fact->ext == wanted) {
+            *insn = (struct decoded_insn){
+                .op = dop_addi, .rd = insn->rd, .rs1 = fact->value, .imm = 0};
+        } else if (wanted == ext_zero) {
+            *insn = (struct decoded_insn){.op = dop_andi,
+                                          .rd = insn->rd,
+                                          .rs1 = fact->value,
+                                          .imm = width == 1 ? 0xff : 0xffff};
+        }
+        // Sign-extending the low bytes would take two instructions, which
+        // is no better than the load.
+        return;
+    }
+}
+
+// Updates what's known about memory after `insn` (the instruction at
+// `index`) runs. `loaded` is the load `insn` was rewritten from, if any.
+static void track_memory(struct optimizer *opt, struct decoded_insn const *insn,
+                         struct decoded_insn const *loaded, u32 index) {
+    enum decoded_op const op = insn->op;
+
+    if (is_store(op)) {
+        u8 const width = access_width(op);
+        i32 const offset = bit_cast_i32(insn->imm);
+
+        // Earlier stores completely covered by this one are dead. Nothing
+        // else can tell, since pending stores are dropped when something
+        // might read them.
+        u32 kept = 0;
+        for (u32 i = 0; i < opt->store_count; ++i) {
+            struct pending_store const *store = &opt->stores[i];
+            if (store->base == insn->rs1 && store->offset >= offset &&
+                store->offset + store->width <= offset + width) {
+                opt->dead[store->index] = true;
+                continue;
+            }
+            opt->stores[kept++] = *store;
+        }
+        opt->store_count = kept;
+        if (opt->store_count < MAX_TRACKED) {
+            opt->stores[opt->store_count++] = (struct pending_store){
+                .index = index, .base = insn->rs1, .width = width,
+                .offset = offset};
+        }
+
+        // Anything this store may have overwritten is stale now.
+        kept = 0;
+        for (u32 i = 0; i < opt->fact_count; ++i) {
+            struct mem_fact const *fact = &opt->facts[i];
+            if (fact->base != insn->rs1 ||
+                overlaps(fact->offset, fact->width, offset, width))
+                continue;
+            opt->facts[kept++] = *fact;
+        }
+        opt->fact_count = kept;
+
+        add_fact(opt, (struct mem_fact){.base = insn->rs1,
+                                        .width = width,
+                                        .offset = offset,
+                                        .value = insn->rs2,
+                                        .ext = ext_none});
+        return;
+    }
+
+    // Vector loads and stores aren't tracked, nor are atomics: anything could
+    // have been read or overwritten.
+    if (op == dop_vle || op == dop_vlse || op == dop_vse || op == dop_vsse ||
+        is_atomic(op)) {
+        opt->fact_count = 0;
+        opt->store_count = 0;
+        return;
+    }
+
+    // Neither are floating-point ones, which only matter for what they may
+    // read or overwrite.
+    if (is_float_access(op)) {
+        bool const load = op == dop_flw || op == dop_fld;
+        u8 const width = op == dop_flw || op == dop_fsw ? 4 : 8;
+        i32 const offset = bit_cast_i32(insn->imm);
+        u32 kept = 0;
+        if (load) {
+            for (u32 i = 0; i < opt->store_count; ++i) {
+                struct pending_store const *store = &opt->stores[i];
+                if (store->base == insn->rs1 &&
+                    !overlaps(store->offset, store->width, offset, width))
+                    opt->stores[kept++] = *store;
+            }
+            opt->store_count = kept;
+        } else {
+            for (u32 i = 0; i < opt->fact_count; ++i) {
+                struct mem_fact const *fact = &opt->facts[i];
+                if (fact->base == insn->rs1 &&
+                    !overlaps(fact->offset, fact->width, offset, width))
+                    opt->facts[kept++] = *fact;
+            }
+            opt->fact_count = kept;
+        }
+        return;
+    }
+
+    if (loaded == NULL && is_load(op)) {
+        // A real load: pending stores it might read from are live.
+        u8 const width = access_width(op);
+        i32 const offset = bit_cast_i32(insn->imm);
+        u32 kept = 0;
+        for (u32 i = 0; i < opt->store_count; ++i) {
+            struct pending_store const *store = &opt->stores[i];
+            if (store->base != insn->rs1 ||
+                overlaps(store->offset, store->width, offset, width))
+                continue;
+            opt->stores[kept++] = *store;
+        }
+        opt->store_count = kept;
+        loaded = insn;
+    }
+
+    if (writes_rd(insn) && insn->rd != DECODED_SINK_REG)
+        clobber(opt, insn);
+
+    // The destination now holds the loaded value, unless it was also the base
+    // register.
+    if (loaded != NULL && loaded->rd != DECODED_SINK_REG &&
+        loaded->rd != loaded->rs1) {
+        enum decoded_op load_op = loaded->op;
+        add_fact(opt,
+                 (struct mem_fact){.base = loaded->rs1,
+                                   .width = access_width(load_op),
+                                   .offset = bit_cast_i32(loaded->imm),
+                                   .value = loaded->rd,
+                                   .ext = load_op == dop_lb || load_op == dop_lh
+                                              ? ext_sign
+                                              : ext_zero});
+    }
+}
+
+static void track_constants(struct optimizer *opt,
+                            struct decoded_insn const *insn) {
+    if (!writes_rd(insn))
+        return;
+    // lui and auipc both carry their final value.
+    bool known = insn->op == dop_lui || insn->op == dop_auipc;
+    opt->known[insn->rd] = known;
+    opt->values[insn->rd] = known ? insn->imm : 0;
+}
+
+// Marks instructions whose only effect is writing a register nobody reads
+// before the end of the block.
+static void remove_dead_writes(struct optimizer *opt, u32 count) {
+    // Every register is live out of the block. The sink never is.
+    bool live[DECODED_SINK_REG + 1];
+    memset(live, true, sizeof(live));
+    live[DECODED_SINK_REG] = false;
+
+    for (u32 i = count; i-- > 0;) {
+        struct decoded_insn const *insn = &opt->insns[i];
+        if (opt->dead[i])
+            continue;
+
+        enum decoded_op op = insn->op;
+        // Loads stay, since they can fault.
+        bool pure = op == dop_lui || op == dop_auipc || is_alu_imm(op) ||
+                    is_alu_reg(op);
+        if (pure && !live[insn->rd]) {
+            opt->dead[i] = true;
+            continue;
+        }
+
+        if (writes_rd(insn))
+            live[insn->rd] = false;
+        if (reads_rs1(insn))
+            live[insn->rs1] = true;
+        if (reads_rs2(insn))
+            live[insn->rs2] = true;
+    }
+}
+
+// Returns whether `insn` is `<op> reg, reg, ...`.
+static bool is_update(struct decoded_insn const *insn, enum decoded_op op,
+                      u8 reg) {
+    return insn->op == op && insn->rd == reg && insn->rs1 == reg;
+}
+
+// Merges `addi r,r,a; andi r,r,m; addi r,r,b; andi r,r,m` into
+// `addi r,r,a+b; andi r,r,m`, where `m` keeps the low byte or half: the low
+// bits of a sum only depend on the low bits of what's added. Forwarding
+// leaves these behind for every run of bf `+` or `-`.
+static u32 merge_masked_adds(struct decoded_insn *insns, u32 count) {
+    u32 kept = 0;
+    for (u32 i = 0; i < count; ++i) {
+        insns[kept++] = insns[i];
+        while (kept >= 4) {
+            struct decoded_insn *first = &insns[kept - 4];
+            struct decoded_insn const *mask = &insns[kept - 3];
+            u8 const reg = first->rd;
+            if (!is_update(first, dop_addi, reg) ||
+                !is_update(mask, dop_andi, reg) ||
+                (mask->imm != 0xff && mask->imm != 0xffff) ||
+                !is_update(&insns[kept - 2], dop_addi, reg) ||
+                !is_update(&insns[kept - 1], dop_andi, reg) ||
+                insns[kept - 1].imm != mask->imm)
+                break;
+            first->imm += insns[kept - 2].imm;
+            kept -= 2;
+        }
+    }
+    return kept;
+}
+
+u32 optimize_block(struct decoded_insn *insns, u32 count, u32 end) {
+    assert(count <= BLOCK_MAX_INSNS);
+
+    struct optimizer opt = {.insns = insns};
+    opt.known[0] = true;
+
+    for (u32 i = 0; i < count; ++i) {
+        struct decoded_insn *insn = &insns[i];
+        fold_constants(&opt, insn, end);
+
+        struct decoded_insn loaded = *insn;
+        bool forwarded = false;
+        if (is_load(insn->op)) {
+            forward_load(&opt, insn);
+            if ((forwarded = !is_load(insn->op)))
+                fold_constants(&opt, insn, end);
+        }
+
+        track_memory(&opt, insn, forwarded ? &loaded : NULL, i);
+        track_constants(&opt, insn);
+    }
+
+    remove_dead_writes(&opt, count);
+
+    u32 kept = 0;
+    for (u32 i = 0; i < count; ++i) {
+        if (!opt.dead[i])
+            insns[kept++] = insns[i];
+    }
+    return merge_masked_adds(insns, kept);
+}
+
+// vim:sw=4
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common/types.h"
+#include "rv/decode.h"
+
+// Block-local optimizer.
+// Runs over the decoded instructions of a single basic block, before it gets
+// interpreted or compiled. Within the block it:
+//
+// - folds constants (`lui`+`addi` pairs, operations on known registers, and
+//   branches whose outcome is known);
+// - forwards values from stores to later loads of the same address, and from
+//   loads to repeated loads of it;
+// - drops stores that get overwritten before anything can read them;
+// - drops writes to x0 and to registers that get overwritten before they're
+//   read.
+//
+// bfc output is mostly `lbu t0,0(s1)` / `addi t0,t0,±1` / `sb t0,0(s1)`
+// triples, and most of their memory traffic goes away this way.
+//
+// Instructions that end the block are never dropped, so the last instruction
+// of an optimized block is still at the last guest address it covers. Only
+// instructions that end a block ever need their own guest address.
+
+// Optimizes the `count` instructions in `insns`, decoded from the guest
+// addresses up to `end`. Returns how many are left, compacted at the start of
+// `insns`.
+u32 optimize_block(struct decoded_insn *insns, u32 count, u32 end);
+
+// vim:ft=c
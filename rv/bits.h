@@ -1,6 +1,7 @@
 #pragma once
 #include "../common/types.h"
 #include "insn.h"
+#include "xlen.h"
 
 static i32 __attribute_const__ bit_cast_i32(u32 v) { return *(i32 *)&v; }
 static u32 __attribute_const__ bit_cast_u32(i32 v) {
@@ -181,6 +182,105 @@ static u32 __attribute_const__ read_i_immediate(u32 raw) {
 }
 
 static u32 __attribute_const__ read_shift_immediate(u32 raw) {
-    // lower 5 bits of the I-immediate field.
-    return read_i_immediate(raw) & 0x1f;
+    // lower 5 bits of the I-immediate field, or 6 for RV64I.
+    return read_i_immediate(raw) & (RV_XLEN - 1);
+}
+
+// M extension arithmetic, with the spec's results where C would be undefined:
+// > The quotient of division by zero has all bits set, and the remainder of
+// division by zero equals the dividend. Signed division overflow occurs only
+// when the most-negative integer is divided by -1. The quotient of a signed
+// division with overflow is equal to the dividend, and the remainder is zero.
+
+static u32 __attribute_const__ rv_mulh(u32 a, u32 b) {
+    return (u64)((i64)bit_cast_i32(a) * bit_cast_i32(b)) >> 32;
+}
+static u32 __attribute_const__ rv_mulhsu(u32 a, u32 b) {
+    return (u64)((i64)bit_cast_i32(a) * (i64)b) >> 32;
+}
+static u32 __attribute_const__ rv_mulhu(u32 a, u32 b) {
+    return ((u64)a * b) >> 32;
+}
+static u32 __attribute_const__ rv_div(u32 a, u32 b) {
+    if (b == 0)
+        return UINT32_MAX;
+    if (a == 0x80000000 && b == UINT32_MAX)
+        return a;
+    return bit_cast_u32(bit_cast_i32(a) / bit_cast_i32(b));
+}
+static u32 __attribute_const__ rv_divu(u32 a, u32 b) {
+    return b == 0 ? UINT32_MAX : a / b;
+}
+static u32 __attribute_const__ rv_rem(u32 a, u32 b) {
+    if (b == 0)
+        return a;
+    if (b == UINT32_MAX)
+        return 0;
+    return bit_cast_u32(bit_cast_i32(a) % bit_cast_i32(b));
+}
+static u32 __attribute_const__ rv_remu(u32 a, u32 b) {
+    return b == 0 ? a : a % b;
+}
+
+#if RV_XLEN == 64
+// The same at 64 bits, for RV64, whose W forms use the ones above. The upper
+// halves of products take 128-bit arithmetic.
+static u64 __attribute_const__ rv_mulh64(u64 a, u64 b) {
+    return (unsigned __int128)((__int128)(i64)a * (i64)b) >> 64;
+}
+static u64 __attribute_const__ rv_mulhsu64(u64 a, u64 b) {
+    return (unsigned __int128)((__int128)(i64)a * (__int128)b) >> 64;
+}
+static u64 __attribute_const__ rv_mulhu64(u64 a, u64 b) {
+    return ((unsigned __int128)a * b) >> 64;
+}
+static u64 __attribute_const__ rv_div64(u64 a, u64 b) {
+    if (b == 0)
+        return UINT64_MAX;
+    if (a == 1ull << 63 && b == UINT64_MAX)
+        return a;
+    return (u64)((i64)a / (i64)b);
+}
+static u64 __attribute_const__ rv_divu64(u64 a, u64 b) {
+    return b == 0 ? UINT64_MAX : a / b;
+}
+static u64 __attribute_const__ rv_rem64(u64 a, u64 b) {
+    if (b == 0)
+        return a;
+    if (b == UINT64_MAX)
+        return 0;
+    return (u64)((i64)a % (i64)b);
+}
+static u64 __attribute_const__ rv_remu64(u64 a, u64 b) {
+    return b == 0 ? a : a % b;
+}
+#endif
+
+// Bit manipulation (Zbb and Zbs) on top of the compiler's builtins, which the
+// host has single instructions for. Counts and shift amounts are masked to 5
+// bits like the spec says, and counting the zeros of 0 gives 32.
+
+static u32 __attribute_const__ rv_clz(u32 a) {
+    return a == 0 ? 32 : __builtin_clz(a);
+}
+static u32 __attribute_const__ rv_ctz(u32 a) {
+    return a == 0 ? 32 : __builtin_ctz(a);
+}
+static u32 __attribute_const__ rv_cpop(u32 a) { return __builtin_popcount(a); }
+static u32 __attribute_const__ rv_rol(u32 a, u32 b) {
+    return a << (b & 0x1f) | a >> (-b & 0x1f);
+}
+static u32 __attribute_const__ rv_ror(u32 a, u32 b) {
+    return a >> (b & 0x1f) | a << (-b & 0x1f);
+}
+static u32 __attribute_const__ rv_rev8(u32 a) { return __builtin_bswap32(a); }
+// > Combines the bits within each byte using bitwise logical OR. This sets the
+// bits of each byte in the result rd to all zeros if no bit within the
+// respective byte of rs is set, or to all ones if any bit within the
+// respective byte of rs is set.
+static u32 __attribute_const__ rv_orc_b(u32 a) {
+    // Each byte's high bit ends up set if any of its bits is, and then gets
+    // spread over the byte.
+    u32 const any = ((a & 0x7f7f7f7f) + 0x7f7f7f7f) | a;
+    return ((any >> 7) & 0x01010101) * 0xff;
 }
@@ -2,12 +2,460 @@
 #include "../common/log.h"
 #include "bits.h"
 #include "insn.h"
+#include "rvc.h"
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 static char const *abi_reg_names[];
+static char const *fp_reg_names[];
+
+// Names of the shift-immediate forms (funct3 imm_func_slli or imm_func_srli)
+// by the upper 7 bits of the immediate, and of Zbb's unary instructions by the
+// shift amount they take the place of.
+static char const *shift_imm_name(u32 funct3, u32 funct7, u32 shamt) {
+    static char const *unary_names[] = {
+        [unary_func_clz] = "clz",       [unary_func_ctz] = "ctz",
+        [unary_func_cpop] = "cpop",     [unary_func_sext_b] = "sext.b",
+        [unary_func_sext_h] = "sext.h",
+    };
+    if (funct3 == imm_func_slli) {
+        switch (funct7) {
+        case shift_func_srli:
+            return "slli";
+        case op_funct7_bset:
+            return "bseti";
+        case op_funct7_bclr:
+            return "bclri";
+        case op_funct7_binv:
+            return "binvi";
+        case op_funct7_rotate:
+            return shamt < sizeof(unary_names) / sizeof(*unary_names)
+                       ? unary_names[shamt]
+                       : NULL;
+        }
+        return NULL;
+    }
+    switch (funct7) {
+    case shift_func_srli:
+        return "srli";
+    case shift_func_srai:
+        return "srai";
+    case op_funct7_rotate:
+        return "rori";
+    case op_funct7_bclr:
+        return "bexti";
+    }
+    return NULL;
+}
+
+// Names of the Zba, Zbb and Zbs register-register instructions whose funct7
+// is not one of the base ISA's.
+static char const *bitmanip_name(u32 funct7, u32 funct3) {
+    switch (funct7) {
+    case op_funct7_shadd: {
+        static char const *names[] = {
+            [0b010] = "sh1add", [0b100] = "sh2add", [0b110] = "sh3add"};
+        return names[funct3];
+    }
+    case op_funct7_minmax: {
+        static char const *names[] = {
+            [0b100] = "min", [0b101] = "minu", [0b110] = "max",
+            [0b111] = "maxu"};
+        return names[funct3];
+    }
+    case op_funct7_rotate:
+        return funct3 == 0b001 ? "rol" : funct3 == 0b101 ? "ror" : NULL;
+    case op_funct7_bset:
+        return funct3 == 0b001 ? "bset" : NULL;
+    case op_funct7_bclr:
+        return funct3 == 0b001 ? "bclr" : funct3 == 0b101 ? "bext" : NULL;
+    case op_funct7_binv:
+        return funct3 == 0b001 ? "binv" : NULL;
+    }
+    return NULL;
+}
+
+// Returns the element width in bits of a vector load or store, or 0 if
+// `width` is a scalar floating-point width.
+static u32 vector_eew(u32 width) {
+    switch (width) {
+    case vector_width_8:
+        return 8;
+    case vector_width_16:
+        return 16;
+    case vector_width_32:
+        return 32;
+    case vector_width_64:
+        return 64;
+    default:
+        return 0;
+    }
+}
+
+static void dasm_vector_memory(FILE *out, union insn as) {
+    bool const strided = as.vmem.mop == vector_mop_strided;
+    fprintf(out, "v%c%se%u.v v%u, (%s)",
+            as.vmem.opcode == op_load_fp ? 'l' : 's', strided ? "s" : "",
+            vector_eew(as.vmem.width), as.vmem.vd, abi_reg_names[as.vmem.rs1]);
+    if (strided)
+        fprintf(out, ", %s", abi_reg_names[as.vmem.rs2]);
+    if (!as.vmem.vm)
+        fputs(", v0.t", out);
+}
+
+static void dasm_vector(FILE *out, union insn as) {
+    static char const *int_names[64] = {
+        [vint_funct6_add] = "add",     [vint_funct6_sub] = "sub",
+        [vint_funct6_rsub] = "rsub",   [vint_funct6_minu] = "minu",
+        [vint_funct6_min] = "min",     [vint_funct6_maxu] = "maxu",
+        [vint_funct6_max] = "max",     [vint_funct6_and] = "and",
+        [vint_funct6_or] = "or",       [vint_funct6_xor] = "xor",
+        [vint_funct6_merge] = "merge", [vint_funct6_mseq] = "mseq",
+        [vint_funct6_msne] = "msne",   [vint_funct6_msltu] = "msltu",
+        [vint_funct6_mslt] = "mslt",   [vint_funct6_msleu] = "msleu",
+        [vint_funct6_msle] = "msle",   [vint_funct6_msgtu] = "msgtu",
+        [vint_funct6_msgt] = "msgt",
+    };
+    static char const *reduction_names[] = {
+        [vmvv_funct6_redsum] = "sum",   [vmvv_funct6_redand] = "and",
+        [vmvv_funct6_redor] = "or",     [vmvv_funct6_redxor] = "xor",
+        [vmvv_funct6_redminu] = "minu", [vmvv_funct6_redmin] = "min",
+        [vmvv_funct6_redmaxu] = "maxu", [vmvv_funct6_redmax] = "max",
+    };
+    char const *const mask = as.v.vm ? "" : ", v0.t";
+
+    switch ((enum vector_funct3)as.v.funct3) {
+    case vector_funct3_cfg:
+        if (!(as.raw >> 31)) {
+            fprintf(out, "vsetvli %s, %s, 0x%x", abi_reg_names[as.v.vd],
+                    abi_reg_names[as.v.vs1], as.raw >> 20 & 0x7ff);
+        } else if (as.raw >> 30 == 0b11) {
+            fprintf(out, "vsetivli %s, %u, 0x%x", abi_reg_names[as.v.vd],
+                    as.v.vs1, as.raw >> 20 & 0x3ff);
+        } else {
+            fprintf(out, "vsetvl %s, %s, %s", abi_reg_names[as.v.vd],
+                    abi_reg_names[as.v.vs1], abi_reg_names[as.v.vs2]);
+        }
+        return;
+    case vector_funct3_mvv:
+        if (as.v.funct6 <= vmvv_funct6_redmax) {
+            fprintf(out, "vred%s.vs v%u, v%u, v%u%s",
+                    reduction_names[as.v.funct6], as.v.vd, as.v.vs2, as.v.vs1,
+                    mask);
+            return;
+        }
+        if (as.v.funct6 == vmvv_funct6_wxunary0 && as.v.vs1 == 0) {
+            fprintf(out, "vmv.x.s %s, v%u", abi_reg_names[as.v.vd], as.v.vs2);
+            return;
+        }
+        break;
+    case vector_funct3_mvx:
+        if (as.v.funct6 == vmvv_funct6_wxunary0 && as.v.vs2 == 0) {
+            fprintf(out, "vmv.s.x v%u, %s", as.v.vd, abi_reg_names[as.v.vs1]);
+            return;
+        }
+        break;
+    case vector_funct3_ivv:
+    case vector_funct3_ivx:
+    case vector_funct3_ivi: {
+        char const *const name = int_names[as.v.funct6];
+        if (name == NULL)
+            break;
+        char const form = as.v.funct3 == vector_funct3_ivv   ? 'v'
+                          : as.v.funct3 == vector_funct3_ivx ? 'x'
+                                                             : 'i';
+        // An unmasked merge is a plain move, with no vs2.
+        bool const move = as.v.funct6 == vint_funct6_merge && as.v.vm;
+        if (move)
+            fprintf(out, "vmv.v.%c v%u, ", form, as.v.vd);
+        else
+            fprintf(out, "v%s.v%c%s v%u, v%u, ", name, form,
+                    as.v.funct6 == vint_funct6_merge ? "m" : "", as.v.vd,
+                    as.v.vs2);
+        if (form == 'v')
+            fprintf(out, "v%u", as.v.vs1);
+        else if (form == 'x')
+            fputs(abi_reg_names[as.v.vs1], out);
+        else
+            fprintf(out, "%d", (i32)(as.raw << 12) >> 27);
+        // vmerge's v0 is an operand rather than a mask.
+        fputs(move ? ""
+              : as.v.funct6 == vint_funct6_merge ? ", v0"
+                                                  : mask,
+              out);
+        return;
+    }
+    }
+    fputs("<illegal>", out);
+}
+
+// Prints the rounding mode operand, unless it's the dynamic one.
+static void dasm_rm(FILE *out, u32 rm) {
+    static char const *names[8] = {
+        [fp_rm_rne] = "rne", [fp_rm_rtz] = "rtz", [fp_rm_rdn] = "rdn",
+        [fp_rm_rup] = "rup", [fp_rm_rmm] = "rmm", [0b101] = "<reserved>",
+        [0b110] = "<reserved>",
+    };
+    if (rm != fp_rm_dyn)
+        fprintf(out, ", %s", names[rm]);
+}
+
+static void dasm_float_memory(FILE *out, union insn as) {
+    char const fmt = as.i.funct3 == fp_width_d ? 'd' : 'w';
+    if (as.unknown.opcode == op_load_fp)
+        fprintf(out, "fl%c %s, %d(%s)", fmt, fp_reg_names[as.i.rd],
+                bit_cast_i32(read_i_immediate(as.raw)),
+                abi_reg_names[as.i.rs1]);
+    else
+        fprintf(out, "fs%c %s, %d(%s)", fmt, fp_reg_names[as.s.rs2],
+                bit_cast_i32(read_s_immediate(as.raw)),
+                abi_reg_names[as.s.rs1]);
+}
+
+static void dasm_fused(FILE *out, union insn as) {
+    static char const *names[] = {"fmadd", "fmsub", "fnmsub", "fnmadd"};
+    fprintf(out, "%s.%c %s, %s, %s, %s",
+            names[(as.unknown.opcode - op_madd) / 4],
+            as.r4.fmt == fp_fmt_d ? 'd' : 's', fp_reg_names[as.r4.rd],
+            fp_reg_names[as.r4.rs1], fp_reg_names[as.r4.rs2],
+            fp_reg_names[as.r4.rs3]);
+    dasm_rm(out, as.r4.rm);
+}
+
+static void dasm_float(FILE *out, union insn as) {
+    u32 const fmt = as.r.funct7 & 0b11, funct3 = as.r.funct3;
+    char const f = fmt == fp_fmt_d ? 'd' : 's';
+    char const *const rd = fp_reg_names[as.r.rd];
+    char const *const xd = abi_reg_names[as.r.rd];
+    char const *const rs1 = fp_reg_names[as.r.rs1];
+    char const *const xs1 = abi_reg_names[as.r.rs1];
+    char const *const rs2 = fp_reg_names[as.r.rs2];
+    char const *const unsigned_ = as.r.rs2 == 1 ? "u" : "";
+
+    if (fmt != fp_fmt_s && fmt != fp_fmt_d) {
+        fputs("<illegal>", out);
+        return;
+    }
+    switch ((enum fp_funct5)(as.r.funct7 >> 2)) {
+    case fp_funct5_add:
+    case fp_funct5_sub:
+    case fp_funct5_mul:
+    case fp_funct5_div: {
+        static char const *names[] = {"fadd", "fsub", "fmul", "fdiv"};
+        fprintf(out, "%s.%c %s, %s, %s", names[as.r.funct7 >> 2], f, rd, rs1,
+                rs2);
+        dasm_rm(out, funct3);
+        return;
+    }
+    case fp_funct5_sqrt:
+        fprintf(out, "fsqrt.%c %s, %s", f, rd, rs1);
+        dasm_rm(out, funct3);
+        return;
+    case fp_funct5_sgnj:
+        if (funct3 > 0b010)
+            break;
+        fprintf(out, "fsgnj%s.%c %s, %s, %s",
+                funct3 == 0b000   ? ""
+                : funct3 == 0b001 ? "n"
+                                  : "x",
+                f, rd, rs1, rs2);
+        return;
+    case fp_funct5_minmax:
+        if (funct3 > 0b001)
+            break;
+        fprintf(out, "f%s.%c %s, %s, %s", funct3 == 0b000 ? "min" : "max", f,
+                rd, rs1, rs2);
+        return;
+    case fp_funct5_cvt_fmt:
+        fprintf(out, "fcvt.%c.%c %s, %s", f, as.r.rs2 == fp_fmt_d ? 'd' : 's',
+                rd, rs1);
+        dasm_rm(out, funct3);
+        return;
+    case fp_funct5_compare:
+        if (funct3 > 0b010)
+            break;
+        fprintf(out, "f%s.%c %s, %s, %s",
+                funct3 == 0b000   ? "le"
+                : funct3 == 0b001 ? "lt"
+                                  : "eq",
+                f, xd, rs1, rs2);
+        return;
+    case fp_funct5_cvt_to_int:
+        fprintf(out, "fcvt.w%s.%c %s, %s", unsigned_, f, xd, rs1);
+        dasm_rm(out, funct3);
+        return;
+    case fp_funct5_cvt_from_int:
+        fprintf(out, "fcvt.%c.w%s %s, %s", f, unsigned_, rd, xs1);
+        dasm_rm(out, funct3);
+        return;
+    case fp_funct5_mv_to_int:
+        if (funct3 == 0b000)
+            fprintf(out, "fmv.x.w %s, %s", xd, rs1);
+        else
+            fprintf(out, "fclass.%c %s, %s", f, xd, rs1);
+        return;
+    case fp_funct5_mv_from_int:
+        fprintf(out, "fmv.w.x %s, %s", rd, xs1);
+        return;
+    }
+    fputs("<illegal>", out);
+}
+
+// Prints fence and fence.i, the former with its predecessor and successor sets
+// as `iorw` letters.
+static void dasm_fence(FILE *out, union insn as) {
+    if (as.fence.funct3 == fence_funct3_i) {
+        fputs("fence.i", out);
+        return;
+    }
+    if (as.fence.funct3 != fence_funct3) {
+        fputs("<illegal>", out);
+        return;
+    }
+    u32 const sets[2] = {as.raw >> 24 & 0xf, as.raw >> 20 & 0xf};
+    fputs("fence ", out);
+    for (u32 i = 0; i < 2; ++i) {
+        if (i != 0)
+            fputs(", ", out);
+        if (sets[i] == 0)
+            fputc('0', out);
+        if (sets[i] & fence_i)
+            fputc('i', out);
+        if (sets[i] & fence_o)
+            fputc('o', out);
+        if (sets[i] & fence_r)
+            fputc('r', out);
+        if (sets[i] & fence_w)
+            fputc('w', out);
+    }
+}
+
+static char const *csr_name(u32 csr) {
+    switch ((enum csr)csr) {
+    case csr_fflags:
+        return "fflags";
+    case csr_frm:
+        return "frm";
+    case csr_fcsr:
+        return "fcsr";
+    case csr_cycle:
+        return "cycle";
+    case csr_time:
+        return "time";
+    case csr_instret:
+        return "instret";
+    case csr_cycleh:
+        return "cycleh";
+    case csr_timeh:
+        return "timeh";
+    case csr_instreth:
+        return "instreth";
+    }
+    return NULL;
+}
+
+static void dasm_csr(FILE *out, union insn as) {
+    static char const *names[8] = {
+        [csrrw] = "csrrw",   [csrrs] = "csrrs",   [csrrc] = "csrrc",
+        [csrrwi] = "csrrwi", [csrrsi] = "csrrsi", [csrrci] = "csrrci",
+    };
+    u32 const csr = as.i.imm_11_0;
+    if (names[as.i.funct3] == NULL) {
+        fputs("<illegal>", out);
+        return;
+    }
+    fprintf(out, "%s %s, ", names[as.i.funct3], abi_reg_names[as.i.rd]);
+    char const *name = csr_name(csr);
+    if (name != NULL)
+        fputs(name, out);
+    else
+        fprintf(out, "0x%03x", csr);
+    if (as.i.funct3 & 0b100)
+        fprintf(out, ", %u", as.i.rs1);
+    else
+        fprintf(out, ", %s", abi_reg_names[as.i.rs1]);
+}
+
+static void dasm_atomic(FILE *out, union insn as) {
+    static char const *names[32] = {
+        [amo_funct5_lr] = "lr",        [amo_funct5_sc] = "sc",
+        [amo_funct5_swap] = "amoswap", [amo_funct5_add] = "amoadd",
+        [amo_funct5_xor] = "amoxor",   [amo_funct5_and] = "amoand",
+        [amo_funct5_or] = "amoor",     [amo_funct5_min] = "amomin",
+        [amo_funct5_max] = "amomax",   [amo_funct5_minu] = "amominu",
+        [amo_funct5_maxu] = "amomaxu",
+    };
+    static char const *orderings[4] = {
+        [0] = "",
+        [amo_aq] = ".aq",
+        [amo_rl] = ".rl",
+        [amo_aq | amo_rl] = ".aqrl",
+    };
+    u32 const funct5 = as.r.funct7 >> 2;
+    if (names[funct5] == NULL ||
+        (as.r.funct3 != amo_funct3_w && as.r.funct3 != amo_funct3_d)) {
+        fputs("<illegal>", out);
+        return;
+    }
+    fprintf(out, "%s.%c%s %s, ", names[funct5],
+            as.r.funct3 == amo_funct3_d ? 'd' : 'w',
+            orderings[as.r.funct7 & (amo_aq | amo_rl)],
+            abi_reg_names[as.r.rd]);
+    if (funct5 != amo_funct5_lr)
+        fprintf(out, "%s, ", abi_reg_names[as.r.rs2]);
+    fprintf(out, "(%s)", abi_reg_names[as.r.rs1]);
+}
+
+#if RV_XLEN == 64
+// RV64's op_imm_32 and op_op_32 instructions, which work on words.
+static void dasm_word(FILE *out, union insn as) {
+    char const *const rd = abi_reg_names[as.r.rd];
+    char const *const rs1 = abi_reg_names[as.r.rs1];
+    if (as.unknown.opcode == op_imm_32) {
+        u32 const funct7 = as.i.imm_11_0 >> 5;
+        if (as.i.funct3 == imm_func_addi)
+            fprintf(out, "addiw %s, %s, %d", rd, rs1,
+                    bit_cast_i32(read_i_immediate(as.raw)));
+        else if ((as.i.funct3 == imm_func_slli ||
+                  as.i.funct3 == imm_func_srli) &&
+                 (funct7 == shift_func_srli ||
+                  (funct7 == shift_func_srai && as.i.funct3 == imm_func_srai)))
+            fprintf(out, "%s %s, %s, 0x%x",
+                    as.i.funct3 == imm_func_slli ? "slliw"
+                    : funct7 == shift_func_srli  ? "srliw"
+                                                 : "sraiw",
+                    rd, rs1, as.i.imm_11_0 & 0x1f);
+        else
+            fputs("<illegal>", out);
+        return;
+    }
+    static char const *names[8][3] = {
+        [op_funct3_add] = {"addw", "subw", "mulw"},
+        [op_funct3_sll] = {"sllw"},
+        [op_funct3_srl] = {"srlw", "sraw", "divuw"},
+        [muldiv_funct3_div] = {[2] = "divw"},
+        [muldiv_funct3_rem] = {[2] = "remw"},
+        [muldiv_funct3_remu] = {[2] = "remuw"},
+    };
+    u32 const form = as.r.funct7 == 0                  ? 0
+                     : as.r.funct7 == op_funct7_sub    ? 1
+                     : as.r.funct7 == op_funct7_muldiv ? 2
+                                                       : 3;
+    char const *const name = form == 3 ? NULL : names[as.r.funct3][form];
+    if (name == NULL)
+        fputs("<illegal>", out);
+    else
+        fprintf(out, "%s %s, %s, %s", name, rd, rs1, abi_reg_names[as.r.rs2]);
+}
+#endif
 
 void dasm(FILE *out, u32 raw, u32 insn_offset) {
+    // Compressed instructions are shown as the instruction they stand for.
+    if (raw != 0 && rvc_insn_size(raw) == 2) {
+        fputs("c.", out);
+        raw = rvc_expand(raw);
+    }
 
     if (__builtin_expect(raw == 0, 0)) {
         fputs("<illegal>", out);
@@ -40,6 +488,9 @@ void dasm(FILE *out, u32 raw, u32 insn_offset) {
             [load_func_lb] = "lb",   [load_func_lh] = "lh",
             [load_func_lw] = "lw",   [load_func_lbu] = "lbu",
             [load_func_lhu] = "lhu",
+#if RV_XLEN == 64
+            [load_func_ld] = "ld",   [load_func_lwu] = "lwu",
+#endif
         };
 
         fprintf(out, "%s %s, %d(%s)", func_names[as.i.funct3],
@@ -96,13 +547,29 @@ void dasm(FILE *out, u32 raw, u32 insn_offset) {
         } break;
 
         case imm_func_slli:
-            fprintf(out, "slli %s, %s, 0x%x", abi_reg_names[as.i.rd],
-                    abi_reg_names[as.i.rs1], read_shift_immediate(as.raw));
-            break;
-        case imm_func_srli:
-            assert(!"TODO: disassemble sr[la]i instructions");
-            /* TODO: case imm_func_srai */
-            break;
+        case imm_func_srli: {
+            u32 const imm = as.i.imm_11_0, shamt = read_shift_immediate(raw);
+            // RV64's shift amounts take up the low bit of funct7.
+            u32 const funct7 = imm >> 5 & (RV_XLEN == 64 ? ~1u : ~0u);
+            // The unary instructions have no shift amount to show.
+            bool const unary = imm == bitmanip_imm_orc_b ||
+                               imm == bitmanip_imm_rev8 ||
+                               (as.i.funct3 == imm_func_slli &&
+                                funct7 == op_funct7_rotate);
+            char const *name =
+                imm == bitmanip_imm_orc_b   ? "orc.b"
+                : imm == bitmanip_imm_rev8 ? "rev8"
+                                           : shift_imm_name(as.i.funct3,
+                                                            funct7, shamt);
+            if (name == NULL)
+                fputs("<illegal>", out);
+            else if (unary)
+                fprintf(out, "%s %s, %s", name, abi_reg_names[as.i.rd],
+                        abi_reg_names[as.i.rs1]);
+            else
+                fprintf(out, "%s %s, %s, 0x%x", name, abi_reg_names[as.i.rd],
+                        abi_reg_names[as.i.rs1], shamt);
+        } break;
         }
     } break;
 
@@ -111,6 +578,9 @@ void dasm(FILE *out, u32 raw, u32 insn_offset) {
             [store_func_sb] = "sb",
             [store_func_sh] = "sh",
             [store_func_sw] = "sw",
+#if RV_XLEN == 64
+            [store_func_sd] = "sd",
+#endif
         };
 
         i32 imm = bit_cast_i32(read_s_immediate(as.raw));
@@ -127,20 +597,52 @@ void dasm(FILE *out, u32 raw, u32 insn_offset) {
                 [op_funct3_sll] = {"sll", "sll"},
                 [op_funct3_slt] = {"slt", "slt"},
                 [op_funct3_sltu] = {"sltu", "sltu"},
-                [op_funct3_xor] = {"xor", "xor"},
+                [op_funct3_xor] = {"xor", "xnor"},
                 [op_funct3_srl] = {"srl", "sra"},
-                [op_funct3_or] = {"or", "or"},
-                [op_funct3_and] = {"and", "and"},
+                [op_funct3_or] = {"or", "orn"},
+                [op_funct3_and] = {"and", "andn"},
             };
 
+            static char const *muldiv_names[] = {
+                [muldiv_funct3_mul] = "mul",
+                [muldiv_funct3_mulh] = "mulh",
+                [muldiv_funct3_mulhsu] = "mulhsu",
+                [muldiv_funct3_mulhu] = "mulhu",
+                [muldiv_funct3_div] = "div",
+                [muldiv_funct3_divu] = "divu",
+                [muldiv_funct3_rem] = "rem",
+                [muldiv_funct3_remu] = "remu",
+            };
+
+            if (as.r.funct7 == op_funct7_zext) {
+                fprintf(out, "zext.h %s, %s", abi_reg_names[as.r.rd],
+                        abi_reg_names[as.r.rs1]);
+                break;
+            }
+
             u32 has_funct7 = as.r.funct7 != 0;
+            char const *name =
+                as.r.funct7 == op_funct7_muldiv ? muldiv_names[as.r.funct3]
+                : has_funct7 && as.r.funct7 != op_funct7_sub
+                    ? bitmanip_name(as.r.funct7, as.r.funct3)
+                    : inames[as.r.funct3][has_funct7];
+            if (name == NULL) {
+                fputs("<illegal>", out);
+                break;
+            }
 
-            fprintf(out, "%s %s, %s, %s", inames[as.r.funct3][has_funct7],
-                    abi_reg_names[as.r.rd], abi_reg_names[as.r.rs1],
-                    abi_reg_names[as.r.rs2]);
+            fprintf(out, "%s %s, %s, %s", name, abi_reg_names[as.r.rd],
+                    abi_reg_names[as.r.rs1], abi_reg_names[as.r.rs2]);
         }
         break;
+    case op_misc_mem:
+        dasm_fence(out, as);
+        break;
     case op_system:
+        if (as.i.funct3 != 0) {
+            dasm_csr(out, as);
+            break;
+        }
         switch ((enum ecall_imm)as.i.imm_11_0) {
         case ecall_ecall:
             fputs("ecall", out);
@@ -151,22 +653,48 @@ void dasm(FILE *out, u32 raw, u32 insn_offset) {
         }
         break;
 
+    case op_op_v:
+        dasm_vector(out, as);
+        break;
     case op_load_fp:
-    case op_custom_0:
-    case op_misc_mem:
-    case op_imm_32:
     case op_store_fp:
-    case op_custom_1:
-    case op_amo:
-    case op_op_32:
+        if (vector_eew(as.vmem.width) != 0) {
+            dasm_vector_memory(out, as);
+            break;
+        }
+        if (as.i.funct3 == fp_width_w || as.i.funct3 == fp_width_d) {
+            dasm_float_memory(out, as);
+            break;
+        }
+        fprintf(out, "unknown 0x%08x", raw);
+        break;
     case op_madd:
     case op_msub:
     case op_nmsub:
     case op_nmadd:
+        dasm_fused(out, as);
+        break;
     case op_fp:
+        dasm_float(out, as);
+        break;
+    case op_amo:
+        dasm_atomic(out, as);
+        break;
+#if RV_XLEN == 64
+    case op_imm_32:
+    case op_op_32:
+        dasm_word(out, as);
+        break;
+#else
+    case op_imm_32:
+    case op_op_32:
+#endif
+    case op_custom_0:
+    case op_custom_1:
     case op_custom2_rv128:
     case op_custom3_rv128:
-        assert(!"TODO: disassemble");
+        fprintf(out, "unknown 0x%08x", raw);
+        break;
     }
 }
 
@@ -190,7 +718,7 @@ char const *opcode_names[] = {
     [0b1001011] = "op_nmsub",
     [0b1001111] = "op_nmadd",
     [0b1010011] = "op_fp",
-    [0b1010111] = "reserved: 0b10100",
+    [0b1010111] = "op_op_v",
     [0b1011011] = "op_custom2_rv128",
     [0b1100011] = "op_branch",
     [0b1100111] = "op_jalr",
@@ -210,3 +738,9 @@ static char const *abi_reg_names[] = {
     [rv_t3] = "t3",     [rv_t4] = "t4", [rv_t5] = "t5",   [rv_t6] = "t6",
 
 };
+static char const *fp_reg_names[] = {
+    "ft0", "ft1", "ft2",  "ft3",  "ft4", "ft5", "ft6",  "ft7",
+    "fs0", "fs1", "fa0",  "fa1",  "fa2", "fa3", "fa4",  "fa5",
+    "fa6", "fa7", "fs2",  "fs3",  "fs4", "fs5", "fs6",  "fs7",
+    "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11",
+};
@@ -0,0 +1,719 @@
+#include "decode.h"
+#include "bits.h"
+#include "insn.h"
+#include "rvc.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+char const *decoded_op_names[dop_count] = {
+#define X(name) [dop_##name] = #name,
+    DECODED_OPS(X)
+#undef X
+};
+
+static u8 decode_rd(u8 rd) { return rd == rv_zero ? DECODED_SINK_REG : rd; }
+
+#if RV_XLEN == 64
+// Returns the operation of an op_imm instruction with funct3 imm_func_slli or
+// imm_func_srli, given the 12 bits of its immediate, the low 6 of which are
+// the shift amount. Bit manipulation isn't there for RV64.
+static enum decoded_op decode_shift_imm(u32 funct3, u32 imm) {
+    u32 const funct6 = imm >> 6;
+    if (funct6 == shift_func_srli)
+        return funct3 == imm_func_slli ? dop_slli : dop_srli;
+    if (funct6 == shift_func_srai >> 1 && funct3 == imm_func_srai)
+        return dop_srai;
+    return dop_unimplemented;
+}
+#else
+// Returns the operation of an op_imm instruction with funct3 imm_func_slli or
+// imm_func_srli, given the 12 bits of its immediate. Bit manipulation takes
+// up the encodings with other upper bits.
+static enum decoded_op decode_shift_imm(u32 funct3, u32 imm) {
+    u32 const funct7 = imm >> 5, shamt = imm & 0x1f;
+    if (funct3 == imm_func_slli) {
+        switch (funct7) {
+        case shift_func_srli:
+            return dop_slli;
+        case op_funct7_bset:
+            return dop_bseti;
+        case op_funct7_bclr:
+            return dop_bclri;
+        case op_funct7_binv:
+            return dop_binvi;
+        case op_funct7_rotate:
+            switch (shamt) {
+            case unary_func_clz:
+                return dop_clz;
+            case unary_func_ctz:
+                return dop_ctz;
+            case unary_func_cpop:
+                return dop_cpop;
+            case unary_func_sext_b:
+                return dop_sext_b;
+            case unary_func_sext_h:
+                return dop_sext_h;
+            }
+            break;
+        }
+        return dop_illegal;
+    }
+    if (imm == bitmanip_imm_orc_b)
+        return dop_orc_b;
+    if (imm == bitmanip_imm_rev8)
+        return dop_rev8;
+    switch (funct7) {
+    case shift_func_srli:
+        return dop_srli;
+    case shift_func_srai:
+        return dop_srai;
+    case op_funct7_rotate:
+        return dop_rori;
+    case op_funct7_bclr:
+        return dop_bexti;
+    }
+    return dop_illegal;
+}
+#endif
+
+// Returns the operation of an op_op instruction whose funct7 is one of the
+// bit manipulation ones.
+static enum decoded_op decode_bitmanip(u32 funct7, u32 funct3, u32 rs2) {
+    switch (funct7) {
+    case op_funct7_shadd:
+        return funct3 == 0b010   ? dop_sh1add
+               : funct3 == 0b100 ? dop_sh2add
+               : funct3 == 0b110 ? dop_sh3add
+                                 : dop_unimplemented;
+    case op_funct7_minmax:
+        // min, minu, max and maxu, in funct3 order.
+        return funct3 >= 0b100 ? dop_min + (funct3 - 0b100)
+                               : dop_unimplemented;
+    case op_funct7_zext:
+        return funct3 == 0b100 && rs2 == 0 ? dop_zext_h : dop_unimplemented;
+    case op_funct7_rotate:
+        return funct3 == 0b001   ? dop_rol
+               : funct3 == 0b101 ? dop_ror
+                                 : dop_unimplemented;
+    case op_funct7_bset:
+        return funct3 == 0b001 ? dop_bset : dop_unimplemented;
+    case op_funct7_bclr:
+        return funct3 == 0b001   ? dop_bclr
+               : funct3 == 0b101 ? dop_bext
+                                 : dop_unimplemented;
+    case op_funct7_binv:
+        return funct3 == 0b001 ? dop_binv : dop_unimplemented;
+    }
+    return dop_unimplemented;
+}
+
+// The V extension is only there for RV32.
+#if RV_XLEN == 32
+// Operand kinds each integer vector operation comes in, by funct6.
+enum vector_forms { vv = 1 << 0, vx = 1 << 1, vi = 1 << 2 };
+static u8 const vector_int_forms[64] = {
+    [vint_funct6_add] = vv | vx | vi,   [vint_funct6_sub] = vv | vx,
+    [vint_funct6_rsub] = vx | vi,       [vint_funct6_minu] = vv | vx,
+    [vint_funct6_min] = vv | vx,        [vint_funct6_maxu] = vv | vx,
+    [vint_funct6_max] = vv | vx,        [vint_funct6_and] = vv | vx | vi,
+    [vint_funct6_or] = vv | vx | vi,    [vint_funct6_xor] = vv | vx | vi,
+    [vint_funct6_merge] = vv | vx | vi, [vint_funct6_mseq] = vv | vx | vi,
+    [vint_funct6_msne] = vv | vx | vi,  [vint_funct6_msltu] = vv | vx,
+    [vint_funct6_mslt] = vv | vx,       [vint_funct6_msleu] = vv | vx | vi,
+    [vint_funct6_msle] = vv | vx | vi,  [vint_funct6_msgtu] = vx | vi,
+    [vint_funct6_msgt] = vx | vi,
+};
+
+// Decodes an op_op_v instruction into `d`.
+static void decode_vector_arith(union insn as, struct decoded_insn *d) {
+    d->rd = as.v.vd;
+    d->rs1 = as.v.vs1;
+    d->rs2 = as.v.vs2;
+    d->imm = as.raw;
+    switch ((enum vector_funct3)as.v.funct3) {
+    case vector_funct3_ivv:
+    case vector_funct3_ivx:
+    case vector_funct3_ivi: {
+        u8 const form = as.v.funct3 == vector_funct3_ivv   ? vv
+                        : as.v.funct3 == vector_funct3_ivx ? vx
+                                                           : vi;
+        if (!(vector_int_forms[as.v.funct6] & form))
+            return;
+        // vmv.v.* is the unmasked vmerge, with vs2 0.
+        if (as.v.funct6 == vint_funct6_merge && as.v.vm && as.v.vs2 != 0) {
+            d->op = dop_illegal;
+            return;
+        }
+        d->op = form == vv   ? dop_varith_vv
+                : form == vx ? dop_varith_vx
+                             : dop_varith_vi;
+        return;
+    }
+    case vector_funct3_mvv:
+        if (as.v.funct6 <= vmvv_funct6_redmax) {
+            d->op = dop_vred;
+        } else if (as.v.funct6 == vmvv_funct6_wxunary0 && as.v.vs1 == 0 &&
+                   as.v.vm) {
+            d->op = dop_vmv_x_s;
+            d->rd = decode_rd(as.v.vd);
+        }
+        return;
+    case vector_funct3_mvx:
+        if (as.v.funct6 == vmvv_funct6_wxunary0 && as.v.vs2 == 0 && as.v.vm)
+            d->op = dop_vmv_s_x;
+        return;
+    case vector_funct3_cfg:
+        d->rd = decode_rd(as.v.vd);
+        if (!(as.raw >> 31)) {
+            d->op = dop_vsetvli;
+            d->imm = as.raw >> 20 & 0x7ff;
+        } else if (as.raw >> 30 == 0b11) {
+            d->op = dop_vsetivli;
+            d->imm = as.raw >> 20 & 0x3ff;
+        } else if (as.v.funct6 == 0b100000 && !as.v.vm) {
+            d->op = dop_vsetvl;
+            d->imm = 0;
+        }
+        return;
+    default:
+        // Floating-point.
+        return;
+    }
+}
+
+// Decodes an op_load_fp or op_store_fp instruction into `d`, if it's a vector
+// one.
+static void decode_vector_memory(union insn as, struct decoded_insn *d) {
+    bool const load = as.vmem.opcode == op_load_fp;
+    // The scalar floating-point accesses, and 64-bit elements, which are
+    // larger than ELEN.
+    if (as.vmem.width != vector_width_8 && as.vmem.width != vector_width_16 &&
+        as.vmem.width != vector_width_32)
+        return;
+    // Segments and wider element widths.
+    if (as.vmem.nf != 0 || as.vmem.mew != 0)
+        return;
+    if (as.vmem.mop == vector_mop_unit_stride && as.vmem.rs2 == 0)
+        d->op = load ? dop_vle : dop_vse;
+    else if (as.vmem.mop == vector_mop_strided)
+        d->op = load ? dop_vlse : dop_vsse;
+    else
+        return;
+    d->rd = as.vmem.vd;
+    d->rs1 = as.vmem.rs1;
+    d->rs2 = as.vmem.rs2;
+    d->imm = as.raw;
+}
+#endif
+
+// Returns whether `rm` is a rounding mode an instruction can ask for, which
+// leaves out the reserved ones.
+static bool valid_rm(u32 rm) { return rm <= fp_rm_rmm || rm == fp_rm_dyn; }
+
+// Decodes an op_fp instruction into `d`.
+static void decode_float(union insn as, struct decoded_insn *d) {
+    u32 const fmt = as.r.funct7 & 0b11, funct3 = as.r.funct3, rs2 = as.r.rs2;
+    // Half and quad precision.
+    if (fmt != fp_fmt_s && fmt != fp_fmt_d)
+        return;
+    bool const dbl = fmt == fp_fmt_d;
+#define PICK(name) (dbl ? dop_##name##_d : dop_##name##_s)
+    d->rd = as.r.rd;
+    d->rs1 = as.r.rs1;
+    d->rs2 = rs2;
+    d->imm = funct3;
+    bool rounds = true;
+    switch ((enum fp_funct5)(as.r.funct7 >> 2)) {
+    case fp_funct5_add:
+        d->op = PICK(fadd);
+        break;
+    case fp_funct5_sub:
+        d->op = PICK(fsub);
+        break;
+    case fp_funct5_mul:
+        d->op = PICK(fmul);
+        break;
+    case fp_funct5_div:
+        d->op = PICK(fdiv);
+        break;
+    case fp_funct5_sqrt:
+        if (rs2 == 0)
+            d->op = PICK(fsqrt);
+        break;
+    case fp_funct5_sgnj:
+        rounds = false;
+        d->op = funct3 == 0b000   ? PICK(fsgnj)
+                : funct3 == 0b001 ? PICK(fsgnjn)
+                : funct3 == 0b010 ? PICK(fsgnjx)
+                                  : dop_illegal;
+        break;
+    case fp_funct5_minmax:
+        rounds = false;
+        d->op = funct3 == 0b000   ? PICK(fmin)
+                : funct3 == 0b001 ? PICK(fmax)
+                                  : dop_illegal;
+        break;
+    case fp_funct5_cvt_fmt:
+        // Widening is exact.
+        if (!dbl && rs2 == fp_fmt_d) {
+            d->op = dop_fcvt_s_d;
+        } else if (dbl && rs2 == fp_fmt_s) {
+            d->op = dop_fcvt_d_s;
+            rounds = false;
+        }
+        break;
+    case fp_funct5_compare:
+        rounds = false;
+        d->rd = decode_rd(as.r.rd);
+        d->op = funct3 == 0b000   ? PICK(fle)
+                : funct3 == 0b001 ? PICK(flt)
+                : funct3 == 0b010 ? PICK(feq)
+                                  : dop_illegal;
+        break;
+    case fp_funct5_cvt_to_int:
+        d->rd = decode_rd(as.r.rd);
+        d->op = rs2 == 0 ? PICK(fcvt_w) : rs2 == 1 ? PICK(fcvt_wu) : d->op;
+        break;
+    case fp_funct5_cvt_from_int:
+        d->op = rs2 == 0   ? (dbl ? dop_fcvt_d_w : dop_fcvt_s_w)
+                : rs2 == 1 ? (dbl ? dop_fcvt_d_wu : dop_fcvt_s_wu)
+                           : d->op;
+        // Every 32-bit integer is a double.
+        rounds = !dbl;
+        break;
+    case fp_funct5_mv_to_int:
+        rounds = false;
+        d->rd = decode_rd(as.r.rd);
+        if (funct3 == 0b000 && !dbl && rs2 == 0)
+            d->op = dop_fmv_x_w;
+        else if (funct3 == 0b001 && rs2 == 0)
+            d->op = PICK(fclass);
+        break;
+    case fp_funct5_mv_from_int:
+        rounds = false;
+        if (funct3 == 0b000 && !dbl && rs2 == 0)
+            d->op = dop_fmv_w_x;
+        break;
+    }
+#undef PICK
+    if (rounds && d->op != dop_unimplemented && !valid_rm(funct3))
+        d->op = dop_illegal;
+}
+
+// Decodes an op_load_fp or op_store_fp instruction into `d`.
+static void decode_float_memory(union insn as, u32 raw,
+                                struct decoded_insn *d) {
+    if (as.i.funct3 != fp_width_w && as.i.funct3 != fp_width_d) {
+#if RV_XLEN == 32
+        decode_vector_memory(as, d);
+#endif
+        return;
+    }
+    bool const dbl = as.i.funct3 == fp_width_d;
+    if (as.unknown.opcode == op_load_fp) {
+        d->op = dbl ? dop_fld : dop_flw;
+        d->rd = as.i.rd;
+        d->rs1 = as.i.rs1;
+        d->imm = read_i_immediate(raw);
+    } else {
+        d->op = dbl ? dop_fsd : dop_fsw;
+        d->rs1 = as.s.rs1;
+        d->rs2 = as.s.rs2;
+        d->imm = read_s_immediate(raw);
+    }
+}
+
+// Decodes an op_amo instruction into `d`.
+static void decode_atomic(union insn as, struct decoded_insn *d) {
+    static u8 const ops[32] = {
+        [amo_funct5_lr] = dop_lr_w,       [amo_funct5_sc] = dop_sc_w,
+        [amo_funct5_swap] = dop_amoswap_w, [amo_funct5_add] = dop_amoadd_w,
+        [amo_funct5_xor] = dop_amoxor_w,  [amo_funct5_and] = dop_amoand_w,
+        [amo_funct5_or] = dop_amoor_w,    [amo_funct5_min] = dop_amomin_w,
+        [amo_funct5_max] = dop_amomax_w,  [amo_funct5_minu] = dop_amominu_w,
+        [amo_funct5_maxu] = dop_amomaxu_w,
+    };
+    u32 const funct5 = as.r.funct7 >> 2;
+    if (ops[funct5] == 0 || (funct5 == amo_funct5_lr && as.r.rs2 != 0))
+        return;
+    if (as.r.funct3 == amo_funct3_w) {
+        d->op = ops[funct5];
+#if RV_XLEN == 64
+    } else if (as.r.funct3 == amo_funct3_d) {
+        d->op = ops[funct5] + (dop_lr_d - dop_lr_w);
+#endif
+    } else {
+        return;
+    }
+    d->rd = decode_rd(as.r.rd);
+    d->rs1 = as.r.rs1;
+    d->rs2 = as.r.rs2;
+    d->imm = as.r.funct7 & (amo_aq | amo_rl);
+}
+
+struct decoded_insn decode_insn(u32 raw, u32 pc) {
+    union insn as;
+    as.raw = raw;
+
+    struct decoded_insn d = {.op = dop_unimplemented};
+
+    if (raw == 0) {
+        d.op = dop_illegal;
+        return d;
+    }
+
+    switch (as.unknown.opcode) {
+    case op_lui:
+        d.op = dop_lui;
+        d.rd = decode_rd(as.u.rd);
+        d.imm = read_upper_immediate(raw);
+        break;
+    case op_auipc:
+        d.op = dop_auipc;
+        d.rd = decode_rd(as.u.rd);
+        d.imm = pc + read_upper_immediate(raw);
+        break;
+    case op_jal:
+        d.op = dop_jal;
+        d.rd = decode_rd(as.j.rd);
+        d.imm = pc + read_j_immediate(raw);
+        break;
+    case op_jalr:
+        d.op = dop_jalr;
+        d.rd = decode_rd(as.i.rd);
+        d.rs1 = as.i.rs1;
+        d.imm = read_i_immediate(raw);
+        break;
+    case op_branch: {
+        static u8 const ops[8] = {
+            [branch_func_beq] = dop_beq,   [branch_func_bne] = dop_bne,
+            [branch_func_blt] = dop_blt,   [branch_func_bge] = dop_bge,
+            [branch_func_bltu] = dop_bltu, [branch_func_bgeu] = dop_bgeu,
+            // 0b010 and 0b011 are reserved.
+            [0b010] = dop_illegal,         [0b011] = dop_illegal,
+        };
+        d.op = ops[as.b.funct3];
+        d.rs1 = as.b.rs1;
+        d.rs2 = as.b.rs2;
+        d.imm = pc + read_b_immediate(raw);
+    } break;
+    case op_load: {
+        static u8 const ops[8] = {
+            [load_func_lb] = dop_lb,   [load_func_lh] = dop_lh,
+            [load_func_lw] = dop_lw,   [load_func_lbu] = dop_lbu,
+            [load_func_lhu] = dop_lhu, [0b111] = dop_illegal,
+#if RV_XLEN == 64
+            [load_func_ld] = dop_ld,   [load_func_lwu] = dop_lwu,
+#else
+            [0b011] = dop_illegal,     [0b110] = dop_illegal,
+#endif
+        };
+        d.op = ops[as.i.funct3];
+        d.rd = decode_rd(as.i.rd);
+        d.rs1 = as.i.rs1;
+        d.imm = read_i_immediate(raw);
+    } break;
+    case op_store: {
+        d.op = as.s.funct3 == store_func_sb   ? dop_sb
+               : as.s.funct3 == store_func_sh ? dop_sh
+               : as.s.funct3 == store_func_sw ? dop_sw
+#if RV_XLEN == 64
+               : as.s.funct3 == store_func_sd ? dop_sd
+#endif
+                                              : dop_illegal;
+        d.rs1 = as.s.rs1;
+        d.rs2 = as.s.rs2;
+        d.imm = read_s_immediate(raw);
+    } break;
+    case op_imm:
+        d.rd = decode_rd(as.i.rd);
+        d.rs1 = as.i.rs1;
+        d.imm = read_i_immediate(raw);
+        switch ((enum insn_imm_func)as.i.funct3) {
+        case imm_func_addi:
+            d.op = dop_addi;
+            break;
+        case imm_func_slti:
+            d.op = dop_slti;
+            break;
+        case imm_func_sltiu:
+            d.op = dop_sltiu;
+            break;
+        case imm_func_xori:
+            d.op = dop_xori;
+            break;
+        case imm_func_ori:
+            d.op = dop_ori;
+            break;
+        case imm_func_andi:
+            d.op = dop_andi;
+            break;
+        case imm_func_slli:
+        case imm_func_srli:
+            d.op = decode_shift_imm(as.i.funct3, as.i.imm_11_0);
+            d.imm = read_shift_immediate(raw);
+            break;
+        }
+        break;
+    case op_op: {
+        static u8 const ops[8][2] = {
+            [op_funct3_add] = {dop_add, dop_sub},
+            [op_funct3_sll] = {dop_sll, dop_illegal},
+            [op_funct3_slt] = {dop_slt, dop_illegal},
+            [op_funct3_sltu] = {dop_sltu, dop_illegal},
+            [op_funct3_xor] = {dop_xor, dop_xnor},
+            [op_funct3_srl] = {dop_srl, dop_sra},
+            [op_funct3_or] = {dop_or, dop_orn},
+            [op_funct3_and] = {dop_and, dop_andn},
+        };
+        d.rd = decode_rd(as.r.rd);
+        d.rs1 = as.r.rs1;
+        d.rs2 = as.r.rs2;
+        if (as.r.funct7 == 0) {
+            d.op = ops[as.r.funct3][0];
+        } else if (as.r.funct7 == op_funct7_sub) {
+            d.op = ops[as.r.funct3][1];
+        } else if (as.r.funct7 == op_funct7_muldiv) {
+            d.op = dop_mul + as.r.funct3;
+        } else {
+            d.op = decode_bitmanip(as.r.funct7, as.r.funct3, as.r.rs2);
+        }
+#if RV_XLEN == 64
+        // Bit manipulation is only there for RV32.
+        if (d.op >= dop_sh1add && d.op <= dop_bseti)
+            d.op = dop_unimplemented;
+#endif
+    } break;
+#if RV_XLEN == 64
+    case op_imm_32:
+        d.rd = decode_rd(as.i.rd);
+        d.rs1 = as.i.rs1;
+        d.imm = read_i_immediate(raw);
+        if (as.i.funct3 == imm_func_addi) {
+            d.op = dop_addiw;
+        } else if (as.i.funct3 == imm_func_slli ||
+                   as.i.funct3 == imm_func_srli) {
+            // Shift amounts of 32 and more are reserved, and the other upper
+            // bits are bit manipulation.
+            u32 const funct7 = as.i.imm_11_0 >> 5;
+            if (funct7 == shift_func_srli)
+                d.op = as.i.funct3 == imm_func_slli ? dop_slliw : dop_srliw;
+            else if (funct7 == shift_func_srai && as.i.funct3 == imm_func_srai)
+                d.op = dop_sraiw;
+            d.imm &= 0x1f;
+        }
+        break;
+    case op_op_32: {
+        // Indexed by funct3, for funct7 0, op_funct7_sub and
+        // op_funct7_muldiv.
+        static u8 const ops[8][3] = {
+            [op_funct3_add] = {dop_addw, dop_subw, dop_mulw},
+            [op_funct3_sll] = {dop_sllw},
+            [op_funct3_srl] = {dop_srlw, dop_sraw, dop_divuw},
+            [muldiv_funct3_div] = {[2] = dop_divw},
+            [muldiv_funct3_rem] = {[2] = dop_remw},
+            [muldiv_funct3_remu] = {[2] = dop_remuw},
+        };
+        d.rd = decode_rd(as.r.rd);
+        d.rs1 = as.r.rs1;
+        d.rs2 = as.r.rs2;
+        u32 const form = as.r.funct7 == 0                  ? 0
+                         : as.r.funct7 == op_funct7_sub    ? 1
+                         : as.r.funct7 == op_funct7_muldiv ? 2
+                                                           : 3;
+        if (form != 3 && ops[as.r.funct3][form] != 0)
+            d.op = ops[as.r.funct3][form];
+    } break;
+#endif
+
+    case op_misc_mem:
+        // Only the predecessor and successor sets matter, see ATOMIC_OPS.
+        d.rd = DECODED_SINK_REG;
+        d.op = as.fence.funct3 == fence_funct3     ? dop_fence
+               : as.fence.funct3 == fence_funct3_i ? dop_fence_i
+                                                   : dop_illegal;
+        if (d.op == dop_fence)
+            d.imm = raw >> 20 & 0xff;
+        break;
+
+    case op_op_v:
+        // The V extension is only there for RV32.
+#if RV_XLEN == 32
+        decode_vector_arith(as, &d);
+#endif
+        break;
+    case op_load_fp:
+    case op_store_fp:
+        decode_float_memory(as, raw, &d);
+        break;
+    case op_fp:
+        decode_float(as, &d);
+        break;
+    case op_madd:
+    case op_msub:
+    case op_nmsub:
+    case op_nmadd:
+        // The four opcodes are 4 apart, and their operations in the same
+        // order for either format.
+        if (as.r4.fmt == fp_fmt_s || as.r4.fmt == fp_fmt_d) {
+            d.op = !valid_rm(as.r4.rm) ? dop_illegal
+                   : (as.r4.fmt == fp_fmt_d ? dop_fmadd_d : dop_fmadd_s) +
+                         (as.unknown.opcode - op_madd) / 4;
+            d.rd = as.r4.rd;
+            d.rs1 = as.r4.rs1;
+            d.rs2 = as.r4.rs2;
+            d.imm = as.r4.rm | as.r4.rs3 << 3;
+        }
+        break;
+
+    case op_system:
+        // ecall and ebreak are funct3 0. ebreak is left unimplemented.
+        if (as.i.funct3 == 0) {
+            if (as.i.rd == 0 && as.i.rs1 == 0 &&
+                as.i.imm_11_0 == ecall_ecall)
+                d.op = dop_ecall;
+        } else {
+            static u8 const ops[8] = {
+                [csrrw] = dop_csrrw,   [csrrs] = dop_csrrs,
+                [csrrc] = dop_csrrc,   [0b100] = dop_illegal,
+                [csrrwi] = dop_csrrwi, [csrrsi] = dop_csrrsi,
+                [csrrci] = dop_csrrci,
+            };
+            d.op = ops[as.i.funct3];
+            d.rd = decode_rd(as.i.rd);
+            d.rs1 = as.i.rs1;
+            d.imm = as.i.imm_11_0;
+        }
+        break;
+
+    case op_amo:
+        decode_atomic(as, &d);
+        break;
+
+    case op_custom_0:
+#if RV_XLEN == 32
+    case op_imm_32:
+    case op_op_32:
+#endif
+    case op_custom_1:
+    case op_custom2_rv128:
+    case op_custom3_rv128:
+        break;
+    }
+
+    if (d.op == dop_unimplemented)
+        d.imm = raw;
+    return d;
+}
+
+struct decoded_insn decode_insn_at(void const *memory, u32 pc, bool compressed,
+                                   u32 *size) {
+    u16 low;
+    memcpy(&low, (u8 const *)memory + pc, sizeof(low));
+    if (compressed && rvc_insn_size(low) == 2) {
+        *size = 2;
+        return decode_insn(rvc_expand(low), pc);
+    }
+    u32 raw;
+    memcpy(&raw, (u8 const *)memory + pc, sizeof(raw));
+    *size = 4;
+    return decode_insn(raw, pc);
+}
+
+int decode_text(struct decoded_text *text, void const *memory, u32 base,
+                u32 size, bool compressed) {
+    text->base = base;
+    text->count = compressed ? size / 2 : size / 4;
+    // A trailing partial instruction isn't part of the text.
+    text->size = text->count * (compressed ? 2 : 4);
+    text->pcs = NULL;
+    text->indices = NULL;
+    // One extra slot past the end, so that falling off the text is caught as
+    // an illegal instruction rather than running off the array.
+    text->insns = calloc(text->count + 1, sizeof(*text->insns));
+    if (text->insns == NULL)
+        return ENOMEM;
+    if (compressed) {
+        text->pcs = malloc((text->count + 1) * sizeof(*text->pcs));
+        text->indices = malloc(text->count * sizeof(*text->indices));
+        if (text->pcs == NULL || text->indices == NULL) {
+            decoded_text_destroy(text);
+            return ENOMEM;
+        }
+    }
+    text->insns[text->count].op = dop_illegal;
+
+    decoded_text_refresh(text, memory);
+    return 0;
+}
+
+// Sweeps compressed text from its start, an instruction at a time.
+static void refresh_compressed(struct decoded_text const *text,
+                               void const *memory) {
+    u32 const end = text->base + text->size;
+    u32 i = 0;
+    for (u32 pc = text->base; pc < end; ++i) {
+        u32 size;
+        struct decoded_insn insn = decode_insn_at(memory, pc, true, &size);
+        // The last 2 bytes can't hold a 4-byte instruction.
+        if (pc + size > end) {
+            insn = (struct decoded_insn){.op = dop_illegal};
+            size = end - pc;
+        }
+        text->insns[i] = insn;
+        text->pcs[i] = pc;
+        text->indices[(pc - text->base) / 2] = i;
+        if (size == 4)
+            text->indices[(pc - text->base) / 2 + 1] = UINT32_MAX;
+        pc += size;
+    }
+    for (; i <= text->count; ++i) {
+        text->insns[i] = (struct decoded_insn){.op = dop_illegal};
+        text->pcs[i] = end;
+    }
+}
+
+void decoded_text_refresh(struct decoded_text const *text, void const *memory) {
+    if (text->indices != NULL) {
+        refresh_compressed(text, memory);
+        return;
+    }
+    u8 const *bytes = memory + text->base;
+    for (u32 i = 0; i < text->count; ++i) {
+        u32 raw;
+        memcpy(&raw, bytes + 4 * i, sizeof(raw));
+        text->insns[i] = decode_insn(raw, text->base + 4 * i);
+    }
+}
+
+int decoded_text_copy(struct decoded_text *copy,
+                      struct decoded_text const *text) {
+    *copy = *text;
+    copy->insns = malloc((text->count + 1) * sizeof(*copy->insns));
+    copy->pcs = NULL;
+    copy->indices = NULL;
+    if (text->indices != NULL) {
+        copy->pcs = malloc((text->count + 1) * sizeof(*copy->pcs));
+        copy->indices = malloc(text->count * sizeof(*copy->indices));
+    }
+    if (copy->insns == NULL ||
+        (text->indices != NULL &&
+         (copy->pcs == NULL || copy->indices == NULL))) {
+        decoded_text_destroy(copy);
+        return ENOMEM;
+    }
+    memcpy(copy->insns, text->insns, (text->count + 1) * sizeof(*copy->insns));
+    if (text->indices != NULL) {
+        memcpy(copy->pcs, text->pcs, (text->count + 1) * sizeof(*copy->pcs));
+        memcpy(copy->indices, text->indices,
+               text->count * sizeof(*copy->indices));
+    }
+    return 0;
+}
+
+void decoded_text_destroy(struct decoded_text *text) {
+    free(text->insns);
+    free(text->pcs);
+    free(text->indices);
+}
@@ -0,0 +1,390 @@
+#pragma once
+
+#include "../common/types.h"
+#include "insn.h"
+#include "xlen.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Pre-decoded instruction stream.
+// Every instruction is resolved once into a `struct decoded_insn`, which names
+// the exact operation (no funct3/funct7 left to look at), its register
+// indices and its immediate already sign-extended. Executors then run off the
+// decoded array instead of re-extracting bitfields on every step.
+
+// X-macro listing every operation a decoded instruction can name.
+// `undecoded` must stay first so that a zeroed slot is never executable.
+#define DECODED_OPS(X)                                                         \
+    X(undecoded)                                                               \
+    X(illegal)                                                                 \
+    X(unimplemented)                                                           \
+    X(lui)                                                                     \
+    X(auipc)                                                                   \
+    X(jal)                                                                     \
+    X(jalr)                                                                    \
+    X(beq)                                                                     \
+    X(bne)                                                                     \
+    X(blt)                                                                     \
+    X(bge)                                                                     \
+    X(bltu)                                                                    \
+    X(bgeu)                                                                    \
+    X(lb)                                                                      \
+    X(lh)                                                                      \
+    X(lw)                                                                      \
+    X(lbu)                                                                     \
+    X(lhu)                                                                     \
+    X(sb)                                                                      \
+    X(sh)                                                                      \
+    X(sw)                                                                      \
+    X(addi)                                                                    \
+    X(slti)                                                                    \
+    X(sltiu)                                                                   \
+    X(xori)                                                                    \
+    X(ori)                                                                     \
+    X(andi)                                                                    \
+    X(slli)                                                                    \
+    X(srli)                                                                    \
+    X(srai)                                                                    \
+    X(add)                                                                     \
+    X(sub)                                                                     \
+    X(sll)                                                                     \
+    X(slt)                                                                     \
+    X(sltu)                                                                    \
+    X(xor)                                                                     \
+    X(srl)                                                                     \
+    X(sra)                                                                     \
+    X(or)                                                                      \
+    X(and)                                                                     \
+    RV64_OPS(X)                                                                \
+    MULDIV_OPS(X)                                                              \
+    BITMANIP_OPS(X)                                                            \
+    VECTOR_OPS(X)                                                              \
+    FLOAT_OPS(X)                                                               \
+    CSR_OPS(X)                                                                 \
+    ATOMIC_OPS(X)                                                              \
+    X(fence)                                                                   \
+    X(fence_i)                                                                 \
+    X(ecall)                                                                   \
+    FUSED_OPS(X)                                                               \
+    IDIOM_OPS(X)
+
+// RV64I, and the word forms of the M extension, which only RV64 builds (see
+// xlen.h) have. The `*w` forms work on the low 32 bits of their operands, and
+// sign-extend their 32-bit result.
+#if RV_XLEN == 64
+#define RV64_OPS(X)                                                            \
+    X(ld)                                                                      \
+    X(lwu)                                                                     \
+    X(sd)                                                                      \
+    X(addiw)                                                                   \
+    X(slliw)                                                                   \
+    X(srliw)                                                                   \
+    X(sraiw)                                                                   \
+    X(addw)                                                                    \
+    X(subw)                                                                    \
+    X(sllw)                                                                    \
+    X(srlw)                                                                    \
+    X(sraw)                                                                    \
+    X(mulw)                                                                    \
+    X(divw)                                                                    \
+    X(divuw)                                                                   \
+    X(remw)                                                                    \
+    X(remuw)
+#else
+#define RV64_OPS(X)
+#endif
+
+// M extension, in funct3 order.
+#define MULDIV_OPS(X)                                                          \
+    X(mul)                                                                     \
+    X(mulh)                                                                    \
+    X(mulhsu)                                                                  \
+    X(mulhu)                                                                   \
+    X(div)                                                                     \
+    X(divu)                                                                    \
+    X(rem)                                                                     \
+    X(remu)
+
+// Zba, Zbb and Zbs. The `*i` forms take their shift amount or bit index as the
+// immediate, the unary ones only read rs1.
+#define BITMANIP_OPS(X)                                                        \
+    X(sh1add)                                                                  \
+    X(sh2add)                                                                  \
+    X(sh3add)                                                                  \
+    X(andn)                                                                    \
+    X(orn)                                                                     \
+    X(xnor)                                                                    \
+    X(clz)                                                                     \
+    X(ctz)                                                                     \
+    X(cpop)                                                                    \
+    X(min)                                                                     \
+    X(minu)                                                                    \
+    X(max)                                                                     \
+    X(maxu)                                                                    \
+    X(sext_b)                                                                  \
+    X(sext_h)                                                                  \
+    X(zext_h)                                                                  \
+    X(rol)                                                                     \
+    X(ror)                                                                     \
+    X(rori)                                                                    \
+    X(orc_b)                                                                   \
+    X(rev8)                                                                    \
+    X(bclr)                                                                    \
+    X(bclri)                                                                   \
+    X(bext)                                                                    \
+    X(bexti)                                                                   \
+    X(binv)                                                                    \
+    X(binvi)                                                                   \
+    X(bset)                                                                    \
+    X(bseti)
+
+// V extension (see vector.h). Unlike other instructions, these keep vector
+// register numbers in rd, rs1 and rs2 where the encoding has vd (or vs3), vs1
+// and vs2, and such an rd is never the sink:
+// - vsetvli: rd, rs1 (the AVL) and imm (vtype) as encoded.
+// - vsetivli: the same, but rs1 is the AVL itself.
+// - vsetvl: rd, rs1 and rs2 (vtype) as encoded.
+// - Loads, stores and the rest: vd, rs1 and rs2 (or vs1 and vs2) as encoded,
+//   and imm is the whole instruction, for the handlers to read the other
+//   fields from.
+// vmv.x.s writes the scalar rd, which is mapped to the sink like any other.
+#define VECTOR_OPS(X)                                                          \
+    X(vsetvli)                                                                 \
+    X(vsetivli)                                                                \
+    X(vsetvl)                                                                  \
+    X(vle)                                                                     \
+    X(vlse)                                                                    \
+    X(vse)                                                                     \
+    X(vsse)                                                                    \
+    X(varith_vv)                                                               \
+    X(varith_vx)                                                               \
+    X(varith_vi)                                                               \
+    X(vred)                                                                    \
+    X(vmv_x_s)                                                                 \
+    X(vmv_s_x)
+
+// F and D extensions (see fpu.h). Floating-point registers are named by their
+// number in rd, rs1 and rs2, and such an rd is never the sink. The operations
+// that round keep the rounding mode (`enum fp_rm`) in imm, along with rs3
+// shifted left by 3 for the fused multiply-adds. Loads and stores have the
+// usual address offset instead.
+// They come in three runs: the ones writing a floating-point register, then
+// the ones writing an integer register (mapped to the sink like any other),
+// then the stores.
+#define FLOAT_OPS(X)                                                           \
+    X(flw)                                                                     \
+    X(fld)                                                                     \
+    X(fmadd_s)                                                                 \
+    X(fmsub_s)                                                                 \
+    X(fnmsub_s)                                                                \
+    X(fnmadd_s)                                                                \
+    X(fmadd_d)                                                                 \
+    X(fmsub_d)                                                                 \
+    X(fnmsub_d)                                                                \
+    X(fnmadd_d)                                                                \
+    X(fadd_s)                                                                  \
+    X(fsub_s)                                                                  \
+    X(fmul_s)                                                                  \
+    X(fdiv_s)                                                                  \
+    X(fsqrt_s)                                                                 \
+    X(fsgnj_s)                                                                 \
+    X(fsgnjn_s)                                                                \
+    X(fsgnjx_s)                                                                \
+    X(fmin_s)                                                                  \
+    X(fmax_s)                                                                  \
+    X(fcvt_s_w)                                                                \
+    X(fcvt_s_wu)                                                               \
+    X(fadd_d)                                                                  \
+    X(fsub_d)                                                                  \
+    X(fmul_d)                                                                  \
+    X(fdiv_d)                                                                  \
+    X(fsqrt_d)                                                                 \
+    X(fsgnj_d)                                                                 \
+    X(fsgnjn_d)                                                                \
+    X(fsgnjx_d)                                                                \
+    X(fmin_d)                                                                  \
+    X(fmax_d)                                                                  \
+    X(fcvt_d_w)                                                                \
+    X(fcvt_d_wu)                                                               \
+    X(fmv_w_x)                                                                 \
+    X(fcvt_s_d)                                                                \
+    X(fcvt_d_s)                                                                \
+    X(fcvt_w_s)                                                                \
+    X(fcvt_wu_s)                                                               \
+    X(feq_s)                                                                   \
+    X(flt_s)                                                                   \
+    X(fle_s)                                                                   \
+    X(fclass_s)                                                                \
+    X(fmv_x_w)                                                                 \
+    X(fcvt_w_d)                                                                \
+    X(fcvt_wu_d)                                                               \
+    X(feq_d)                                                                   \
+    X(flt_d)                                                                   \
+    X(fle_d)                                                                   \
+    X(fclass_d)                                                                \
+    X(fsw)                                                                     \
+    X(fsd)
+
+// Zicsr. rd and rs1 are integer registers, rs1 standing for the 5-bit
+// immediate of the `i` forms, and imm is the CSR number.
+#define CSR_OPS(X)                                                             \
+    X(csrrw)                                                                   \
+    X(csrrs)                                                                   \
+    X(csrrc)                                                                   \
+    X(csrrwi)                                                                  \
+    X(csrrsi)                                                                  \
+    X(csrrci)
+
+// A extension. rs1 is the address, there's no offset, and imm holds the
+// ordering bits (`enum amo_ordering`). The `*_d` forms, which only RV64 builds
+// have, come in the same order as the `*_w` ones.
+// fence keeps the predecessor and successor sets (`enum fence_flags`) in bits
+// 7:4 and 3:0 of its imm, as encoded.
+#define ATOMIC_OPS(X)                                                          \
+    X(lr_w)                                                                    \
+    X(sc_w)                                                                    \
+    X(amoswap_w)                                                               \
+    X(amoadd_w)                                                                \
+    X(amoxor_w)                                                                \
+    X(amoand_w)                                                                \
+    X(amoor_w)                                                                 \
+    X(amomin_w)                                                                \
+    X(amomax_w)                                                                \
+    X(amominu_w)                                                               \
+    X(amomaxu_w)                                                               \
+    RV64_ATOMIC_OPS(X)
+
+#if RV_XLEN == 64
+#define RV64_ATOMIC_OPS(X)                                                     \
+    X(lr_d)                                                                    \
+    X(sc_d)                                                                    \
+    X(amoswap_d)                                                               \
+    X(amoadd_d)                                                                \
+    X(amoxor_d)                                                                \
+    X(amoand_d)                                                                \
+    X(amoor_d)                                                                 \
+    X(amomin_d)                                                                \
+    X(amomax_d)                                                                \
+    X(amominu_d)                                                               \
+    X(amomaxu_d)
+#else
+#define RV64_ATOMIC_OPS(X)
+#endif
+
+// Superinstructions: one handler for a sequence of instructions. These are
+// never produced by decode_insn(), only by fuse_text() (see fuse.h).
+#define FUSED_OPS(X)                                                           \
+    X(fused_li)                                                                \
+    X(fused_far_call)                                                          \
+    X(fused_byte_update)                                                       \
+    X(fused_ecall_args)
+
+// Whole loops run by a host kernel. These are never produced by decode_insn(),
+// only by idiom_match() (see idiom.h).
+#define IDIOM_OPS(X)                                                           \
+    X(idiom_scan)                                                              \
+    X(idiom_clear)                                                             \
+    X(idiom_strlen)                                                            \
+    X(idiom_memset)                                                            \
+    X(idiom_memcpy)
+
+enum decoded_op {
+#define X(name) dop_##name,
+    DECODED_OPS(X)
+#undef X
+        dop_count,
+};
+
+extern char const *decoded_op_names[dop_count];
+
+// Writes to x0 are redirected to this register index, so that executors can
+// store unconditionally. The register file must have room for it, and it must
+// never be read back.
+#define DECODED_SINK_REG 32
+
+struct decoded_insn {
+    u8 op;
+    u8 rd;
+    u8 rs1;
+    u8 rs2;
+    // Sign-extended immediate. For auipc, jal and branches it's already the
+    // absolute guest address (pc + offset). For dop_unimplemented it's the
+    // instruction itself (expanded, if it was compressed), to report it.
+    u32 imm;
+};
+
+// Decoded copy of a guest text segment. `insns[i]` describes the instruction
+// at guest address `base + 4 * i`.
+// Text with compressed instructions (see rvc.h) is decoded by sweeping it from
+// the start instead, since instructions aren't all 4 bytes long: `insns` holds
+// them back to back, `pcs[i]` is the guest address of `insns[i]`, and
+// `indices[(pc - base) / 2]` the index of the instruction at `pc`, or
+// UINT32_MAX when no instruction starts there. `count` is then the most
+// instructions the text could hold, and the slots past the last one are
+// illegal. `indices` and `pcs` are NULL for other text.
+struct decoded_text {
+    u32 base;
+    u32 count;
+    struct decoded_insn *insns;
+    // Size of the text in bytes.
+    u32 size;
+    u32 *pcs;
+    u32 *indices;
+};
+
+struct decoded_insn decode_insn(u32 raw, u32 pc);
+
+// Decodes the instruction at guest address `pc` of `memory`, which may be a
+// compressed one when `compressed` is set, and stores its size in `*size`.
+// Doesn't read past the first halfword of compressed instructions.
+struct decoded_insn decode_insn_at(void const *memory, u32 pc, bool compressed,
+                                   u32 *size);
+
+// Decodes `size` bytes of instructions found at `memory + base`, which may
+// include compressed ones when `compressed` is set.
+// Returns 0 on success or an errno value.
+int decode_text(struct decoded_text *text, void const *memory, u32 base,
+                u32 size, bool compressed);
+
+// Makes `copy` a decoded text of its own with the same instructions as `text`,
+// superinstructions included. Returns 0 on success or an errno value.
+int decoded_text_copy(struct decoded_text *copy,
+                      struct decoded_text const *text);
+
+void decoded_text_destroy(struct decoded_text *text);
+
+// Decodes every instruction of `text` again from `memory + text->base`, after
+// the guest wrote to its own code. The arrays stay where they are, so
+// pointers into `text->insns` stay good, but with compressed instructions
+// they may now be another instruction. Superinstructions are lost.
+void decoded_text_refresh(struct decoded_text const *text, void const *memory);
+
+// Returns whether an instruction of the decoded text starts at `pc`, which may
+// be any register value, including ones past 4 GiB for RV64.
+static inline bool decoded_text_contains(struct decoded_text const *text,
+                                         uxlen pc) {
+    if (text->indices != NULL) {
+        return pc - text->base < text->size && (pc & 0b1) == 0 &&
+               text->indices[(pc - text->base) / 2] != UINT32_MAX;
+    }
+    return pc - text->base < text->size && (pc & 0b11) == 0;
+}
+
+// Returns the index into `text->insns` of the instruction at `pc`, which the
+// text must contain.
+static inline u32 decoded_text_index(struct decoded_text const *text, u32 pc) {
+    if (text->indices != NULL)
+        return text->indices[(pc - text->base) / 2];
+    return (pc - text->base) / 4;
+}
+
+// Returns the guest address of `text->insns[i]`. Past the last instruction,
+// that's the end of the text.
+static inline u32 decoded_text_pc(struct decoded_text const *text, u32 i) {
+    if (text->pcs != NULL)
+        return text->pcs[i];
+    return text->base + 4 * i;
+}
+
+// vim:ft=c
@@ -72,7 +72,8 @@ enum insn_op {
     op_nmsub = 0b1001011,
     op_nmadd = 0b1001111,
     op_fp = 0b1010011,
-    // reserved: 0b1010011
+    // The V extension's arithmetic and configuration, see `enum vector_funct3`.
+    op_op_v = 0b1010111,
     op_custom2_rv128 = 0b1011011,
     op_branch = 0b1100011,
     op_jalr = 0b1100111,
@@ -93,6 +94,8 @@ enum insn_store_func {
     store_func_sb = 0b000,
     store_func_sh = 0b001,
     store_func_sw = 0b010,
+    // RV64I only.
+    store_func_sd = 0b011,
 };
 
 // Accompanied with an op_branch opcode.
@@ -114,6 +117,9 @@ enum insn_load_func {
     load_func_lw = 0b010,
     load_func_lbu = 0b100,
     load_func_lhu = 0b101,
+    // RV64I only.
+    load_func_ld = 0b011,
+    load_func_lwu = 0b110,
 };
 
 // Accompanied with an op_imm opcode.
@@ -169,17 +175,240 @@ enum insn_op_funct7 {
     op_funct7_sra = 1 << 5,
     op_funct7_or = 0,
     op_funct7_and = 0,
+    // The whole M extension, see `enum insn_muldiv_funct3`.
+    op_funct7_muldiv = 1,
+
+    // Bit manipulation (Zba, Zbb and Zbs). andn, orn and xnor share funct7
+    // with sub, as the and, or and xor with an inverted rs2.
+    // sh1add, sh2add and sh3add are funct3 0b010, 0b100 and 0b110.
+    op_funct7_shadd = 0b0010000,
+    // min, minu, max and maxu are funct3 0b100 to 0b111.
+    op_funct7_minmax = 0b0000101,
+    // zext.h, with funct3 0b100 and rs2 0.
+    op_funct7_zext = 0b0000100,
+    // rol and ror are funct3 0b001 and 0b101.
+    op_funct7_rotate = 0b0110000,
+    // bset, bclr, binv with funct3 0b001, and bext with funct3 0b101.
+    op_funct7_bset = 0b0010100,
+    op_funct7_bclr = 0b0100100,
+    op_funct7_binv = 0b0110100,
 };
 
-// CSR instructions. Accompanied with an op_system opcode.
-// I-type.
+// Bit manipulation instructions with an immediate, accompanied with an op_imm
+// opcode. These are shifts as far as encoding goes: the upper 7 bits of the
+// immediate are one of the `enum insn_op_funct7` values for the matching
+// register form, and the 5 low bits are the shift amount or bit index.
+// Under op_funct7_rotate with funct3 0b001, the low bits select a unary
+// operation instead, see `enum insn_unary_func`. orc.b and rev8 are fixed
+// immediates under funct3 0b101.
+enum insn_unary_func {
+    unary_func_clz = 0b00000,
+    unary_func_ctz = 0b00001,
+    unary_func_cpop = 0b00010,
+    unary_func_sext_b = 0b00100,
+    unary_func_sext_h = 0b00101,
+};
+
+enum bitmanip_imm {
+    bitmanip_imm_orc_b = 0b001010000111,
+    bitmanip_imm_rev8 = 0b011010011000,
+};
+
+// M extension. Accompanied with an op_op opcode and op_funct7_muldiv.
+// R-type.
+enum insn_muldiv_funct3 {
+    muldiv_funct3_mul,
+    muldiv_funct3_mulh,
+    muldiv_funct3_mulhsu,
+    muldiv_funct3_mulhu,
+    muldiv_funct3_div,
+    muldiv_funct3_divu,
+    muldiv_funct3_rem,
+    muldiv_funct3_remu,
+};
+
+// V extension, accompanied with an op_op_v opcode. funct3 tells what the
+// operands are: vd = vs2 <op> vs1, rs1 or a 5-bit signed immediate in the vs1
+// field. The integer (OPI*) and the other (OPM*) instructions have separate
+// funct6 spaces.
+enum vector_funct3 {
+    vector_funct3_ivv = 0b000,
+    vector_funct3_mvv = 0b010,
+    vector_funct3_ivi = 0b011,
+    vector_funct3_ivx = 0b100,
+    vector_funct3_mvx = 0b110,
+    // vsetvli, vsetivli and vsetvl, told apart by the top two bits.
+    vector_funct3_cfg = 0b111,
+};
+
+// funct6 of the OPIVV, OPIVX and OPIVI instructions.
+enum vector_int_funct6 {
+    vint_funct6_add = 0b000000,
+    vint_funct6_sub = 0b000010,
+    vint_funct6_rsub = 0b000011,
+    vint_funct6_minu = 0b000100,
+    vint_funct6_min = 0b000101,
+    vint_funct6_maxu = 0b000110,
+    vint_funct6_max = 0b000111,
+    vint_funct6_and = 0b001001,
+    vint_funct6_or = 0b001010,
+    vint_funct6_xor = 0b001011,
+    // vmerge when masked, vmv.v.v/x/i (with vs2 0) when not.
+    vint_funct6_merge = 0b010111,
+    // Compares, writing a mask.
+    vint_funct6_mseq = 0b011000,
+    vint_funct6_msne = 0b011001,
+    vint_funct6_msltu = 0b011010,
+    vint_funct6_mslt = 0b011011,
+    vint_funct6_msleu = 0b011100,
+    vint_funct6_msle = 0b011101,
+    vint_funct6_msgtu = 0b011110,
+    vint_funct6_msgt = 0b011111,
+};
+
+// funct6 of the OPMVV and OPMVX instructions.
+enum vector_mvv_funct6 {
+    // Reductions, vd[0] = vs1[0] <op> every active element of vs2. In the
+    // same order as the matching `enum vector_int_funct6` operations.
+    vmvv_funct6_redsum = 0b000000,
+    vmvv_funct6_redand = 0b000001,
+    vmvv_funct6_redor = 0b000010,
+    vmvv_funct6_redxor = 0b000011,
+    vmvv_funct6_redminu = 0b000100,
+    vmvv_funct6_redmin = 0b000101,
+    vmvv_funct6_redmaxu = 0b000110,
+    vmvv_funct6_redmax = 0b000111,
+    // vmv.x.s (OPMVV, vs1 0) and vmv.s.x (OPMVX, vs2 0).
+    vmvv_funct6_wxunary0 = 0b010000,
+};
+
+// Vector loads and stores share op_load_fp and op_store_fp with the scalar
+// floating-point ones, which use the other widths.
+enum vector_width {
+    vector_width_8 = 0b000,
+    vector_width_16 = 0b101,
+    vector_width_32 = 0b110,
+    vector_width_64 = 0b111,
+};
+
+// Addressing mode (mop) of vector loads and stores.
+enum vector_mop {
+    vector_mop_unit_stride = 0b00,
+    vector_mop_strided = 0b10,
+};
+
+// F and D extensions' scalar widths of op_load_fp and op_store_fp, which
+// share them with the vector ones.
+enum fp_width {
+    fp_width_w = 0b010,
+    fp_width_d = 0b011,
+};
+
+// F and D extensions, accompanied with an op_fp opcode.
+// R-type, with funct7 made of the operation (`enum fp_funct5`) in its upper 5
+// bits and the format (`enum fp_fmt`) in its lower 2. funct3 is the rounding
+// mode (`enum fp_rm`) of the operations that round, and tells the others
+// apart as noted. Operations with a single source have another selector in
+// rs2.
+enum fp_funct5 {
+    fp_funct5_add = 0b00000,
+    fp_funct5_sub = 0b00001,
+    fp_funct5_mul = 0b00010,
+    fp_funct5_div = 0b00011,
+    // fsgnj, fsgnjn and fsgnjx are funct3 0b000, 0b001 and 0b010.
+    fp_funct5_sgnj = 0b00100,
+    // fmin and fmax are funct3 0b000 and 0b001.
+    fp_funct5_minmax = 0b00101,
+    // Between formats: rs2 is the format converted from.
+    fp_funct5_cvt_fmt = 0b01000,
+    fp_funct5_sqrt = 0b01011,
+    // fle, flt and feq are funct3 0b000, 0b001 and 0b010.
+    fp_funct5_compare = 0b10100,
+    // fcvt.w.<fmt> (rs2 0) and fcvt.wu.<fmt> (rs2 1).
+    fp_funct5_cvt_to_int = 0b11000,
+    // fcvt.<fmt>.w (rs2 0) and fcvt.<fmt>.wu (rs2 1).
+    fp_funct5_cvt_from_int = 0b11010,
+    // fmv.x.w (funct3 0b000) and fclass (funct3 0b001).
+    fp_funct5_mv_to_int = 0b11100,
+    // fmv.w.x.
+    fp_funct5_mv_from_int = 0b11110,
+};
+
+enum fp_fmt {
+    fp_fmt_s = 0b00,
+    fp_fmt_d = 0b01,
+};
+
+// Rounding modes. 0b101 and 0b110 are reserved.
+enum fp_rm {
+    fp_rm_rne = 0b000,
+    fp_rm_rtz = 0b001,
+    fp_rm_rdn = 0b010,
+    fp_rm_rup = 0b011,
+    fp_rm_rmm = 0b100,
+    // The instruction rounds like the frm CSR says.
+    fp_rm_dyn = 0b111,
+};
+
+// A extension, accompanied with an op_amo opcode.
+// R-type, with funct7 made of the operation (`enum amo_funct5`) in its upper 5
+// bits and the ordering bits (`enum amo_ordering`) in its lower 2. rs1 is the
+// address, and funct3 the width.
+enum amo_funct3 {
+    amo_funct3_w = 0b010,
+    // RV64A only.
+    amo_funct3_d = 0b011,
+};
+
+enum amo_funct5 {
+    amo_funct5_add = 0b00000,
+    amo_funct5_swap = 0b00001,
+    // rs2 must be 0.
+    amo_funct5_lr = 0b00010,
+    amo_funct5_sc = 0b00011,
+    amo_funct5_xor = 0b00100,
+    amo_funct5_or = 0b01000,
+    amo_funct5_and = 0b01100,
+    amo_funct5_min = 0b10000,
+    amo_funct5_max = 0b10100,
+    amo_funct5_minu = 0b11000,
+    amo_funct5_maxu = 0b11100,
+};
+
+enum amo_ordering {
+    // Release: no earlier access may be seen after this one.
+    amo_rl = 1 << 0,
+    // Acquire: no later access may be seen before this one.
+    amo_aq = 1 << 1,
+};
+
+// CSR instructions. Accompanied with an op_system opcode, funct3 0 being
+// ecall and ebreak.
+// I-type, with the CSR number as the unsigned immediate. The `i` forms take a
+// 5-bit unsigned immediate in place of rs1.
 enum insn_csr_funct3 {
-    csrrw,
-    csrrs,
-    csrrc,
-    csrrwi,
-    csrrsi,
-    csrrci,
+    csrrw = 0b001,
+    csrrs = 0b010,
+    csrrc = 0b011,
+    csrrwi = 0b101,
+    csrrsi = 0b110,
+    csrrci = 0b111,
+};
+
+// CSR numbers.
+enum csr {
+    // The F extension's accrued exceptions, rounding mode, and both at once.
+    csr_fflags = 0x001,
+    csr_frm = 0x002,
+    csr_fcsr = 0x003,
+    // Zicsr's counters: cycles, the time and instructions retired. In RV32,
+    // the `*h` ones are their upper halves.
+    csr_cycle = 0xc00,
+    csr_time = 0xc01,
+    csr_instret = 0xc02,
+    csr_cycleh = 0xc80,
+    csr_timeh = 0xc81,
+    csr_instreth = 0xc82,
 };
 
 enum csr_special_source {
@@ -278,6 +507,40 @@ union insn {
         u8 rd : 5;
         u32 imm_31_12 : 20;
     } __attribute__((packed)) u;
+    // Fused multiply-adds (op_madd to op_nmadd), with three sources.
+    struct {
+        enum insn_op opcode : 7;
+        u8 rd : 5;
+        u8 rm : 3;
+        u8 rs1 : 5;
+        u8 rs2 : 5;
+        u8 fmt : 2;
+        u8 rs3 : 5;
+    } __attribute__((packed)) r4;
+    // V extension arithmetic. vs1 is rs1 or the immediate for some funct3.
+    struct {
+        enum insn_op opcode : 7;
+        u8 vd : 5;
+        u8 funct3 : 3;
+        u8 vs1 : 5;
+        u8 vs2 : 5;
+        // Set for unmasked, clear for masked by v0.
+        u8 vm : 1;
+        u8 funct6 : 6;
+    } __attribute__((packed)) v;
+    // V extension loads and stores. vd is vs3 for stores, and rs2 the stride
+    // register, or a sub-mode which is 0 for plain unit-stride accesses.
+    struct {
+        enum insn_op opcode : 7;
+        u8 vd : 5;
+        u8 width : 3;
+        u8 rs1 : 5;
+        u8 rs2 : 5;
+        u8 vm : 1;
+        u8 mop : 2;
+        u8 mew : 1;
+        u8 nf : 3;
+    } __attribute__((packed)) vmem;
     struct j_format {
         enum insn_op opcode : 7;
         u8 rd : 5;
@@ -0,0 +1,287 @@
+#include "rvc.h"
+#include "insn.h"
+#include "xlen.h"
+
+// RISC-V Specification, Chapter 16: "C" Standard Extension for Compressed
+// Instructions. Table 16.5 to 16.7 list the encodings by quadrant. RV64C takes
+// some of RV32C's floating-point encodings for its own instructions.
+
+// Returns bits `hi` down to `lo` of `raw`, moved down to bit 0.
+static u32 field(u32 raw, u32 hi, u32 lo) {
+    return (raw >> lo) & ((1u << (hi - lo + 1)) - 1);
+}
+
+// Returns the low `bits` bits of `value`, sign-extended.
+static i32 sext(u32 value, u32 bits) {
+    u32 const sign = 1u << (bits - 1);
+    return (i32)((value ^ sign) - sign);
+}
+
+// Registers x8 to x15, which the 3-bit rd', rs1' and rs2' fields name.
+static u32 creg(u32 bits) { return 8 + bits; }
+
+static u32 encode_r(enum insn_op opcode, u32 funct3, u32 funct7, u32 rd,
+                    u32 rs1, u32 rs2) {
+    return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 |
+           opcode;
+}
+
+static u32 encode_i(enum insn_op opcode, u32 funct3, u32 rd, u32 rs1,
+                    i32 imm) {
+    return ((u32)imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 |
+           opcode;
+}
+
+static u32 encode_s(enum insn_op opcode, u32 funct3, u32 rs1, u32 rs2,
+                    i32 imm) {
+    u32 const bits = (u32)imm;
+    return field(bits, 11, 5) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+           field(bits, 4, 0) << 7 | opcode;
+}
+
+static u32 encode_b(enum insn_branch_func funct3, u32 rs1, u32 rs2, i32 imm) {
+    u32 const bits = (u32)imm;
+    return field(bits, 12, 12) << 31 | field(bits, 10, 5) << 25 | rs2 << 20 |
+           rs1 << 15 | funct3 << 12 | field(bits, 4, 1) << 8 |
+           field(bits, 11, 11) << 7 | op_branch;
+}
+
+static u32 encode_u(enum insn_op opcode, u32 rd, i32 imm) {
+    return ((u32)imm & 0xfffff000) | rd << 7 | opcode;
+}
+
+static u32 encode_j(u32 rd, i32 imm) {
+    u32 const bits = (u32)imm;
+    return field(bits, 20, 20) << 31 | field(bits, 10, 1) << 21 |
+           field(bits, 11, 11) << 20 | field(bits, 19, 12) << 12 | rd << 7 |
+           op_jal;
+}
+
+// Offset of c.j and c.jal: imm[11|4|9:8|10|6|7|3:1|5].
+static i32 cj_offset(u32 raw) {
+    u32 const imm = field(raw, 12, 12) << 11 | field(raw, 11, 11) << 4 |
+                    field(raw, 10, 9) << 8 | field(raw, 8, 8) << 10 |
+                    field(raw, 7, 7) << 6 | field(raw, 6, 6) << 7 |
+                    field(raw, 5, 3) << 1 | field(raw, 2, 2) << 5;
+    return sext(imm, 12);
+}
+
+// Offset of c.beqz and c.bnez: imm[8|4:3] and imm[7:6|2:1|5].
+static i32 cb_offset(u32 raw) {
+    u32 const imm = field(raw, 12, 12) << 8 | field(raw, 11, 10) << 3 |
+                    field(raw, 6, 5) << 6 | field(raw, 4, 3) << 1 |
+                    field(raw, 2, 2) << 5;
+    return sext(imm, 9);
+}
+
+// The 6-bit signed immediate of c.addi, c.li, c.andi: imm[5] and imm[4:0].
+static i32 ci_imm(u32 raw) {
+    return sext(field(raw, 12, 12) << 5 | field(raw, 6, 2), 6);
+}
+
+// Offsets of word and doubleword accesses off rs1': uimm[5:3] and
+// uimm[2|6] or uimm[7:6].
+static u32 cl_word_offset(u32 raw) {
+    return field(raw, 12, 10) << 3 | field(raw, 6, 6) << 2 |
+           field(raw, 5, 5) << 6;
+}
+static u32 cl_double_offset(u32 raw) {
+    return field(raw, 12, 10) << 3 | field(raw, 6, 5) << 6;
+}
+
+static u32 expand_quadrant0(u32 raw) {
+    u32 const rd = creg(field(raw, 4, 2)), rs1 = creg(field(raw, 9, 7));
+    switch (field(raw, 15, 13)) {
+    case 0b000: {
+        // c.addi4spn: nzuimm[5:4|9:6|2|3].
+        u32 const imm = field(raw, 12, 11) << 4 | field(raw, 10, 7) << 6 |
+                        field(raw, 6, 6) << 2 | field(raw, 5, 5) << 3;
+        if (imm == 0)
+            return 0;
+        return encode_i(op_imm, imm_func_addi, rd, rv_sp, imm);
+    }
+    case 0b001: // c.fld
+        return encode_i(op_load_fp, 0b011, rd, rs1, cl_double_offset(raw));
+    case 0b010: // c.lw
+        return encode_i(op_load, load_func_lw, rd, rs1, cl_word_offset(raw));
+#if RV_XLEN == 64
+    case 0b011: // c.ld
+        return encode_i(op_load, load_func_ld, rd, rs1, cl_double_offset(raw));
+#else
+    case 0b011: // c.flw
+        return encode_i(op_load_fp, 0b010, rd, rs1, cl_word_offset(raw));
+#endif
+    case 0b101: // c.fsd
+        return encode_s(op_store_fp, 0b011, rs1, rd, cl_double_offset(raw));
+    case 0b110: // c.sw
+        return encode_s(op_store, store_func_sw, rs1, rd, cl_word_offset(raw));
+#if RV_XLEN == 64
+    case 0b111: // c.sd
+        return encode_s(op_store, store_func_sd, rs1, rd,
+                        cl_double_offset(raw));
+#else
+    case 0b111: // c.fsw
+        return encode_s(op_store_fp, 0b010, rs1, rd, cl_word_offset(raw));
+#endif
+    default:
+        return 0;
+    }
+}
+
+static u32 expand_quadrant1(u32 raw) {
+    u32 const rd = field(raw, 11, 7);
+    // rd'/rs1' of the arithmetic instructions, and rs2'.
+    u32 const rd_c = creg(field(raw, 9, 7)), rs2_c = creg(field(raw, 4, 2));
+    switch (field(raw, 15, 13)) {
+    case 0b000: // c.addi, c.nop
+        return encode_i(op_imm, imm_func_addi, rd, rd, ci_imm(raw));
+#if RV_XLEN == 64
+    case 0b001: // c.addiw
+        if (rd == rv_zero)
+            return 0;
+        return encode_i(op_imm_32, imm_func_addi, rd, rd, ci_imm(raw));
+#else
+    case 0b001: // c.jal
+        return encode_j(rv_ra, cj_offset(raw));
+#endif
+    case 0b010: // c.li
+        return encode_i(op_imm, imm_func_addi, rd, rv_zero, ci_imm(raw));
+    case 0b011:
+        if (rd == rv_sp) {
+            // c.addi16sp: nzimm[9] and nzimm[4|6|8:7|5].
+            u32 const imm = field(raw, 12, 12) << 9 | field(raw, 6, 6) << 4 |
+                            field(raw, 5, 5) << 6 | field(raw, 4, 3) << 7 |
+                            field(raw, 2, 2) << 5;
+            if (imm == 0)
+                return 0;
+            return encode_i(op_imm, imm_func_addi, rv_sp, rv_sp,
+                            sext(imm, 10));
+        } else {
+            // c.lui: nzimm[17] and nzimm[16:12].
+            i32 const imm = ci_imm(raw) * (1 << 12);
+            if (imm == 0)
+                return 0;
+            return encode_u(op_lui, rd, imm);
+        }
+    case 0b100:
+        switch (field(raw, 11, 10)) {
+        case 0b00:   // c.srli
+        case 0b01: { // c.srai
+            // shamt[5] must be clear on RV32.
+            if (RV_XLEN == 32 && field(raw, 12, 12))
+                return 0;
+            u32 const upper = field(raw, 10, 10) ? shift_func_srai
+                                                 : shift_func_srli;
+            return encode_i(op_imm, imm_func_srli, rd_c, rd_c,
+                            upper << 5 | field(raw, 12, 12) << 5 |
+                                field(raw, 6, 2));
+        }
+        case 0b10: // c.andi
+            return encode_i(op_imm, imm_func_andi, rd_c, rd_c, ci_imm(raw));
+        default: {
+            u32 const funct2 = field(raw, 6, 5);
+            if (field(raw, 12, 12)) {
+                // c.subw and c.addw are RV64 only, and the others reserved.
+                if (RV_XLEN == 32 || funct2 > 0b01)
+                    return 0;
+                return encode_r(op_op_32, op_funct3_add,
+                                funct2 == 0 ? op_funct7_sub : 0, rd_c, rd_c,
+                                rs2_c);
+            }
+            static u8 const funct3[] = {op_funct3_add, op_funct3_xor,
+                                        op_funct3_or, op_funct3_and};
+            return encode_r(op_op, funct3[funct2],
+                            funct2 == 0 ? op_funct7_sub : 0, rd_c, rd_c,
+                            rs2_c);
+        }
+        }
+    case 0b101: // c.j
+        return encode_j(rv_zero, cj_offset(raw));
+    case 0b110: // c.beqz
+        return encode_b(branch_func_beq, rd_c, rv_zero, cb_offset(raw));
+    default: // c.bnez
+        return encode_b(branch_func_bne, rd_c, rv_zero, cb_offset(raw));
+    }
+}
+
+static u32 expand_quadrant2(u32 raw) {
+    u32 const rd = field(raw, 11, 7), rs2 = field(raw, 6, 2);
+    switch (field(raw, 15, 13)) {
+    case 0b000: // c.slli
+        if (RV_XLEN == 32 && field(raw, 12, 12))
+            return 0;
+        return encode_i(op_imm, imm_func_slli, rd, rd,
+                        field(raw, 12, 12) << 5 | rs2);
+    case 0b001: // c.fldsp: uimm[5] and uimm[4:3|8:6].
+        return encode_i(op_load_fp, 0b011, rd, rv_sp,
+                        field(raw, 12, 12) << 5 | field(raw, 6, 5) << 3 |
+                            field(raw, 4, 2) << 6);
+    case 0b010: // c.lwsp: uimm[5] and uimm[4:2|7:6].
+        if (rd == rv_zero)
+            return 0;
+        return encode_i(op_load, load_func_lw, rd, rv_sp,
+                        field(raw, 12, 12) << 5 | field(raw, 6, 4) << 2 |
+                            field(raw, 3, 2) << 6);
+#if RV_XLEN == 64
+    case 0b011: // c.ldsp: uimm[5] and uimm[4:3|8:6].
+        if (rd == rv_zero)
+            return 0;
+        return encode_i(op_load, load_func_ld, rd, rv_sp,
+                        field(raw, 12, 12) << 5 | field(raw, 6, 5) << 3 |
+                            field(raw, 4, 2) << 6);
+#else
+    case 0b011: // c.flwsp
+        return encode_i(op_load_fp, 0b010, rd, rv_sp,
+                        field(raw, 12, 12) << 5 | field(raw, 6, 4) << 2 |
+                            field(raw, 3, 2) << 6);
+#endif
+    case 0b100:
+        if (!field(raw, 12, 12)) {
+            if (rs2 != rv_zero) // c.mv
+                return encode_r(op_op, op_funct3_add, 0, rd, rv_zero, rs2);
+            if (rd == rv_zero)
+                return 0;
+            // c.jr
+            return encode_i(op_jalr, 0, rv_zero, rd, 0);
+        }
+        if (rs2 != rv_zero) // c.add
+            return encode_r(op_op, op_funct3_add, 0, rd, rd, rs2);
+        if (rd == rv_zero) // c.ebreak, whose immediate is 1.
+            return encode_i(op_system, 0, rv_zero, rv_zero, 1);
+        // c.jalr
+        return encode_i(op_jalr, 0, rv_ra, rd, 0);
+    case 0b101: // c.fsdsp: uimm[5:3|8:6].
+        return encode_s(op_store_fp, 0b011, rv_sp, rs2,
+                        field(raw, 12, 10) << 3 | field(raw, 9, 7) << 6);
+    case 0b110: // c.swsp: uimm[5:2|7:6].
+        return encode_s(op_store, store_func_sw, rv_sp, rs2,
+                        field(raw, 12, 9) << 2 | field(raw, 8, 7) << 6);
+#if RV_XLEN == 64
+    default: // c.sdsp: uimm[5:3|8:6].
+        return encode_s(op_store, store_func_sd, rv_sp, rs2,
+                        field(raw, 12, 10) << 3 | field(raw, 9, 7) << 6);
+#else
+    default: // c.fswsp
+        return encode_s(op_store_fp, 0b010, rv_sp, rs2,
+                        field(raw, 12, 9) << 2 | field(raw, 8, 7) << 6);
+#endif
+    }
+}
+
+u32 rvc_expand(u16 raw) {
+    // All zeros is defined to be illegal, rather than a c.addi4spn.
+    if (raw == 0)
+        return 0;
+    switch (raw & 0b11) {
+    case 0b00:
+        return expand_quadrant0(raw);
+    case 0b01:
+        return expand_quadrant1(raw);
+    case 0b10:
+        return expand_quadrant2(raw);
+    default:
+        return 0;
+    }
+}
+
+// vim:sw=4
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "../common/types.h"
+
+// Compressed instructions (the C extension).
+// Every 16-bit instruction is a shorter encoding of a 32-bit one, so engines
+// expand it right after fetching and carry on as if it had been the full
+// instruction, only 2 bytes long. The two sizes are told apart by the low two
+// bits of the first halfword, which are 0b11 only for 32-bit instructions.
+// RV64 builds (see xlen.h) expand RV64C instead, where some of the encodings
+// stand for other instructions.
+
+// Returns the size in bytes of the instruction whose first halfword is the
+// low half of `raw`.
+static inline u32 rvc_insn_size(u32 raw) {
+    return (raw & 0b11) == 0b11 ? 4 : 2;
+}
+
+// Returns the 32-bit instruction the compressed instruction `raw` stands for,
+// or 0 (itself illegal) if `raw` is illegal or reserved.
+u32 rvc_expand(u16 raw);
+
+// vim:ft=c
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../common/types.h"
+#include <stdint.h>
+
+// Width of the guest's integer registers, XLEN in the spec: 32 for RV32I
+// guests (the default), or 64 for RV64I ones.
+// It's chosen when building rather than when running, so that RV32 engines
+// don't pay for 64-bit registers, and each build runs guests of one width.
+// Guest code always lives in the low 4 GiB, so that guest program counters
+// stay 32 bits wide either way; only data addresses go past it.
+#ifndef RV_XLEN
+#define RV_XLEN 32
+#endif
+
+#if RV_XLEN == 64
+typedef u64 uxlen;
+typedef i64 ixlen;
+#elif RV_XLEN == 32
+typedef u32 uxlen;
+typedef i32 ixlen;
+#else
+#error "RV_XLEN must be 32 or 64"
+#endif
+
+// Sign-extends `value` to XLEN bits, e.g. a decoded immediate.
+static inline uxlen xlen_sext(u32 value) { return (uxlen)(ixlen)(i32)value; }
+
+// vim:ft=c
@@ -0,0 +1,646 @@
+// Ahead-of-time translator from an rv32i ELF image to host C source.
+// The whole text segment is decoded once. Every basic block becomes a labeled
+// region of a single function, with guest registers as locals so that the host
+// compiler can keep them in registers. Static jumps become plain `goto`s, and
+// jalr goes through a dispatch table indexed by guest address, which is left
+// out of programs without one. Since a jalr can go to any address worked out
+// at run time, every instruction gets a label and a slot in the table then.
+// The memory image is embedded in the output, which only needs a C compiler
+// with GNU extensions (labels as values), and a POSIX libc: the guest's system
+// calls (see syscalls.h) become calls to write(), read() and _exit().
+
+#include "common/log.h"
+#include "common/types.h"
+#include "loader.h"
+#include "rv/bits.h"
+#include "rv/decode.h"
+#include "syscalls.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char const USAGE[] = "usage: %s <elf file> <output.c>\n";
+
+// How a basic block can be reached, as flags.
+enum leader {
+    // By falling through or by a jalr, which can be any instruction.
+    leader_indirect = 1 << 0,
+    // By a branch or a jal, or as the entrypoint.
+    leader_jumped_to = 1 << 1,
+};
+
+struct translation {
+    FILE *out;
+    struct decoded_text text;
+    // leaders[i] holds the `enum leader` flags of text.insns[i] when it starts
+    // a basic block, which needs a label if anything jumps there.
+    u8 *leaders;
+    // Whether the text has a jalr, which needs the dispatch table.
+    bool indirect;
+};
+
+static void find_leaders(struct translation *t, u32 entrypoint);
+static void emit_memory(FILE *out, struct loaded_exe const *exe);
+static void emit_code(struct translation *t, u32 entrypoint);
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, USAGE, argc > 0 ? argv[0] : "rv2c");
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd == -1) {
+        perror("Could not open source file");
+        return 1;
+    }
+
+    struct loaded_exe exe;
+    int code = loader_read_elf(fd, &exe);
+    close(fd);
+    if (code != 0)
+        return code;
+
+    struct translation t = {0};
+    if ((code = decode_text(&t.text, exe.mem, exe.text_offset, exe.text_size,
+                            exe.compressed)) != 0) {
+        fprintf(stderr, "Could not decode text segment: %s\n",
+                strerror(code));
+        goto clean_exe;
+    }
+
+    t.leaders = calloc(t.text.count, sizeof(*t.leaders));
+    if (t.leaders == NULL && t.text.count != 0) {
+        code = ENOMEM;
+        goto clean_text;
+    }
+
+    if ((t.out = fopen(argv[2], "w")) == NULL) {
+        perror("Could not open output file");
+        code = errno;
+        goto clean_leaders;
+    }
+
+    find_leaders(&t, exe.entrypoint);
+
+    fprintf(t.out,
+            "// Generated by rv2c from '%s'. Do not edit.\n"
+            "#include <errno.h>\n"
+            "#include <stdint.h>\n"
+            "#include <stdio.h>\n"
+            "#include <unistd.h>\n\n",
+            argv[1]);
+    emit_memory(t.out, &exe);
+    emit_code(&t, exe.entrypoint);
+
+    if (fclose(t.out) != 0) {
+        perror("Could not write output file");
+        code = errno;
+    }
+
+clean_leaders:
+    free(t.leaders);
+clean_text:
+    decoded_text_destroy(&t.text);
+clean_exe:
+    loader_destroy_exe(&exe);
+    return code;
+}
+
+static bool is_branch(enum decoded_op op) {
+    return op == dop_beq || op == dop_bne || op == dop_blt || op == dop_bge ||
+           op == dop_bltu || op == dop_bgeu;
+}
+
+static void mark_leader(struct translation *t, u32 pc, enum leader how) {
+    if (decoded_text_contains(&t->text, pc))
+        t->leaders[decoded_text_index(&t->text, pc)] |= how;
+}
+
+// Returns whether the block starting at `text.insns[i]`, if any, needs a label.
+static bool needs_label(struct translation const *t, u32 i) {
+    return (t->leaders[i] & leader_jumped_to) ||
+           (t->leaders[i] != 0 && t->indirect);
+}
+
+static void find_leaders(struct translation *t, u32 entrypoint) {
+    mark_leader(t, entrypoint, leader_jumped_to);
+    for (u32 i = 0; i < t->text.count; ++i) {
+        struct decoded_insn const *insn = &t->text.insns[i];
+        if (is_branch(insn->op) || insn->op == dop_jal) {
+            mark_leader(t, insn->imm, leader_jumped_to);
+        }
+        // What follows a control transfer is either a fall-through or a
+        // return address, which jalr can reach.
+        if (is_branch(insn->op) || insn->op == dop_jal ||
+            insn->op == dop_jalr) {
+            mark_leader(t, decoded_text_pc(&t->text, i + 1), leader_indirect);
+        }
+        t->indirect |= insn->op == dop_jalr;
+    }
+    if (!t->indirect)
+        return;
+
+    // A jalr can go to an address from auipc, a jump table or a function
+    // pointer as well as to a return address. Compressed text leaves slots
+    // past its last instruction, which are all at its end.
+    u32 const end = t->text.base + t->text.size;
+    for (u32 i = 0; i < t->text.count && decoded_text_pc(&t->text, i) < end;
+         ++i)
+        t->leaders[i] |= leader_indirect;
+}
+
+static void emit_memory(FILE *out, struct loaded_exe const *exe) {
+    fprintf(out,
+            "static uint8_t memory[%zu]\n"
+            "    __attribute__((aligned(4096), unused)) = {",
+            exe->mem_count);
+    u8 const *bytes = exe->mem;
+    for (size_t i = 0; i < exe->mem_count; ++i) {
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", bytes[i]);
+    }
+    fputs("\n};\n\n", out);
+    fputs("#define LOAD(type, addr) (*(type *)(memory + (uint32_t)(addr)))\n"
+          "#define STORE(type, addr, value)                                 "
+          "              \\\n"
+          "    (*(type *)(memory + (uint32_t)(addr)) = (type)(value))\n"
+          "#define FAULT(pc, msg)                                           "
+          "              \\\n"
+          "    do {                                                         "
+          "              \\\n"
+          "        fprintf(stderr, \"fault @ 0x%08x: %s\\n\", (pc), (msg));  "
+          "              \\\n"
+          "        return 1;                                                "
+          "              \\\n"
+          "    } while (0)\n"
+          "// What a system call returns to the guest: negative errno values "
+          "are errors.\n"
+          "#define SYSCALL_RESULT(call)                                     "
+          "              \\\n"
+          "    ({                                                           "
+          "              \\\n"
+          "        long result_ = (call);                                   "
+          "              \\\n"
+          "        (uint32_t)(result_ < 0 ? -errno : result_);              "
+          "              \\\n"
+          "    })\n\n",
+          out);
+}
+
+// Name of the local holding guest register `reg`, as an rvalue.
+static char const *reg(u8 reg) {
+    static char const *names[] = {
+        "0u",  "x1",  "x2",  "x3",  "x4",  "x5",  "x6",  "x7",
+        "x8",  "x9",  "x10", "x11", "x12", "x13", "x14", "x15",
+        "x16", "x17", "x18", "x19", "x20", "x21", "x22", "x23",
+        "x24", "x25", "x26", "x27", "x28", "x29", "x30", "x31",
+    };
+    return names[reg];
+}
+
+// Emits `x<rd> = <expr>;`, or just evaluates `expr` when writing to x0.
+static void emit_assign(FILE *out, u8 rd, char const *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void emit_assign(FILE *out, u8 rd, char const *fmt, ...) {
+    if (rd == DECODED_SINK_REG)
+        fputs("    (void)(", out);
+    else
+        fprintf(out, "    x%u = (", rd);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(out, fmt, args);
+    va_end(args);
+    fputs(");\n", out);
+}
+
+static void emit_goto(struct translation *t, u32 pc, u32 target) {
+    if (decoded_text_contains(&t->text, target)) {
+        fprintf(t->out, "goto L_%08x;", target);
+    } else {
+        fprintf(t->out, "FAULT(0x%08xu, \"jump outside of text\");", pc);
+    }
+}
+
+// `next` is the guest address of the instruction after `insn`.
+static void emit_insn(struct translation *t, struct decoded_insn const *insn,
+                      u32 pc, u32 next) {
+    FILE *out = t->out;
+    char const *rs1 = reg(insn->rs1);
+    char const *rs2 = reg(insn->rs2);
+    u32 imm = insn->imm;
+
+    switch ((enum decoded_op)insn->op) {
+    case dop_lui:
+    case dop_auipc:
+        emit_assign(out, insn->rd, "0x%08xu", imm);
+        break;
+    case dop_jal:
+        emit_assign(out, insn->rd, "0x%08xu", next);
+        fputs("    ", out);
+        emit_goto(t, pc, imm);
+        fputc('\n', out);
+        break;
+    case dop_jalr:
+        // The target must be computed before rd gets written, in case
+        // they're the same register.
+        fprintf(out, "    pc = (%s + 0x%08xu) & ~1u;\n", rs1, imm);
+        emit_assign(out, insn->rd, "0x%08xu", next);
+        fputs("    goto dispatch;\n", out);
+        break;
+
+#define BRANCH(cond_fmt, ...)                                                  \
+    fprintf(out, "    if (" cond_fmt ") ", __VA_ARGS__);                       \
+    emit_goto(t, pc, imm);                                                     \
+    fputc('\n', out);                                                          \
+    break;
+    case dop_beq:
+        BRANCH("%s == %s", rs1, rs2);
+    case dop_bne:
+        BRANCH("%s != %s", rs1, rs2);
+    case dop_blt:
+        BRANCH("(int32_t)%s < (int32_t)%s", rs1, rs2);
+    case dop_bge:
+        BRANCH("(int32_t)%s >= (int32_t)%s", rs1, rs2);
+    case dop_bltu:
+        BRANCH("%s < %s", rs1, rs2);
+    case dop_bgeu:
+        BRANCH("%s >= %s", rs1, rs2);
+#undef BRANCH
+
+    case dop_lb:
+        emit_assign(out, insn->rd, "(uint32_t)LOAD(int8_t, %s + 0x%08xu)", rs1,
+                    imm);
+        break;
+    case dop_lh:
+        emit_assign(out, insn->rd, "(uint32_t)LOAD(int16_t, %s + 0x%08xu)",
+                    rs1, imm);
+        break;
+    case dop_lw:
+        emit_assign(out, insn->rd, "LOAD(uint32_t, %s + 0x%08xu)", rs1, imm);
+        break;
+    case dop_lbu:
+        emit_assign(out, insn->rd, "LOAD(uint8_t, %s + 0x%08xu)", rs1, imm);
+        break;
+    case dop_lhu:
+        emit_assign(out, insn->rd, "LOAD(uint16_t, %s + 0x%08xu)", rs1, imm);
+        break;
+    case dop_sb:
+        fprintf(out, "    STORE(uint8_t, %s + 0x%08xu, %s);\n", rs1, imm, rs2);
+        break;
+    case dop_sh:
+        fprintf(out, "    STORE(uint16_t, %s + 0x%08xu, %s);\n", rs1, imm,
+                rs2);
+        break;
+    case dop_sw:
+        fprintf(out, "    STORE(uint32_t, %s + 0x%08xu, %s);\n", rs1, imm,
+                rs2);
+        break;
+
+    case dop_addi:
+        emit_assign(out, insn->rd, "%s + 0x%08xu", rs1, imm);
+        break;
+    case dop_slti:
+        emit_assign(out, insn->rd, "(int32_t)%s < (int32_t)0x%08xu", rs1, imm);
+        break;
+    case dop_sltiu:
+        emit_assign(out, insn->rd, "%s < 0x%08xu", rs1, imm);
+        break;
+    case dop_xori:
+        emit_assign(out, insn->rd, "%s ^ 0x%08xu", rs1, imm);
+        break;
+    case dop_ori:
+        emit_assign(out, insn->rd, "%s | 0x%08xu", rs1, imm);
+        break;
+    case dop_andi:
+        emit_assign(out, insn->rd, "%s & 0x%08xu", rs1, imm);
+        break;
+    case dop_slli:
+        emit_assign(out, insn->rd, "%s << %u", rs1, imm);
+        break;
+    case dop_srli:
+        emit_assign(out, insn->rd, "%s >> %u", rs1, imm);
+        break;
+    case dop_srai:
+        emit_assign(out, insn->rd, "(uint32_t)((int32_t)%s >> %u)", rs1, imm);
+        break;
+
+    case dop_add:
+        emit_assign(out, insn->rd, "%s + %s", rs1, rs2);
+        break;
+    case dop_sub:
+        emit_assign(out, insn->rd, "%s - %s", rs1, rs2);
+        break;
+    case dop_sll:
+        emit_assign(out, insn->rd, "%s << (%s & 31)", rs1, rs2);
+        break;
+    case dop_slt:
+        emit_assign(out, insn->rd, "(int32_t)%s < (int32_t)%s", rs1, rs2);
+        break;
+    case dop_sltu:
+        emit_assign(out, insn->rd, "%s < %s", rs1, rs2);
+        break;
+    case dop_xor:
+        emit_assign(out, insn->rd, "%s ^ %s", rs1, rs2);
+        break;
+    case dop_srl:
+        emit_assign(out, insn->rd, "%s >> (%s & 31)", rs1, rs2);
+        break;
+    case dop_sra:
+        emit_assign(out, insn->rd, "(uint32_t)((int32_t)%s >> (%s & 31))", rs1,
+                    rs2);
+        break;
+    case dop_or:
+        emit_assign(out, insn->rd, "%s | %s", rs1, rs2);
+        break;
+    case dop_and:
+        emit_assign(out, insn->rd, "%s & %s", rs1, rs2);
+        break;
+
+    case dop_mul:
+        emit_assign(out, insn->rd, "%s * %s", rs1, rs2);
+        break;
+    case dop_mulh:
+        emit_assign(out, insn->rd,
+                    "(uint32_t)((uint64_t)((int64_t)(int32_t)%s * "
+                    "(int32_t)%s) >> 32)",
+                    rs1, rs2);
+        break;
+    case dop_mulhsu:
+        emit_assign(out, insn->rd,
+                    "(uint32_t)((uint64_t)((int64_t)(int32_t)%s * "
+                    "(int64_t)%s) >> 32)",
+                    rs1, rs2);
+        break;
+    case dop_mulhu:
+        emit_assign(out, insn->rd, "(uint32_t)((uint64_t)%s * %s >> 32)", rs1,
+                    rs2);
+        break;
+    // Division by zero and INT32_MIN / -1 are defined by the spec, but not
+    // by C.
+    case dop_div:
+        emit_assign(out, insn->rd,
+                    "%s == 0 ? 0xffffffffu : %s == 0xffffffffu ? -%s : "
+                    "(uint32_t)((int32_t)%s / (int32_t)%s)",
+                    rs2, rs2, rs1, rs1, rs2);
+        break;
+    case dop_divu:
+        emit_assign(out, insn->rd, "%s == 0 ? 0xffffffffu : %s / %s", rs2, rs1,
+                    rs2);
+        break;
+    case dop_rem:
+        emit_assign(out, insn->rd,
+                    "%s == 0 ? %s : %s == 0xffffffffu ? 0 : "
+                    "(uint32_t)((int32_t)%s %% (int32_t)%s)",
+                    rs2, rs1, rs2, rs1, rs2);
+        break;
+    case dop_remu:
+        emit_assign(out, insn->rd, "%s == 0 ? %s : %s %% %s", rs2, rs1, rs1,
+                    rs2);
+        break;
+
+    case dop_sh1add:
+        emit_assign(out, insn->rd, "(%s << 1) + %s", rs1, rs2);
+        break;
+    case dop_sh2add:
+        emit_assign(out, insn->rd, "(%s << 2) + %s", rs1, rs2);
+        break;
+    case dop_sh3add:
+        emit_assign(out, insn->rd, "(%s << 3) + %s", rs1, rs2);
+        break;
+    case dop_andn:
+        emit_assign(out, insn->rd, "%s & ~%s", rs1, rs2);
+        break;
+    case dop_orn:
+        emit_assign(out, insn->rd, "%s | ~%s", rs1, rs2);
+        break;
+    case dop_xnor:
+        emit_assign(out, insn->rd, "~(%s ^ %s)", rs1, rs2);
+        break;
+    // The builtins leave a zero argument undefined, the spec does not.
+    case dop_clz:
+        emit_assign(out, insn->rd, "%s == 0 ? 32 : __builtin_clz(%s)", rs1,
+                    rs1);
+        break;
+    case dop_ctz:
+        emit_assign(out, insn->rd, "%s == 0 ? 32 : __builtin_ctz(%s)", rs1,
+                    rs1);
+        break;
+    case dop_cpop:
+        emit_assign(out, insn->rd, "__builtin_popcount(%s)", rs1);
+        break;
+    case dop_min:
+        emit_assign(out, insn->rd, "(int32_t)%s < (int32_t)%s ? %s : %s", rs1,
+                    rs2, rs1, rs2);
+        break;
+    case dop_minu:
+        emit_assign(out, insn->rd, "%s < %s ? %s : %s", rs1, rs2, rs1, rs2);
+        break;
+    case dop_max:
+        emit_assign(out, insn->rd, "(int32_t)%s > (int32_t)%s ? %s : %s", rs1,
+                    rs2, rs1, rs2);
+        break;
+    case dop_maxu:
+        emit_assign(out, insn->rd, "%s > %s ? %s : %s", rs1, rs2, rs1, rs2);
+        break;
+    case dop_sext_b:
+        emit_assign(out, insn->rd, "(uint32_t)(int8_t)%s", rs1);
+        break;
+    case dop_sext_h:
+        emit_assign(out, insn->rd, "(uint32_t)(int16_t)%s", rs1);
+        break;
+    case dop_zext_h:
+        emit_assign(out, insn->rd, "(uint16_t)%s", rs1);
+        break;
+    case dop_rol:
+        emit_assign(out, insn->rd, "%s << (%s & 31) | %s >> (-%s & 31)", rs1,
+                    rs2, rs1, rs2);
+        break;
+    case dop_ror:
+        emit_assign(out, insn->rd, "%s >> (%s & 31) | %s << (-%s & 31)", rs1,
+                    rs2, rs1, rs2);
+        break;
+    case dop_rori:
+        emit_assign(out, insn->rd, "%s >> %u | %s << %u", rs1, imm, rs1,
+                    -imm & 31);
+        break;
+    case dop_orc_b:
+        emit_assign(out, insn->rd,
+                    "((((%s & 0x7f7f7f7fu) + 0x7f7f7f7fu | %s) >> 7) & "
+                    "0x01010101u) * 0xffu",
+                    rs1, rs1);
+        break;
+    case dop_rev8:
+        emit_assign(out, insn->rd, "__builtin_bswap32(%s)", rs1);
+        break;
+    case dop_bclr:
+        emit_assign(out, insn->rd, "%s & ~(1u << (%s & 31))", rs1, rs2);
+        break;
+    case dop_bclri:
+        emit_assign(out, insn->rd, "%s & 0x%08xu", rs1, ~(1u << imm));
+        break;
+    case dop_bext:
+        emit_assign(out, insn->rd, "%s >> (%s & 31) & 1", rs1, rs2);
+        break;
+    case dop_bexti:
+        emit_assign(out, insn->rd, "%s >> %u & 1", rs1, imm);
+        break;
+    case dop_binv:
+        emit_assign(out, insn->rd, "%s ^ 1u << (%s & 31)", rs1, rs2);
+        break;
+    case dop_binvi:
+        emit_assign(out, insn->rd, "%s ^ 0x%08xu", rs1, 1u << imm);
+        break;
+    case dop_bset:
+        emit_assign(out, insn->rd, "%s | 1u << (%s & 31)", rs1, rs2);
+        break;
+    case dop_bseti:
+        emit_assign(out, insn->rd, "%s | 0x%08xu", rs1, 1u << imm);
+        break;
+
+    case dop_fence:
+    // The translation is done once and for all, so the guest can't change
+    // its code anyway.
+    case dop_fence_i:
+        break;
+
+    case dop_ecall:
+        // The same fds as the interpreters allow, but unbuffered.
+        fprintf(out,
+                "    switch (x17) {\n"
+                "    case %u:\n"
+                "        x10 = x10 == 1 || x10 == 2\n"
+                "                  ? SYSCALL_RESULT(write(x10, memory + x11, "
+                "x12))\n"
+                "                  : (uint32_t)-EBADF;\n"
+                "        break;\n"
+                "    case %u:\n"
+                "        x10 = x10 == 0\n"
+                "                  ? SYSCALL_RESULT(read(x10, memory + x11, "
+                "x12))\n"
+                "                  : (uint32_t)-EBADF;\n"
+                "        break;\n"
+                "    case %u:\n"
+                "    case %u:\n"
+                "        _exit(x10 & 0xff);\n"
+                "    default:\n"
+                "        FAULT(0x%08xu, \"unsupported system call\");\n"
+                "    }\n",
+                sys_write, sys_read, sys_exit, sys_exit_group, pc);
+        break;
+
+    case dop_illegal:
+        fprintf(out, "    FAULT(0x%08xu, \"illegal instruction\");\n", pc);
+        break;
+    case dop_undecoded:
+    case dop_unimplemented:
+    // The translation has no vector registers.
+    case dop_vsetvli:
+    case dop_vsetivli:
+    case dop_vsetvl:
+    case dop_vle:
+    case dop_vlse:
+    case dop_vse:
+    case dop_vsse:
+    case dop_varith_vv:
+    case dop_varith_vx:
+    case dop_varith_vi:
+    case dop_vred:
+    case dop_vmv_x_s:
+    case dop_vmv_s_x:
+    // Nor floating-point registers and CSRs, nor atomics.
+#define X(name) case dop_##name:
+        FLOAT_OPS(X)
+        CSR_OPS(X)
+        ATOMIC_OPS(X)
+#undef X
+    // Never produced by decode_text().
+    case dop_fused_li:
+    case dop_fused_far_call:
+    case dop_fused_byte_update:
+    case dop_fused_ecall_args:
+    case dop_idiom_scan:
+    case dop_idiom_clear:
+    case dop_idiom_strlen:
+    case dop_idiom_memset:
+    case dop_idiom_memcpy:
+    case dop_count:
+        fprintf(out, "    FAULT(0x%08xu, \"unimplemented instruction\");\n",
+                pc);
+        break;
+    }
+}
+
+static void emit_code(struct translation *t, u32 entrypoint) {
+    FILE *out = t->out;
+    struct decoded_text const *text = &t->text;
+
+    // Programs rarely use every register, which the host compiler would warn
+    // about.
+    fputs("int main(void) {\n"
+          "    __attribute__((unused)) uint32_t x1 = 0, x2 = 0, x3 = 0, "
+          "x4 = 0, x5 = 0;\n"
+          "    __attribute__((unused)) uint32_t x6 = 0, x7 = 0, x8 = 0, "
+          "x9 = 0, x10 = 0;\n"
+          "    __attribute__((unused)) uint32_t x11 = 0, x12 = 0, x13 = 0, "
+          "x14 = 0, x15 = 0;\n"
+          "    __attribute__((unused)) uint32_t x16 = 0, x17 = 0, x18 = 0, "
+          "x19 = 0, x20 = 0;\n"
+          "    __attribute__((unused)) uint32_t x21 = 0, x22 = 0, x23 = 0, "
+          "x24 = 0, x25 = 0;\n"
+          "    __attribute__((unused)) uint32_t x26 = 0, x27 = 0, x28 = 0, "
+          "x29 = 0, x30 = 0;\n"
+          "    __attribute__((unused)) uint32_t x31 = 0;\n",
+          out);
+
+    u32 const end = text->base + text->size;
+    if (!t->indirect) {
+        // Every jump is a goto, starting with the one to the entrypoint.
+        fputs("    ", out);
+        emit_goto(t, entrypoint, entrypoint);
+        fputs("\n\n", out);
+    } else {
+        fprintf(out, "    uint32_t pc = 0x%08xu;\n\n", entrypoint);
+
+        // Every block start is a valid jalr target. The table has a slot for
+        // every address an instruction could start at.
+        u32 const align = text->indices != NULL ? 2 : 4;
+        fprintf(out, "    static void *const dispatch_table[%u] = {\n",
+                text->size / align);
+        for (u32 i = 0; i < text->count; ++i) {
+            u32 pc = decoded_text_pc(text, i);
+            if (t->leaders[i] != 0)
+                fprintf(out, "        [%u] = &&L_%08x,\n",
+                        (pc - text->base) / align, pc);
+        }
+        fputs("    };\n\n", out);
+
+        fputs("dispatch:\n", out);
+        fprintf(out,
+                "    if (pc - 0x%08xu >= %uu || (pc & %u) != 0 ||\n"
+                "        dispatch_table[(pc - 0x%08xu) / %u] == 0)\n"
+                "        FAULT(pc, \"no translated code at jump target\");\n"
+                "    goto *dispatch_table[(pc - 0x%08xu) / %u];\n\n",
+                text->base, text->size, align - 1, text->base, align,
+                text->base, align);
+    }
+
+    // Compressed text leaves slots past its last instruction, which are all at
+    // `end`.
+    for (u32 i = 0; i < text->count && decoded_text_pc(text, i) < end; ++i) {
+        u32 pc = decoded_text_pc(text, i);
+        if (needs_label(t, i))
+            fprintf(out, "L_%08x:\n", pc);
+        emit_insn(t, &text->insns[i], pc, decoded_text_pc(text, i + 1));
+    }
+
+    fprintf(out, "    FAULT(0x%08xu, \"ran off the end of text\");\n}\n",
+            end);
+}
+
+// vim:sw=4
@@ -0,0 +1,516 @@
+#include "simt.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "interpret.h"
+#include "rv/bits.h"
+#include "rv/dasm.h"
+#include "rv/decode.h"
+#include "rv/insn.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// One value per lane, e.g. a guest register of every lane.
+typedef u32 lanes_u32 __attribute__((vector_size(SIMT_LANES * sizeof(u32))));
+typedef i32 lanes_i32 __attribute__((vector_size(SIMT_LANES * sizeof(i32))));
+
+// Stops the lanes set in `bits`, saving where they were and their registers.
+static void stop_lanes(struct simt_lane *lanes, lanes_u32 const *x,
+                       u32 const *pc, u32 bits) {
+    for (; bits != 0; bits &= bits - 1) {
+        u32 const l = __builtin_ctz(bits);
+        lanes[l].pc = pc[l];
+        for (u32 r = 0; r < 33; ++r)
+            lanes[l].cpu.registers[r] = x[r][l];
+    }
+}
+
+// Returns whether every lane of `v` is zero.
+#define ALL_ZERO(v)                                                            \
+    ({                                                                         \
+        lanes_u32 const v_ = (v);                                              \
+        u64 words_[sizeof(v_) / sizeof(u64)];                                  \
+        memcpy(words_, &v_, sizeof(v_));                                       \
+        u64 any_ = 0;                                                          \
+        for (u32 i_ = 0; i_ < sizeof(v_) / sizeof(u64); ++i_)                  \
+            any_ |= words_[i_];                                                \
+        any_ == 0;                                                             \
+    })
+
+// Body of interpret_simt(), instantiated once per host ISA the vector code can
+// be compiled for.
+static inline __attribute__((always_inline)) void
+run_lanes(struct decoded_text const *text, struct simt_lane *lanes, u32 count,
+          u32 entrypoint) {
+    // x[r][l] is register `r` of lane `l`, with the sink at index 32 like in
+    // `struct rv32i`.
+    lanes_u32 x[33] = {0};
+    lanes_u32 lane_bits;
+    // Where every lane continues. Lanes that stay together only get theirs
+    // updated once they split up.
+    u32 pc[SIMT_LANES];
+    for (u32 l = 0; l < SIMT_LANES; ++l) {
+        lane_bits[l] = 1u << l;
+        pc[l] = entrypoint;
+        x[rv_a0][l] = l;
+        x[rv_a1][l] = count;
+    }
+    for (u32 l = 0; l < count; ++l)
+        lanes[l].exited = false;
+    // Lanes that haven't stopped yet, one bit each.
+    u32 running = (1u << count) - 1;
+    u64 steps = 0, lane_insns = 0;
+
+    log("Begin SIMT execution of %u lanes, Entrypoint @ 0x%x\n", count,
+        entrypoint);
+
+    while (running != 0) {
+        // Lanes that fell behind go first, so that the others wait for them
+        // where control flow meets again.
+        u32 at = UINT32_MAX;
+        for (u32 m = running; m != 0; m &= m - 1) {
+            u32 const l = __builtin_ctz(m);
+            if (pc[l] < at)
+                at = pc[l];
+        }
+        // Where the next lanes wait, for the active ones to catch up with.
+        u32 join = UINT32_MAX;
+        u32 active = 0;
+        for (u32 m = running; m != 0; m &= m - 1) {
+            u32 const l = __builtin_ctz(m);
+            if (pc[l] == at)
+                active |= 1u << l;
+            else if (pc[l] < join)
+                join = pc[l];
+        }
+        lanes_u32 const mask = (lanes_u32)((lane_bits & active) != 0);
+        u32 const first = __builtin_ctz(active);
+        // When every lane takes part, registers can be written as a whole.
+        bool const lockstep = active == running;
+        struct decoded_insn const *insn;
+
+    run:
+        if (!decoded_text_contains(text, at)) {
+            error("Lanes 0x%04x jumped to 0x%08x, outside of decoded text\n",
+                  active, at);
+            for (u32 m = active; m != 0; m &= m - 1)
+                pc[__builtin_ctz(m)] = at;
+            stop_lanes(lanes, x, pc, active);
+            running &= ~active;
+            continue;
+        }
+        insn = text->insns + decoded_text_index(text, at);
+
+        // Runs the active lanes up to the next jump or branch, or until they
+        // fall through to where other lanes wait.
+        for (;; ++insn) {
+#define PC decoded_text_pc(text, (u32)(insn - text->insns))
+#define PC_AFTER decoded_text_pc(text, (u32)(insn - text->insns) + 1)
+#define SPLAT(value) ((lanes_u32){0} + (u32)(value))
+// Operands. Each handler reads its own, so that the others don't get loaded.
+#define A x[insn->rs1]
+#define B x[insn->rs2]
+#define SA ((lanes_i32)x[insn->rs1])
+#define SB ((lanes_i32)x[insn->rs2])
+#define IMM insn->imm
+// `value` in the active lanes, `old` in the others.
+#define BLEND(old, value)                                                      \
+    ({                                                                         \
+        lanes_u32 const value_ = (value);                                      \
+        lockstep ? value_ : (value_ & mask) | ((old) & ~mask);                 \
+    })
+#define WRITE(value)                                                           \
+    {                                                                          \
+        x[insn->rd] = BLEND(x[insn->rd], value);                               \
+        continue;                                                              \
+    }
+// Has the active lanes continue at `target`. As long as they all go to the
+// same place, and no other lanes wait there or before, they keep running.
+#define GO(target)                                                             \
+    {                                                                          \
+        lanes_u32 const target_ = (target);                                    \
+        u32 const next_ = target_[first];                                      \
+        if (ALL_ZERO((target_ ^ next_) & mask) && next_ < join) {              \
+            at = next_;                                                        \
+            goto run;                                                          \
+        }                                                                      \
+        for (u32 m_ = active; m_ != 0; m_ &= m_ - 1)                           \
+            pc[__builtin_ctz(m_)] = target_[__builtin_ctz(m_)];                \
+        break;                                                                 \
+    }
+#define BRANCH(cond)                                                           \
+    {                                                                          \
+        lanes_u32 const taken_ = (lanes_u32)(cond);                            \
+        GO((taken_ & insn->imm) | (~taken_ & (PC_AFTER)));                     \
+    }
+#define LOAD(type)                                                             \
+    {                                                                          \
+        lanes_u32 const addr_ = x[insn->rs1] + insn->imm;                      \
+        lanes_u32 value_ = x[insn->rd];                                        \
+        for (u32 m_ = active; m_ != 0; m_ &= m_ - 1) {                         \
+            u32 const l_ = __builtin_ctz(m_);                                  \
+            value_[l_] = (i32)*(type *)(lanes[l_].memory + addr_[l_]);         \
+        }                                                                      \
+        x[insn->rd] = value_;                                                  \
+        continue;                                                              \
+    }
+#define STORE(type)                                                            \
+    {                                                                          \
+        lanes_u32 const addr_ = x[insn->rs1] + insn->imm;                      \
+        for (u32 m_ = active; m_ != 0; m_ &= m_ - 1) {                         \
+            u32 const l_ = __builtin_ctz(m_);                                  \
+            *(type *)(lanes[l_].memory + addr_[l_]) = x[insn->rs2][l_];        \
+        }                                                                      \
+        continue;                                                              \
+    }
+// Runs `fn` on rs1 and rs2 of each active lane, for operations without a
+// vector form.
+#define PER_LANE(fn)                                                           \
+    {                                                                          \
+        lanes_u32 const a_ = A, b_ = B;                                        \
+        lanes_u32 value_ = x[insn->rd];                                        \
+        for (u32 m_ = active; m_ != 0; m_ &= m_ - 1) {                         \
+            u32 const l_ = __builtin_ctz(m_);                                  \
+            value_[l_] = fn(a_[l_], b_[l_]);                                   \
+        }                                                                      \
+        x[insn->rd] = value_;                                                  \
+        continue;                                                              \
+    }
+// The same for operations on rs1 alone.
+#define PER_LANE_UNARY(fn)                                                     \
+    {                                                                          \
+        lanes_u32 const a_ = A;                                                \
+        lanes_u32 value_ = x[insn->rd];                                        \
+        for (u32 m_ = active; m_ != 0; m_ &= m_ - 1) {                         \
+            u32 const l_ = __builtin_ctz(m_);                                  \
+            value_[l_] = fn(a_[l_]);                                           \
+        }                                                                      \
+        x[insn->rd] = value_;                                                  \
+        continue;                                                              \
+    }
+// `a` in the lanes where `cond` holds, `b` in the others.
+#define SELECT(cond, a, b)                                                     \
+    ({                                                                         \
+        lanes_u32 const cond_ = (lanes_u32)(cond);                             \
+        ((a) & cond_) | ((b) & ~cond_);                                        \
+    })
+// Stops the active lanes at the current instruction, which is also how they
+// exit.
+#define FAULT()                                                                \
+    {                                                                          \
+        for (u32 m_ = active; m_ != 0; m_ &= m_ - 1)                           \
+            pc[__builtin_ctz(m_)] = PC;                                        \
+        stop_lanes(lanes, x, pc, active);                                      \
+        running &= ~active;                                                    \
+        break;                                                                 \
+    }
+
+            if (__builtin_expect(PC == join, 0)) {
+                for (u32 m = active; m != 0; m &= m - 1)
+                    pc[__builtin_ctz(m)] = join;
+                break;
+            }
+            ++steps;
+            lane_insns += __builtin_popcount(active);
+
+            switch ((enum decoded_op)insn->op) {
+            case dop_lui:
+            case dop_auipc:
+                WRITE(SPLAT(IMM));
+            case dop_jal:
+                x[insn->rd] = BLEND(x[insn->rd], SPLAT(PC_AFTER));
+                GO(SPLAT(IMM));
+            case dop_jalr: {
+                // rd can be rs1.
+                lanes_u32 const target = (A + IMM) & ~1u;
+                x[insn->rd] = BLEND(x[insn->rd], SPLAT(PC_AFTER));
+                GO(target);
+            }
+
+            case dop_beq:
+                BRANCH(A == B);
+            case dop_bne:
+                BRANCH(A != B);
+            case dop_blt:
+                BRANCH(SA < SB);
+            case dop_bge:
+                BRANCH(SA >= SB);
+            case dop_bltu:
+                BRANCH(A < B);
+            case dop_bgeu:
+                BRANCH(A >= B);
+
+            case dop_lb:
+                LOAD(int8_t);
+            case dop_lh:
+                LOAD(i16);
+            case dop_lw:
+                LOAD(u32);
+            case dop_lbu:
+                LOAD(u8);
+            case dop_lhu:
+                LOAD(u16);
+            case dop_sb:
+                STORE(u8);
+            case dop_sh:
+                STORE(u16);
+            case dop_sw:
+                STORE(u32);
+
+            case dop_addi:
+                WRITE(A + IMM);
+            case dop_slti:
+                WRITE((lanes_u32)(SA < (i32)IMM) & 1);
+            case dop_sltiu:
+                WRITE((lanes_u32)(A < IMM) & 1);
+            case dop_xori:
+                WRITE(A ^ IMM);
+            case dop_ori:
+                WRITE(A | IMM);
+            case dop_andi:
+                WRITE(A & IMM);
+            case dop_slli:
+                WRITE(A << IMM);
+            case dop_srli:
+                WRITE(A >> IMM);
+            case dop_srai:
+                WRITE((lanes_u32)(SA >> IMM));
+
+            case dop_add:
+                WRITE(A + B);
+            case dop_sub:
+                WRITE(A - B);
+            case dop_sll:
+                WRITE(A << (B & 0x1f));
+            case dop_slt:
+                WRITE((lanes_u32)(SA < SB) & 1);
+            case dop_sltu:
+                WRITE((lanes_u32)(A < B) & 1);
+            case dop_xor:
+                WRITE(A ^ B);
+            case dop_srl:
+                WRITE(A >> (B & 0x1f));
+            case dop_sra:
+                WRITE((lanes_u32)(SA >> (lanes_i32)(B & 0x1f)));
+            case dop_or:
+                WRITE(A | B);
+            case dop_and:
+                WRITE(A & B);
+
+            case dop_mul:
+                WRITE(A * B);
+            case dop_mulh:
+                PER_LANE(rv_mulh);
+            case dop_mulhsu:
+                PER_LANE(rv_mulhsu);
+            case dop_mulhu:
+                PER_LANE(rv_mulhu);
+            case dop_div:
+                PER_LANE(rv_div);
+            case dop_divu:
+                PER_LANE(rv_divu);
+            case dop_rem:
+                PER_LANE(rv_rem);
+            case dop_remu:
+                PER_LANE(rv_remu);
+
+            case dop_sh1add:
+                WRITE((A << 1) + B);
+            case dop_sh2add:
+                WRITE((A << 2) + B);
+            case dop_sh3add:
+                WRITE((A << 3) + B);
+            case dop_andn:
+                WRITE(A & ~B);
+            case dop_orn:
+                WRITE(A | ~B);
+            case dop_xnor:
+                WRITE(~(A ^ B));
+            case dop_clz:
+                PER_LANE_UNARY(rv_clz);
+            case dop_ctz:
+                PER_LANE_UNARY(rv_ctz);
+            case dop_cpop:
+                PER_LANE_UNARY(rv_cpop);
+            case dop_min:
+                WRITE(SELECT(SA < SB, A, B));
+            case dop_minu:
+                WRITE(SELECT(A < B, A, B));
+            case dop_max:
+                WRITE(SELECT(SA > SB, A, B));
+            case dop_maxu:
+                WRITE(SELECT(A > B, A, B));
+            case dop_sext_b:
+                WRITE((lanes_u32)((SA << 24) >> 24));
+            case dop_sext_h:
+                WRITE((lanes_u32)((SA << 16) >> 16));
+            case dop_zext_h:
+                WRITE(A & 0xffff);
+            case dop_rol:
+                WRITE((A << (B & 0x1f)) | (A >> (-B & 0x1f)));
+            case dop_ror:
+                WRITE((A >> (B & 0x1f)) | (A << (-B & 0x1f)));
+            case dop_rori:
+                WRITE((A >> IMM) | (A << (-IMM & 0x1f)));
+            case dop_orc_b:
+                PER_LANE_UNARY(rv_orc_b);
+            case dop_rev8:
+                PER_LANE_UNARY(rv_rev8);
+            case dop_bclr:
+                WRITE(A & ~(SPLAT(1) << (B & 0x1f)));
+            case dop_bclri:
+                WRITE(A & ~(1u << IMM));
+            case dop_bext:
+                WRITE((A >> (B & 0x1f)) & 1);
+            case dop_bexti:
+                WRITE((A >> IMM) & 1);
+            case dop_binv:
+                WRITE(A ^ (SPLAT(1) << (B & 0x1f)));
+            case dop_binvi:
+                WRITE(A ^ (1u << IMM));
+            case dop_bset:
+                WRITE(A | (SPLAT(1) << (B & 0x1f)));
+            case dop_bseti:
+                WRITE(A | (1u << IMM));
+
+            case dop_fence:
+                continue;
+            case dop_fence_i:
+                // Lanes share the decoded text, but each has its own copy of
+                // the code it could have written to.
+                error("Refusing to execute: fence.i @ 0x%08x is not supported "
+                      "with lanes\n",
+                      PC);
+                FAULT();
+            case dop_ecall:
+                // Every lane is an instance of its own, so that both exits
+                // only stop the lane calling them. Other system calls aren't
+                // supported: the lanes' output would all go to the same
+                // console. Either way, the lanes stop here.
+                for (u32 m = active; m != 0; m &= m - 1) {
+                    u32 const l = __builtin_ctz(m);
+                    u32 const call = x[rv_a7][l];
+                    if (call == sys_exit || call == sys_exit_group) {
+                        lanes[l].exited = true;
+                        lanes[l].exit_status = x[rv_a0][l] & 0xff;
+                    } else {
+                        error("Refusing to execute: system call %u @ 0x%08x "
+                              "is not supported with lanes (lane %u)\n",
+                              call, PC, l);
+                    }
+                }
+                FAULT();
+
+#define X(name) case dop_##name:
+                VECTOR_OPS(X)
+#undef X
+                // Lanes have no vector registers.
+                error("Refusing to execute: vector instruction @ 0x%08x is "
+                      "not supported with lanes\n",
+                      PC);
+                FAULT();
+
+#define X(name) case dop_##name:
+                FLOAT_OPS(X)
+                CSR_OPS(X)
+#undef X
+                // Nor floating-point registers, which would need a rounding
+                // mode and exception flags per lane.
+                error("Refusing to execute: floating-point or CSR instruction "
+                      "@ 0x%08x is not supported with lanes\n",
+                      PC);
+                FAULT();
+
+#define X(name) case dop_##name:
+                ATOMIC_OPS(X)
+#undef X
+                // Lanes don't share memory, so there'd be nothing to make
+                // atomic, but they'd still need a reservation each.
+                error("Refusing to execute: atomic instruction @ 0x%08x is "
+                      "not supported with lanes\n",
+                      PC);
+                FAULT();
+
+            case dop_illegal:
+                error("Refusing to execute: illegal instruction @ 0x%08x "
+                      "(lanes 0x%04x)\n",
+                      PC, active);
+                FAULT();
+            case dop_unimplemented:
+                error("Refusing to execute: unimplemented instruction @ "
+                      "0x%08x (lanes 0x%04x): ",
+                      PC, active);
+                dasm(stderr, insn->imm, PC);
+                fputc('\n', stderr);
+                FAULT();
+            case dop_undecoded:
+            // The text isn't fused, and idioms only exist in blocks.
+#define X(name) case dop_##name:
+                FUSED_OPS(X)
+                IDIOM_OPS(X)
+#undef X
+                error("Reached undecoded instruction @ 0x%08x\n", PC);
+                FAULT();
+            case dop_count:
+                __builtin_unreachable();
+            }
+            break;
+
+#undef FAULT
+#undef SELECT
+#undef PER_LANE_UNARY
+#undef PER_LANE
+#undef STORE
+#undef LOAD
+#undef BRANCH
+#undef GO
+#undef WRITE
+#undef BLEND
+#undef IMM
+#undef SB
+#undef SA
+#undef B
+#undef A
+#undef SPLAT
+#undef PC_AFTER
+#undef PC
+        }
+    }
+
+    log("Ran %lu steps, with %.2f of %u lanes active on average\n",
+        (unsigned long)steps, steps != 0 ? (double)lane_insns / steps : 0.0,
+        count);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) static void
+run_lanes_avx2(struct decoded_text const *text, struct simt_lane *lanes,
+               u32 count, u32 entrypoint) {
+    run_lanes(text, lanes, count, entrypoint);
+}
+
+static void run_lanes_sse2(struct decoded_text const *text,
+                           struct simt_lane *lanes, u32 count, u32 entrypoint) {
+    run_lanes(text, lanes, count, entrypoint);
+}
+
+void interpret_simt(struct decoded_text const *text, struct simt_lane *lanes,
+                    u32 count, u32 entrypoint) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        run_lanes_avx2(text, lanes, count, entrypoint);
+    else
+        run_lanes_sse2(text, lanes, count, entrypoint);
+}
+
+#else
+
+void interpret_simt(struct decoded_text const *text, struct simt_lane *lanes,
+                    u32 count, u32 entrypoint) {
+    run_lanes(text, lanes, count, entrypoint);
+}
+
+#endif
+
+// vim:sw=4
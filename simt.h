@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common/types.h"
+#include "interpret.h"
+#include "rv/decode.h"
+
+// SIMT batch execution.
+// Runs up to SIMT_LANES instances of the same guest at once, in lockstep: the
+// register files are kept in structure-of-arrays layout, so that one host
+// vector instruction runs a guest instruction for every lane. Each lane has
+// its own copy of guest memory, and its loads and stores go one at a time.
+// Lanes that branch different ways diverge. The engine then runs the lanes at
+// the lowest pc, masking the others out, until those catch up: after an
+// if/else, or once every lane left a loop, they're back in lockstep.
+// Lane `i` starts with a0 = i and a1 = the number of lanes, which it can use to
+// pick its share of the work. A lane exiting stops on its own, the others
+// running on.
+
+// Upper bound on the number of lanes. The vector types are this wide: one AVX2
+// register holds a guest register of every lane. Wider vectors get split up
+// by the compiler, and end up slower than running two batches.
+#define SIMT_LANES 8
+
+struct simt_lane {
+    // Guest memory of the lane, laid out like the packed image.
+    u8 *memory;
+    // Where the lane stopped, and its registers at that point.
+    u32 pc;
+    struct rv32i cpu;
+    // Whether the lane stopped by calling exit or exit_group rather than by
+    // faulting, and the status it exited with then, as a host exit code.
+    bool exited;
+    int exit_status;
+};
+
+// Runs `count` lanes (1 to SIMT_LANES) off the pre-decoded `text`, each
+// against its own `lanes[i].memory`, from `entrypoint` until every lane has
+// stopped. Superinstructions aren't supported, so `text` mustn't be fused.
+void interpret_simt(struct decoded_text const *text, struct simt_lane *lanes,
+                    u32 count, u32 entrypoint);
+
+// vim:ft=c
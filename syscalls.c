@@ -0,0 +1,112 @@
+#include "syscalls.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "rv/xlen.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+// What the harts of the guest share.
+static struct {
+    pthread_mutex_t lock;
+    // Host fd the buffered output goes to. The buffer only ever holds output
+    // for one fd, so that a guest switching between stdout and stderr keeps
+    // its order.
+    int fd;
+    u32 used;
+    u8 buffer[SYSCALL_BUFFER_SIZE];
+    // Whether stdin is a terminal, or -1 until the guest first reads it.
+    int interactive;
+    int exit_status;
+} guest = {.lock = PTHREAD_MUTEX_INITIALIZER,
+           .fd = STDOUT_FILENO,
+           .interactive = -1};
+
+// Writes all of `bytes` to `fd`. The guest was told it all went out already,
+// so errors can only be logged.
+static void write_all(int fd, u8 const *bytes, u32 count) {
+    while (count != 0) {
+        ssize_t written = write(fd, bytes, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            error("Could not write guest output: %s\n", strerror(errno));
+            return;
+        }
+        bytes += written;
+        count -= written;
+    }
+}
+
+// Same as syscall_flush(), with `guest.lock` held.
+static void flush_locked(void) {
+    write_all(guest.fd, guest.buffer, guest.used);
+    guest.used = 0;
+}
+
+i64 syscall_write(uxlen fd, void const *bytes, u32 count) {
+    if (fd != STDOUT_FILENO && fd != STDERR_FILENO)
+        return -EBADF;
+
+    pthread_mutex_lock(&guest.lock);
+    if (guest.fd != (int)fd || count > SYSCALL_BUFFER_SIZE - guest.used) {
+        flush_locked();
+        guest.fd = fd;
+    }
+    if (count >= SYSCALL_BUFFER_SIZE) {
+        // Wouldn't fit anyway.
+        write_all(fd, bytes, count);
+    } else {
+        memcpy(guest.buffer + guest.used, bytes, count);
+        guest.used += count;
+        if (guest.used == SYSCALL_BUFFER_SIZE ||
+            memchr(bytes, '\n', count) != NULL)
+            flush_locked();
+    }
+    pthread_mutex_unlock(&guest.lock);
+    return count;
+}
+
+i64 syscall_read(uxlen fd, void *bytes, u32 count) {
+    if (fd != STDIN_FILENO)
+        return -EBADF;
+
+    // When someone types the input, what the guest wrote before reading it
+    // is likely a prompt. Otherwise, flushing would take the buffering away
+    // from guests that read and write in turn.
+    pthread_mutex_lock(&guest.lock);
+    if (guest.interactive < 0)
+        guest.interactive = isatty(STDIN_FILENO);
+    if (guest.interactive)
+        flush_locked();
+    pthread_mutex_unlock(&guest.lock);
+
+    ssize_t got;
+    do {
+        got = read(STDIN_FILENO, bytes, count);
+    } while (got < 0 && errno == EINTR);
+    return got < 0 ? -errno : got;
+}
+
+void syscall_exit(uxlen status) {
+    pthread_mutex_lock(&guest.lock);
+    // Like Linux, only the low byte makes it to the parent.
+    guest.exit_status = status & 0xff;
+    pthread_mutex_unlock(&guest.lock);
+}
+
+int syscall_exit_status(void) {
+    pthread_mutex_lock(&guest.lock);
+    int const status = guest.exit_status;
+    pthread_mutex_unlock(&guest.lock);
+    return status;
+}
+
+void syscall_flush(void) {
+    pthread_mutex_lock(&guest.lock);
+    flush_locked();
+    pthread_mutex_unlock(&guest.lock);
+}
+
+// vim:sw=4
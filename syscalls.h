@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common/types.h"
+#include "rv/xlen.h"
+
+// Linux system calls.
+// The guest asks for one with ecall, the number in a7 and the arguments from
+// a0 onwards, and gets the result back in a0, negative errno values being
+// errors, as the Linux RISC-V ABI has it. Only what bfc's output needs is
+// there: writing to the console, reading from it, and exiting.
+// What the guest writes to fd 1 and 2 is kept in a host-side buffer, and only
+// written out once a line is complete, the buffer fills up, the guest reads
+// fd 0 from a terminal, or syscall_flush() is called, so that a guest writing
+// a byte at a time doesn't cost a host system call per byte. The guest's fds
+// are the process's, so there's a single buffer for every hart.
+
+enum syscall {
+    sys_read = 63,
+    sys_write = 64,
+    sys_exit = 93,
+    sys_exit_group = 94,
+};
+
+// Size of the output buffer, in bytes.
+#define SYSCALL_BUFFER_SIZE 4096
+
+// Engines copy guest memory in and out this many bytes at a time.
+#define SYSCALL_CHUNK_SIZE 256
+
+// write(fd, bytes, count): returns `count`, or -EBADF unless `fd` is 1 or 2.
+i64 syscall_write(uxlen fd, void const *bytes, u32 count);
+
+// read(fd, bytes, count): returns how many bytes were read from the host's
+// stdin, 0 at its end, or a negative errno value, -EBADF unless `fd` is 0.
+i64 syscall_read(uxlen fd, void *bytes, u32 count);
+
+// exit(status): remembers `status` for syscall_exit_status(). Stopping the hart
+// is up to the engine.
+void syscall_exit(uxlen status);
+
+// Returns the status the guest last exited with, as a host exit code.
+int syscall_exit_status(void);
+
+// Writes out whatever output is still buffered.
+void syscall_flush(void);
+
+// vim:ft=c
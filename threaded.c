@@ -0,0 +1,140 @@
+// Direct-threaded execution engine.
+// Instead of a central `switch` dispatching every instruction, each handler
+// ends in its own indirect jump to the next handler. This gives the host branch
+// predictor one jump site per guest operation, so that common sequences (e.g.
+// lbu -> addi -> sb) become predictable.
+
+#include "common/log.h"
+#include "common/types.h"
+#include "interpret.h"
+#include "rv/bits.h"
+#include "rv/dasm.h"
+#include "rv/decode.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum run_exit interpret_threaded(void *memory, struct decoded_text const *text,
+                                 struct cost_model const *costs,
+                                 struct rv32i *cpu, u32 entrypoint,
+                                 atomic_bool *stop) {
+    static void *const labels[dop_count] = {
+#define X(name) [dop_##name] = &&op_##name,
+        DECODED_OPS(X)
+#undef X
+    };
+
+    // handlers[i] is the handler address for text->insns[i], including the
+    // sentinel slot past the end.
+    void **handlers = malloc((text->count + 1) * sizeof(*handlers));
+    // sums[i] is what the instructions before text->insns[i] cost, see
+    // cost_model_sum().
+    u32 *sums = malloc((text->count + 1) * sizeof(*sums));
+    if (handlers == NULL || sums == NULL) {
+        error("Could not allocate threaded code\n");
+        free(handlers);
+        free(sums);
+        return run_fault;
+    }
+    for (u32 i = 0; i <= text->count; ++i) {
+        handlers[i] = labels[text->insns[i].op];
+    }
+    cost_model_sum(costs, text, sums);
+
+    uxlen *const x = cpu->registers;
+    struct rvv_state *const vector = &cpu->vector;
+    struct fpu_state *const fpu = &cpu->fpu;
+    struct amo_reservation *const reservation = &cpu->reservation;
+    fpu_attach(fpu);
+
+    log("Begin threaded execution. Memory @ %p, Entrypoint @ 0x%x\n", memory,
+        entrypoint);
+
+    struct decoded_insn const *insn =
+        decoded_jump_target(text, entrypoint, entrypoint);
+    // First instruction of the straight-line run being executed, which the
+    // counters get charged for when it ends.
+    struct decoded_insn const *run = insn;
+    if (insn == NULL)
+        goto fault;
+
+#define DISPATCH() goto *handlers[insn - text->insns]
+    DISPATCH();
+
+#define OP(name) op_##name:
+#define NEXT                                                                   \
+    {                                                                          \
+        ++insn;                                                                \
+        DISPATCH();                                                            \
+    }
+#define JUMP(target)                                                           \
+    {                                                                          \
+        decoded_charge(cpu, text, sums, run, insn);                            \
+        if (atomic_load_explicit(stop, memory_order_relaxed))                  \
+            goto stopped;                                                      \
+        if ((insn = run = decoded_jump_target(text, PC, (target))) == NULL)    \
+            goto fault;                                                        \
+        DISPATCH();                                                            \
+    }
+#define PC decoded_text_pc(text, (u32)(insn - text->insns))
+#define PC_AFTER(n) decoded_text_pc(text, (u32)(insn - text->insns) + (n))
+#define LOAD(type, addr) (*(type *)(memory + (uxlen)(addr)))
+#define STORE(type, addr, value) (*(type *)(memory + (uxlen)(addr)) = (value))
+#define ATOMIC(type, addr) ((_Atomic type *)(memory + (uxlen)(addr)))
+#define FAULT() goto fault
+#define EXIT(all)                                                              \
+    {                                                                          \
+        if (all)                                                               \
+            atomic_store_explicit(stop, true, memory_order_relaxed);           \
+        goto exited;                                                           \
+    }
+// Loop idioms are only ever found in blocks.
+#define NO_IDIOM_OPS
+#define FENCE_I()                                                              \
+    {                                                                          \
+        decoded_text_refresh(text, memory);                                    \
+        for (u32 i = 0; i < text->count; ++i)                                  \
+            handlers[i] = labels[text->insns[i].op];                           \
+        cost_model_sum(costs, text, sums);                                     \
+    }
+#define INSTRET (cpu->instret + (u64)(insn - run))
+#define CYCLE                                                                  \
+    (cpu->cycle + (u32)(sums[insn - text->insns] - sums[run - text->insns]))
+#include "interpret_ops.h"
+#undef CYCLE
+#undef INSTRET
+#undef FENCE_I
+#undef NO_IDIOM_OPS
+#undef EXIT
+#undef FAULT
+#undef ATOMIC
+#undef STORE
+#undef LOAD
+#undef PC_AFTER
+#undef PC
+#undef JUMP
+#undef NEXT
+#undef OP
+#undef DISPATCH
+
+exited:
+    fpu_detach(fpu);
+    free(sums);
+    free(handlers);
+    return run_exited;
+
+stopped:
+    fpu_detach(fpu);
+    free(sums);
+    free(handlers);
+    return run_stopped;
+
+fault:
+    fpu_detach(fpu);
+    free(sums);
+    free(handlers);
+    return run_fault;
+}
+
+// vim:sw=4
@@ -0,0 +1,281 @@
+#include "tier.h"
+#include "block.h"
+#include "common/log.h"
+#include "common/types.h"
+#include "interpret.h"
+#include "jit_x86.h"
+#include "rv/bits.h"
+#include "rv/dasm.h"
+#include "rv/decode.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char const *tier_names[tier_count] = {
+    [tier_interpreted] = "interpreted",
+    [tier_decoded] = "decoded",
+    [tier_native] = "native",
+};
+
+void tiers_init(struct tiers *tiers) {
+    memset(tiers, 0, sizeof(*tiers));
+    tiers->thresholds[tier_decoded] = 2;
+    tiers->thresholds[tier_native] = JIT_HOT_THRESHOLD;
+}
+
+void tiers_report(struct tiers const *tiers, FILE *out) {
+    for (enum tier t = tier_decoded; t < tier_count; ++t) {
+        fprintf(out, "tier %-12s threshold %-8u promoted %u blocks\n",
+                tier_names[t], tiers->thresholds[t], tiers->promotions[t]);
+    }
+}
+
+// Execution counts for blocks that are still interpreted, keyed by the guest
+// address they start at. Open-addressed, like the block cache.
+struct hit_counters {
+    struct hit_counter {
+        // `pc | 1`, so that 0 can mark an empty slot. Code is never at odd
+        // addresses.
+        u32 key;
+        u32 hits;
+    } *entries;
+    u32 mask;
+    u32 len;
+};
+
+static u32 hash_pc(u32 pc) { return (pc >> 2) * 2654435761u; }
+
+static void counters_grow(struct hit_counters *counters);
+
+// Returns the counter for `pc`, creating it if needed.
+static u32 *counter_for(struct hit_counters *counters, u32 pc) {
+    u32 const key = pc | 1;
+    u32 slot = hash_pc(pc) & counters->mask;
+    for (; counters->entries[slot].key != 0;
+         slot = (slot + 1) & counters->mask) {
+        if (counters->entries[slot].key == key)
+            return &counters->entries[slot].hits;
+    }
+
+    if ((counters->len + 1) * 2 > counters->mask + 1) {
+        counters_grow(counters);
+        return counter_for(counters, pc);
+    }
+
+    counters->entries[slot].key = key;
+    ++counters->len;
+    return &counters->entries[slot].hits;
+}
+
+static void counters_grow(struct hit_counters *counters) {
+    struct hit_counter *old = counters->entries;
+    u32 old_capacity = counters->mask + 1;
+
+    counters->mask = old_capacity * 2 - 1;
+    counters->len = 0;
+    counters->entries = calloc(counters->mask + 1, sizeof(*counters->entries));
+    if (counters->entries == NULL) {
+        error("Could not grow hit counters to %u entries\n",
+              counters->mask + 1);
+        abort();
+    }
+
+    for (u32 i = 0; i < old_capacity; ++i) {
+        if (old[i].key != 0)
+            *counter_for(counters, old[i].key & ~1u) = old[i].hits;
+    }
+    free(old);
+}
+
+// Runs one block straight from guest memory, decoding every instruction as it
+// goes, but no more than `limit` instructions. Returns whether the guest can
+// keep running, with `*pc` updated to the next block and `*retired` to how many
+// instructions ran, which the hart's counters get charged for. When the guest
+// exited rather than faulted, `*exit` is set to run_exited.
+static bool run_interpreted(struct block_cache const *cache, struct rv32i *cpu,
+                            void *memory, u32 *pc, u32 limit, u32 *retired,
+                            enum run_exit *exit) {
+    u32 *const x = cpu->registers;
+    struct rvv_state *const vector = &cpu->vector;
+    struct fpu_state *const fpu = &cpu->fpu;
+    struct amo_reservation *const reservation = &cpu->reservation;
+    if (!block_cache_check_pc(cache, *pc))
+        return false;
+
+    u32 at = *pc;
+    // What the instructions before this one cost.
+    u32 cycles = 0;
+    for (u32 count = 1;; ++count) {
+        if (__builtin_expect(at >= cache->text_end, 0)) {
+            error("Refusing to execute: pc 0x%08x is outside of text\n", at);
+            return false;
+        }
+        u32 size;
+        struct decoded_insn const decoded =
+            decode_insn_at(memory, at, cache->compressed, &size);
+        struct decoded_insn const *insn = &decoded;
+
+        switch ((enum decoded_op)insn->op) {
+#define OP(name) case dop_##name:
+        // Stop at the same places a translated block would, so that every
+        // block gets counted.
+#define NEXT                                                                   \
+    {                                                                          \
+        at += size;                                                            \
+        cycles += cache->costs.cycles[insn->op];                               \
+        if (decoded_op_ends_block(insn->op) || count == limit) {               \
+            *pc = at;                                                          \
+            RETIRE();                                                          \
+            return true;                                                       \
+        }                                                                      \
+        continue;                                                              \
+    }
+#define JUMP(target)                                                           \
+    {                                                                          \
+        *pc = (target);                                                        \
+        cycles += cache->costs.cycles[insn->op];                               \
+        RETIRE();                                                              \
+        return true;                                                           \
+    }
+#define RETIRE()                                                               \
+    {                                                                          \
+        *retired = count;                                                      \
+        cpu->instret += count;                                                 \
+        cpu->cycle += cycles;                                                  \
+    }
+#define PC at
+// Only ever single instructions: there's no fused or idiom op here.
+#define NO_FUSED_OPS
+#define NO_IDIOM_OPS
+#define PC_AFTER(n) (at + size)
+#define LOAD(type, addr) (*(type *)(memory + (u32)(addr)))
+#define STORE(type, addr, value) (*(type *)(memory + (u32)(addr)) = (value))
+#define ATOMIC(type, addr) ((_Atomic type *)(memory + (u32)(addr)))
+#define FAULT() return false
+#define EXIT(all)                                                              \
+    {                                                                          \
+        cycles += cache->costs.cycles[insn->op];                               \
+        RETIRE();                                                              \
+        *exit = run_exited;                                                    \
+        return false;                                                          \
+    }
+// Instructions are read from memory as they run.
+#define FENCE_I()
+#define INSTRET (cpu->instret + count - 1)
+#define CYCLE (cpu->cycle + cycles)
+#include "interpret_ops.h"
+#undef CYCLE
+#undef INSTRET
+#undef FENCE_I
+#undef EXIT
+#undef FAULT
+#undef ATOMIC
+#undef STORE
+#undef LOAD
+#undef PC_AFTER
+#undef NO_IDIOM_OPS
+#undef NO_FUSED_OPS
+#undef PC
+#undef RETIRE
+#undef JUMP
+#undef NEXT
+#undef OP
+        case dop_count:
+            __builtin_unreachable();
+        }
+    }
+}
+
+enum run_exit interpret_tiered(void *memory, struct block_cache *cache,
+                               struct tiers *tiers, struct run_state *state) {
+    struct hit_counters counters = {.mask = 1024 - 1};
+    counters.entries = calloc(counters.mask + 1, sizeof(*counters.entries));
+    if (counters.entries == NULL) {
+        error("Could not allocate hit counters\n");
+        return run_fault;
+    }
+
+    log("Begin tiered execution. Memory @ %p, Entrypoint @ 0x%x\n", memory,
+        state->pc);
+    fpu_attach(&state->cpu.fpu);
+
+    enum run_exit exit = run_fault;
+    u32 pc = state->pc;
+    // Block for `pc` when it's already been promoted out of the interpreter.
+    struct block *block = block_cache_lookup(cache, pc);
+
+    for (;;) {
+        state->pc = pc;
+        if (__builtin_expect(cache->dirty, 0)) {
+            block_cache_flush_dirty(cache);
+            block = block_cache_lookup(cache, pc);
+        }
+        if (__builtin_expect(
+                atomic_load_explicit(&state->stop, memory_order_relaxed), 0)) {
+            exit = run_stopped;
+            break;
+        }
+        if (block == NULL) {
+            u32 *hits = counter_for(&counters, pc);
+            if (++*hits < tiers->thresholds[tier_decoded]) {
+                // Interpreted blocks can be cut short to use up the fuel
+                // exactly, since they're not translated yet.
+                u32 limit = state->fuel < BLOCK_MAX_INSNS ? (u32)state->fuel
+                                                          : BLOCK_MAX_INSNS;
+                u32 retired;
+                if (limit == 0) {
+                    exit = run_out_of_fuel;
+                    break;
+                }
+                if (!run_interpreted(cache, &state->cpu, memory, &pc, limit,
+                                     &retired, &exit))
+                    break;
+                state->fuel -= retired;
+                block = block_cache_lookup(cache, pc);
+                continue;
+            }
+            if ((block = block_cache_get(cache, memory, pc)) == NULL)
+                break;
+            ++tiers->promotions[tier_decoded];
+        }
+        if (__builtin_expect(block->guest_count > state->fuel, 0)) {
+            exit = run_out_of_fuel;
+            break;
+        }
+        // Loop idioms charge the passes they make as they make them.
+        if (!block_is_idiom(block)) {
+            state->fuel -= block->guest_count;
+            state->cpu.instret += block->guest_count;
+            state->cpu.cycle += block->cycles;
+        }
+
+        if (cache->jit != NULL && block->native == NULL &&
+            ++block->hits == tiers->thresholds[tier_native] &&
+            jit_compile(cache->jit, block)) {
+            ++tiers->promotions[tier_native];
+        }
+
+        struct decoded_insn const *last =
+            block_run(block, state, memory, &pc);
+        if (last == NULL)
+            break;
+        if (block_exit_is_guest_exit(last)) {
+            exit = run_exited;
+            break;
+        }
+
+        // Only chain into successors that have been promoted already; the
+        // rest keep counting in the interpreter.
+        struct block *next = block_next(cache, block, last, pc);
+        if (next == NULL && (next = block_cache_lookup(cache, pc)) != NULL)
+            block_remember(block, last, next);
+        block = next;
+    }
+
+    fpu_detach(&state->cpu.fpu);
+    free(counters.entries);
+    return exit;
+}
+
+// vim:sw=4
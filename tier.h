@@ -0,0 +1,48 @@
+#pragma once
+
+#include "block.h"
+#include "common/types.h"
+#include "interpret.h"
+#include <stdio.h>
+
+// Tiered execution.
+// Every guest block starts out interpreted straight from guest memory, which
+// costs nothing up front. Blocks count how often they run, and once they
+// cross their tier's threshold they get promoted: first to a decoded block in
+// the block cache, then (when a JIT is available) to host code. Short runs
+// never pay for translation, while long ones end up in the fastest tier.
+
+enum tier {
+    // Decoded as it runs, like interpret().
+    tier_interpreted,
+    // Decoded once into the block cache.
+    tier_decoded,
+    // Compiled to host code.
+    tier_native,
+    tier_count,
+};
+
+extern char const *tier_names[tier_count];
+
+struct tiers {
+    // thresholds[t] is how many times a block runs in tier `t - 1` before
+    // being promoted to tier `t`. thresholds[tier_interpreted] is unused.
+    u32 thresholds[tier_count];
+    // promotions[t] counts blocks promoted to tier `t`.
+    u32 promotions[tier_count];
+};
+
+// Fills in the default thresholds and clears the promotion counts.
+void tiers_init(struct tiers *tiers);
+
+// Runs the guest, promoting blocks into `cache` (and `cache->jit`, when set)
+// as they get hot. `cache->jit_threshold` is ignored in favour of `tiers`.
+// Runs from `state` until the guest faults, exits or `state` says to stop,
+// like interpret_blocks().
+enum run_exit interpret_tiered(void *memory, struct block_cache *cache,
+                               struct tiers *tiers, struct run_state *state);
+
+// Prints the promotion counts per tier.
+void tiers_report(struct tiers const *tiers, FILE *out);
+
+// vim:ft=c
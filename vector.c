@@ -0,0 +1,264 @@
+#include "vector.h"
+#include "common/types.h"
+#include "rv/insn.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// RISC-V "V" Vector Extension, version 1.0.
+
+// Bytes of a register processed at once: an AVX2 register.
+#define CHUNK 32
+
+#define T u8
+#define S int8_t
+#define NAME(name) name##_e8
+#include "vector_kernels.h"
+#undef NAME
+#undef S
+#undef T
+
+#define T u16
+#define S i16
+#define NAME(name) name##_e16
+#include "vector_kernels.h"
+#undef NAME
+#undef S
+#undef T
+
+#define T u32
+#define S i32
+#define NAME(name) name##_e32
+#include "vector_kernels.h"
+#undef NAME
+#undef S
+#undef T
+
+// log2 of SEW in bytes.
+static u32 vsew(u32 vtype) { return vtype >> 3 & 0b111; }
+
+// log2 of LMUL, which is negative for fractional LMUL.
+static i32 vlmul(u32 vtype) { return (i32)(vtype << 29) >> 29; }
+
+// Elements in a register group: VLEN * LMUL / SEW.
+static u32 vlmax(u32 vtype) {
+    i32 const shift = vlmul(vtype) - (i32)vsew(vtype) - 3;
+    return shift >= 0 ? (u32)RVV_VLEN << shift : (u32)RVV_VLEN >> -shift;
+}
+
+// Returns whether a group of 2^`emul` registers can start at `reg`: groups of
+// more than one register start at a multiple of their size.
+static bool group_ok(u32 reg, i32 emul) {
+    return emul <= 0 || (reg & ((1u << emul) - 1)) == 0;
+}
+
+static u8 *reg(struct rvv_state *state, u32 index) {
+    return state->v + index * RVV_VLENB;
+}
+
+u32 rvv_set_vtype(struct rvv_state *state, u32 vtype, u32 avl) {
+    // Only vlmul, vsew, vta and vma may be set. SEW is at most ELEN (32 bits),
+    // and fractional LMUL at least SEW / ELEN.
+    bool const supported = (vtype & ~0xffu) == 0 && vsew(vtype) <= 2 &&
+                           (vtype & 0b111) != 0b100 &&
+                           vlmul(vtype) >= (i32)vsew(vtype) - 2;
+    if (!supported) {
+        state->vtype = RVV_VILL;
+        state->vl = 0;
+        return 0;
+    }
+    u32 const max = vlmax(vtype);
+    state->vtype = vtype;
+    state->vl = avl < max ? avl : max;
+    return state->vl;
+}
+
+static inline __attribute__((always_inline)) bool
+arith(struct rvv_state *state, u32 raw, u32 scalar) {
+    union insn const as = {.raw = raw};
+    u32 const vtype = state->vtype;
+    i32 const lmul = vlmul(vtype);
+    bool const compare = as.v.funct6 >= vint_funct6_mseq;
+    bool const masked = !as.v.vm;
+    bool const vv = as.v.funct3 == vector_funct3_ivv;
+    // Masks are a single register, whatever LMUL.
+    if ((vtype & RVV_VILL) || !group_ok(as.v.vs2, lmul) ||
+        (vv && !group_ok(as.v.vs1, lmul)) ||
+        (!compare && !group_ok(as.v.vd, lmul)) ||
+        (masked && !compare && as.v.vd == 0))
+        return false;
+
+    u8 *const vd = reg(state, as.v.vd);
+    u8 const *const vs2 = reg(state, as.v.vs2);
+    u8 const *const vs1 = vv ? reg(state, as.v.vs1) : NULL;
+    u8 const *const v0 = reg(state, 0);
+    u32 const vl = state->vl;
+    u32 const funct6 = as.v.funct6;
+    switch (vsew(vtype)) {
+    case 0:
+        if (compare)
+            compare_e8(funct6, vd, vs2, vs1, scalar, v0, masked, vl);
+        else
+            arith_e8(funct6, vd, vs2, vs1, scalar, v0, masked, vl);
+        break;
+    case 1:
+        if (compare)
+            compare_e16(funct6, vd, vs2, vs1, scalar, v0, masked, vl);
+        else
+            arith_e16(funct6, vd, vs2, vs1, scalar, v0, masked, vl);
+        break;
+    default:
+        if (compare)
+            compare_e32(funct6, vd, vs2, vs1, scalar, v0, masked, vl);
+        else
+            arith_e32(funct6, vd, vs2, vs1, scalar, v0, masked, vl);
+        break;
+    }
+    return true;
+}
+
+static inline __attribute__((always_inline)) bool
+reduce(struct rvv_state *state, u32 raw) {
+    union insn const as = {.raw = raw};
+    u32 const vtype = state->vtype;
+    if ((vtype & RVV_VILL) || !group_ok(as.v.vs2, vlmul(vtype)))
+        return false;
+    // vd and vs1 are single registers, of which only element 0 is used.
+    u32 const vl = state->vl;
+    if (vl == 0)
+        return true;
+
+    u8 *const vd = reg(state, as.v.vd);
+    u8 const *const vs2 = reg(state, as.v.vs2);
+    u8 const *const vs1 = reg(state, as.v.vs1);
+    u8 const *const v0 = reg(state, 0);
+    bool const masked = !as.v.vm;
+    switch (vsew(vtype)) {
+    case 0:
+        vd[0] = reduce_e8(as.v.funct6, vs2, vs1[0], v0, masked, vl);
+        break;
+    case 1: {
+        u16 init;
+        memcpy(&init, vs1, sizeof(init));
+        u16 const result =
+            reduce_e16(as.v.funct6, vs2, init, v0, masked, vl);
+        memcpy(vd, &result, sizeof(result));
+    } break;
+    default: {
+        u32 init;
+        memcpy(&init, vs1, sizeof(init));
+        u32 const result =
+            reduce_e32(as.v.funct6, vs2, init, v0, masked, vl);
+        memcpy(vd, &result, sizeof(result));
+    } break;
+    }
+    return true;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) static bool
+arith_avx2(struct rvv_state *state, u32 raw, u32 scalar) {
+    return arith(state, raw, scalar);
+}
+
+static bool arith_sse2(struct rvv_state *state, u32 raw, u32 scalar) {
+    return arith(state, raw, scalar);
+}
+
+__attribute__((target("avx2"))) static bool
+reduce_avx2(struct rvv_state *state, u32 raw) {
+    return reduce(state, raw);
+}
+
+static bool reduce_sse2(struct rvv_state *state, u32 raw) {
+    return reduce(state, raw);
+}
+
+bool rvv_arith(struct rvv_state *state, u32 raw, u32 scalar) {
+    static bool (*kernel)(struct rvv_state *, u32, u32);
+    if (__builtin_expect(kernel == NULL, 0)) {
+        __builtin_cpu_init();
+        kernel = __builtin_cpu_supports("avx2") ? arith_avx2 : arith_sse2;
+    }
+    return kernel(state, raw, scalar);
+}
+
+bool rvv_reduce(struct rvv_state *state, u32 raw) {
+    static bool (*kernel)(struct rvv_state *, u32);
+    if (__builtin_expect(kernel == NULL, 0)) {
+        __builtin_cpu_init();
+        kernel = __builtin_cpu_supports("avx2") ? reduce_avx2 : reduce_sse2;
+    }
+    return kernel(state, raw);
+}
+
+#else
+
+bool rvv_arith(struct rvv_state *state, u32 raw, u32 scalar) {
+    return arith(state, raw, scalar);
+}
+
+bool rvv_reduce(struct rvv_state *state, u32 raw) {
+    return reduce(state, raw);
+}
+
+#endif
+
+bool rvv_move_to_scalar(struct rvv_state const *state, u32 vs2, u32 *value) {
+    u32 const vtype = state->vtype;
+    if (vtype & RVV_VILL)
+        return false;
+    u8 const *const v = state->v + vs2 * RVV_VLENB;
+    switch (vsew(vtype)) {
+    case 0:
+        *value = (u32)(int8_t)v[0];
+        break;
+    case 1: {
+        i16 element;
+        memcpy(&element, v, sizeof(element));
+        *value = (u32)element;
+    } break;
+    default:
+        memcpy(value, v, sizeof(*value));
+        break;
+    }
+    return true;
+}
+
+bool rvv_move_from_scalar(struct rvv_state *state, u32 vd, u32 value) {
+    u32 const vtype = state->vtype;
+    if (vtype & RVV_VILL)
+        return false;
+    // Only the low SEW bits of `value`, which is little-endian like the host.
+    if (state->vl != 0)
+        memcpy(reg(state, vd), &value, 1u << vsew(vtype));
+    return true;
+}
+
+bool rvv_access_init(struct rvv_state *state, u32 raw,
+                     struct rvv_access *access) {
+    union insn const as = {.raw = raw};
+    u32 const vtype = state->vtype;
+    if (vtype & RVV_VILL)
+        return false;
+
+    // The element width comes from the instruction, and the register group
+    // is sized to hold vl of them: EMUL = EEW / SEW * LMUL.
+    u32 const eew = as.vmem.width == vector_width_8    ? 0
+                    : as.vmem.width == vector_width_16 ? 1
+                                                       : 2;
+    i32 const emul = (i32)eew - (i32)vsew(vtype) + vlmul(vtype);
+    bool const masked = !as.vmem.vm;
+    if (emul < -3 || emul > 3 || !group_ok(as.vmem.vd, emul) ||
+        (masked && as.vmem.opcode == op_load_fp && as.vmem.vd == 0))
+        return false;
+
+    access->group = reg(state, as.vmem.vd);
+    access->size = 1u << eew;
+    access->vl = state->vl;
+    access->masked = masked;
+    return true;
+}
+
+// vim:sw=4
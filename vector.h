@@ -0,0 +1,77 @@
+#pragma once
+
+#include "common/types.h"
+#include <stdbool.h>
+
+// V extension.
+// A practical subset of RVV 1.0, with elements of up to 32 bits like Zve32x:
+// vsetvli, vsetivli and vsetvl; unit-stride and strided loads and stores;
+// integer add, sub, rsub, min/max, and, or, xor, merges and moves; compares
+// into masks; reductions; vmv.x.s and vmv.s.x. Any of them can be masked by
+// v0. Tail and masked-off elements are always left undisturbed, which both
+// the agnostic and the undisturbed policies allow.
+// Arithmetic goes through registers one host vector at a time (an AVX2
+// register when the host has AVX2), so a guest instruction runs in a few host
+// instructions per 8 to 32 elements. Loads and stores go element by element
+// through the engine, so that they see guest memory like scalar accesses do.
+
+// Bits per vector register. Registers are processed 32 bytes at a time, so it
+// must be a multiple of 256. Build with -DRVV_VLEN=<bits> to change it.
+#ifndef RVV_VLEN
+#define RVV_VLEN 256
+#endif
+#define RVV_VLENB (RVV_VLEN / 8)
+_Static_assert(RVV_VLEN % 256 == 0, "RVV_VLEN must be a multiple of 256");
+
+// Set in vtype when the guest asked for a configuration that isn't supported.
+// Every instruction that depends on vtype is then illegal.
+#define RVV_VILL (1u << 31)
+
+struct rvv_state {
+    // v0 to v31 back to back, so that a register group (LMUL > 1) is one span.
+    u8 v[32 * RVV_VLENB] __attribute__((aligned(32)));
+    u32 vl;
+    u32 vtype;
+};
+
+// Sets vtype to `vtype`, or to vill if it's not supported, and vl to what the
+// application vector length `avl` gets under it. Returns the new vl.
+u32 rvv_set_vtype(struct rvv_state *state, u32 vtype, u32 avl);
+
+// Runs the OPIVV, OPIVX or OPIVI instruction `raw`, with `scalar` as the
+// operand of the .vx and .vi forms (the immediate already sign-extended).
+// Returns false if the instruction is illegal under the current vtype.
+bool rvv_arith(struct rvv_state *state, u32 raw, u32 scalar);
+
+// Runs the reduction `raw` (vred*.vs). Returns false if it's illegal under the
+// current vtype.
+bool rvv_reduce(struct rvv_state *state, u32 raw);
+
+// vmv.x.s: stores element 0 of `vs2`, sign-extended, in `*value`.
+bool rvv_move_to_scalar(struct rvv_state const *state, u32 vs2, u32 *value);
+
+// vmv.s.x: sets element 0 of `vd` to `value`, if vl isn't 0.
+bool rvv_move_from_scalar(struct rvv_state *state, u32 vd, u32 value);
+
+// A vector load or store, as far as an engine needs to know to run it.
+struct rvv_access {
+    // The register group loaded or stored.
+    u8 *group;
+    // Bytes per element.
+    u32 size;
+    u32 vl;
+    bool masked;
+};
+
+// Fills `*access` in for the load or store `raw`. Returns false if it's
+// illegal under the current vtype.
+bool rvv_access_init(struct rvv_state *state, u32 raw,
+                     struct rvv_access *access);
+
+// Returns whether element `i` is active, as far as the mask goes.
+static inline bool rvv_active(struct rvv_state const *state, bool masked,
+                              u32 i) {
+    return !masked || (state->v[i / 8] >> (i % 8) & 1);
+}
+
+// vim:ft=c
@@ -0,0 +1,237 @@
+// Element kernels of vector.c for one element width (SEW).
+// This file is meant to be included once per width, after defining:
+//
+// - T and S: the unsigned and signed element types.
+// - NAME(name): `name` with the width appended.
+//
+// Registers are read and written CHUNK bytes at a time, as one host vector.
+// No include guard on purpose.
+
+typedef T NAME(vec) __attribute__((vector_size(CHUNK)));
+typedef S NAME(svec) __attribute__((vector_size(CHUNK)));
+
+// Elements per chunk.
+#define LANES (CHUNK / sizeof(T))
+#define SPLAT(value) ((NAME(vec)){0} + (T)(value))
+// `a` in the lanes set in `mask`, `b` in the others.
+#define SELECT(mask, a, b)                                                     \
+    ({                                                                         \
+        NAME(vec) const mask_ = (NAME(vec))(mask);                             \
+        ((a) & mask_) | ((b) & ~mask_);                                        \
+    })
+
+// Chunk `c` of the register (group) at `reg`.
+#define LOAD(reg, c)                                                           \
+    ({                                                                         \
+        NAME(vec) chunk_;                                                      \
+        memcpy(&chunk_, (reg) + (c) * CHUNK, CHUNK);                           \
+        chunk_;                                                                \
+    })
+// All ones in the lanes of chunk `c` whose elements are active: below `vl`,
+// and set in `v0` if `masked`. Macros rather than functions, since passing
+// host vectors around would need AVX in the callers' signatures.
+#define ACTIVE(masked, c)                                                      \
+    ({                                                                         \
+        NAME(vec) active_ = ~SPLAT(0);                                         \
+        if ((masked) || ((c) + 1) * LANES > vl) {                              \
+            for (u32 j_ = 0; j_ < LANES; ++j_) {                               \
+                u32 const i_ = (c) * LANES + j_;                               \
+                active_[j_] =                                                  \
+                    i_ < vl && (!(masked) || (v0[i_ / 8] >> (i_ % 8) & 1))     \
+                        ? (T)-1                                                \
+                        : 0;                                                   \
+            }                                                                  \
+        }                                                                      \
+        active_;                                                               \
+    })
+
+// vd = vs2 <op> vs1, or vs2 <op> `scalar` when `vs1` is NULL, for the
+// elements-wise operations.
+static inline __attribute__((always_inline)) void
+    NAME(arith)(u32 funct6, u8 *vd, u8 const *vs2, u8 const *vs1, T scalar,
+                u8 const *v0, bool masked, u32 vl) {
+    // vmerge uses the mask to pick an operand rather than to skip elements.
+    bool const merge = funct6 == vint_funct6_merge;
+    for (u32 c = 0; c < (vl + LANES - 1) / LANES; ++c) {
+        NAME(vec) const a = LOAD(vs2, c);
+        NAME(vec) const b = vs1 != NULL ? LOAD(vs1, c) : SPLAT(scalar);
+        NAME(vec) r;
+        switch ((enum vector_int_funct6)funct6) {
+        case vint_funct6_add:
+            r = a + b;
+            break;
+        case vint_funct6_sub:
+            r = a - b;
+            break;
+        case vint_funct6_rsub:
+            r = b - a;
+            break;
+        case vint_funct6_minu:
+            r = SELECT(a < b, a, b);
+            break;
+        case vint_funct6_min:
+            r = SELECT((NAME(svec))a < (NAME(svec))b, a, b);
+            break;
+        case vint_funct6_maxu:
+            r = SELECT(a > b, a, b);
+            break;
+        case vint_funct6_max:
+            r = SELECT((NAME(svec))a > (NAME(svec))b, a, b);
+            break;
+        case vint_funct6_and:
+            r = a & b;
+            break;
+        case vint_funct6_or:
+            r = a | b;
+            break;
+        case vint_funct6_xor:
+            r = a ^ b;
+            break;
+        case vint_funct6_merge:
+            r = masked ? SELECT(ACTIVE(true, c), b, a) : b;
+            break;
+        default:
+            __builtin_unreachable();
+        }
+        NAME(vec) const old = LOAD(vd, c);
+        r = SELECT(ACTIVE(masked && !merge, c), r, old);
+        memcpy(vd + c * CHUNK, &r, CHUNK);
+    }
+}
+
+// Sets the bits of mask register `vd` to vs2 <compare> vs1, or to
+// vs2 <compare> `scalar` when `vs1` is NULL.
+static inline __attribute__((always_inline)) void
+    NAME(compare)(u32 funct6, u8 *vd, u8 const *vs2, u8 const *vs1, T scalar,
+                  u8 const *v0, bool masked, u32 vl) {
+    for (u32 c = 0; c < (vl + LANES - 1) / LANES; ++c) {
+        NAME(vec) const a = LOAD(vs2, c);
+        NAME(vec) const b = vs1 != NULL ? LOAD(vs1, c) : SPLAT(scalar);
+        NAME(svec) const sa = (NAME(svec))a, sb = (NAME(svec))b;
+        NAME(vec) r;
+        switch ((enum vector_int_funct6)funct6) {
+        case vint_funct6_mseq:
+            r = (NAME(vec))(a == b);
+            break;
+        case vint_funct6_msne:
+            r = (NAME(vec))(a != b);
+            break;
+        case vint_funct6_msltu:
+            r = (NAME(vec))(a < b);
+            break;
+        case vint_funct6_mslt:
+            r = (NAME(vec))(sa < sb);
+            break;
+        case vint_funct6_msleu:
+            r = (NAME(vec))(a <= b);
+            break;
+        case vint_funct6_msle:
+            r = (NAME(vec))(sa <= sb);
+            break;
+        case vint_funct6_msgtu:
+            r = (NAME(vec))(a > b);
+            break;
+        case vint_funct6_msgt:
+            r = (NAME(vec))(sa > sb);
+            break;
+        default:
+            __builtin_unreachable();
+        }
+        // One bit per lane, LANES / 8 bytes of the mask per chunk.
+        NAME(vec) const active = ACTIVE(masked, c);
+        u32 bits = 0, keep = 0;
+        for (u32 j = 0; j < LANES; ++j) {
+            bits |= (u32)(r[j] & 1) << j;
+            keep |= (u32)(active[j] & 1) << j;
+        }
+        u32 old = 0;
+        memcpy(&old, vd + c * LANES / 8, LANES / 8);
+        bits = (bits & keep) | (old & ~keep);
+        memcpy(vd + c * LANES / 8, &bits, LANES / 8);
+    }
+}
+
+// Returns `a` <op> `b` for the reduction `funct6`.
+static inline __attribute__((always_inline)) T NAME(fold)(u32 funct6, T a,
+                                                          T b) {
+    switch ((enum vector_mvv_funct6)funct6) {
+    case vmvv_funct6_redsum:
+        return a + b;
+    case vmvv_funct6_redand:
+        return a & b;
+    case vmvv_funct6_redor:
+        return a | b;
+    case vmvv_funct6_redxor:
+        return a ^ b;
+    case vmvv_funct6_redminu:
+        return a < b ? a : b;
+    case vmvv_funct6_redmin:
+        return (S)a < (S)b ? a : b;
+    case vmvv_funct6_redmaxu:
+        return a > b ? a : b;
+    case vmvv_funct6_redmax:
+        return (S)a > (S)b ? a : b;
+    default:
+        __builtin_unreachable();
+    }
+}
+
+// Returns `init` <op> every active element of vs2. The chunks are first
+// folded lane-wise, and only the last one across.
+static inline __attribute__((always_inline)) T
+    NAME(reduce)(u32 funct6, u8 const *vs2, T init, u8 const *v0, bool masked,
+                 u32 vl) {
+    // What inactive elements count as, which leaves the result alone.
+    T const smax = (T)-1 >> 1;
+    T const neutral = funct6 == vmvv_funct6_redand ||
+                              funct6 == vmvv_funct6_redminu
+                          ? (T)-1
+                      : funct6 == vmvv_funct6_redmin ? smax
+                      : funct6 == vmvv_funct6_redmax ? (T)~smax
+                                                     : 0;
+    NAME(vec) acc = SPLAT(neutral);
+    for (u32 c = 0; c < (vl + LANES - 1) / LANES; ++c) {
+        NAME(vec) a = LOAD(vs2, c);
+        a = SELECT(ACTIVE(masked, c), a, SPLAT(neutral));
+        switch ((enum vector_mvv_funct6)funct6) {
+        case vmvv_funct6_redsum:
+            acc += a;
+            break;
+        case vmvv_funct6_redand:
+            acc &= a;
+            break;
+        case vmvv_funct6_redor:
+            acc |= a;
+            break;
+        case vmvv_funct6_redxor:
+            acc ^= a;
+            break;
+        case vmvv_funct6_redminu:
+            acc = SELECT(a < acc, a, acc);
+            break;
+        case vmvv_funct6_redmin:
+            acc = SELECT((NAME(svec))a < (NAME(svec))acc, a, acc);
+            break;
+        case vmvv_funct6_redmaxu:
+            acc = SELECT(a > acc, a, acc);
+            break;
+        case vmvv_funct6_redmax:
+            acc = SELECT((NAME(svec))a > (NAME(svec))acc, a, acc);
+            break;
+        default:
+            __builtin_unreachable();
+        }
+    }
+    T result = init;
+    for (u32 j = 0; j < LANES; ++j)
+        result = NAME(fold)(funct6, result, acc[j]);
+    return result;
+}
+
+#undef ACTIVE
+#undef LOAD
+#undef SELECT
+#undef SPLAT
+#undef LANES
+
+// vim:ft=c